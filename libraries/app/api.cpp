@@ -26,6 +26,7 @@
 #include <graphene/app/api.hpp>
 #include <graphene/app/api_access.hpp>
 #include <graphene/app/application.hpp>
+#include <graphene/account_history/account_history_plugin.hpp>
 #include <graphene/chain/database.hpp>
 #include <graphene/chain/get_config.hpp>
 #include <graphene/utilities/key_conversion.hpp>
@@ -76,7 +77,8 @@ namespace graphene { namespace app {
     {
        if( api_name == "database_api" )
        {
-          _database_api = std::make_shared< database_api >( std::ref( *_app.chain_database() ), &( _app.get_options() ) );
+          _database_api = std::make_shared< database_api >( std::ref( *_app.chain_database() ), &( _app.get_options() ),
+                                                            _app.get_change_notifier() );
        }
        else if( api_name == "block_api" )
        {
@@ -106,6 +108,10 @@ namespace graphene { namespace app {
        {
           _orders_api = std::make_shared< orders_api >( std::ref( _app ) );
        }
+       else if( api_name == "profiler_api" )
+       {
+          _profiler_api = std::make_shared< profiler_api >( std::ref( _app ) );
+       }
        else if( api_name == "debug_api" )
        {
           // can only enable this API if the plugin was loaded
@@ -229,6 +235,32 @@ namespace graphene { namespace app {
        return _app.p2p_node()->set_advanced_node_parameters(params);
     }
 
+    profiler_api::profiler_api( application& a ) : _app( a )
+    {
+    }
+
+    block_profile profiler_api::get_profile() const
+    {
+       return _app.chain_database()->get_profiler().get_profile();
+    }
+
+    void profiler_api::enable_profiling( bool enabled )
+    {
+       _app.chain_database()->get_profiler().enable( enabled );
+    }
+
+    void profiler_api::reset_profile()
+    {
+       _app.chain_database()->get_profiler().reset();
+    }
+
+    void profiler_api::dump_profile() const
+    {
+       const fc::path& file = _app.get_options().profile_dump_file;
+       FC_ASSERT( !file.empty(), "No profile-dump-file is configured" );
+       _app.chain_database()->get_profiler().dump( file );
+    }
+
     fc::api<network_broadcast_api> login_api::network_broadcast()const
     {
        FC_ASSERT(_network_broadcast_api);
@@ -283,6 +315,19 @@ namespace graphene { namespace app {
        return *_debug_api;
     }
 
+    fc::api<profiler_api> login_api::profiler() const
+    {
+       FC_ASSERT(_profiler_api);
+       return *_profiler_api;
+    }
+
+    history_api::history_api( application& app )
+       : _app( app ),
+         database_api( std::ref( *app.chain_database() ), &( app.get_options() ), app.get_change_notifier() ),
+         _account_history( std::dynamic_pointer_cast< account_history::account_history_plugin >(
+                              app.get_plugin( "account_history" ) ) )
+    {}
+
     vector<order_history_object> history_api::get_fill_order_history( std::string asset_a, std::string asset_b, uint32_t limit  )const
     {
        FC_ASSERT(_app.chain_database());
@@ -335,11 +380,11 @@ namespace graphene { namespace app {
        while(itr != index_start && itr->account == account && itr->operation_id.instance.value > stop.instance.value && result.size() < limit)
        {
           if(itr->operation_id.instance.value <= start.instance.value)
-             result.push_back(itr->operation_id(db));
+             result.push_back( get_operation( itr->operation_id ) );
           --itr;
        }
        if(stop.instance.value == 0 && result.size() < limit && itr->account == account) {
-         result.push_back(itr->operation_id(db));
+         result.push_back( get_operation( itr->operation_id ) );
        }
 
        return result;
@@ -365,21 +410,40 @@ namespace graphene { namespace app {
        if( start == operation_history_id_type() )
           start = node->operation_id;
 
-       while(node && node->operation_id.instance.value > stop.instance.value && result.size() < limit)
+       if( _account_history )
+       {
+          auto ops = _account_history->get_account_operations_by_type( account, operation_type, start, stop, limit );
+          if( ops.valid() )
+          {
+             for( const auto& id : *ops )
+                result.push_back( get_operation( id ) );
+             return result;
+          }
+       }
+
+       // stop == 0 means no bound, like in get_account_operations_by_type, so 1.11.0 is found wherever it is in the list
+       while(node && ( stop == operation_history_id_type() || node->operation_id.instance.value > stop.instance.value )
+             && result.size() < limit)
        {
           if( node->operation_id.instance.value <= start.instance.value ) {
 
-             if(node->operation_id(db).op.which() == operation_type)
-               result.push_back( node->operation_id(db) );
+             operation_history_object op = get_operation( node->operation_id );
+             if( op.op.which() == operation_type )
+               result.push_back( std::move( op ) );
           }
           if( node->next == account_transaction_history_id_type() )
              node = nullptr;
           else node = &node->next(db);
        }
+       // 2.9.0 is never reached through next, which uses it to mark the end of the list
        if( stop.instance.value == 0 && result.size() < limit ) {
           auto head = db.find(account_transaction_history_id_type());
-          if (head != nullptr && head->account == account && head->operation_id(db).op.which() == operation_type)
-            result.push_back(head->operation_id(db));
+          if( head != nullptr && head->account == account )
+          {
+             operation_history_object op = get_operation( head->operation_id );
+             if( op.op.which() == operation_type )
+                result.push_back( std::move( op ) );
+          }
        }
        return result;
     }
@@ -415,13 +479,26 @@ namespace graphene { namespace app {
           do
           {
              --itr;
-             result.push_back( itr->operation_id(db) );
+             result.push_back( get_operation( itr->operation_id ) );
           }
           while ( itr != itr_stop && result.size() < limit );
        }
        return result;
     }
 
+    operation_history_object history_api::get_operation( operation_history_id_type id )const
+    {
+       const operation_history_object* op = _app.chain_database()->find( id );
+       if( op != nullptr )
+          return *op;
+       // it may have been moved out of the object database
+       optional< operation_history_object > stored;
+       if( _account_history )
+          stored = _account_history->find_stored_operation( id );
+       FC_ASSERT( stored.valid(), "Unable to find operation ${id}", ("id",id) );
+       return *stored;
+    }
+
     flat_set<uint32_t> history_api::get_market_history_buckets()const
     {
        auto hist = _app.get_plugin<market_history_plugin>( "market_history" );
@@ -531,7 +608,7 @@ namespace graphene { namespace app {
     // asset_api
     asset_api::asset_api(graphene::app::application& app) :
          _db( *app.chain_database()), 
-         database_api( std::ref(*app.chain_database()), &(app.get_options()) 
+         database_api( std::ref(*app.chain_database()), &(app.get_options()), app.get_change_notifier()
          ) { }
     asset_api::~asset_api() { }
 
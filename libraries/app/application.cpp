@@ -51,6 +51,7 @@
 #include <boost/range/algorithm/reverse.hpp>
 #include <boost/algorithm/string.hpp>
 
+#include <algorithm>
 #include <iostream>
 
 #include <fc/log/file_appender.hpp>
@@ -122,6 +123,9 @@ void application_impl::reset_p2p_node(const fc::path& data_dir)
    _p2p_network->load_configuration(data_dir / "p2p");
    _p2p_network->set_node_delegate(this);
 
+   if( _options->count("p2p-io-threads") )
+      _p2p_network->set_io_threads( _options->at("p2p-io-threads").as<uint16_t>() );
+
    if( _options->count("seed-node") )
    {
       auto seeds = _options->at("seed-node").as<vector<string>>();
@@ -393,9 +397,44 @@ void application_impl::startup()
       _chain_db->enable_standby_votes_tracking( _options->at("enable-standby-votes-tracking").as<bool>() );
    }
 
+   if( _options->count("incremental-flush-max-segments") )
+      _chain_db->enable_incremental_flush( _options->at("incremental-flush-max-segments").as<uint32_t>() );
+
+   if( _options->count("replay-pipeline-depth") )
+      _chain_db->set_replay_pipeline_depth( _options->at("replay-pipeline-depth").as<uint32_t>() );
+
+   if( _options->count("signature-cache-size") )
+      _chain_db->set_signature_cache_size( _options->at("signature-cache-size").as<uint32_t>() );
+
+   if( _options->count("parallel-tx-execution") )
+      _chain_db->enable_parallel_tx_execution( _options->at("parallel-tx-execution").as<bool>() );
+
+   if( _options->count("incremental-vote-tally") )
+      _chain_db->enable_incremental_vote_tally( _options->at("incremental-vote-tally").as<bool>() );
+
+   if( _options->count("verify-vote-tally") )
+      _chain_db->enable_vote_tally_verification( _options->at("verify-vote-tally").as<bool>() );
+
+   if( _options->count("profile-blocks") )
+      _chain_db->get_profiler().enable( _options->at("profile-blocks").as<bool>() );
+
+   if( _options->count("profile-dump-file") )
+   {
+      const fc::path file = _options->at("profile-dump-file").as<boost::filesystem::path>();
+      _app_options.profile_dump_file = file.is_relative() ? _data_dir / file : file;
+   }
+
    if( _options->count("replay-blockchain") || _options->count("revalidate-blockchain") )
       _chain_db->wipe( _data_dir / "blockchain", false );
 
+   if( _options->count("load-snapshot") )
+   {
+      // the object database is replaced by the snapshot, the block database is kept
+      _chain_db->wipe( _data_dir / "blockchain", false );
+      _chain_db->load_snapshot( _options->at("load-snapshot").as<boost::filesystem::path>(),
+                                initial_state().initial_chain_id );
+   }
+
    try
    {
       // these flags are used in open() only, i. e. during replay
@@ -434,9 +473,24 @@ void application_impl::startup()
       _force_validate = true;
    }
 
+   if( _options->count("sync-precompute-memory-limit") )
+      _sync_precompute_memory_limit = uint64_t( _options->at("sync-precompute-memory-limit").as<uint32_t>() )
+                                      * 1024 * 1024;
+
    if ( _options->count("enable-subscribe-to-all") )
       _app_options.enable_subscribe_to_all = _options->at( "enable-subscribe-to-all" ).as<bool>();
 
+   if( _options->count("api-max-subscribed-objects") )
+      _app_options.subscription_limits.max_objects = _options->at("api-max-subscribed-objects").as<uint32_t>();
+   if( _options->count("api-max-subscribed-accounts") )
+      _app_options.subscription_limits.max_accounts = _options->at("api-max-subscribed-accounts").as<uint32_t>();
+
+   // created here so that the memory limit applies before the first connection subscribes
+   _change_notifier = std::make_shared<change_notifier>( *_chain_db );
+   if( _options->count("api-subscriptions-memory-limit") )
+      _change_notifier->set_memory_limit( uint64_t( _options->at("api-subscriptions-memory-limit").as<uint32_t>() )
+                                          * 1024 * 1024 );
+
    if( _active_plugins.find( "market_history" ) != _active_plugins.end() )
       _app_options.has_market_history_plugin = true;
 
@@ -534,17 +588,25 @@ bool application_impl::handle_block(const graphene::net::block_message& blk_msg,
    FC_ASSERT( (latency.count()/1000) > -5000, "Rejecting block with timestamp in the future" );
 
    try {
-      const uint32_t skip = (_is_block_producer | _force_validate) ?
-                               database::skip_nothing : database::skip_transaction_signatures;
-      bool result = valve.do_serial( [this,&blk_msg,skip] () {
-         _chain_db->precompute_parallel( blk_msg.block, skip ).wait();
-      }, [this,&blk_msg,skip] () {
+      const uint32_t skip = get_block_skip_flags();
+      // during sync the block has usually been precomputed while it waited for the blocks before it
+      const std::shared_ptr<precomputed_sync_block> precomputed = sync_mode ? take_precomputed_sync_block( blk_msg.block_id )
+                                                                            : nullptr;
+      const signed_block& block = precomputed ? precomputed->block : blk_msg.block;
+      bool result = valve.do_serial( [this,&block,&precomputed,skip] () {
+         if( precomputed )
+            precomputed->ready.wait();
+         else
+            _chain_db->precompute_parallel( block, skip ).wait();
+      }, [this,&block,skip] () {
          // TODO: in the case where this block is valid but on a fork that's too old for us to switch to,
          // you can help the network code out by throwing a block_older_than_undo_history exception.
          // when the net code sees that, it will stop trying to push blocks from that chain, but
          // leave that peer connected so that they can get sync blocks from us
-         return _chain_db->push_block( blk_msg.block, skip );
+         return _chain_db->push_block( block, skip );
       });
+      if( sync_mode )
+         forget_precomputed_sync_blocks( _chain_db->head_block_num() );
 
       // the block was accepted, so we now know all of the transactions contained in the block
       if (!sync_mode)
@@ -582,6 +644,103 @@ bool application_impl::handle_block(const graphene::net::block_message& blk_msg,
    }
 } FC_CAPTURE_AND_RETHROW( (blk_msg)(sync_mode) ) return false; }
 
+uint32_t application_impl::get_block_skip_flags()const
+{
+   return (_is_block_producer | _force_validate) ? database::skip_nothing : database::skip_transaction_signatures;
+}
+
+void application_impl::precompute_sync_block(const graphene::net::block_message& blk_msg)
+{ try {
+   if( _sync_precompute_memory_limit == 0 )
+      return;
+   auto item = std::make_shared<precomputed_sync_block>();
+   item->size = fc::raw::pack_size( blk_msg.block );
+   item->received = fc::time_point::now();
+   {
+      std::lock_guard<std::mutex> guard( _precomputed_sync_blocks_mutex );
+      auto itr = _precomputed_sync_blocks.begin();
+      while( itr != _precomputed_sync_blocks.end() )
+      {
+         if( itr->second->received + _precomputed_sync_block_lifetime < item->received )
+            itr = erase_precomputed_sync_block( itr );
+         else
+            ++itr;
+      }
+      // handle_block() precomputes the block itself
+      if( _precomputed_sync_blocks_size + item->size > _sync_precompute_memory_limit
+            || _precomputed_sync_blocks.find( blk_msg.block_id ) != _precomputed_sync_blocks.end() )
+         return;
+   }
+   item->block = blk_msg.block;
+   const uint32_t skip = get_block_skip_flags();
+   std::shared_ptr<chain::database> db = _chain_db;
+   item->ready = fc::do_parallel( [db,item,skip] () {
+      db->precompute_block( item->block, skip );
+   });
+
+   std::lock_guard<std::mutex> guard( _precomputed_sync_blocks_mutex );
+   if( _precomputed_sync_blocks.emplace( blk_msg.block_id, item ).second )
+      _precomputed_sync_blocks_size += item->size;
+} FC_CAPTURE_AND_LOG( (blk_msg.block_id) ) }
+
+std::shared_ptr<application_impl::precomputed_sync_block> application_impl::take_precomputed_sync_block(
+      const graphene::chain::block_id_type& id )
+{
+   std::lock_guard<std::mutex> guard( _precomputed_sync_blocks_mutex );
+   auto itr = _precomputed_sync_blocks.find( id );
+   if( itr == _precomputed_sync_blocks.end() )
+      return nullptr;
+   std::shared_ptr<precomputed_sync_block> item = itr->second;
+   _precomputed_sync_blocks_size -= item->size;
+   _precomputed_sync_blocks.erase( itr );
+   ++_precomputed_sync_blocks_taken;
+   return item;
+}
+
+application_impl::precomputed_sync_block_map::iterator application_impl::erase_precomputed_sync_block(
+      precomputed_sync_block_map::iterator itr )
+{
+   _precomputed_sync_blocks_size -= itr->second->size;
+   // a task which has not started yet is skipped, a running one keeps the block and the database alive
+   itr->second->ready.cancel();
+   if( !itr->second->ready.ready() )
+      _forgotten_sync_block_tasks.push_back( itr->second->ready );
+   return _precomputed_sync_blocks.erase( itr );
+}
+
+void application_impl::forget_precomputed_sync_blocks(uint32_t block_num)
+{
+   std::lock_guard<std::mutex> guard( _precomputed_sync_blocks_mutex );
+   auto itr = _precomputed_sync_blocks.begin();
+   while( itr != _precomputed_sync_blocks.end() && block_header::num_from_id( itr->first ) <= block_num )
+      itr = erase_precomputed_sync_block( itr );
+   _forgotten_sync_block_tasks.erase( std::remove_if( _forgotten_sync_block_tasks.begin(),
+                                                      _forgotten_sync_block_tasks.end(),
+                                                      [] ( const fc::future<void>& task ) { return task.ready(); } ),
+                                      _forgotten_sync_block_tasks.end() );
+}
+
+void application_impl::wait_for_precomputed_sync_blocks()
+{
+   std::vector<fc::future<void>> tasks;
+   {
+      std::lock_guard<std::mutex> guard( _precomputed_sync_blocks_mutex );
+      auto itr = _precomputed_sync_blocks.begin();
+      while( itr != _precomputed_sync_blocks.end() )
+         itr = erase_precomputed_sync_block( itr );
+      tasks.swap( _forgotten_sync_block_tasks );
+   }
+   // the tasks read the database, don't leave them running behind
+   for( auto& task : tasks )
+   {
+      try {
+         task.wait();
+      } catch( const fc::exception& ) {
+         // the block is not going to be applied
+      }
+   }
+}
+
 void application_impl::handle_transaction(const graphene::net::trx_message& transaction_message)
 { try {
    static fc::time_point last_call;
@@ -954,6 +1113,8 @@ void application::set_program_options(boost::program_options::options_descriptio
 {
    configuration_file_options.add_options()
          ("p2p-endpoint", bpo::value<string>(), "Endpoint for P2P node to listen on")
+         ("p2p-io-threads", bpo::value<uint16_t>()->default_value(0),
+          "Number of threads decrypting and unpacking the messages of peers, default to 0 to do it on the p2p thread")
          ("seed-node,s", bpo::value<vector<string>>()->composing(),
           "P2P nodes to connect to on startup (may specify multiple times)")
          ("seed-nodes", bpo::value<string>()->composing(),
@@ -972,9 +1133,43 @@ void application::set_program_options(boost::program_options::options_descriptio
          ("io-threads", bpo::value<uint16_t>()->implicit_value(0), "Number of IO threads, default to 0 for auto-configuration")
          ("enable-subscribe-to-all", bpo::value<bool>()->implicit_value(true),
           "Whether allow API clients to subscribe to universal object creation and removal events")
+         ("api-max-subscribed-objects", bpo::value<uint32_t>()->default_value(10000),
+          "Maximum number of objects, keys and addresses an API connection can subscribe to")
+         ("api-max-subscribed-accounts", bpo::value<uint32_t>()->default_value(100),
+          "Maximum number of accounts an API connection can subscribe to through get_full_accounts")
+         ("api-subscriptions-memory-limit", bpo::value<uint32_t>()->default_value(256),
+          "Maximum memory in MiB used for the subscriptions of all API connections, further subscriptions are "
+          "ignored. 0 for no limit")
          ("enable-standby-votes-tracking", bpo::value<bool>()->implicit_value(true),
           "Whether to enable tracking of votes of standby witnesses and committee members. "
           "Set it to true to provide accurate data to API clients, set to false for slightly better performance.")
+         ("incremental-flush-max-segments", bpo::value<uint32_t>()->default_value(0),
+          "When saving the object database, only write objects changed since the last save, and rewrite an index "
+          "completely after this many incremental segments. Default to 0 to always rewrite everything")
+         ("sync-precompute-memory-limit", bpo::value<uint32_t>()->default_value(64),
+          "Maximum memory in MiB of the sync blocks which are checked in parallel while they wait for the blocks "
+          "before them to be applied. 0 checks each block only when it is applied")
+         ("replay-pipeline-depth", bpo::value<uint32_t>()->default_value(0),
+          "Number of blocks read and precomputed in parallel ahead of the block being applied during replay, "
+          "default to 0 for four blocks per IO thread")
+         ("signature-cache-size", bpo::value<uint32_t>()->default_value(10000),
+          "Number of recent transactions whose signing keys are remembered, so that transactions received before "
+          "they are included in a block do not need their signatures checked again. 0 disables the cache")
+         ("parallel-tx-execution", bpo::value<bool>()->implicit_value(true),
+          "Whether to evaluate the transactions of a block that do not depend on each other in parallel. "
+          "Only transfers are evaluated in parallel for now, the first other transaction ends it for the block")
+         ("incremental-vote-tally", bpo::value<bool>()->implicit_value(true),
+          "Whether to use the incrementally maintained vote tally at maintenance instead of counting all votes from "
+          "scratch. Off by default until it has been checked against a replay of the chain with verify-vote-tally")
+         ("verify-vote-tally", bpo::value<bool>()->implicit_value(true),
+          "Whether to also count all votes from scratch at each maintenance interval and compare the result with the "
+          "incrementally maintained tally. Slows down maintenance, a difference is logged and the full tally is used")
+         ("profile-blocks", bpo::value<bool>()->implicit_value(true),
+          "Whether to record the time spent in the steps of applying blocks, in each operation type and in the "
+          "applied_block handlers of plugins. The profile is available through the profiler API")
+         ("profile-dump-file", bpo::value<boost::filesystem::path>(),
+          "File to write the block profile to as JSON at shutdown and when requested through the profiler API, "
+          "relative to the data directory")
          ;
    command_line_options.add(configuration_file_options);
    command_line_options.add_options()
@@ -982,6 +1177,9 @@ void application::set_program_options(boost::program_options::options_descriptio
          ("revalidate-blockchain", "Rebuild object graph by replaying all blocks with full validation")
          ("resync-blockchain", "Delete all blocks and re-sync with network from scratch")
          ("force-validate", "Force validation of all transactions during normal operation")
+         ("load-snapshot", bpo::value<boost::filesystem::path>(),
+          "Replace the current state with a binary snapshot created by the snapshot plugin and continue from its "
+          "head block. Blocks before the snapshot are not downloaded, so the node cannot replay from genesis")
          ("genesis-timestamp", bpo::value<uint32_t>(),
           "Replace timestamp from genesis.json with current time plus this many seconds (experts only!)")
          ;
@@ -1071,8 +1269,21 @@ void application::shutdown()
 {
    if( my->_p2p_network )
       my->_p2p_network->close();
+   my->wait_for_precomputed_sync_blocks();
    if( my->_chain_db )
    {
+      if( !my->_app_options.profile_dump_file.empty() && my->_chain_db->get_profiler().enabled() )
+      {
+         try
+         {
+            my->_chain_db->get_profiler().dump( my->_app_options.profile_dump_file );
+         }
+         catch( const fc::exception& e )
+         {
+            elog( "Failed to write the block profile: ${e}", ("e",e.to_detail_string()) );
+         }
+      }
+      my->_change_notifier = nullptr;
       my->_chain_db->close();
       my->_chain_db = nullptr;
    }
@@ -1100,5 +1311,10 @@ const application_options& application::get_options()
    return my->_app_options;
 }
 
+std::shared_ptr<change_notifier> application::get_change_notifier()const
+{
+   return my->_change_notifier;
+}
+
 // namespace detail
 } }
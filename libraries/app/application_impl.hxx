@@ -9,6 +9,8 @@
 #include <graphene/chain/protocol/types.hpp>
 #include <graphene/net/message.hpp>
 
+#include <mutex>
+
 namespace graphene { namespace app { namespace detail {
 
 
@@ -64,6 +66,21 @@ class application_impl : public net::node_delegate
       virtual bool handle_block(const graphene::net::block_message& blk_msg, bool sync_mode,
                                 std::vector<fc::uint160_t>& contained_transaction_message_ids) override;
 
+      /**
+       * Starts precomputing a sync block on the thread pool, unless the blocks waiting for handle_block()
+       * already use up the sync-precompute-memory-limit.
+       */
+      virtual void precompute_sync_block(const graphene::net::block_message& blk_msg) override;
+
+      /**
+       * Forgets the precomputed sync blocks up to block_num, they have been applied or are on a dead fork.
+       * Tasks still precomputing them are canceled or left to finish, this does not wait for them.
+       */
+      void forget_precomputed_sync_blocks(uint32_t block_num);
+
+      /** Forgets all precomputed sync blocks and waits for the tasks precomputing them, before closing the database */
+      void wait_for_precomputed_sync_blocks();
+
       virtual void handle_transaction(const graphene::net::trx_message& transaction_message) override;
 
       void handle_message(const graphene::net::message& message_to_process);
@@ -188,6 +205,7 @@ class application_impl : public net::node_delegate
       api_access _apiaccess;
 
       std::shared_ptr<graphene::chain::database>            _chain_db;
+      std::shared_ptr<change_notifier>                      _change_notifier;
       std::shared_ptr<graphene::net::node>                  _p2p_network;
       std::shared_ptr<fc::http::websocket_server>      _websocket_server;
       std::shared_ptr<fc::http::websocket_tls_server>  _websocket_tls_server;
@@ -196,8 +214,38 @@ class application_impl : public net::node_delegate
       std::map<string, std::shared_ptr<abstract_plugin>> _available_plugins;
 
       bool _is_finished_syncing = false;
-   private:
+      uint64_t _sync_precompute_memory_limit = 0;
+   protected:
+      uint32_t get_block_skip_flags()const;
+
+      /** A sync block copied by precompute_sync_block() */
+      struct precomputed_sync_block
+      {
+         graphene::chain::signed_block block;
+         fc::future<void>              ready;
+         uint64_t                      size = 0;
+         fc::time_point                received;
+      };
+      using precomputed_sync_block_map
+            = std::map<graphene::chain::block_id_type, std::shared_ptr<precomputed_sync_block>>;
+
+      std::shared_ptr<precomputed_sync_block> take_precomputed_sync_block(const graphene::chain::block_id_type& id);
+      /// must be called with the mutex locked
+      precomputed_sync_block_map::iterator erase_precomputed_sync_block(precomputed_sync_block_map::iterator itr);
+
       fc::serial_valve valve;
+
+      /// written from the p2p thread, so guarded by the mutex
+      std::mutex _precomputed_sync_blocks_mutex;
+      /// block ids start with the block number, so the map is ordered by block number
+      precomputed_sync_block_map _precomputed_sync_blocks;
+      uint64_t _precomputed_sync_blocks_size = 0;
+      /// number of sync blocks handle_block() found precomputed
+      uint64_t _precomputed_sync_blocks_taken = 0;
+      /// tasks of forgotten blocks which were still running, waited for before the database is closed
+      std::vector<fc::future<void>> _forgotten_sync_block_tasks;
+      /// blocks not applied within this time were fetched by a sync which has been abandoned
+      fc::microseconds _precomputed_sync_block_lifetime = fc::seconds(60);
    };
 
 }}} // namespace graphene namespace app namespace detail
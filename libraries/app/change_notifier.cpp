@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <graphene/app/change_notifier.hpp>
+
+#include <graphene/chain/asset_object.hpp>
+#include <graphene/chain/market_object.hpp>
+#include <graphene/chain/operation_history_object.hpp>
+#include <graphene/net/config.hpp>
+
+#include <fc/thread/thread.hpp>
+
+namespace graphene { namespace app {
+
+using namespace graphene::chain;
+
+change_notifier::change_notifier( database& db ) : _db( db )
+{
+   _new_connection = _db.new_objects.connect( [this]( const vector<object_id_type>& ids,
+                                                      const flat_set<account_id_type>& impacted_accounts ) {
+      on_objects( true, true, ids, impacted_accounts, [this]( object_id_type id ) { return _db.find_object( id ); } );
+   });
+   _change_connection = _db.changed_objects.connect( [this]( const vector<object_id_type>& ids,
+                                                             const flat_set<account_id_type>& impacted_accounts ) {
+      on_objects( false, true, ids, impacted_accounts, [this]( object_id_type id ) { return _db.find_object( id ); } );
+   });
+   _removed_connection = _db.removed_objects.connect( [this]( const vector<object_id_type>& ids,
+                                                              const vector<const object*>& objs,
+                                                              const flat_set<account_id_type>& impacted_accounts ) {
+      std::map<object_id_type, const object*> removed;
+      for( const object* obj : objs )
+         if( obj != nullptr )
+            removed.emplace( obj->id, obj );
+      on_objects( true, false, ids, impacted_accounts, [&removed]( object_id_type id ) -> const object* {
+         auto itr = removed.find( id );
+         return itr == removed.end() ? nullptr : itr->second;
+      });
+   });
+   _applied_block_connection = _db.applied_block.connect( [this]( const signed_block& ) { on_applied_block(); } );
+}
+
+uint64_t change_notifier::add_subscriber( const std::weak_ptr<subscriber>& s, const subscription_limits& limits )
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   const uint64_t handle = _next_handle++;
+   subscription& sub = _subscriptions[handle];
+   sub.target = s;
+   sub.limits = limits;
+   return handle;
+}
+
+void change_notifier::remove_subscriber( uint64_t handle )
+{
+   clear_subscriptions( handle, true );
+   std::lock_guard<std::mutex> guard( _mutex );
+   _object_subscribers.erase( handle );
+   _remove_create_subscribers.erase( handle );
+   _subscriptions.erase( handle );
+}
+
+void change_notifier::set_object_subscription( uint64_t handle, bool enabled, bool notify_remove_create )
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   auto itr = _subscriptions.find( handle );
+   FC_ASSERT( itr != _subscriptions.end(), "Unknown subscriber ${h}", ("h",handle) );
+   itr->second.objects = enabled;
+   itr->second.notify_remove_create = enabled && notify_remove_create;
+   if( enabled )
+      _object_subscribers.insert( handle );
+   else
+      _object_subscribers.erase( handle );
+   if( itr->second.notify_remove_create )
+      _remove_create_subscribers.insert( handle );
+   else
+      _remove_create_subscribers.erase( handle );
+}
+
+template<typename Key, typename Compare>
+bool change_notifier::add_entry( uint64_t handle, std::set<Key, Compare>& items, registry_index<Key, Compare>& index,
+                                 const Key& key, bool at_limit )
+{
+   if( items.find( key ) != items.end() )
+      return true;
+   if( at_limit || ( _memory_limit > 0 && _memory_used >= _memory_limit ) )
+   {
+      ++_rejected;
+      return false;
+   }
+   items.insert( key );
+   index.add( key, handle );
+   _memory_used += registry_index<Key, Compare>::entry_size;
+   return true;
+}
+
+change_notifier::subscription& change_notifier::get_subscription( uint64_t handle )
+{
+   auto itr = _subscriptions.find( handle );
+   FC_ASSERT( itr != _subscriptions.end(), "Unknown subscriber ${h}", ("h",handle) );
+   return itr->second;
+}
+
+bool change_notifier::subscribe_to_object( uint64_t handle, object_id_type id )
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   subscription& sub = get_subscription( handle );
+   return add_entry( handle, sub.object_ids, _object_index, id, sub.object_ids.size() >= sub.limits.max_objects );
+}
+
+bool change_notifier::subscribe_to_account( uint64_t handle, account_id_type account )
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   subscription& sub = get_subscription( handle );
+   return add_entry( handle, sub.accounts, _account_index, account, sub.accounts.size() >= sub.limits.max_accounts );
+}
+
+void change_notifier::subscribe_to_market( uint64_t handle, const market_type& market )
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   auto itr = _subscriptions.find( handle );
+   FC_ASSERT( itr != _subscriptions.end(), "Unknown subscriber ${h}", ("h",handle) );
+   itr->second.markets.insert( market );
+   _market_subscribers[market].insert( handle );
+}
+
+void change_notifier::unsubscribe_from_market( uint64_t handle, const market_type& market )
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   auto itr = _subscriptions.find( handle );
+   if( itr == _subscriptions.end() )
+      return;
+   itr->second.markets.erase( market );
+   auto sub = _market_subscribers.find( market );
+   if( sub == _market_subscribers.end() )
+      return;
+   sub->second.erase( handle );
+   if( sub->second.empty() )
+      _market_subscribers.erase( sub );
+}
+
+void change_notifier::clear_subscriptions( uint64_t handle, bool reset_markets )
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   auto itr = _subscriptions.find( handle );
+   if( itr == _subscriptions.end() )
+      return;
+   subscription& sub = itr->second;
+   for( object_id_type id : sub.object_ids )
+      _object_index.remove( id, handle );
+   for( account_id_type account : sub.accounts )
+      _account_index.remove( account, handle );
+   _memory_used -= sub.object_ids.size() * registry_index<object_id_type>::entry_size
+                 + sub.accounts.size() * registry_index<account_id_type>::entry_size;
+   sub.object_ids.clear();
+   sub.accounts.clear();
+   if( !reset_markets )
+      return;
+   for( const market_type& market : itr->second.markets )
+   {
+      auto sub = _market_subscribers.find( market );
+      sub->second.erase( handle );
+      if( sub->second.empty() )
+         _market_subscribers.erase( sub );
+   }
+   itr->second.markets.clear();
+}
+
+void change_notifier::set_memory_limit( uint64_t bytes )
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   _memory_limit = bytes;
+}
+
+subscription_stats change_notifier::get_stats()const
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   subscription_stats stats;
+   stats.subscribers = _subscriptions.size();
+   stats.objects = _object_index.size();
+   stats.accounts = _account_index.size();
+   stats.markets = _market_subscribers.size();
+   stats.memory_used = _memory_used;
+   stats.memory_limit = _memory_limit;
+   stats.rejected = _rejected;
+   return stats;
+}
+
+optional<change_notifier::market_type> change_notifier::get_order_market( const object& obj )const
+{
+   optional<market_type> market;
+   if( obj.id.is<limit_order_object>() )
+      market = static_cast<const limit_order_object&>( obj ).get_market();
+   else if( obj.id.is<call_order_object>() )
+      market = static_cast<const call_order_object&>( obj ).get_market();
+   else if( obj.id.is<force_settlement_object>() )
+   {
+      const force_settlement_object& order = static_cast<const force_settlement_object&>( obj );
+      asset_id_type backing_id = order.balance.asset_id( _db ).bitasset_data( _db ).options.short_backing_asset;
+      market = std::make_pair( order.balance.asset_id, backing_id );
+      if( market->first > market->second )
+         std::swap( market->first, market->second );
+   }
+   return market;
+}
+
+void change_notifier::on_objects( bool force_notify, bool full_object, const vector<object_id_type>& ids,
+                                  const flat_set<account_id_type>& impacted_accounts,
+                                  const find_object_type& find_object )
+{ try {
+   std::shared_ptr<delivery> d = std::make_shared<delivery>();
+   {
+      std::lock_guard<std::mutex> guard( _mutex );
+      if( _object_subscribers.empty() && _market_subscribers.empty() )
+         return;
+
+      // subscribers of an impacted account receive all objects of the batch, the others only their objects
+      flat_set<uint64_t> whole_batch;
+      if( force_notify )
+         whole_batch = _remove_create_subscribers;
+      for( account_id_type account : impacted_accounts )
+      {
+         const flat_set<uint64_t>* handles = _account_index.find( account );
+         if( handles == nullptr )
+            continue;
+         for( uint64_t handle : *handles )
+            if( _object_subscribers.find( handle ) != _object_subscribers.end() )
+               whole_batch.insert( handle );
+      }
+
+      std::map< uint64_t, vector<fc::variant> > updates;
+      std::map< market_type, vector<fc::variant> > market_updates;
+      for( object_id_type id : ids )
+      {
+         const object* obj = find_object( id );
+         // serialized at most once, and only if somebody wants it
+         fc::variant payload;
+         bool serialized = false;
+         auto get_payload = [&]() -> const fc::variant& {
+            if( !serialized )
+            {
+               if( full_object )
+               {
+                  payload = obj->to_variant();
+                  ++_serialized_objects;
+               }
+               else
+                  payload = fc::variant( id, 1 );
+               serialized = true;
+            }
+            return payload;
+         };
+
+         // like before, the full object is only sent if it can be found
+         if( obj != nullptr || !full_object )
+         {
+            for( uint64_t handle : whole_batch )
+               updates[handle].push_back( get_payload() );
+            const flat_set<uint64_t>* handles = _object_index.find( id );
+            if( handles != nullptr )
+               for( uint64_t handle : *handles )
+                  if( whole_batch.find( handle ) == whole_batch.end()
+                        && _object_subscribers.find( handle ) != _object_subscribers.end() )
+                     updates[handle].push_back( get_payload() );
+         }
+
+         if( obj != nullptr && !_market_subscribers.empty() )
+         {
+            optional<market_type> market = get_order_market( *obj );
+            if( market.valid() && _market_subscribers.find( *market ) != _market_subscribers.end() )
+               market_updates[*market].push_back( get_payload() );
+         }
+      }
+
+      d->objects.reserve( updates.size() );
+      for( auto& item : updates )
+         d->objects.emplace_back( item.first, fc::variant( item.second ) );
+      d->markets.reserve( market_updates.size() );
+      for( auto& item : market_updates )
+         d->markets.emplace_back( item.first, fc::variant( item.second ) );
+   }
+
+   if( d->objects.empty() && d->markets.empty() )
+      return;
+   // must not yield in the middle of applying a block
+   auto self = shared_from_this();
+   fc::async( [self,d]() { self->deliver( d ); } );
+} FC_CAPTURE_AND_LOG( (ids) ) }
+
+void change_notifier::on_applied_block()
+{
+   std::shared_ptr<delivery> d = std::make_shared<delivery>();
+   {
+      std::lock_guard<std::mutex> guard( _mutex );
+      if( _market_subscribers.empty() )
+         return;
+
+      // orders are sent through the object changes, fills only appear as operations
+      std::map< market_type, vector< std::pair<operation, operation_result> > > fills;
+      for( const optional< operation_history_object >& o_op : _db.get_applied_operations() )
+      {
+         if( !o_op.valid() || o_op->op.which() != operation::tag<fill_order_operation>::value )
+            continue;
+         const market_type market = o_op->op.get<fill_order_operation>().get_market();
+         if( _market_subscribers.find( market ) != _market_subscribers.end() )
+            // FIXME this may cause fill_order_operation be pushed before order creation
+            fills[market].emplace_back( o_op->op, o_op->result );
+      }
+      d->markets.reserve( fills.size() );
+      for( const auto& item : fills )
+         d->markets.emplace_back( item.first, fc::variant( item.second, GRAPHENE_NET_MAX_NESTED_OBJECTS ) );
+   }
+
+   if( d->markets.empty() )
+      return;
+   auto self = shared_from_this();
+   fc::async( [self,d]() { self->deliver( d ); } );
+}
+
+void change_notifier::deliver( const std::shared_ptr<delivery>& d )
+{
+   auto lock_subscriber = [this]( uint64_t handle ) -> std::shared_ptr<subscriber> {
+      std::lock_guard<std::mutex> guard( _mutex );
+      auto itr = _subscriptions.find( handle );
+      return itr == _subscriptions.end() ? std::shared_ptr<subscriber>() : itr->second.target.lock();
+   };
+
+   for( const auto& item : d->objects )
+   {
+      std::shared_ptr<subscriber> s = lock_subscriber( item.first );
+      if( !s )
+         continue;
+      try
+      {
+         s->on_object_updates( item.second );
+      }
+      FC_CAPTURE_AND_LOG( (item.first) )
+   }
+
+   for( const auto& item : d->markets )
+   {
+      flat_set<uint64_t> handles;
+      {
+         std::lock_guard<std::mutex> guard( _mutex );
+         auto itr = _market_subscribers.find( item.first );
+         if( itr != _market_subscribers.end() )
+            handles = itr->second;
+      }
+      for( uint64_t handle : handles )
+      {
+         std::shared_ptr<subscriber> s = lock_subscriber( handle );
+         if( !s )
+            continue;
+         try
+         {
+            s->on_market_updates( item.first, item.second );
+         }
+         FC_CAPTURE_AND_LOG( (handle) )
+      }
+   }
+}
+
+} } // graphene::app
@@ -23,10 +23,10 @@
  */
 
 #include <graphene/app/database_api.hpp>
+#include <graphene/app/change_notifier.hpp>
 #include <graphene/app/util.hpp>
 #include <graphene/chain/get_config.hpp>
 
-#include <fc/bloom_filter.hpp>
 
 #include <fc/crypto/hex.hpp>
 #include <fc/uint128.hpp>
@@ -42,14 +42,13 @@
 
 #define GET_REQUIRED_FEES_MAX_RECURSION 4
 
-typedef std::map< std::pair<graphene::chain::asset_id_type, graphene::chain::asset_id_type>, std::vector<fc::variant> > market_queue_type;
-
 namespace graphene { namespace app {
 
-class database_api_impl : public std::enable_shared_from_this<database_api_impl>
+class database_api_impl : public std::enable_shared_from_this<database_api_impl>, public change_notifier::subscriber
 {
    public:
-      explicit database_api_impl( graphene::chain::database& db, const application_options* app_options );
+      database_api_impl( graphene::chain::database& db, const application_options* app_options,
+                         std::shared_ptr<change_notifier> notifier );
       ~database_api_impl();
 
 
@@ -74,6 +73,7 @@ class database_api_impl : public std::enable_shared_from_this<database_api_impl>
       fc::variant_object get_config()const;
       chain_id_type get_chain_id()const;
       dynamic_global_property_object get_dynamic_global_properties()const;
+      vector<graphene::db::pool_allocator_stats> get_pool_allocator_stats()const;
 
       // Keys
       vector<vector<account_id_type>> get_key_references( vector<public_key_type> key )const;
@@ -170,43 +170,24 @@ class database_api_impl : public std::enable_shared_from_this<database_api_impl>
    //private:
       static string price_to_string( const price& _price, const asset_object& _base, const asset_object& _quote );
 
-      template<typename T>
-      void subscribe_to_item( const T& i )const
+      void subscribe_to_item( const object_id_type& id )const
       {
-         auto vec = fc::raw::pack(i);
          if( !_subscribe_callback )
             return;
-
-         if( !is_subscribed_to_item(i) )
-            _subscribe_filter.insert( vec.data(), vec.size() );
-      }
-
-      template<typename T>
-      bool is_subscribed_to_item( const T& i )const
-      {
-         if( !_subscribe_callback )
-            return false;
-
-         return _subscribe_filter.contains( i );
+         // notifier() assigns the handle, so it is called before the handle is read
+         change_notifier& n = notifier();
+         if( !n.subscribe_to_object( _notifier_handle, id ) )
+            subscription_rejected();
       }
 
-      bool is_impacted_account( const flat_set<account_id_type>& accounts)
+      /// Logs the first subscription of the connection refused by a limit since its subscriptions were cleared
+      void subscription_rejected()const
       {
-         if( !_subscribed_accounts.size() || !accounts.size() )
-            return false;
-
-         return std::any_of(accounts.begin(), accounts.end(), [this](const account_id_type& account) {
-            return _subscribed_accounts.find(account) != _subscribed_accounts.end();
-         });
-      }
-
-      const std::pair<asset_id_type,asset_id_type> get_order_market( const force_settlement_object& order )
-      {
-         // TODO cache the result to avoid repeatly fetching from db
-         asset_id_type backing_id = order.balance.asset_id( _db ).bitasset_data( _db ).options.short_backing_asset;
-         auto tmp = std::make_pair( order.balance.asset_id, backing_id );
-         if( tmp.first > tmp.second ) std::swap( tmp.first, tmp.second );
-         return tmp;
+         if( _subscription_rejected )
+            return;
+         _subscription_rejected = true;
+         wlog( "Database api ${x} reached a subscription limit, further objects and accounts are not tracked",
+               ("x",int64_t(this)) );
       }
 
       const account_object* get_account_from_string( const std::string& name_or_id ) const
@@ -290,46 +271,23 @@ class database_api_impl : public std::enable_shared_from_this<database_api_impl>
          return result;
       }
 
-      template<typename T>
-      const std::pair<asset_id_type,asset_id_type> get_order_market( const T& order )
-      {
-         return order.get_market();
-      }
-
-      template<typename T>
-      void enqueue_if_subscribed_to_market(const object* obj, market_queue_type& queue, bool full_object=true)
-      {
-         const T* order = dynamic_cast<const T*>(obj);
-         FC_ASSERT( order != nullptr);
-
-         const auto& market = get_order_market( *order );
-
-         auto sub = _market_subscriptions.find( market );
-         if( sub != _market_subscriptions.end() ) {
-            queue[market].emplace_back( full_object ? obj->to_variant() : fc::variant(obj->id, 1) );
-         }
-      }
+      /// The subscriptions of this connection are matched by the notifier shared by all connections
+      change_notifier& notifier()const;
 
-      void broadcast_updates( const vector<variant>& updates );
-      void broadcast_market_updates( const market_queue_type& queue);
-      void handle_object_changed(bool force_notify, bool full_object, const vector<object_id_type>& ids, const flat_set<account_id_type>& impacted_accounts, std::function<const object*(object_id_type id)> find_object);
+      virtual void on_object_updates( const fc::variant& updates ) override;
+      virtual void on_market_updates( const change_notifier::market_type& market, const fc::variant& updates ) override;
 
-      /** called every time a block is applied to report the objects that were changed */
-      void on_objects_new(const vector<object_id_type>& ids, const flat_set<account_id_type>& impacted_accounts);
-      void on_objects_changed(const vector<object_id_type>& ids, const flat_set<account_id_type>& impacted_accounts);
-      void on_objects_removed(const vector<object_id_type>& ids, const vector<const object*>& objs, const flat_set<account_id_type>& impacted_accounts);
+      /** called every time a block is applied */
       void on_applied_block();
 
       bool _notify_remove_create = false;
-      mutable fc::bloom_filter _subscribe_filter;
-      std::set<account_id_type> _subscribed_accounts;
       std::function<void(const fc::variant&)> _subscribe_callback;
       std::function<void(const fc::variant&)> _pending_trx_callback;
       std::function<void(const fc::variant&)> _block_applied_callback;
 
-      boost::signals2::scoped_connection                                                                                           _new_connection;
-      boost::signals2::scoped_connection                                                                                           _change_connection;
-      boost::signals2::scoped_connection                                                                                           _removed_connection;
+      mutable std::shared_ptr<change_notifier>                                                                                     _notifier;
+      mutable uint64_t                                                                                                             _notifier_handle = 0;
+      mutable bool                                                                                                                 _subscription_rejected = false;
       boost::signals2::scoped_connection                                                                                           _applied_block_connection;
       boost::signals2::scoped_connection                                                                                           _pending_trx_connection;
       map< pair<asset_id_type,asset_id_type>, std::function<void(const variant&)> >      _market_subscriptions;
@@ -343,24 +301,17 @@ class database_api_impl : public std::enable_shared_from_this<database_api_impl>
 //                                                                  //
 //////////////////////////////////////////////////////////////////////
 
-database_api::database_api( graphene::chain::database& db, const application_options* app_options )
-   : my( new database_api_impl( db, app_options ) ) {}
+database_api::database_api( graphene::chain::database& db, const application_options* app_options,
+                            std::shared_ptr<change_notifier> notifier )
+   : my( new database_api_impl( db, app_options, notifier ) ) {}
 
 database_api::~database_api() {}
 
-database_api_impl::database_api_impl( graphene::chain::database& db, const application_options* app_options )
-:_db(db), _app_options(app_options)
+database_api_impl::database_api_impl( graphene::chain::database& db, const application_options* app_options,
+                                      std::shared_ptr<change_notifier> notifier )
+:_notifier(notifier), _db(db), _app_options(app_options)
 {
    wlog("creating database api ${x}", ("x",int64_t(this)) );
-   _new_connection = _db.new_objects.connect([this](const vector<object_id_type>& ids, const flat_set<account_id_type>& impacted_accounts) {
-                                on_objects_new(ids, impacted_accounts);
-                                });
-   _change_connection = _db.changed_objects.connect([this](const vector<object_id_type>& ids, const flat_set<account_id_type>& impacted_accounts) {
-                                on_objects_changed(ids, impacted_accounts);
-                                });
-   _removed_connection = _db.removed_objects.connect([this](const vector<object_id_type>& ids, const vector<const object*>& objs, const flat_set<account_id_type>& impacted_accounts) {
-                                on_objects_removed(ids, objs, impacted_accounts);
-                                });
    _applied_block_connection = _db.applied_block.connect([this](const signed_block&){ on_applied_block(); });
 
    _pending_trx_connection = _db.on_pending_transaction.connect([this](const signed_transaction& trx ){
@@ -371,6 +322,21 @@ database_api_impl::database_api_impl( graphene::chain::database& db, const appli
 database_api_impl::~database_api_impl()
 {
    elog("freeing database api ${x}", ("x",int64_t(this)) );
+   if( _notifier_handle != 0 )
+      _notifier->remove_subscriber( _notifier_handle );
+}
+
+change_notifier& database_api_impl::notifier()const
+{
+   if( _notifier_handle == 0 )
+   {
+      if( !_notifier )
+         _notifier = std::make_shared<change_notifier>( _db );
+      _notifier_handle = _notifier->add_subscriber(
+            std::const_pointer_cast<database_api_impl>( shared_from_this() ),
+            _app_options ? _app_options->subscription_limits : subscription_limits() );
+   }
+   return *_notifier;
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -479,6 +445,8 @@ void database_api_impl::set_subscribe_callback( std::function<void(const variant
 
    _subscribe_callback = cb;
    _notify_remove_create = notify_remove_create;
+   change_notifier& n = notifier();
+   n.set_object_subscription( _notifier_handle, bool(cb), notify_remove_create );
 }
 
 void database_api::set_pending_transaction_callback( std::function<void(const variant&)> cb )
@@ -506,6 +474,11 @@ void database_api::cancel_all_subscriptions()
    my->cancel_all_subscriptions(true, true);
 }
 
+subscription_stats database_api::get_subscription_stats()const
+{
+   return my->notifier().get_stats();
+}
+
 void database_api_impl::cancel_all_subscriptions( bool reset_callback, bool reset_market_subscriptions )
 {
    if ( reset_callback )
@@ -515,9 +488,13 @@ void database_api_impl::cancel_all_subscriptions( bool reset_callback, bool rese
       _market_subscriptions.clear();
 
    _notify_remove_create = false;
-   _subscribed_accounts.clear();
-   static fc::bloom_parameters param(10000, 1.0/100, 1024*8*8*2);
-   _subscribe_filter = fc::bloom_filter(param);
+   _subscription_rejected = false;
+
+   if( _notifier_handle != 0 )
+   {
+      _notifier->clear_subscriptions( _notifier_handle, reset_market_subscriptions );
+      _notifier->set_object_subscription( _notifier_handle, bool(_subscribe_callback), false );
+   }
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -641,6 +618,16 @@ dynamic_global_property_object database_api_impl::get_dynamic_global_properties(
    return _db.get(dynamic_global_property_id_type());
 }
 
+vector<graphene::db::pool_allocator_stats> database_api::get_pool_allocator_stats()const
+{
+   return my->get_pool_allocator_stats();
+}
+
+vector<graphene::db::pool_allocator_stats> database_api_impl::get_pool_allocator_stats()const
+{
+   return graphene::db::get_pool_allocator_stats();
+}
+
 //////////////////////////////////////////////////////////////////////
 //                                                                  //
 // Keys                                                             //
@@ -674,13 +661,6 @@ vector<vector<account_id_type>> database_api_impl::get_key_references( vector<pu
       address a4( pts_address(key, true, 0)  );
       address a5( key );
 
-      subscribe_to_item( key );
-      subscribe_to_item( a1 );
-      subscribe_to_item( a2 );
-      subscribe_to_item( a3 );
-      subscribe_to_item( a4 );
-      subscribe_to_item( a5 );
-
       vector<account_id_type> result;
 
       for( auto& a : {a1,a2,a3,a4,a5} )
@@ -878,10 +858,12 @@ std::map<std::string, full_account> database_api_impl::get_full_accounts( const
 
       if( subscribe )
       {
-         if(_subscribed_accounts.size() < 100) {
-            _subscribed_accounts.insert( account->get_id() );
+         // the notifier refuses accounts beyond the api-max-subscribed-accounts limit of the connection
+         change_notifier& n = notifier();
+         if( n.subscribe_to_account( _notifier_handle, account->get_id() ) )
             subscribe_to_item( account->id );
-         }
+         else
+            subscription_rejected();
       }
 
       full_account acnt;
@@ -1098,10 +1080,10 @@ vector<balance_object> database_api_impl::get_balance_objects( const vector<addr
 
       for( const auto& owner : addrs )
       {
-         subscribe_to_item( owner );
          auto itr = by_owner_idx.lower_bound( boost::make_tuple( owner, asset_id_type(0) ) );
          while( itr != by_owner_idx.end() && itr->owner == owner )
          {
+            subscribe_to_item( itr->id );
             result.push_back( *itr );
             ++itr;
          }
@@ -1376,6 +1358,8 @@ void database_api_impl::subscribe_to_market(std::function<void(const variant&)>
    if(asset_a_id > asset_b_id) std::swap(asset_a_id,asset_b_id);
    FC_ASSERT(asset_a_id != asset_b_id);
    _market_subscriptions[ std::make_pair(asset_a_id,asset_b_id) ] = callback;
+   change_notifier& n = notifier();
+   n.subscribe_to_market( _notifier_handle, std::make_pair(asset_a_id,asset_b_id) );
 }
 
 void database_api::unsubscribe_from_market(const std::string& a, const std::string& b)
@@ -1391,6 +1375,8 @@ void database_api_impl::unsubscribe_from_market(const std::string& a, const std:
    if(a > b) std::swap(asset_a_id,asset_b_id);
    FC_ASSERT(asset_a_id != asset_b_id);
    _market_subscriptions.erase(std::make_pair(asset_a_id,asset_b_id));
+   if( _notifier_handle != 0 )
+      _notifier->unsubscribe_from_market( _notifier_handle, std::make_pair(asset_a_id,asset_b_id) );
 }
 
 string database_api_impl::price_to_string( const price& _price, const asset_object& _base, const asset_object& _quote )
@@ -2362,115 +2348,17 @@ vector<withdraw_permission_object> database_api_impl::get_withdraw_permissions_b
 //                                                                  //
 //////////////////////////////////////////////////////////////////////
 
-void database_api_impl::broadcast_updates( const vector<variant>& updates )
+void database_api_impl::on_object_updates( const fc::variant& updates )
 {
-   if( updates.size() && _subscribe_callback ) {
-      auto capture_this = shared_from_this();
-      fc::async([capture_this,updates](){
-          if(capture_this->_subscribe_callback)
-            capture_this->_subscribe_callback( fc::variant(updates) );
-      });
-   }
-}
-
-void database_api_impl::broadcast_market_updates( const market_queue_type& queue)
-{
-   if( queue.size() )
-   {
-      auto capture_this = shared_from_this();
-      fc::async([capture_this, this, queue](){
-          for( const auto& item : queue )
-          {
-            auto sub = _market_subscriptions.find(item.first);
-            if( sub != _market_subscriptions.end() )
-                sub->second( fc::variant(item.second ) );
-          }
-      });
-   }
-}
-
-void database_api_impl::on_objects_removed( const vector<object_id_type>& ids, const vector<const object*>& objs, const flat_set<account_id_type>& impacted_accounts)
-{
-   handle_object_changed(_notify_remove_create, false, ids, impacted_accounts,
-      [objs](object_id_type id) -> const object* {
-         auto it = std::find_if(
-               objs.begin(), objs.end(),
-               [id](const object* o) {return o != nullptr && o->id == id;});
-
-         if (it != objs.end())
-            return *it;
-
-         return nullptr;
-      }
-   );
-}
-
-void database_api_impl::on_objects_new(const vector<object_id_type>& ids, const flat_set<account_id_type>& impacted_accounts)
-{
-   handle_object_changed(_notify_remove_create, true, ids, impacted_accounts,
-      std::bind(&object_database::find_object, &_db, std::placeholders::_1)
-   );
+   if( _subscribe_callback )
+      _subscribe_callback( updates );
 }
 
-void database_api_impl::on_objects_changed(const vector<object_id_type>& ids, const flat_set<account_id_type>& impacted_accounts)
+void database_api_impl::on_market_updates( const change_notifier::market_type& market, const fc::variant& updates )
 {
-   handle_object_changed(false, true, ids, impacted_accounts,
-      std::bind(&object_database::find_object, &_db, std::placeholders::_1)
-   );
-}
-
-void database_api_impl::handle_object_changed(bool force_notify, bool full_object, const vector<object_id_type>& ids, const flat_set<account_id_type>& impacted_accounts, std::function<const object*(object_id_type id)> find_object)
-{
-   if( _subscribe_callback )
-   {
-      vector<variant> updates;
-
-      for(auto id : ids)
-      {
-         if( force_notify || is_subscribed_to_item(id) || is_impacted_account(impacted_accounts) )
-         {
-            if( full_object )
-            {
-               auto obj = find_object(id);
-               if( obj )
-               {
-                  updates.emplace_back( obj->to_variant() );
-               }
-            }
-            else
-            {
-               updates.emplace_back( fc::variant( id, 1 ) );
-            }
-         }
-      }
-
-      if( updates.size() )
-         broadcast_updates(updates);
-   }
-
-   if( _market_subscriptions.size() )
-   {
-      market_queue_type broadcast_queue;
-
-      for(auto id : ids)
-      {
-         if( id.is<call_order_object>() )
-         {
-            enqueue_if_subscribed_to_market<call_order_object>( find_object(id), broadcast_queue, full_object );
-         }
-         else if( id.is<limit_order_object>() )
-         {
-            enqueue_if_subscribed_to_market<limit_order_object>( find_object(id), broadcast_queue, full_object );
-         }
-         else if( id.is<force_settlement_object>() )
-         {
-            enqueue_if_subscribed_to_market<force_settlement_object>( find_object(id), broadcast_queue, full_object );
-         }
-      }
-
-      if( broadcast_queue.size() )
-         broadcast_market_updates(broadcast_queue);
-   }
+   auto itr = _market_subscriptions.find( market );
+   if( itr != _market_subscriptions.end() )
+      itr->second( updates );
 }
 
 /** note: this method cannot yield because it is called in the middle of
@@ -2486,48 +2374,6 @@ void database_api_impl::on_applied_block()
          _block_applied_callback(fc::variant(block_id, 1));
       });
    }
-
-   if(_market_subscriptions.size() == 0)
-      return;
-
-   const auto& ops = _db.get_applied_operations();
-   map< std::pair<asset_id_type,asset_id_type>, vector<pair<operation, operation_result>> > subscribed_markets_ops;
-   for(const optional< operation_history_object >& o_op : ops)
-   {
-      if( !o_op.valid() )
-         continue;
-      const operation_history_object& op = *o_op;
-
-      optional< std::pair<asset_id_type,asset_id_type> > market;
-      switch(op.op.which())
-      {
-         /*  This is sent via the object_changed callback
-         case operation::tag<limit_order_create_operation>::value:
-            market = op.op.get<limit_order_create_operation>().get_market();
-            break;
-         */
-         case operation::tag<fill_order_operation>::value:
-            market = op.op.get<fill_order_operation>().get_market();
-            break;
-            /*
-         case operation::tag<limit_order_cancel_operation>::value:
-         */
-         default: break;
-      }
-      if( market.valid() && _market_subscriptions.count(*market) )
-         // FIXME this may cause fill_order_operation be pushed before order creation
-         subscribed_markets_ops[*market].emplace_back(std::make_pair(op.op, op.result));
-   }
-   /// we need to ensure the database_api is not deleted for the life of the async operation
-   auto capture_this = shared_from_this();
-   fc::async([this,capture_this,subscribed_markets_ops](){
-      for(auto item : subscribed_markets_ops)
-      {
-         auto itr = _market_subscriptions.find(item.first);
-         if(itr != _market_subscriptions.end())
-            itr->second(fc::variant(item.second, GRAPHENE_NET_MAX_NESTED_OBJECTS));
-      }
-   });
 }
 
 } } // graphene::app
@@ -48,6 +48,10 @@
 #include <string>
 #include <vector>
 
+namespace graphene { namespace account_history {
+   class account_history_plugin;
+} }
+
 namespace graphene { namespace app {
    using namespace graphene::chain;
    using namespace graphene::market_history;
@@ -116,8 +120,7 @@ namespace graphene { namespace app {
    class history_api
    {
       public:
-         history_api(application& app)
-               :_app(app), database_api( std::ref(*app.chain_database()), &(app.get_options())) {}
+         history_api(application& app);
 
          /**
           * @brief Get operations relevant to the specificed account
@@ -215,8 +218,13 @@ namespace graphene { namespace app {
           */                                 
          flat_set<uint32_t> get_market_history_buckets()const;
       private:
+           /// @return the operation from the object database or from the account_history plugin's store
+           operation_history_object get_operation( operation_history_id_type id )const;
+
            application& _app;
            graphene::app::database_api database_api;
+           /// looked up once, plugins are set up before any API is created
+           std::shared_ptr<account_history::account_history_plugin> _account_history;
    };
 
    /**
@@ -346,6 +354,38 @@ namespace graphene { namespace app {
       private:
          application& _app;
    };
+
+   /**
+    * @brief The profiler_api class gives access to the block profiler of the node, see the profile-blocks option.
+    */
+   class profiler_api
+   {
+      public:
+         profiler_api(application& a);
+
+         /**
+          * @brief Get the time spent in block and maintenance phases, operation types and plugins since the last reset
+          */
+         block_profile get_profile() const;
+
+         /**
+          * @brief Start or stop recording, the profile recorded so far is kept
+          */
+         void enable_profiling( bool enabled );
+
+         /**
+          * @brief Forget the profile recorded so far
+          */
+         void reset_profile();
+
+         /**
+          * @brief Write the profile to the file configured with the profile-dump-file option
+          */
+         void dump_profile() const;
+
+      private:
+         application& _app;
+   };
    
    class crypto_api
    {
@@ -543,6 +583,8 @@ namespace graphene { namespace app {
          fc::api<orders_api> orders()const;
          /// @brief Retrieve the debug API (if available)
          fc::api<graphene::debug_witness::debug_api> debug()const;
+         /// @brief Retrieve the profiler API
+         fc::api<profiler_api> profiler()const;
 
          /// @brief Called to enable an API, not reflected.
          void enable_api( const string& api_name );
@@ -558,6 +600,7 @@ namespace graphene { namespace app {
          optional< fc::api<asset_api> > _asset_api;
          optional< fc::api<orders_api> > _orders_api;
          optional< fc::api<graphene::debug_witness::debug_api> > _debug_api;
+         optional< fc::api<profiler_api> > _profiler_api;
    };
 
 }}  // graphene::app
@@ -604,6 +647,12 @@ FC_API(graphene::app::network_node_api,
        (get_advanced_node_parameters)
        (set_advanced_node_parameters)
      )
+FC_API(graphene::app::profiler_api,
+       (get_profile)
+       (enable_profiling)
+       (reset_profile)
+       (dump_profile)
+     )
 FC_API(graphene::app::crypto_api,
        (blind)
        (blind_sum)
@@ -633,4 +682,5 @@ FC_API(graphene::app::login_api,
        (asset)
        (orders)
        (debug)
+       (profiler)
      )
@@ -24,6 +24,7 @@
 #pragma once
 
 #include <graphene/app/api_access.hpp>
+#include <graphene/app/change_notifier.hpp>
 #include <graphene/net/node.hpp>
 #include <graphene/chain/database.hpp>
 
@@ -40,6 +41,10 @@ namespace graphene { namespace app {
       public:
          bool enable_subscribe_to_all = false;
          bool has_market_history_plugin = false;
+         /// Where the block profile is written at shutdown and by profiler_api::dump_profile, empty for nowhere
+         fc::path profile_dump_file;
+         /// The limits of the subscriptions of each API connection
+         graphene::app::subscription_limits subscription_limits;
    };
 
    class application
@@ -101,6 +106,9 @@ namespace graphene { namespace app {
 
          const application_options& get_options();
 
+         /// The notifier of the chain database, shared by the database_api of all connections
+         std::shared_ptr<change_notifier> get_change_notifier()const;
+
          void enable_plugin( const string& name );
 
       private:
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+
+#include <graphene/chain/database.hpp>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+
+namespace graphene { namespace app {
+
+   using graphene::chain::account_id_type;
+   using graphene::chain::asset_id_type;
+   using graphene::chain::object_id_type;
+
+   /** The limits of the subscriptions of one connection, see the api-max-subscribed-* options */
+   struct subscription_limits
+   {
+      uint32_t max_objects  = 10000;
+      uint32_t max_accounts = 100;
+   };
+
+   /** The size of the subscription registry of a node */
+   struct subscription_stats
+   {
+      uint64_t subscribers = 0;
+      uint64_t objects = 0;
+      uint64_t accounts = 0;
+      uint64_t markets = 0;
+      /// estimated bytes used by the registry entries
+      uint64_t memory_used = 0;
+      uint64_t memory_limit = 0;
+      /// subscriptions refused because of a limit
+      uint64_t rejected = 0;
+   };
+
+   /**
+    * @brief Matches the object changes of each block against the subscriptions of all API connections
+    *
+    * Without it every connection would look up and serialize each changed object of a block itself. The notifier
+    * serializes a changed object once, no matter how many connections receive it, finds the connections subscribed
+    * to the object, the impacted accounts or the market of an order through exact indexes of the subscriptions,
+    * and delivers the updates of a block to all connections from a single task.
+    *
+    * Subscriptions are limited per connection, and the estimated memory of all entries is limited per node.
+    * Subscribing beyond a limit is refused, database_api logs it once per connection.
+    *
+    * There is one notifier per database, shared by the database_api instances of all connections.
+    */
+   class change_notifier : public std::enable_shared_from_this<change_notifier>
+   {
+      public:
+         typedef std::pair<asset_id_type, asset_id_type> market_type;
+
+         /** A connection receiving updates, implemented by database_api */
+         class subscriber
+         {
+            public:
+               virtual ~subscriber() {}
+
+               /** Receives the changed objects of a block, or their IDs if they have been removed */
+               virtual void on_object_updates( const fc::variant& updates ) = 0;
+               /** Receives the changed orders or the fills of a market */
+               virtual void on_market_updates( const market_type& market, const fc::variant& updates ) = 0;
+         };
+
+         /** The application creates the notifier of its database and shares it between the connections */
+         explicit change_notifier( graphene::chain::database& db );
+
+         /** @return the handle of the subscriber for the other calls, it gets updates until remove_subscriber() */
+         uint64_t add_subscriber( const std::weak_ptr<subscriber>& s, const subscription_limits& limits );
+         void remove_subscriber( uint64_t handle );
+
+         /** Sets whether the subscriber wants object updates at all, and whether it wants all new and removed objects */
+         void set_object_subscription( uint64_t handle, bool enabled, bool notify_remove_create );
+         /** @return false if a limit has been reached */
+         bool subscribe_to_object( uint64_t handle, object_id_type id );
+         /** The subscriber receives all changes of a block which impact the account, @return false at a limit */
+         bool subscribe_to_account( uint64_t handle, account_id_type account );
+         void subscribe_to_market( uint64_t handle, const market_type& market );
+         void unsubscribe_from_market( uint64_t handle, const market_type& market );
+         /** Forgets the objects and accounts of the subscriber, and its markets if reset_markets */
+         void clear_subscriptions( uint64_t handle, bool reset_markets );
+
+         /** Limits the estimated memory of all subscriptions of the node, 0 for no limit */
+         void set_memory_limit( uint64_t bytes );
+         subscription_stats get_stats()const;
+
+         /** @return how many changed objects have been serialized for subscribers */
+         uint64_t serialized_objects()const { return _serialized_objects; }
+
+      private:
+         struct subscription
+         {
+            std::weak_ptr<subscriber>   target;
+            subscription_limits         limits;
+            bool                        objects = false;
+            bool                        notify_remove_create = false;
+            std::set<object_id_type>    object_ids;
+            std::set<account_id_type>   accounts;
+            flat_set<market_type>       markets;
+         };
+
+         /** A map from subscribed items to the handles of their subscribers */
+         template<typename Key, typename Compare = std::less<Key>>
+         class registry_index
+         {
+            public:
+               /// rough size of an entry of the index and of the set of the subscription, for memory accounting
+               static constexpr uint64_t entry_size = 2 * sizeof(Key) + 2 * sizeof(uint64_t) + 4 * 4 * sizeof(void*);
+
+               /// @return false if the handle was already subscribed
+               bool add( const Key& key, uint64_t handle ) { return _entries[key].insert( handle ).second; }
+               void remove( const Key& key, uint64_t handle )
+               {
+                  auto itr = _entries.find( key );
+                  if( itr == _entries.end() )
+                     return;
+                  itr->second.erase( handle );
+                  if( itr->second.empty() )
+                     _entries.erase( itr );
+               }
+               const flat_set<uint64_t>* find( const Key& key )const
+               {
+                  auto itr = _entries.find( key );
+                  return itr == _entries.end() ? nullptr : &itr->second;
+               }
+               size_t size()const { return _entries.size(); }
+
+            private:
+               std::map< Key, flat_set<uint64_t>, Compare > _entries;
+         };
+
+         subscription& get_subscription( uint64_t handle );
+         /** Adds key to the items of a subscription and to the index, unless at_limit or the memory is used up */
+         template<typename Key, typename Compare>
+         bool add_entry( uint64_t handle, std::set<Key, Compare>& items, registry_index<Key, Compare>& index,
+                         const Key& key, bool at_limit );
+
+         /** The prebuilt payloads of a batch of changes */
+         struct delivery
+         {
+            vector< std::pair<uint64_t, fc::variant> >     objects;  ///< by subscriber handle
+            vector< std::pair<market_type, fc::variant> >  markets;
+         };
+
+         typedef std::function<const graphene::db::object*(object_id_type)> find_object_type;
+
+         void on_objects( bool force_notify, bool full_object, const vector<object_id_type>& ids,
+                          const flat_set<account_id_type>& impacted_accounts, const find_object_type& find_object );
+         void on_applied_block();
+         optional<market_type> get_order_market( const graphene::db::object& obj )const;
+         void deliver( const std::shared_ptr<delivery>& d );
+
+         graphene::chain::database&                 _db;
+         mutable std::mutex                         _mutex;
+         uint64_t                                   _next_handle = 1;
+         std::map<uint64_t, subscription>           _subscriptions;
+         flat_set<uint64_t>                         _object_subscribers;
+         flat_set<uint64_t>                         _remove_create_subscribers;
+         registry_index<object_id_type>             _object_index;
+         registry_index<account_id_type>            _account_index;
+         std::map<market_type, flat_set<uint64_t>>  _market_subscribers;
+         uint64_t                                   _memory_used = 0;
+         uint64_t                                   _memory_limit = 0;
+         uint64_t                                   _rejected = 0;
+         std::atomic<uint64_t>                      _serialized_objects{0};
+
+         boost::signals2::scoped_connection         _new_connection;
+         boost::signals2::scoped_connection         _change_connection;
+         boost::signals2::scoped_connection         _removed_connection;
+         boost::signals2::scoped_connection         _applied_block_connection;
+   };
+
+} } // graphene::app
+
+FC_REFLECT( graphene::app::subscription_stats,
+            (subscribers)(objects)(accounts)(markets)(memory_used)(memory_limit)(rejected) )
@@ -23,6 +23,7 @@
  */
 #pragma once
 
+#include <graphene/app/change_notifier.hpp>
 #include <graphene/app/full_account.hpp>
 
 #include <graphene/chain/protocol/types.hpp>
@@ -129,7 +130,9 @@ struct market_trade
 class database_api
 {
    public:
-      database_api(graphene::chain::database& db, const application_options* app_options = nullptr );
+      /** Without a notifier, the subscriptions of this API get a notifier of their own */
+      database_api( graphene::chain::database& db, const application_options* app_options = nullptr,
+                    std::shared_ptr<change_notifier> notifier = std::shared_ptr<change_notifier>() );
       ~database_api();
 
       /////////////
@@ -179,6 +182,11 @@ class database_api
        * This unsubscribes from all subscribed markets and objects.
        */
       void cancel_all_subscriptions();
+      /**
+       * @brief Get the number of subscriptions of all connections of this node and their estimated memory
+       * @return The size of the subscription registry, including the subscriptions refused because of a limit
+       */
+      subscription_stats get_subscription_stats()const;
 
       /////////////////////////////
       // Blocks and transactions //
@@ -247,6 +255,13 @@ class database_api
        */
       dynamic_global_property_object get_dynamic_global_properties()const;
 
+      /**
+       * @brief Retrieve the memory usage of the pooled object indexes of this node
+       *
+       * Each entry describes the node pool of one object type, see @ref graphene::db::pool_allocator.
+       */
+      vector<graphene::db::pool_allocator_stats> get_pool_allocator_stats()const;
+
       //////////
       // Keys //
       //////////
@@ -762,6 +777,7 @@ FC_API(graphene::app::database_api,
    (set_pending_transaction_callback)
    (set_block_applied_callback)
    (cancel_all_subscriptions)
+   (get_subscription_stats)
 
    // Blocks and transactions
    (get_block_header)
@@ -776,6 +792,7 @@ FC_API(graphene::app::database_api,
    (get_config)
    (get_chain_id)
    (get_dynamic_global_properties)
+   (get_pool_allocator_stats)
 
    // Keys
    (get_key_references)
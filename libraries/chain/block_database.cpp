@@ -25,6 +25,12 @@
 #include <graphene/chain/protocol/fee_schedule.hpp>
 #include <fc/io/raw.hpp>
 
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <cstring>
+#include <thread>
+
 namespace graphene { namespace chain {
 
 struct index_entry
@@ -38,23 +44,52 @@ FC_REFLECT( graphene::chain::index_entry, (block_pos)(block_size)(block_id) );
 
 namespace graphene { namespace chain {
 
+/**
+ * A read-only mapping of a whole file as it was at the time the mapping was made.
+ * Instances are immutable and shared between readers; a reader keeps the mapping it
+ * obtained alive for as long as it is looking at the data.
+ */
+class block_database::mapped_file
+{
+   public:
+      explicit mapped_file( const fc::path& filename )
+         : _mapping( filename.generic_string().c_str(), boost::interprocess::read_only ),
+           _region( _mapping, boost::interprocess::read_only )
+      {}
+
+      const char* data()const { return static_cast<const char*>( _region.get_address() ); }
+      uint64_t    size()const { return _region.get_size(); }
+
+   private:
+      boost::interprocess::file_mapping  _mapping;
+      boost::interprocess::mapped_region _region;
+};
+
 void block_database::open( const fc::path& dbdir )
 { try {
    fc::create_directories(dbdir);
    _block_num_to_pos.exceptions(std::ios_base::failbit | std::ios_base::badbit);
    _blocks.exceptions(std::ios_base::failbit | std::ios_base::badbit);
 
-   _index_filename = dbdir / "index";
-   if( !fc::exists( _index_filename ) )
+   _index_log.filename = dbdir / "index";
+   _blocks_log.filename = dbdir / "blocks";
+   if( !fc::exists( _index_log.filename ) )
    {
-     _block_num_to_pos.open( _index_filename.generic_string().c_str(), std::fstream::binary | std::fstream::in | std::fstream::out | std::fstream::trunc);
-     _blocks.open( (dbdir/"blocks").generic_string().c_str(), std::fstream::binary | std::fstream::in | std::fstream::out | std::fstream::trunc);
+     _block_num_to_pos.open( _index_log.filename.generic_string().c_str(), std::fstream::binary | std::fstream::in | std::fstream::out | std::fstream::trunc);
+     _blocks.open( _blocks_log.filename.generic_string().c_str(), std::fstream::binary | std::fstream::in | std::fstream::out | std::fstream::trunc);
    }
    else
    {
-     _block_num_to_pos.open( _index_filename.generic_string().c_str(), std::fstream::binary | std::fstream::in | std::fstream::out );
-     _blocks.open( (dbdir/"blocks").generic_string().c_str(), std::fstream::binary | std::fstream::in | std::fstream::out );
+     _block_num_to_pos.open( _index_log.filename.generic_string().c_str(), std::fstream::binary | std::fstream::in | std::fstream::out );
+     _blocks.open( _blocks_log.filename.generic_string().c_str(), std::fstream::binary | std::fstream::in | std::fstream::out );
    }
+
+   for( mapped_log* log : { &_index_log, &_blocks_log } )
+   {
+      std::atomic_store( &log->mapping, std::shared_ptr<const mapped_file>() );
+      log->size.store( fc::file_size( log->filename ), std::memory_order_release );
+   }
+   _last_read_position.store( 0, std::memory_order_relaxed );
 } FC_CAPTURE_AND_RETHROW( (dbdir) ) }
 
 bool block_database::is_open()const
@@ -66,6 +101,11 @@ void block_database::close()
 {
   _blocks.close();
   _block_num_to_pos.close();
+  for( mapped_log* log : { &_index_log, &_blocks_log } )
+  {
+     log->size.store( 0, std::memory_order_release );
+     std::atomic_store( &log->mapping, std::shared_ptr<const mapped_file>() );
+  }
 }
 
 void block_database::flush()
@@ -74,6 +114,91 @@ void block_database::flush()
   _block_num_to_pos.flush();
 }
 
+std::shared_ptr<const block_database::mapped_file> block_database::map_for_read( mapped_log& log,
+                                                                                 uint64_t required_size )const
+{
+   if( log.size.load( std::memory_order_acquire ) < required_size )
+      return std::shared_ptr<const mapped_file>();
+
+   auto mapping = std::atomic_load( &log.mapping );
+   if( mapping && mapping->size() >= required_size )
+      return mapping;
+
+   // The file has grown past the current mapping. Only one reader remaps, the others reuse its result.
+   // Readers still holding the previous mapping are unaffected.
+   std::lock_guard<std::mutex> guard( log.remap_mutex );
+   mapping = std::atomic_load( &log.mapping );
+   if( mapping && mapping->size() >= required_size )
+      return mapping;
+
+   mapping = std::make_shared<const mapped_file>( log.filename );
+   if( mapping->size() < required_size )
+      return std::shared_ptr<const mapped_file>();
+   std::atomic_store( &log.mapping, mapping );
+   return mapping;
+}
+
+void block_database::publish_size( mapped_log& log, std::fstream& stream, uint64_t new_size )
+{
+   // Data must reach the OS before readers may map it
+   stream.flush();
+   if( new_size > log.size.load( std::memory_order_relaxed ) )
+      log.size.store( new_size, std::memory_order_release );
+}
+
+optional<index_entry> block_database::read_index_entry( uint32_t block_num )const
+{
+   const uint64_t index_pos = sizeof(index_entry) * uint64_t(block_num);
+   auto index = map_for_read( _index_log, index_pos + sizeof(index_entry) );
+   if( !index )
+      return optional<index_entry>();
+
+   // The entry may be rewritten in place by the writer (see write_index_entry), retry until a copy
+   // was taken while no write was in progress
+   index_entry e;
+   for(;;)
+   {
+      const uint64_t sequence = _index_sequence.load( std::memory_order_acquire );
+      if( sequence & 1 )
+      {
+         std::this_thread::yield();
+         continue;
+      }
+      std::memcpy( (char*)&e, index->data() + index_pos, sizeof(e) );
+      std::atomic_thread_fence( std::memory_order_acquire );
+      if( _index_sequence.load( std::memory_order_relaxed ) == sequence )
+         return e;
+   }
+}
+
+void block_database::write_index_entry( uint32_t block_num, const index_entry& e )
+{
+   const uint64_t index_pos = sizeof( index_entry ) * uint64_t(block_num);
+   _index_sequence.fetch_add( 1, std::memory_order_relaxed );
+   std::atomic_thread_fence( std::memory_order_release );
+   _block_num_to_pos.seekp( index_pos );
+   _block_num_to_pos.write( (const char*)&e, sizeof(e) );
+   publish_size( _index_log, _block_num_to_pos, index_pos + sizeof(e) );
+   _index_sequence.fetch_add( 1, std::memory_order_release );
+}
+
+optional<signed_block> block_database::read_block( const index_entry& e )const
+{
+   if( e.block_size == 0 )
+      return optional<signed_block>();
+   auto blocks = map_for_read( _blocks_log, e.block_pos + e.block_size );
+   if( !blocks )
+      return optional<signed_block>();
+
+   // Deserialize straight out of the mapping, no intermediate copy
+   fc::datastream<const char*> ds( blocks->data() + e.block_pos, e.block_size );
+   signed_block result;
+   fc::raw::unpack( ds, result );
+   FC_ASSERT( result.id() == e.block_id );
+   _last_read_position.store( e.block_pos + e.block_size, std::memory_order_relaxed );
+   return result;
+}
+
 void block_database::store( const block_id_type& _id, const signed_block& b )
 {
    block_id_type id = _id;
@@ -82,7 +207,6 @@ void block_database::store( const block_id_type& _id, const signed_block& b )
       id = b.id();
       elog( "id argument of block_database::store() was not initialized for block ${id}", ("id", id) );
    }
-   _block_num_to_pos.seekp( sizeof( index_entry ) * int64_t(block_header::num_from_id(id)) );
    index_entry e;
    _blocks.seekp( 0, _blocks.end );
    auto vec = fc::raw::pack( b );
@@ -90,25 +214,22 @@ void block_database::store( const block_id_type& _id, const signed_block& b )
    e.block_size = vec.size();
    e.block_id   = id;
    _blocks.write( vec.data(), vec.size() );
-   _block_num_to_pos.write( (char*)&e, sizeof(e) );
+   // The block has to be visible before the index entry pointing to it
+   publish_size( _blocks_log, _blocks, e.block_pos + e.block_size );
+   write_index_entry( block_header::num_from_id(id), e );
 }
 
 void block_database::remove( const block_id_type& id )
 { try {
-   index_entry e;
-   int64_t index_pos = sizeof(e) * int64_t(block_header::num_from_id(id));
-   _block_num_to_pos.seekg( 0, _block_num_to_pos.end );
-   if ( _block_num_to_pos.tellg() <= index_pos )
+   const uint32_t block_num = block_header::num_from_id(id);
+   optional<index_entry> e = read_index_entry( block_num );
+   if( !e.valid() )
       FC_THROW_EXCEPTION(fc::key_not_found_exception, "Block ${id} not contained in block database", ("id", id));
 
-   _block_num_to_pos.seekg( index_pos );
-   _block_num_to_pos.read( (char*)&e, sizeof(e) );
-
-   if( e.block_id == id )
+   if( e->block_id == id )
    {
-      e.block_size = 0;
-      _block_num_to_pos.seekp( sizeof(e) * int64_t(block_header::num_from_id(id)) );
-      _block_num_to_pos.write( (char*)&e, sizeof(e) );
+      e->block_size = 0;
+      write_index_entry( block_num, *e );
    }
 } FC_CAPTURE_AND_RETHROW( (id) ) }
 
@@ -117,55 +238,29 @@ bool block_database::contains( const block_id_type& id )const
    if( id == block_id_type() )
       return false;
 
-   index_entry e;
-   int64_t index_pos = sizeof(e) * int64_t(block_header::num_from_id(id));
-   _block_num_to_pos.seekg( 0, _block_num_to_pos.end );
-   if ( _block_num_to_pos.tellg() < int64_t(index_pos + sizeof(e)) )
-      return false;
-   _block_num_to_pos.seekg( index_pos );
-   _block_num_to_pos.read( (char*)&e, sizeof(e) );
-
-   return e.block_id == id && e.block_size > 0;
+   optional<index_entry> e = read_index_entry( block_header::num_from_id(id) );
+   return e.valid() && e->block_id == id && e->block_size > 0;
 }
 
 block_id_type block_database::fetch_block_id( uint32_t block_num )const
 {
    assert( block_num != 0 );
-   index_entry e;
-   int64_t index_pos = sizeof(e) * int64_t(block_num);
-   _block_num_to_pos.seekg( 0, _block_num_to_pos.end );
-   if ( _block_num_to_pos.tellg() <= index_pos )
+   optional<index_entry> e = read_index_entry( block_num );
+   if( !e.valid() )
       FC_THROW_EXCEPTION(fc::key_not_found_exception, "Block number ${block_num} not contained in block database", ("block_num", block_num));
 
-   _block_num_to_pos.seekg( index_pos );
-   _block_num_to_pos.read( (char*)&e, sizeof(e) );
-
-   FC_ASSERT( e.block_id != block_id_type(), "Empty block_id in block_database (maybe corrupt on disk?)" );
-   return e.block_id;
+   FC_ASSERT( e->block_id != block_id_type(), "Empty block_id in block_database (maybe corrupt on disk?)" );
+   return e->block_id;
 }
 
 optional<signed_block> block_database::fetch_optional( const block_id_type& id )const
 {
    try
    {
-      index_entry e;
-      int64_t index_pos = sizeof(e) * int64_t(block_header::num_from_id(id));
-      _block_num_to_pos.seekg( 0, _block_num_to_pos.end );
-      if ( _block_num_to_pos.tellg() <= index_pos )
-         return {};
-
-      _block_num_to_pos.seekg( index_pos );
-      _block_num_to_pos.read( (char*)&e, sizeof(e) );
-
-      if( e.block_id != id ) return optional<signed_block>();
-
-      vector<char> data( e.block_size );
-      _blocks.seekg( e.block_pos );
-      if (e.block_size)
-         _blocks.read( data.data(), e.block_size );
-      auto result = fc::raw::unpack<signed_block>(data);
-      FC_ASSERT( result.id() == e.block_id );
-      return result;
+      optional<index_entry> e = read_index_entry( block_header::num_from_id(id) );
+      if( !e.valid() || e->block_id != id ) return optional<signed_block>();
+
+      return read_block( *e );
    }
    catch (const fc::exception&)
    {
@@ -178,22 +273,21 @@ optional<signed_block> block_database::fetch_optional( const block_id_type& id )
 
 optional<signed_block> block_database::fetch_by_number( uint32_t block_num )const
 {
+   size_t end_position;
+   return fetch_by_number( block_num, end_position );
+}
+
+optional<signed_block> block_database::fetch_by_number( uint32_t block_num, size_t& end_position )const
+{
+   end_position = 0;
    try
    {
-      index_entry e;
-      int64_t index_pos = sizeof(e) * int64_t(block_num);
-      _block_num_to_pos.seekg( 0, _block_num_to_pos.end );
-      if ( _block_num_to_pos.tellg() <= index_pos )
-         return {};
-
-      _block_num_to_pos.seekg( index_pos, _block_num_to_pos.beg );
-      _block_num_to_pos.read( (char*)&e, sizeof(e) );
-
-      vector<char> data( e.block_size );
-      _blocks.seekg( e.block_pos );
-      _blocks.read( data.data(), e.block_size );
-      auto result = fc::raw::unpack<signed_block>(data);
-      FC_ASSERT( result.id() == e.block_id );
+      optional<index_entry> e = read_index_entry( block_num );
+      if( !e.valid() ) return optional<signed_block>();
+
+      optional<signed_block> result = read_block( *e );
+      if( result.valid() )
+         end_position = (size_t)( e->block_pos + e->block_size );
       return result;
    }
    catch (const fc::exception&)
@@ -208,35 +302,21 @@ optional<signed_block> block_database::fetch_by_number( uint32_t block_num )cons
 optional<index_entry> block_database::last_index_entry()const {
    try
    {
-      index_entry e;
-
-      _block_num_to_pos.seekg( 0, _block_num_to_pos.end );
-      std::streampos pos = _block_num_to_pos.tellg();
-      if( pos < long(sizeof(index_entry)) )
+      uint64_t pos = _index_log.size.load( std::memory_order_acquire );
+      if( pos < sizeof(index_entry) )
          return optional<index_entry>();
 
       pos -= pos % sizeof(index_entry);
 
-      _blocks.seekg( 0, _block_num_to_pos.end );
-      const std::streampos blocks_size = _blocks.tellg();
       while( pos > 0 )
       {
          pos -= sizeof(index_entry);
-         _block_num_to_pos.seekg( pos );
-         _block_num_to_pos.read( (char*)&e, sizeof(e) );
-         if( _block_num_to_pos.gcount() == sizeof(e) && e.block_size > 0
-                && int64_t(e.block_pos + e.block_size) <= blocks_size )
+         optional<index_entry> e = read_index_entry( pos / sizeof(index_entry) );
+         if( e.valid() && e->block_size > 0 )
             try
             {
-               vector<char> data( e.block_size );
-               _blocks.seekg( e.block_pos );
-               _blocks.read( data.data(), e.block_size );
-               if( _blocks.gcount() == long(e.block_size) )
-               {
-                  const signed_block block = fc::raw::unpack<signed_block>(data);
-                  if( block.id() == e.block_id )
-                     return e;
-               }
+               if( read_block( *e ).valid() )
+                  return e;
             }
             catch (const fc::exception&)
             {
@@ -244,7 +324,15 @@ optional<index_entry> block_database::last_index_entry()const {
             catch (const std::exception&)
             {
             }
-         fc::resize_file( _index_filename, pos );
+         // Drop the broken tail of the index. This only happens while recovering from an unclean
+         // shutdown, before anyone else reads from the database, so no reader can still be looking
+         // at the truncated part of the old mapping.
+         {
+            std::lock_guard<std::mutex> guard( _index_log.remap_mutex );
+            std::atomic_store( &_index_log.mapping, std::shared_ptr<const mapped_file>() );
+            _index_log.size.store( pos, std::memory_order_release );
+            fc::resize_file( _index_log.filename, pos );
+         }
       }
    }
    catch (const fc::exception&)
@@ -272,13 +360,12 @@ optional<block_id_type> block_database::last_id()const
 
 size_t block_database::blocks_current_position()const
 {
-   return (size_t)_blocks.tellg();
+   return (size_t)_last_read_position.load( std::memory_order_relaxed );
 }
 
 size_t block_database::total_block_size()const
 {
-   _blocks.seekg( 0, _blocks.end );
-   return (size_t)_blocks.tellg();
+   return (size_t)_blocks_log.size.load( std::memory_order_acquire );
 }
 
 } }
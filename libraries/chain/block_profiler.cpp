@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <graphene/chain/block_profiler.hpp>
+#include <graphene/chain/config.hpp>
+#include <graphene/chain/protocol/operations.hpp>
+
+#include <fc/io/json.hpp>
+
+namespace graphene { namespace chain {
+
+namespace detail {
+
+   struct operation_name_visitor
+   {
+      typedef string result_type;
+
+      template<typename Op>
+      string operator()( const Op& )const
+      {
+         const string name = fc::get_typename<Op>::name();
+         const auto pos = name.rfind( ':' );
+         return pos == string::npos ? name : name.substr( pos + 1 );
+      }
+   };
+
+   string operation_name( int operation_tag )
+   {
+      operation op;
+      op.set_which( operation_tag );
+      return op.visit( operation_name_visitor() );
+   }
+
+} // detail
+
+void block_profiler::reset()
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   _profile = block_profile();
+}
+
+void block_profiler::record_block( uint32_t block_num )
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   if( _profile.blocks == 0 )
+      _profile.first_block = block_num;
+   _profile.last_block = block_num;
+   ++_profile.blocks;
+}
+
+void block_profiler::record_block_phase( const char* name, const fc::microseconds& duration )
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   _profile.block_phases[name].add( duration );
+}
+
+void block_profiler::record_maintenance_phase( const char* name, const fc::microseconds& duration )
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   _profile.maintenance_phases[name].add( duration );
+}
+
+operation_profile& block_profiler::operation_entry( int operation_tag )
+{
+   auto itr = _profile.operations.find( operation_tag );
+   if( itr == _profile.operations.end() )
+   {
+      itr = _profile.operations.emplace( operation_tag, operation_profile() ).first;
+      itr->second.name = detail::operation_name( operation_tag );
+   }
+   return itr->second;
+}
+
+void block_profiler::record_evaluate( int operation_tag, const fc::microseconds& duration )
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   operation_entry( operation_tag ).evaluate.add( duration );
+}
+
+void block_profiler::record_apply( int operation_tag, const fc::microseconds& duration )
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   operation_entry( operation_tag ).apply.add( duration );
+}
+
+void block_profiler::record_applied_block_slot( const string& slot, const fc::microseconds& duration )
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   _profile.applied_block_slots[slot].add( duration );
+}
+
+std::function<void(const signed_block&)> block_profiler::profile_applied_block(
+      const string& slot, const std::function<void(const signed_block&)>& handler )
+{
+   return [this,slot,handler]( const signed_block& b ) {
+      if( !_enabled )
+      {
+         handler( b );
+         return;
+      }
+      const fc::time_point start = fc::time_point::now();
+      handler( b );
+      record_applied_block_slot( slot, fc::time_point::now() - start );
+   };
+}
+
+block_profile block_profiler::get_profile()const
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   block_profile result = _profile;
+   result.enabled = _enabled;
+   return result;
+}
+
+void block_profiler::dump( const fc::path& file )const
+{ try {
+   fc::json::save_to_file( fc::variant( get_profile(), GRAPHENE_MAX_NESTED_OBJECTS ), file );
+} FC_CAPTURE_AND_RETHROW( (file) ) }
+
+} } // graphene::chain
@@ -36,11 +36,65 @@
 #include <graphene/chain/protocol/fee_schedule.hpp>
 #include <graphene/chain/exceptions.hpp>
 #include <graphene/chain/evaluator.hpp>
+#include <graphene/chain/impacted.hpp>
+#include <graphene/chain/parallel_chunks.hpp>
 
 #include <fc/thread/parallel.hpp>
 
+#include <algorithm>
+
 namespace graphene { namespace chain {
 
+namespace detail {
+
+   /// What the evaluation of operations reads, and what applying them writes
+   struct speculation_footprint
+   {
+      flat_set<account_id_type> accounts; ///< read and written
+      flat_set<asset_id_type>   read_assets;
+      flat_set<asset_id_type>   written_assets;
+   };
+
+   /**
+    * Adds the assets used by an operation to a footprint, returns false if the footprint of the operation is not
+    * known. The accounts are taken from operation_get_impacted_accounts. Operations which can have side effects
+    * on other accounts, like filling orders in a market, are not supported.
+    */
+   struct speculation_footprint_visitor
+   {
+      typedef bool result_type;
+
+      speculation_footprint& footprint;
+
+      speculation_footprint_visitor( speculation_footprint& f ) : footprint( f ) {}
+
+      void add_fee( const asset& fee )const
+      {
+         footprint.read_assets.insert( fee.asset_id );
+         if( fee.asset_id != asset_id_type() ) // paid from the fee pool
+            footprint.written_assets.insert( fee.asset_id );
+      }
+
+      bool operator()( const transfer_operation& op )const
+      {
+         add_fee( op.fee );
+         footprint.read_assets.insert( op.amount.asset_id );
+         return true;
+      }
+
+      bool operator()( const override_transfer_operation& op )const
+      {
+         add_fee( op.fee );
+         footprint.read_assets.insert( op.amount.asset_id );
+         return true;
+      }
+
+      template<typename Operation>
+      bool operator()( const Operation& )const { return false; }
+   };
+
+} // detail
+
 bool database::is_known_block( const block_id_type& id )const
 {
    return _fork_db.is_known_block(id) || _block_id_to_block.contains(id);
@@ -532,6 +586,8 @@ void database::_apply_block( const signed_block& next_block )
    uint32_t next_block_num = next_block.block_num();
    uint32_t skip = get_node_properties().skip_flags;
    _applied_ops.clear();
+   block_profiler::applying_block applying( _profiler );
+   block_profiler::phase_timer timer( _profiler, block_profiler::phase_timer::block_phase );
 
    if( !(skip & skip_block_size_check) )
    {
@@ -554,35 +610,65 @@ void database::_apply_block( const signed_block& next_block )
    _current_trx_in_block = 0;
 
    _issue_453_affected_assets.clear();
+   timer.phase_done( "validate header" );
 
-   for( const auto& trx : next_block.transactions )
-   {
-      /* We do not need to push the undo state for each transaction
-       * because they either all apply and are valid or the
-       * entire block fails to apply.  We only need an "undo" state
-       * for transactions when validating broadcast transactions or
-       * when building a block.
-       */
-      apply_transaction( trx, skip );
-      ++_current_trx_in_block;
+   // Changes are only detectable through the undo journal
+   if( !(skip & skip_transaction_signatures) && _undo_db.enabled() && next_block.transactions.size() > 1 )
+      verify_block_authorities( next_block );
+   timer.phase_done( "verify authorities" );
+
+   if( _parallel_tx_execution && next_block.transactions.size() > 1 )
+      speculate_block_transactions( next_block );
+   timer.phase_done( "speculate transactions" );
+
+   try {
+      for( const auto& trx : next_block.transactions )
+      {
+         /* We do not need to push the undo state for each transaction
+          * because they either all apply and are valid or the
+          * entire block fails to apply.  We only need an "undo" state
+          * for transactions when validating broadcast transactions or
+          * when building a block.
+          */
+         apply_transaction( trx, skip );
+         ++_current_trx_in_block;
+      }
+   } catch( ... ) {
+      // must not be applied to other transactions
+      _preverified_authorities.clear();
+      _speculative_evaluations.clear();
+      throw;
    }
+   _preverified_authorities.clear();
+   _speculative_evaluations.clear();
+   timer.phase_done( "transactions" );
 
    const uint32_t missed = update_witness_missed_blocks( next_block );
    update_global_dynamic_data( next_block, missed );
    update_signing_witness(signing_witness, next_block);
    update_last_irreversible_block();
+   timer.phase_done( "global properties" );
 
    // Are we at the maintenance interval?
    if( maint_needed )
+   {
       perform_chain_maintenance(next_block, global_props);
+      timer.phase_done( "chain maintenance" );
+   }
 
    create_block_summary(next_block);
    clear_expired_transactions();
+   timer.phase_done( "clear_expired_transactions" );
    clear_expired_proposals();
+   timer.phase_done( "clear_expired_proposals" );
    clear_expired_orders();
+   timer.phase_done( "clear_expired_orders" );
    update_expired_feeds();       // this will update expired feeds and some core exchange rates
+   timer.phase_done( "update_expired_feeds" );
    update_core_exchange_rates(); // this will update remaining core exchange rates
+   timer.phase_done( "update_core_exchange_rates" );
    update_withdraw_permissions();
+   timer.phase_done( "update_withdraw_permissions" );
 
    // n.b., update_maintenance_flag() happens this late
    // because get_slot_time() / get_slot_at_time() is needed above
@@ -593,12 +679,17 @@ void database::_apply_block( const signed_block& next_block )
    update_witness_schedule();
    if( !_node_property_object.debug_updates.empty() )
       apply_debug_updates();
+   timer.phase_done( "update_witness_schedule" );
 
    // notify observers that the block has been applied
    notify_applied_block( next_block ); //emit
    _applied_ops.clear();
+   timer.phase_done( "applied_block" );
 
    notify_changed_objects();
+   timer.phase_done( "notify_changed_objects" );
+   if( _profiler.enabled() )
+      _profiler.record_block( next_block_num );
 } FC_CAPTURE_AND_RETHROW( (next_block.block_num()) )  }
 
 
@@ -629,9 +720,21 @@ processed_transaction database::_apply_transaction(const signed_transaction& trx
 
    if( !(skip & skip_transaction_signatures) )
    {
-      auto get_active = [&]( account_id_type id ) { return &id(*this).active; };
-      auto get_owner  = [&]( account_id_type id ) { return &id(*this).owner;  };
-      trx.verify_authority( chain_id, get_active, get_owner, get_global_properties().parameters.max_authority_depth );
+      bool verified = false;
+      if( _current_trx_in_block < _preverified_authorities.size() )
+      {
+         const auto& accounts = _preverified_authorities[_current_trx_in_block];
+         verified = accounts.valid()
+                    && std::none_of( accounts->begin(), accounts->end(), [this] ( account_id_type id ) {
+                          return _undo_db.changed_since( id, _preverified_position );
+                       });
+      }
+      if( !verified )
+      {
+         auto get_active = [&]( account_id_type id ) { return &id(*this).active; };
+         auto get_owner  = [&]( account_id_type id ) { return &id(*this).owner;  };
+         trx.verify_authority( chain_id, get_active, get_owner, get_global_properties().parameters.max_authority_depth );
+      }
    }
 
    //Skip all manner of expiration and TaPoS checking if we're on block 1; It's impossible that the transaction is
@@ -667,7 +770,13 @@ processed_transaction database::_apply_transaction(const signed_transaction& trx
    //Finally process the operations
    processed_transaction ptrx(trx);
    _current_op_in_trx = 0;
-   for( const auto& op : ptrx.operations )
+   if( _current_trx_in_block < _speculative_evaluations.size() && _speculative_evaluations[_current_trx_in_block] )
+   {
+      unique_ptr<generic_evaluator> eval = std::move( _speculative_evaluations[_current_trx_in_block] );
+      eval_state.operation_results.emplace_back( apply_speculated_operation( eval_state, ptrx.operations[0], *eval ) );
+      ++_current_op_in_trx;
+   }
+   else for( const auto& op : ptrx.operations )
    {
       eval_state.operation_results.emplace_back(apply_operation(eval_state, op));
       ++_current_op_in_trx;
@@ -691,6 +800,15 @@ operation_result database::apply_operation(transaction_evaluation_state& eval_st
    return result;
 } FC_CAPTURE_AND_RETHROW( (op) ) }
 
+operation_result database::apply_speculated_operation( transaction_evaluation_state& eval_state, const operation& op,
+                                                       generic_evaluator& eval )
+{ try {
+   auto op_id = push_applied_operation( op );
+   auto result = eval.resume_apply( eval_state, op );
+   set_applied_operation_result( op_id, result );
+   return result;
+} FC_CAPTURE_AND_RETHROW( (op) ) }
+
 const witness_object& database::validate_block_header( uint32_t skip, const signed_block& next_block )const
 {
    FC_ASSERT( head_block_id() == next_block.previous, "", ("head_block_id",head_block_id())("next.prev",next_block.previous) );
@@ -746,10 +864,110 @@ void database::_precompute_parallel( const Trx* trx, const size_t count, const u
       if( !(skip&skip_transaction_dupe_check) )
          trx->id();
       if( !(skip&skip_transaction_signatures) )
-         trx->get_signature_keys( get_chain_id() );
+         _signature_cache.apply( *trx, get_chain_id() );
    }
 }
 
+void database::verify_block_authorities( const signed_block& block )
+{
+   const size_t count = block.transactions.size();
+   _preverified_authorities.clear();
+   _preverified_authorities.resize( count );
+   _preverified_position = _undo_db.position();
+
+   const chain_id_type& chain_id = get_chain_id();
+   const uint32_t max_depth = get_global_properties().parameters.max_authority_depth;
+   // Nothing modifies the database until all tasks are done, so they can read it concurrently
+   auto verify = [this,&block,&chain_id,max_depth] ( size_t begin, size_t end ) {
+      for( size_t i = begin; i < end; ++i )
+      {
+         flat_set<account_id_type> accounts;
+         auto get_active = [this,&accounts]( account_id_type id ) {
+            accounts.insert( id );
+            return &id(*this).active;
+         };
+         auto get_owner  = [this,&accounts]( account_id_type id ) {
+            accounts.insert( id );
+            return &id(*this).owner;
+         };
+         try {
+            block.transactions[i].verify_authority( chain_id, get_active, get_owner, max_depth );
+            _preverified_authorities[i] = std::move( accounts );
+         } catch( const fc::exception& ) {
+            // verified again when the transaction is applied, the state may differ by then
+         }
+      }
+   };
+
+   detail::run_in_parallel_chunks( count, verify );
+}
+
+void database::speculate_block_transactions( const signed_block& block )
+{
+   const size_t count = block.transactions.size();
+   _speculative_evaluations.clear();
+   _speculative_evaluations.resize( count );
+
+   // A transaction can be evaluated against the state before the block if no transaction before it writes anything
+   // it reads. The first transaction with an unknown footprint ends the speculation, the rest of the block is
+   // evaluated serially when it is applied.
+   vector<size_t> independent;
+   flat_set<account_id_type> written_accounts;
+   flat_set<asset_id_type>   written_assets;
+   for( size_t i = 0; i < count; ++i )
+   {
+      const signed_transaction& trx = block.transactions[i];
+      detail::speculation_footprint footprint;
+      detail::speculation_footprint_visitor vtor( footprint );
+      bool known = true;
+      for( const auto& op : trx.operations )
+      {
+         known = op.visit( vtor );
+         if( !known )
+            break;
+         operation_get_impacted_accounts( op, footprint.accounts );
+      }
+      if( !known )
+         break;
+
+      const bool conflicts =
+            std::any_of( footprint.accounts.begin(), footprint.accounts.end(), [&written_accounts] ( account_id_type id ) {
+               return written_accounts.find( id ) != written_accounts.end();
+            })
+         || std::any_of( footprint.read_assets.begin(), footprint.read_assets.end(), [&written_assets] ( asset_id_type id ) {
+               return written_assets.find( id ) != written_assets.end();
+            });
+      // later operations of a transaction read what the earlier ones write
+      if( !conflicts && trx.operations.size() == 1 )
+         independent.push_back( i );
+
+      written_accounts.insert( footprint.accounts.begin(), footprint.accounts.end() );
+      written_assets.insert( footprint.written_assets.begin(), footprint.written_assets.end() );
+   }
+   if( independent.size() < 2 )
+      return;
+
+   // Nothing modifies the database until all tasks are done, so they can read it concurrently
+   auto speculate = [this,&block,&independent] ( size_t begin, size_t end ) {
+      for( size_t k = begin; k < end; ++k )
+      {
+         const size_t i = independent[k];
+         const operation& op = block.transactions[i].operations[0];
+         transaction_evaluation_state eval_state( this );
+         eval_state._trx = &block.transactions[i];
+         try {
+            block.transactions[i].validate();
+            const auto& eval = _operation_evaluators[ op.which() ];
+            if( eval )
+               _speculative_evaluations[i] = eval->speculate( eval_state, op );
+         } catch( const fc::exception& ) {
+            // evaluated again when the transaction is applied, which reports the failure
+         }
+      }
+   };
+   detail::run_in_parallel_chunks( independent.size(), speculate );
+}
+
 fc::future<void> database::precompute_parallel( const signed_block& block, const uint32_t skip )const
 { try {
    std::vector<fc::future<void>> workers;
@@ -759,15 +977,9 @@ fc::future<void> database::precompute_parallel( const signed_block& block, const
          _precompute_parallel( &block.transactions[0], block.transactions.size(), skip );
       else
       {
-         uint32_t chunks = fc::asio::default_io_service_scope::get_num_threads();
-         uint32_t chunk_size = ( block.transactions.size() + chunks - 1 ) / chunks;
-         workers.reserve( chunks + 1 );
-         for( size_t base = 0; base < block.transactions.size(); base += chunk_size )
-            workers.push_back( fc::do_parallel( [this,&block,base,chunk_size,skip] () {
-               _precompute_parallel( &block.transactions[base],
-                                     base + chunk_size < block.transactions.size() ? chunk_size : block.transactions.size() - base,
-                                     skip );
-            }) );
+         workers = detail::start_parallel_chunks( block.transactions.size(), [this,&block,skip] ( size_t begin, size_t end ) {
+            _precompute_parallel( &block.transactions[begin], end - begin, skip );
+         });
       }
    }
 
@@ -787,6 +999,17 @@ fc::future<void> database::precompute_parallel( const signed_block& block, const
    return *first;
 } FC_LOG_AND_RETHROW() }
 
+void database::precompute_block( const signed_block& block, const uint32_t skip )const
+{
+   if( !block.transactions.empty() )
+      _precompute_parallel( &block.transactions[0], block.transactions.size(), skip );
+   if( !(skip&skip_witness_signature) )
+      block.signee();
+   if( !(skip&skip_merkle_check) )
+      block.calculate_merkle_root();
+   block.id();
+}
+
 fc::future<void> database::precompute_parallel( const precomputable_transaction& trx )const
 {
    return fc::do_parallel([this,&trx] () {
@@ -40,6 +40,16 @@ const asset_dynamic_data_object& database::get_core_dynamic_data() const
    return *_p_core_dynamic_data_obj;
 }
 
+const limit_order_book& database::get_limit_order_book()const
+{
+   return *_p_limit_order_book;
+}
+
+const call_order_book& database::get_call_order_book()const
+{
+   return *_p_call_order_book;
+}
+
 const global_property_object& database::get_global_properties()const
 {
    return *_p_global_prop_obj;
@@ -178,6 +178,7 @@ void database::initialize_evaluators()
 void database::initialize_indexes()
 {
    reset_indexes();
+   _vote_tally.reset();
    _undo_db.set_max_size( GRAPHENE_MIN_UNDO_HISTORY );
 
    //Protocol object indexes
@@ -187,17 +188,21 @@ void database::initialize_indexes()
    auto acnt_index = add_index< primary_index<account_index, 20> >(); // ~1 million accounts per chunk
    acnt_index->add_secondary_index<account_member_index>();
    acnt_index->add_secondary_index<account_referrer_index>();
+   acnt_index->add_secondary_index< vote_tally_tracker<account_object> >( &_vote_tally );
 
    add_index< primary_index<committee_member_index, 8> >(); // 256 members per chunk
    add_index< primary_index<witness_index, 10> >(); // 1024 witnesses per chunk
-   add_index< primary_index<limit_order_index > >();
-   add_index< primary_index<call_order_index > >();
+   auto limit_order_idx = add_index< hashed_primary_index<limit_order_index > >();
+   _p_limit_order_book = limit_order_idx->add_secondary_index<limit_order_book>();
+   auto call_order_idx = add_index< hashed_primary_index<call_order_index > >();
+   _p_call_order_book = call_order_idx->add_secondary_index<call_order_book>();
 
    auto prop_index = add_index< primary_index<proposal_index > >();
    prop_index->add_secondary_index<required_approval_index>();
 
    add_index< primary_index<withdraw_permission_index > >();
-   add_index< primary_index<vesting_balance_index> >();
+   auto vesting_idx = add_index< primary_index<vesting_balance_index> >();
+   vesting_idx->add_secondary_index< vote_tally_tracker<vesting_balance_object> >( &_vote_tally );
    add_index< primary_index<worker_index> >();
    add_index< primary_index<balance_index> >();
    add_index< primary_index<blinded_balance_index> >();
@@ -205,13 +210,14 @@ void database::initialize_indexes()
    //Implementation object indexes
    add_index< primary_index<transaction_index                             > >();
 
-   auto bal_idx = add_index< primary_index<account_balance_index          > >();
+   auto bal_idx = add_index< hashed_primary_index<account_balance_index   > >();
    bal_idx->add_secondary_index<balances_by_account_index>();
 
    add_index< primary_index<asset_bitasset_data_index,                 13 > >(); // 8192
    add_index< primary_index<simple_index<global_property_object          >> >();
    add_index< primary_index<simple_index<dynamic_global_property_object  >> >();
-   add_index< primary_index<account_stats_index,                       20 > >(); // 1 Mi
+   auto stats_idx = add_index< primary_index<account_stats_index,      20 > >(); // 1 Mi
+   stats_idx->add_secondary_index<vote_tally_stats_tracker>( &_vote_tally );
    add_index< primary_index<simple_index<asset_dynamic_data_object       >> >();
    add_index< primary_index<simple_index<block_summary_object            >> >();
    add_index< primary_index<simple_index<chain_property_object          > > >();
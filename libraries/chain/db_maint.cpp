@@ -25,6 +25,7 @@
 #include <boost/multiprecision/integer.hpp>
 
 #include <fc/uint128.hpp>
+#include <fc/thread/parallel.hpp>
 
 #include <graphene/chain/database.hpp>
 #include <graphene/chain/fba_accumulator_id.hpp>
@@ -94,22 +95,58 @@ void database::perform_account_maintenance(Type tally_helper)
       }
    }
 
-   const auto& stats_idx = get_index_type< account_stats_index >().indices().get< by_maintenance_seq >();
-   auto stats_itr = stats_idx.lower_bound( true );
+   // The incremental tally is kept when it is enabled or verified, and replaces the full one only when it is
+   // enabled and not verified. It does not apply when membership matters, see vote_tally
+   const bool incremental = get_global_properties().parameters.count_non_member_votes
+                            && ( _incremental_vote_tally || _verify_vote_tally );
+   if( incremental )
+   {
+      _vote_tally.update( *this );
+      _vote_tally.begin_fees();
+   }
 
-   while( stats_itr != stats_idx.end() )
+   if( !incremental || _verify_vote_tally )
    {
-      const account_statistics_object& acc_stat = *stats_itr;
-      const account_object& acc_obj = acc_stat.owner( *this );
-      ++stats_itr;
+      const auto& stats_idx = get_index_type< account_stats_index >().indices().get< by_maintenance_seq >();
+      auto stats_itr = stats_idx.lower_bound( true );
+
+      while( stats_itr != stats_idx.end() )
+      {
+         const account_statistics_object& acc_stat = *stats_itr;
+         const account_object& acc_obj = acc_stat.owner( *this );
+         ++stats_itr;
 
-      if( acc_stat.has_some_core_voting() )
-         tally_helper( acc_obj, acc_stat );
+         if( acc_stat.has_some_core_voting() )
+            tally_helper( acc_obj, acc_stat );
 
-      if( acc_stat.has_pending_fees() )
-         acc_stat.process_fees( acc_obj, *this );
+         if( acc_stat.has_pending_fees() )
+         {
+            if( incremental )
+               _vote_tally.visit( *this, acc_stat.name );
+            acc_stat.process_fees( acc_obj, *this );
+         }
+      }
    }
+   else
+   {
+      // Same order as above, paying fees deposits cashback which counts for the accounts which come later
+      const auto& fees_idx = get_index_type< account_stats_index >().indices().get< by_pending_fees >();
+      auto fees_itr = fees_idx.lower_bound( true );
+
+      while( fees_itr != fees_idx.end() )
+      {
+         const account_statistics_object& acc_stat = *fees_itr;
+         ++fees_itr;
 
+         _vote_tally.visit( *this, acc_stat.name );
+         acc_stat.process_fees( acc_stat.owner( *this ), *this );
+      }
+   }
+
+   if( incremental )
+      _vote_tally.end_fees( *this );
+   else
+      _vote_tally.reset();
 }
 
 /// @brief A visitor for @ref worker_type which calls pay_worker on the worker within
@@ -197,7 +234,7 @@ void database::pay_workers( share_type& budget )
    }
 }
 
-void database::update_active_witnesses()
+vector<std::reference_wrapper<const witness_object>> database::select_active_witnesses()const
 { try {
    assert( _witness_count_histogram_buffer.size() > 0 );
    share_type stake_target = (_total_voting_stake-_witness_count_histogram_buffer[0]) / 2;
@@ -220,8 +257,11 @@ void database::update_active_witnesses()
    const chain_property_object& cpo = get_chain_properties();
 
    witness_count = std::max( witness_count*2+1, (size_t)cpo.immutable_parameters.min_witness_count );
-   auto wits = sort_votable_objects<witness_index>( witness_count );
+   return sort_votable_objects<witness_index>( witness_count );
+} FC_CAPTURE_AND_RETHROW() }
 
+void database::update_active_witnesses( const vector<std::reference_wrapper<const witness_object>>& wits )
+{ try {
    const global_property_object& gpo = get_global_properties();
 
    auto update_witness_total_votes = [this]( const witness_object& wit ) {
@@ -299,7 +339,7 @@ void database::update_active_witnesses()
 
 } FC_CAPTURE_AND_RETHROW() }
 
-void database::update_active_committee_members()
+vector<std::reference_wrapper<const committee_member_object>> database::select_active_committee_members()const
 { try {
    assert( _committee_count_histogram_buffer.size() > 0 );
    share_type stake_target = (_total_voting_stake-_committee_count_histogram_buffer[0]) / 2;
@@ -320,8 +360,12 @@ void database::update_active_committee_members()
    const chain_property_object& cpo = get_chain_properties();
 
    committee_member_count = std::max( committee_member_count*2+1, (size_t)cpo.immutable_parameters.min_committee_member_count );
-   auto committee_members = sort_votable_objects<committee_member_index>( committee_member_count );
+   return sort_votable_objects<committee_member_index>( committee_member_count );
+} FC_CAPTURE_AND_RETHROW() }
 
+void database::update_active_committee_members(
+      const vector<std::reference_wrapper<const committee_member_object>>& committee_members )
+{ try {
    auto update_committee_member_total_votes = [this]( const committee_member_object& cm ) {
       modify( cm, [this]( committee_member_object& obj )
       {
@@ -564,8 +608,18 @@ void visit_special_authorities( const database& db, Visitor visit )
    }
 }
 
-void update_top_n_authorities( database& db )
+/// A new authority of an account with a top holders special authority
+struct top_n_authority_update
 {
+   const account_object*  account = nullptr;
+   bool                   is_owner = false;
+   vote_counter           vc;
+};
+
+/// Only reads the database, the updates are applied by apply_top_n_authorities in the same order
+vector<top_n_authority_update> compute_top_n_authorities( const database& db )
+{
+   vector<top_n_authority_update> updates;
    visit_special_authorities( db,
    [&]( const account_object& acct, bool is_owner, const special_authority& auth )
    {
@@ -593,14 +647,29 @@ void update_top_n_authorities( database& db )
                 break;
          }
 
-         db.modify( acct, [&]( account_object& a )
-         {
-            vc.finish( is_owner ? a.owner : a.active );
-            if( !vc.is_empty() )
-               a.top_n_control_flags |= (is_owner ? account_object::top_n_control_owner : account_object::top_n_control_active);
-         } );
+         top_n_authority_update update;
+         update.account = &acct;
+         update.is_owner = is_owner;
+         update.vc = std::move( vc );
+         updates.push_back( std::move( update ) );
       }
    } );
+   return updates;
+}
+
+void apply_top_n_authorities( database& db, vector<top_n_authority_update>& updates )
+{
+   for( auto& update : updates )
+   {
+      const bool is_owner = update.is_owner;
+      vote_counter& vc = update.vc;
+      db.modify( *update.account, [is_owner,&vc]( account_object& a )
+      {
+         vc.finish( is_owner ? a.owner : a.active );
+         if( !vc.is_empty() )
+            a.top_n_control_flags |= (is_owner ? account_object::top_n_control_owner : account_object::top_n_control_active);
+      } );
+   }
 }
 
 void split_fba_balance(
@@ -1074,12 +1143,34 @@ void process_hf_935( database& db )
    }
 }
 
+namespace detail {
+
+   /// Waits until a parallel task is done, leaving its exception for a later wait()
+   template<typename T>
+   void wait_quietly( fc::future<T>& f )
+   {
+      try
+      {
+         f.wait();
+      }
+      catch( ... )
+      {
+      }
+   }
+
+} // detail
+
 void database::perform_chain_maintenance(const signed_block& next_block, const global_property_object& global_props)
 {
    const auto& gpo = get_global_properties();
+   _maintenance_timings.clear();
+   block_profiler::phase_timer timer( _profiler, block_profiler::phase_timer::maintenance_phase,
+                                      &_maintenance_timings );
 
    distribute_fba_balances(*this);
+   timer.phase_done( "fba" );
    create_buyback_orders(*this);
+   timer.phase_done( "buyback" );
 
    struct vote_tally_helper {
       database& d;
@@ -1148,6 +1239,29 @@ void database::perform_chain_maintenance(const signed_block& next_block, const g
 
    perform_account_maintenance( tally_helper );
 
+   if( gpo.parameters.count_non_member_votes && ( _incremental_vote_tally || _verify_vote_tally ) )
+   {
+      if( _verify_vote_tally )
+      {
+         vector<uint64_t> votes( _vote_tally_buffer.size() );
+         vector<uint64_t> witness_counts( _witness_count_histogram_buffer.size() );
+         vector<uint64_t> committee_counts( _committee_count_histogram_buffer.size() );
+         uint64_t total_stake = 0;
+         _vote_tally.fill( votes, witness_counts, committee_counts, total_stake, gpo.parameters );
+         if( votes != _vote_tally_buffer || witness_counts != _witness_count_histogram_buffer
+               || committee_counts != _committee_count_histogram_buffer || total_stake != _total_voting_stake )
+         {
+            elog( "Incremental vote tally differs from the full tally at block ${b}, using the full tally",
+                  ("b",next_block.block_num()) );
+            _vote_tally.record_mismatch();
+         }
+      }
+      else
+         _vote_tally.fill( _vote_tally_buffer, _witness_count_histogram_buffer, _committee_count_histogram_buffer,
+                           _total_voting_stake, gpo.parameters );
+   }
+   timer.phase_done( "vote tally" );
+
    struct clear_canary {
       clear_canary(vector<uint64_t>& target): target(target){}
       ~clear_canary() { target.clear(); }
@@ -1158,10 +1272,42 @@ void database::perform_chain_maintenance(const signed_block& next_block, const g
                 b(_committee_count_histogram_buffer),
                 c(_vote_tally_buffer);
 
-   update_top_n_authorities(*this);
-   update_active_witnesses();
-   update_active_committee_members();
+   // The elections only read the state and the tally, their results are applied below in the usual order
+   vector<std::reference_wrapper<const witness_object>> wits;
+   vector<std::reference_wrapper<const committee_member_object>> committee_members;
+   vector<top_n_authority_update> top_n_updates;
+   if( _parallel_elections )
+   {
+      auto witnesses_future = fc::do_parallel( [this]() { return select_active_witnesses(); } );
+      auto committee_future = fc::do_parallel( [this]() { return select_active_committee_members(); } );
+      try
+      {
+         top_n_updates = compute_top_n_authorities( *this );
+      }
+      catch( ... )
+      {
+         // the tasks must not read the state while it is undone
+         detail::wait_quietly( witnesses_future );
+         detail::wait_quietly( committee_future );
+         throw;
+      }
+      detail::wait_quietly( committee_future );
+      wits = witnesses_future.wait();
+      committee_members = committee_future.wait();
+   }
+   else
+   {
+      wits = select_active_witnesses();
+      committee_members = select_active_committee_members();
+      top_n_updates = compute_top_n_authorities( *this );
+   }
+   timer.phase_done( "elections" );
+
+   apply_top_n_authorities( *this, top_n_updates );
+   update_active_witnesses( wits );
+   update_active_committee_members( committee_members );
    update_worker_votes();
+   timer.phase_done( "apply elections" );
 
    const auto& dgpo = get_dynamic_global_properties();
    
@@ -1232,12 +1378,21 @@ void database::perform_chain_maintenance(const signed_block& next_block, const g
    // We need to do it after updated next_maintenance_time, to apply new rules here
    if( to_update_and_match_call_orders )
       update_and_match_call_orders(*this);
+   timer.phase_done( "parameters" );
 
    process_bitassets();
+   timer.phase_done( "bitassets" );
 
    // process_budget needs to run at the bottom because
    //   it needs to know the next_maintenance_time
    process_budget();
+   timer.phase_done( "budget" );
+
+   fc::mutable_variant_object phases;
+   for( const auto& phase : _maintenance_timings )
+      phases( phase.first, phase.second.count() );
+   dlog( "Chain maintenance at block ${b} took ${t} us: ${p}",
+         ("b",next_block.block_num())("t",timer.total().count())("p",phases) );
 }
 
 } }
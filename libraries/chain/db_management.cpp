@@ -31,12 +31,30 @@
 #include <graphene/chain/protocol/fee_schedule.hpp>
 
 #include <fc/io/fstream.hpp>
+#include <fc/thread/parallel.hpp>
 
+#include <algorithm>
+#include <deque>
 #include <fstream>
 #include <functional>
 #include <iostream>
-#include <queue>
-#include <tuple>
+#include <memory>
+
+namespace graphene { namespace chain { namespace detail {
+
+   /** Chain specific part of a snapshot, stored in front of the objects */
+   struct snapshot_header
+   {
+      chain_id_type          chain_id;
+      uint32_t               head_block_num = 0;
+      block_id_type          head_block_id;
+      /** From the last irreversible block up to the head block, in ascending order */
+      vector<signed_block>   recent_blocks;
+   };
+
+} } }
+
+FC_REFLECT( graphene::chain::detail::snapshot_header, (chain_id)(head_block_num)(head_block_id)(recent_blocks) )
 
 namespace graphene { namespace chain {
 
@@ -51,6 +69,21 @@ database::~database()
    clear_pending();
 }
 
+namespace {
+   /** A block travelling through the replay pipeline */
+   struct replay_item
+   {
+      explicit replay_item( uint32_t num ) : block_num( num ) {}
+
+      const uint32_t                block_num;
+      /** Position in the block log after this block, for progress reports */
+      size_t                        processed_block_size = 0;
+      fc::optional< signed_block >  block;
+      /** Resolves once the block has been read, deserialized and precomputed */
+      fc::future< void >            ready;
+   };
+}
+
 void database::reindex( fc::path data_dir )
 { try {
    auto last_block = _block_id_to_block.last();
@@ -78,27 +111,62 @@ void database::reindex( fc::path data_dir )
 
    uint32_t skip = node_properties().skip_flags;
 
-   size_t total_block_size = _block_id_to_block.total_block_size();
+   // The replay is a pipeline of two stages: worker threads read, deserialize and precompute up to
+   // pipeline_depth blocks ahead, while this thread applies them strictly in order.
+   const uint32_t pipeline_depth = std::max( 2u, _replay_pipeline_depth > 0 ? _replay_pipeline_depth
+                                             : 4 * uint32_t( fc::asio::default_io_service_scope::get_num_threads() ) );
+   ilog( "Replay pipeline depth: ${d} blocks", ("d",pipeline_depth) );
+
+   const size_t total_block_size = _block_id_to_block.total_block_size();
    const auto& gpo = get_global_properties();
-   std::queue< std::tuple< size_t, signed_block, fc::future< void > > > blocks;
+   // Only decides whether transaction ids are precomputed. The authoritative check is done when applying.
+   const fc::time_point_sec precompute_ids_after = last_block->timestamp - gpo.parameters.maximum_time_until_expiration;
+
+   std::deque< std::shared_ptr< replay_item > > blocks;
+   auto start_reading = [this,&blocks,skip,precompute_ids_after] ( uint32_t block_num ) {
+      auto item = std::make_shared< replay_item >( block_num );
+      item->ready = fc::do_parallel( [this,item,skip,precompute_ids_after] () {
+         item->block = _block_id_to_block.fetch_by_number( item->block_num, item->processed_block_size );
+         if( !item->block.valid() )
+            return;
+         uint32_t precompute_skip = skip;
+         if( item->block->timestamp >= precompute_ids_after )
+            precompute_skip &= ~skip_transaction_dupe_check;
+         precompute_block( *item->block, precompute_skip );
+      });
+      blocks.push_back( std::move( item ) );
+   };
+
+   // Stage metrics, reported with the progress line
+   fc::microseconds apply_waited; // time the apply stage was starved by the read/precompute stage
+   fc::microseconds apply_busy;   // time spent in apply_block / push_block
+   fc::time_point last_report = fc::time_point::now();
+   uint32_t last_report_block = head_block_num();
+
    uint32_t next_block_num = head_block_num() + 1;
-   uint32_t i = next_block_num;
-   while( next_block_num <= last_block_num || !blocks.empty() )
+   try
    {
-      if( next_block_num <= last_block_num && blocks.size() < 20 )
+      while( next_block_num <= last_block_num || !blocks.empty() )
       {
-         const size_t processed_block_size = _block_id_to_block.blocks_current_position();
-         fc::optional< signed_block > block = _block_id_to_block.fetch_by_number( next_block_num++ );
-         if( block.valid() )
-         {
-            if( block->timestamp >= last_block->timestamp - gpo.parameters.maximum_time_until_expiration )
-               skip &= ~skip_transaction_dupe_check;
-            blocks.emplace( processed_block_size, std::move(*block), fc::future<void>() );
-            std::get<2>(blocks.back()) = precompute_parallel( std::get<1>(blocks.back()), skip );
-         }
-         else
+         while( next_block_num <= last_block_num && blocks.size() < pipeline_depth )
+            start_reading( next_block_num++ );
+
+         const fc::time_point wait_start = fc::time_point::now();
+         blocks.front()->ready.wait();
+         const fc::time_point apply_start = fc::time_point::now();
+         apply_waited += apply_start - wait_start;
+
+         std::shared_ptr< replay_item > item = std::move( blocks.front() );
+         blocks.pop_front();
+         const uint32_t i = item->block_num;
+
+         if( !item->block.valid() )
          {
             wlog( "Reindexing terminated due to gap:  Block ${i} does not exist!", ("i", i) );
+            // Blocks after the gap are discarded, let the workers finish with them before touching the files
+            for( const auto& pending : blocks )
+               pending->ready.wait();
+            blocks.clear();
             uint32_t dropped_count = 0;
             while( true )
             {
@@ -113,27 +181,46 @@ void database::reindex( fc::path data_dir )
                dropped_count++;
             }
             wlog( "Dropped ${n} blocks from after the gap", ("n", dropped_count) );
-            next_block_num = last_block_num + 1; // don't load more blocks
+            break;
          }
-      }
-      else
-      {
-         std::get<2>(blocks.front()).wait();
-         const signed_block& block = std::get<1>(blocks.front());
+
+         const signed_block& block = *item->block;
+         if( block.timestamp >= last_block->timestamp - gpo.parameters.maximum_time_until_expiration )
+            skip &= ~skip_transaction_dupe_check;
 
          if( i % 10000 == 0 )
          {
+            size_t ready_count = 0;
+            for( const auto& pending : blocks )
+               if( pending->ready.ready() )
+                  ++ready_count;
+            const fc::time_point now = fc::time_point::now();
+            const double elapsed = double( std::max<int64_t>( (now - last_report).count(), 1 ) ) / 1000000.0;
             ilog(
                "   [by size: ${size}%   ${processed} of ${total}]   [by num: ${num}%   ${i} of ${last}]",
-               ("size", double(std::get<0>(blocks.front())) / total_block_size * 100)
-               ("processed", std::get<0>(blocks.front()))
+               ("size", double(item->processed_block_size) / total_block_size * 100)
+               ("processed", item->processed_block_size)
                ("total", total_block_size)
                ("num", double(i*100)/last_block_num)
                ("i", i)
                ("last", last_block_num)
             );
+            ilog(
+               "   [pipeline: ${bps} blocks/s   ${ready} of ${queued} queued blocks precomputed   "
+               "apply busy ${busy} ms, starved ${waited} ms]",
+               ("bps", uint64_t( (i - last_report_block) / elapsed ))
+               ("ready", ready_count)
+               ("queued", blocks.size())
+               ("busy", apply_busy.count() / 1000)
+               ("waited", apply_waited.count() / 1000)
+            );
+            last_report = now;
+            last_report_block = i;
+            apply_busy = fc::microseconds();
+            apply_waited = fc::microseconds();
          }
-         if( i == flush_point )
+         // With incremental flushing, checkpoints are cheap enough to make an interrupted replay resumable
+         if( i == flush_point || ( incremental_flush_enabled() && i < undo_point && i % 100000 == 0 ) )
          {
             ilog( "Writing database to disk at block ${i}", ("i",i) );
             flush();
@@ -146,10 +233,22 @@ void database::reindex( fc::path data_dir )
             _undo_db.enable();
             push_block( block, skip );
          }
-         blocks.pop();
-         i++;
+         apply_busy += fc::time_point::now() - apply_start;
       }
    }
+   catch( ... )
+   {
+      // the workers read the block files and the database, let them finish before these are closed
+      for( const auto& pending : blocks )
+      {
+         try {
+            pending->ready.wait();
+         } catch( ... ) {
+            // the block is not going to be applied
+         }
+      }
+      throw;
+   }
    _undo_db.enable();
    auto end = fc::time_point::now();
    ilog( "Done reindexing, elapsed time: ${t} sec", ("t",double((end-start).count())/1000000.0 ) );
@@ -166,6 +265,55 @@ void database::wipe(const fc::path& data_dir, bool include_blocks)
       fc::remove_all( data_dir / "database" );
 }
 
+void database::save_snapshot( const fc::path& file )const
+{ try {
+   write_snapshot( capture_snapshot(), file );
+} FC_CAPTURE_AND_RETHROW( (file) ) }
+
+std::shared_ptr<snapshot_capture> database::capture_snapshot()const
+{ try {
+   detail::snapshot_header header;
+   header.chain_id = get_chain_id();
+   header.head_block_num = head_block_num();
+   header.head_block_id = head_block_id();
+
+   // Walk back along the current chain, which is not necessarily the only one in the fork database
+   const uint32_t last_irreversible = get_dynamic_global_properties().last_irreversible_block_num;
+   block_id_type next_id = header.head_block_id;
+   while( block_header::num_from_id( next_id ) > 0 && block_header::num_from_id( next_id ) >= last_irreversible )
+   {
+      optional<signed_block> block = fetch_block_by_id( next_id );
+      if( !block.valid() )
+         break;
+      next_id = block->previous;
+      header.recent_blocks.push_back( std::move( *block ) );
+   }
+   FC_ASSERT( header.head_block_num == 0 || !header.recent_blocks.empty(), "Head block not found" );
+   std::reverse( header.recent_blocks.begin(), header.recent_blocks.end() );
+
+   return object_database::capture_snapshot( fc::raw::pack( header ) );
+} FC_CAPTURE_AND_RETHROW() }
+
+void database::load_snapshot( const fc::path& file, const chain_id_type& expected_chain_id )
+{ try {
+   FC_ASSERT( !_opened, "Snapshots can only be loaded before opening the database" );
+   ilog( "Loading snapshot ${f} ...", ("f",file) );
+   const auto start = fc::time_point::now();
+   const auto header = fc::raw::unpack<detail::snapshot_header>( object_database::load_snapshot( file ) );
+   FC_ASSERT( header.chain_id == expected_chain_id, "Snapshot is for chain ${c}, expected ${e}",
+              ("c",header.chain_id)("e",expected_chain_id) );
+   // The cached object pointers are only set up by open()
+   FC_ASSERT( find( global_property_id_type() ) != nullptr
+              && get( chain_property_id_type() ).chain_id == header.chain_id
+              && get( dynamic_global_property_id_type() ).head_block_id == header.head_block_id,
+              "Snapshot content does not match its header" );
+   _snapshot_blocks = header.recent_blocks;
+   _snapshot_loaded = true;
+   ilog( "Loaded snapshot at block ${n} ${id} in ${t} sec",
+         ("n",header.head_block_num)("id",header.head_block_id)
+         ("t",double((fc::time_point::now()-start).count())/1000000.0) );
+} FC_CAPTURE_AND_RETHROW( (file) ) }
+
 void database::open(
    const fc::path& data_dir,
    std::function<genesis_state_type()> genesis_loader,
@@ -191,9 +339,13 @@ void database::open(
           version_file.close();
       }
 
+      _vote_tally.reset();
       object_database::open(data_dir);
 
       _block_id_to_block.open(data_dir / "database" / "block_num_to_block");
+      for( const auto& block : _snapshot_blocks )
+         _block_id_to_block.store( block.id(), block );
+      _snapshot_blocks.clear();
 
       if( !find(global_property_id_type()) )
          init_genesis(genesis_loader());
@@ -215,6 +367,13 @@ void database::open(
                     ("last_block->id", last_block)("head_block_id",head_block_num()) );
          reindex( data_dir );
       }
+      if( _snapshot_loaded )
+      {
+         // Until it is written, the state of the snapshot lives in memory only. After a crash the next start
+         // would begin from genesis, hit the gap in the block database and drop the blocks of the snapshot
+         flush();
+         _snapshot_loaded = false;
+      }
       _opened = true;
    }
    FC_CAPTURE_LOG_AND_RETHROW( (data_dir) )
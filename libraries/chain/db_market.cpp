@@ -382,19 +382,13 @@ bool database::apply_order(const limit_order_object& new_order_object, bool allo
    asset_id_type recv_asset_id = new_order_object.receive_asset_id();
 
    // We only need to check if the new order will match with others if it is at the front of the book
-   const auto& limit_price_idx = get_index_type<limit_order_index>().indices().get<by_price>();
-   auto limit_itr = limit_price_idx.lower_bound( boost::make_tuple( new_order_object.sell_price, order_id ) );
-   if( limit_itr != limit_price_idx.begin() )
-   {
-      --limit_itr;
-      if( limit_itr->sell_asset_id() == sell_asset_id && limit_itr->receive_asset_id() == recv_asset_id )
-         return false;
-   }
+   const limit_order_book& limit_book = get_limit_order_book();
+   if( limit_book.best( sell_asset_id, recv_asset_id ) != &new_order_object )
+      return false;
 
-   // this is the opposite side (on the book)
-   auto max_price = ~new_order_object.sell_price;
-   limit_itr = limit_price_idx.lower_bound( max_price.max() );
-   auto limit_end = limit_price_idx.upper_bound( max_price );
+   // this is the opposite side (on the book), matching orders sell at least at max_price
+   const order_book_price max_price( ~new_order_object.sell_price );
+   const limit_order_book::price_level* maker_level = limit_book.best_level( recv_asset_id, sell_asset_id );
 
    // Order matching should be in favor of the taker.
    // When a new limit order is created, e.g. an ask, need to check if it will match the highest bid.
@@ -430,7 +424,7 @@ bool database::apply_order(const limit_order_object& new_order_object, bool allo
    bool to_check_call_orders = false;
    const asset_object& sell_asset = sell_asset_id( *this );
    const asset_bitasset_data_object* sell_abd = nullptr;
-   price call_match_price;
+   order_book_price call_match_price;
    if( sell_asset.is_market_issued() )
    {
       sell_abd = &sell_asset.bitasset_data( *this );
@@ -439,8 +433,8 @@ bool database::apply_order(const limit_order_object& new_order_object, bool allo
           && !sell_abd->has_settlement()
           && !sell_abd->current_feed.settlement_price.is_null() )
       {
-         call_match_price = ~sell_abd->current_feed.max_short_squeeze_price();
-         if( ~new_order_object.sell_price <= call_match_price ) // new limit order price is good enough to match a call
+         call_match_price = order_book_price( ~sell_abd->current_feed.max_short_squeeze_price() );
+         if( !( call_match_price < max_price ) ) // new limit order price is good enough to match a call
             to_check_call_orders = true;
       }
    }
@@ -449,30 +443,31 @@ bool database::apply_order(const limit_order_object& new_order_object, bool allo
    if( to_check_call_orders )
    {
       // check limit orders first, match the ones with better price in comparison to call orders
-      while( !finished && limit_itr != limit_end && limit_itr->sell_price > call_match_price )
+      while( !finished && maker_level != nullptr && !( maker_level->price < max_price )
+             && call_match_price < maker_level->price )
       {
-         auto old_limit_itr = limit_itr;
-         ++limit_itr;
+         const limit_order_object& maker = *maker_level->orders.front();
          // match returns 2 when only the old order was fully filled. In this case, we keep matching; otherwise, we stop.
-         finished = ( match( new_order_object, *old_limit_itr, old_limit_itr->sell_price ) != 2 );
+         finished = ( match( new_order_object, maker, maker.sell_price ) != 2 );
+         maker_level = limit_book.best_level( recv_asset_id, sell_asset_id );
       }
 
       if( !finished )
       {
          // check if there are margin calls
-         const auto& call_price_idx = get_index_type<call_order_index>().indices().get<by_price>();
-         auto call_min = price::min( recv_asset_id, sell_asset_id );
+         const call_order_book& call_book = get_call_order_book();
+         const price call_limit = ~sell_abd->current_feed.settlement_price;
          while( !finished )
          {
             // assume hard fork core-343 and core-625 will take place at same time, always check call order with least call_price
-            auto call_itr = call_price_idx.lower_bound( call_min );
-            if( call_itr == call_price_idx.end()
-                  || call_itr->debt_type() != sell_asset_id
+            // the backing asset can only change without debt, so all calls with this debt are in this market
+            const call_order_object* call = call_book.best( recv_asset_id, sell_asset_id );
+            if( call == nullptr
                   // feed protected https://github.com/cryptonomex/graphene/issues/436
-                  || call_itr->call_price > ~sell_abd->current_feed.settlement_price )
+                  || call->call_price > call_limit )
                break;
             // assume hard fork core-338 and core-625 will take place at same time, not checking HARDFORK_CORE_338_TIME here.
-            int match_result = match( new_order_object, *call_itr, call_match_price,
+            int match_result = match( new_order_object, *call, call_match_price.value,
                                       sell_abd->current_feed.settlement_price,
                                       sell_abd->current_feed.maintenance_collateral_ratio );
             // match returns 1 or 3 when the new order was fully filled. In this case, we stop matching; otherwise keep matching.
@@ -484,12 +479,12 @@ bool database::apply_order(const limit_order_object& new_order_object, bool allo
    }
 
    // still need to check limit orders
-   while( !finished && limit_itr != limit_end )
+   while( !finished && maker_level != nullptr && !( maker_level->price < max_price ) )
    {
-      auto old_limit_itr = limit_itr;
-      ++limit_itr;
+      const limit_order_object& maker = *maker_level->orders.front();
       // match returns 2 when only the old order was fully filled. In this case, we keep matching; otherwise, we stop.
-      finished = ( match( new_order_object, *old_limit_itr, old_limit_itr->sell_price ) != 2 );
+      finished = ( match( new_order_object, maker, maker.sell_price ) != 2 );
+      maker_level = limit_book.best_level( recv_asset_id, sell_asset_id );
    }
 
    const limit_order_object* updated_order_object = find< limit_order_object >( order_id );
@@ -931,22 +926,24 @@ bool database::check_call_orders( const asset_object& mia, bool enable_black_swa
     if( bitasset.is_prediction_market ) return false;
     if( bitasset.current_feed.settlement_price.is_null() ) return false;
 
-    const limit_order_index& limit_index = get_index_type<limit_order_index>();
-    const auto& limit_price_index = limit_index.indices().get<by_price>();
-
     // looking for limit orders selling the most USD for the least CORE
     auto max_price = price::max( mia.id, bitasset.options.short_backing_asset );
     // stop when limit orders are selling too little USD for too much CORE
     auto min_price = bitasset.current_feed.max_short_squeeze_price();
 
     assert( max_price.base.asset_id == min_price.base.asset_id );
+    // most of the time nothing can be called, which the order book tells without searching the by_price index
+    const auto* best_level = get_limit_order_book().best_level( mia.id, bitasset.options.short_backing_asset );
+    if( best_level == nullptr || best_level->price < order_book_price( min_price ) )
+       return false;
+
+    const limit_order_index& limit_index = get_index_type<limit_order_index>();
+    const auto& limit_price_index = limit_index.indices().get<by_price>();
+
     // NOTE limit_price_index is sorted from greatest to least
     auto limit_itr = limit_price_index.lower_bound( max_price );
     auto limit_end = limit_price_index.upper_bound( min_price );
 
-    if( limit_itr == limit_end )
-       return false;
-
     const call_order_index& call_index = get_index_type<call_order_index>();
     const auto& call_price_index = call_index.indices().get<by_price>();
 
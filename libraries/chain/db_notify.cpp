@@ -454,7 +454,7 @@ void database::notify_changed_objects()
         for( const auto& item : head_undo.old_values )
         {
           changed_ids.push_back(item.first);
-          get_relevant_accounts(item.second.get(), changed_accounts_impacted);
+          get_relevant_accounts(item.second, changed_accounts_impacted);
         }
 
         if( changed_ids.size() )
@@ -470,7 +470,7 @@ void database::notify_changed_objects()
         for( const auto& item : head_undo.removed )
         {
           removed_ids.emplace_back( item.first );
-          auto obj = item.second.get();
+          auto obj = item.second;
           removed.emplace_back( obj );
           get_relevant_accounts(obj, removed_accounts_impacted);
         }
@@ -44,9 +44,39 @@ database& generic_evaluator::db()const { return trx_state->db(); }
    { try {
       trx_state   = &eval_state;
       //check_required_authorities(op);
+      block_profiler& profiler = db().get_profiler();
+      if( !profiler.recording_operations() )
+      {
+         auto result = evaluate( op );
+
+         if( apply ) result = this->apply( op );
+         return result;
+      }
+
+      fc::time_point start = fc::time_point::now();
       auto result = evaluate( op );
+      fc::time_point end = fc::time_point::now();
+      profiler.record_evaluate( op.which(), end - start );
+
+      if( apply )
+      {
+         start = end;
+         result = this->apply( op );
+         profiler.record_apply( op.which(), fc::time_point::now() - start );
+      }
+      return result;
+   } FC_CAPTURE_AND_RETHROW() }
+
+   operation_result generic_evaluator::resume_apply( transaction_evaluation_state& eval_state, const operation& op )
+   { try {
+      trx_state   = &eval_state;
+      block_profiler& profiler = db().get_profiler();
+      if( !profiler.recording_operations() )
+         return this->apply( op );
 
-      if( apply ) result = this->apply( op );
+      const fc::time_point start = fc::time_point::now();
+      auto result = this->apply( op );
+      profiler.record_apply( op.which(), fc::time_point::now() - start );
       return result;
    } FC_CAPTURE_AND_RETHROW() }
 
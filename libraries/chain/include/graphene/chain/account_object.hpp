@@ -383,7 +383,8 @@ namespace graphene { namespace chain {
                std::less< account_id_type >
             >
          >
-      >
+      >,
+      pool_allocator< account_balance_object >
    > account_balance_object_multi_index_type;
 
    /**
@@ -411,6 +412,7 @@ namespace graphene { namespace chain {
 
    struct by_owner;
    struct by_maintenance_seq;
+   struct by_pending_fees;
 
    /**
     * @ingroup object_index
@@ -427,6 +429,13 @@ namespace graphene { namespace chain {
                const_mem_fun<account_statistics_object, bool, &account_statistics_object::need_maintenance>,
                member<account_statistics_object, string, &account_statistics_object::name>
             >
+         >,
+         ordered_unique< tag<by_pending_fees>,
+            composite_key<
+               account_statistics_object,
+               const_mem_fun<account_statistics_object, bool, &account_statistics_object::has_pending_fees>,
+               member<account_statistics_object, string, &account_statistics_object::name>
+            >
          >
       >
    > account_stats_multi_index_type;
@@ -22,12 +22,28 @@
  * THE SOFTWARE.
  */
 #pragma once
+#include <atomic>
 #include <fstream>
+#include <memory>
+#include <mutex>
 #include <graphene/chain/protocol/block.hpp>
 
 namespace graphene { namespace chain {
    struct index_entry;
 
+   /**
+    * Stores blocks in an append-only log ("blocks") plus a fixed-size index
+    * ("index") addressed by block number.
+    *
+    * Writes (store/remove) go through file streams and must come from a single
+    * thread.  Reads are served from read-only memory mappings of both files and
+    * do not touch any shared cursor, so the const methods may be called from
+    * any number of threads concurrently with each other and with the writer.
+    *
+    * Index entries are rewritten in place when a fork replaces a block or a block
+    * is removed.  Such writes are bracketed by a sequence word which readers check
+    * around their copy of the entry, so a reader never sees a half-written entry.
+    */
    class block_database 
    {
       public:
@@ -43,14 +59,51 @@ namespace graphene { namespace chain {
          block_id_type          fetch_block_id( uint32_t block_num )const;
          optional<signed_block> fetch_optional( const block_id_type& id )const;
          optional<signed_block> fetch_by_number( uint32_t block_num )const;
+         /** Like fetch_by_number(), also reports the position in the block log right after the block,
+          *  taken from the same index entry the block was read through */
+         optional<signed_block> fetch_by_number( uint32_t block_num, size_t& end_position )const;
          optional<signed_block> last()const;
          optional<block_id_type> last_id()const;
+         /**
+          * Position in the block log right after the block most recently read by any thread.
+          * With several concurrent readers this is whichever read finished last, so it is
+          * only meaningful as a rough progress indicator; callers which need the position of
+          * a particular block should take it from that block's own index entry.
+          */
          size_t                 blocks_current_position()const;
          size_t                 total_block_size()const;
       private:
+         class mapped_file;
+
+         /** A file which is written through a stream and read through a memory mapping */
+         struct mapped_log
+         {
+            fc::path                                   filename;
+            /** Number of bytes visible to readers, updated by the writer after each flush */
+            std::atomic<uint64_t>                      size{0};
+            /** Current mapping, replaced (never modified) when the file has grown past it */
+            std::shared_ptr<const mapped_file>         mapping;
+            std::mutex                                 remap_mutex;
+         };
+
+         /** Returns a mapping covering at least the first @ref required_size bytes of the log,
+          *  or an empty pointer if the log is not that large. */
+         std::shared_ptr<const mapped_file> map_for_read( mapped_log& log, uint64_t required_size )const;
+         /** Flushes the write stream of the log and publishes its new size to readers */
+         void publish_size( mapped_log& log, std::fstream& stream, uint64_t new_size );
+         optional<index_entry> read_index_entry( uint32_t block_num )const;
+         /** Writes an index entry, publishing it to readers atomically */
+         void write_index_entry( uint32_t block_num, const index_entry& e );
+         optional<signed_block> read_block( const index_entry& e )const;
+
          optional<index_entry> last_index_entry()const;
-         fc::path _index_filename;
-         mutable std::fstream _blocks;
-         mutable std::fstream _block_num_to_pos;
+         std::fstream _blocks;
+         std::fstream _block_num_to_pos;
+         mutable mapped_log _blocks_log;
+         mutable mapped_log _index_log;
+         /** Odd while the writer is modifying the index, bumped again once the change is visible */
+         std::atomic<uint64_t> _index_sequence{0};
+         /** Position in the block log right after the most recently read block, used for progress reports */
+         mutable std::atomic<uint64_t> _last_read_position{0};
    };
 } }
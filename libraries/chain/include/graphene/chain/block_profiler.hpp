@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+
+#include <graphene/chain/protocol/block.hpp>
+
+#include <fc/filesystem.hpp>
+#include <fc/time.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+
+namespace graphene { namespace chain {
+
+   /** The accumulated wall time of a profiled section */
+   struct profile_entry
+   {
+      uint64_t count = 0;
+      uint64_t total_us = 0;
+      uint64_t max_us = 0;
+
+      void add( const fc::microseconds& duration )
+      {
+         const uint64_t us = duration.count() > 0 ? uint64_t( duration.count() ) : 0;
+         ++count;
+         total_us += us;
+         max_us = std::max( max_us, us );
+      }
+   };
+
+   /** The evaluator phases of an operation type, evaluated while applying a block */
+   struct operation_profile
+   {
+      string         name;
+      profile_entry  evaluate; ///< do_evaluate including the fee checks
+      profile_entry  apply;    ///< do_apply including paying the fee
+   };
+
+   struct block_profile
+   {
+      bool                             enabled = false;
+      /// The number of blocks applied while profiling
+      uint64_t                         blocks = 0;
+      uint32_t                         first_block = 0;
+      uint32_t                         last_block = 0;
+      /// The steps of database::_apply_block, by name
+      std::map<string, profile_entry>  block_phases;
+      /// The steps of database::perform_chain_maintenance, by name
+      std::map<string, profile_entry>  maintenance_phases;
+      /// The operation types which have been evaluated while applying blocks, by operation tag
+      std::map<int, operation_profile> operations;
+      /// The handlers of the applied_block signal which have been wrapped by block_profiler::profile_applied_block
+      std::map<string, profile_entry>  applied_block_slots;
+   };
+
+   /**
+    * @brief Accumulates the wall time spent in the steps of applying blocks
+    *
+    * Profiling is switched off by default, then the hooks cost a load of a flag and no clock reads. The profile is
+    * kept until reset(). Operations are only recorded while a block is applied, not when transactions are pushed or
+    * blocks are generated. They are also evaluated by the threads speculating transactions, so recording is safe
+    * from several threads.
+    */
+   class block_profiler
+   {
+      public:
+         void enable( bool enabled ) { _enabled = enabled; }
+         bool enabled()const { return _enabled; }
+
+         /** Forgets everything recorded so far */
+         void reset();
+
+         /** Whether the evaluations of operations are being recorded */
+         bool recording_operations()const { return _enabled && _applying_block; }
+
+         /** Marks the application of a block, operations are recorded within it */
+         class applying_block
+         {
+            public:
+               explicit applying_block( block_profiler& profiler ) : _profiler( profiler )
+               {
+                  _profiler._applying_block = true;
+               }
+               ~applying_block() { _profiler._applying_block = false; }
+
+            private:
+               block_profiler& _profiler;
+         };
+
+         /**
+          * Times consecutive steps, each step takes the time since the previous one ended, rounded up to whole
+          * microseconds. The steps are added to the given list if there is one, and to the profile if profiling
+          * is enabled.
+          */
+         class phase_timer
+         {
+            public:
+               enum phase_kind { block_phase, maintenance_phase };
+
+               phase_timer( block_profiler& profiler, phase_kind kind,
+                            vector< std::pair<string, fc::microseconds> >* timings = nullptr )
+                  : _profiler( profiler ), _kind( kind ), _timings( timings ),
+                    _enabled( profiler.enabled() ), _timed( _enabled || timings != nullptr )
+               {
+                  if( _timed )
+                     _start = _last = std::chrono::steady_clock::now();
+               }
+
+               void phase_done( const char* name )
+               {
+                  if( !_timed )
+                     return;
+                  const auto now = std::chrono::steady_clock::now();
+                  const fc::microseconds duration = to_microseconds( now - _last );
+                  _last = now;
+                  if( _timings != nullptr )
+                     _timings->emplace_back( name, duration );
+                  if( !_enabled )
+                     return;
+                  if( _kind == block_phase )
+                     _profiler.record_block_phase( name, duration );
+                  else
+                     _profiler.record_maintenance_phase( name, duration );
+               }
+
+               /** The time from the start to the end of the last step */
+               fc::microseconds total()const { return to_microseconds( _last - _start ); }
+
+            private:
+               static fc::microseconds to_microseconds( std::chrono::steady_clock::duration d )
+               {
+                  const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>( d ).count();
+                  return fc::microseconds( ( ns + 999 ) / 1000 );
+               }
+
+               block_profiler&                                  _profiler;
+               const phase_kind                                 _kind;
+               vector< std::pair<string, fc::microseconds> >*   _timings;
+               const bool                                       _enabled;
+               const bool                                       _timed;
+               std::chrono::steady_clock::time_point            _start;
+               std::chrono::steady_clock::time_point            _last;
+         };
+
+         void record_block( uint32_t block_num );
+         void record_block_phase( const char* name, const fc::microseconds& duration );
+         void record_maintenance_phase( const char* name, const fc::microseconds& duration );
+         void record_evaluate( int operation_tag, const fc::microseconds& duration );
+         void record_apply( int operation_tag, const fc::microseconds& duration );
+         void record_applied_block_slot( const string& slot, const fc::microseconds& duration );
+
+         /**
+          * Wraps a handler of database::applied_block so that its calls are recorded under the given name,
+          * usually the name of the plugin connecting it
+          */
+         std::function<void(const signed_block&)> profile_applied_block(
+               const string& slot, const std::function<void(const signed_block&)>& handler );
+
+         block_profile get_profile()const;
+
+         /** Writes get_profile() as JSON to the file */
+         void dump( const fc::path& file )const;
+
+      private:
+         operation_profile& operation_entry( int operation_tag );
+
+         std::atomic<bool>      _enabled{false};
+         std::atomic<bool>      _applying_block{false};
+         mutable std::mutex     _mutex;
+         block_profile          _profile;
+   };
+
+} } // graphene::chain
+
+FC_REFLECT( graphene::chain::profile_entry, (count)(total_us)(max_us) )
+FC_REFLECT( graphene::chain::operation_profile, (name)(evaluate)(apply) )
+FC_REFLECT( graphene::chain::block_profile,
+            (enabled)(blocks)(first_block)(last_block)(block_phases)(maintenance_phases)(operations)
+            (applied_block_slots) )
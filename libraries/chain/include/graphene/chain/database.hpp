@@ -26,9 +26,13 @@
 #include <graphene/chain/node_property_object.hpp>
 #include <graphene/chain/account_object.hpp>
 #include <graphene/chain/asset_object.hpp>
+#include <graphene/chain/market_object.hpp>
 #include <graphene/chain/fork_database.hpp>
 #include <graphene/chain/block_database.hpp>
 #include <graphene/chain/genesis_state.hpp>
+#include <graphene/chain/signature_key_cache.hpp>
+#include <graphene/chain/vote_tally.hpp>
+#include <graphene/chain/block_profiler.hpp>
 #include <graphene/chain/evaluator.hpp>
 
 #include <graphene/db/object_database.hpp>
@@ -47,6 +51,8 @@ namespace graphene { namespace chain {
    class transaction_evaluation_state;
 
    struct budget_record;
+   class witness_object;
+   class committee_member_object;
 
    /**
     *   @class database
@@ -109,6 +115,32 @@ namespace graphene { namespace chain {
          void wipe(const fc::path& data_dir, bool include_blocks);
          void close(bool rewind = true);
 
+         /**
+          * @brief Write the current state into a binary snapshot file
+          *
+          * The snapshot contains all objects of all indexes, see @ref object_database::save_snapshot, plus the
+          * blocks from the last irreversible block up to the head block, so that a node started from it can link
+          * new blocks and answer sync requests.
+          */
+         void save_snapshot( const fc::path& file )const;
+         /**
+          * @brief Copy the current state for a snapshot written later, possibly on another thread
+          *
+          * Only the copy has to be made while the database is not being modified, pass the result to
+          * @ref object_database::write_snapshot to produce the same file as @ref save_snapshot.
+          */
+         std::shared_ptr<snapshot_capture> capture_snapshot()const;
+
+         /**
+          * @brief Load the state from a snapshot written by @ref save_snapshot
+          *
+          * Must be called on a wiped database before @ref open. The blocks contained in the snapshot are written
+          * to the block database by @ref open, which then continues from the head block of the snapshot.
+          *
+          * @param expected_chain_id the chain ID of the genesis state the node is configured for
+          */
+         void load_snapshot( const fc::path& file, const chain_id_type& expected_chain_id );
+
          //////////////////// db_block.cpp ////////////////////
 
          /**
@@ -256,6 +288,8 @@ namespace graphene { namespace chain {
          const fee_schedule&                    current_fee_schedule()const;
          const account_statistics_object&       get_account_stats_by_owner( account_id_type owner )const;
          const witness_schedule_object&         get_witness_schedule_object()const;
+         const limit_order_book&                get_limit_order_book()const;
+         const call_order_book&                 get_call_order_book()const;
 
          time_point_sec   head_block_time()const;
          uint32_t         head_block_num()const;
@@ -414,6 +448,37 @@ namespace graphene { namespace chain {
          /// Enable or disable tracking of votes of standby witnesses and committee members
          inline void enable_standby_votes_tracking(bool enable)  { _track_standby_votes = enable; }
 
+         /// Set the maximum number of blocks being read and precomputed ahead of the block being applied during replay.
+         /// 0 means four blocks per worker thread.
+         inline void set_replay_pipeline_depth( uint32_t depth ) { _replay_pipeline_depth = depth; }
+
+         /// Set the number of transactions whose recovered signature keys are remembered, 0 disables the cache.
+         inline void set_signature_cache_size( size_t size ) { _signature_cache.set_capacity( size ); }
+
+         /// Enable or disable evaluating the independent transactions of a block in parallel, see
+         /// speculate_block_transactions
+         inline void enable_parallel_tx_execution( bool enable ) { _parallel_tx_execution = enable; }
+
+         /// Enable or disable using the incremental vote tally instead of a full tally at maintenance
+         inline void enable_incremental_vote_tally( bool enable ) { _incremental_vote_tally = enable; }
+
+         /// Enable or disable checking the incremental vote tally against a full tally at each maintenance interval
+         inline void enable_vote_tally_verification( bool enable ) { _verify_vote_tally = enable; }
+
+         const vote_tally& get_vote_tally()const { return _vote_tally; }
+
+         /// Enable or disable selecting the active witnesses and committee members in parallel at maintenance
+         inline void enable_parallel_elections( bool enable ) { _parallel_elections = enable; }
+
+         /// The phases of the last chain maintenance and how long they took, in the order they ran
+         const vector< std::pair<string, fc::microseconds> >& get_maintenance_timings()const
+         { return _maintenance_timings; }
+
+         /// Records where the time goes while applying blocks when enabled, plugins wrap their applied_block
+         /// handlers with block_profiler::profile_applied_block
+         block_profiler& get_profiler() { return _profiler; }
+         const block_profiler& get_profiler()const { return _profiler; }
+
          /** Precomputes digests, signatures and operation validations depending
           *  on skip flags. "Expensive" computations may be done in a parallel
           *  thread.
@@ -437,6 +502,21 @@ namespace graphene { namespace chain {
          template<typename Trx>
          void _precompute_parallel( const Trx* trx, const size_t count, const uint32_t skip )const;
 
+         /** Does the same precomputations as precompute_parallel, but entirely on the calling thread.
+          *  Used by the replay pipeline, which gets its parallelism from working on many blocks at once.
+          */
+         void precompute_block( const signed_block& block, const uint32_t skip )const;
+
+         /** Verifies the authorities of all transactions of a block in parallel against the current state, see
+          *  _preverified_authorities.
+          */
+         void verify_block_authorities( const signed_block& block );
+
+         /** Evaluates the transactions of a block in parallel against the current state, as far as no transaction
+          *  before them in the block can change what their evaluation reads, see _speculative_evaluations.
+          */
+         void speculate_block_transactions( const signed_block& block );
+
    protected:
          //Mark pop_undo() as protected -- we do not want outside calling pop_undo(); it should call pop_block() instead
          void pop_undo() { object_database::pop_undo(); }
@@ -462,6 +542,8 @@ namespace graphene { namespace chain {
       private:
          void                  _apply_block( const signed_block& next_block );
          processed_transaction _apply_transaction( const signed_transaction& trx );
+         operation_result      apply_speculated_operation( transaction_evaluation_state& eval_state, const operation& op,
+                                                           generic_evaluator& eval );
          void                  _cancel_bids_and_revive_mpa( const asset_object& bitasset, const asset_bitasset_data_object& bad );
 
          ///Steps involved in applying a new block
@@ -498,8 +580,12 @@ namespace graphene { namespace chain {
          void process_budget();
          void pay_workers( share_type& budget );
          void perform_chain_maintenance(const signed_block& next_block, const global_property_object& global_props);
-         void update_active_witnesses();
-         void update_active_committee_members();
+         /// Only read the state and the vote tally buffers, so they can run in parallel
+         vector<std::reference_wrapper<const witness_object>> select_active_witnesses()const;
+         vector<std::reference_wrapper<const committee_member_object>> select_active_committee_members()const;
+         void update_active_witnesses( const vector<std::reference_wrapper<const witness_object>>& wits );
+         void update_active_committee_members(
+               const vector<std::reference_wrapper<const committee_member_object>>& committee_members );
          void update_worker_votes();
          void process_bids( const asset_bitasset_data_object& bad );
          void process_bitassets();
@@ -541,6 +627,19 @@ namespace graphene { namespace chain {
          vector<uint64_t>                  _committee_count_histogram_buffer;
          uint64_t                          _total_voting_stake;
 
+         /// The votes as of the last maintenance interval, updated with the accounts which have changed since then
+         vote_tally                        _vote_tally;
+         /// Whether the incremental tally replaces the full one, off until it has been checked against a replay
+         bool                              _incremental_vote_tally = false;
+         /// Whether to also do the full tally at each maintenance interval and compare the results
+         bool                              _verify_vote_tally = false;
+         /// Whether the witness and committee elections run in parallel with each other at maintenance
+         bool                              _parallel_elections = true;
+
+         vector< std::pair<string, fc::microseconds> > _maintenance_timings;
+
+         block_profiler                    _profiler;
+
          flat_map<uint32_t,block_id_type>  _checkpoints;
 
          node_property_object              _node_property_object;
@@ -549,6 +648,35 @@ namespace graphene { namespace chain {
          /// Set it to true to provide accurate data to API clients, set to false to have better performance.
          bool                              _track_standby_votes = true;
 
+         /// Blocks from a loaded snapshot, stored in the block database when it is opened
+         vector<signed_block>              _snapshot_blocks;
+         /// Whether the object database has been loaded from a snapshot, it is written to disk by @ref open
+         bool                              _snapshot_loaded = false;
+
+         /// Number of blocks read and precomputed ahead of the block being applied during replay, 0 for automatic
+         uint32_t                          _replay_pipeline_depth = 0;
+
+         /// Keys recovered from the signatures of recent transactions, shared by p2p, API and block processing
+         mutable signature_key_cache       _signature_cache;
+
+         /**
+          * While applying a block, for each of its transactions the accounts whose authorities were used to
+          * successfully verify it in verify_block_authorities, or nothing if the verification failed. A transaction
+          * has to be verified again if one of the accounts has changed since _preverified_position.
+          */
+         vector< optional< flat_set<account_id_type> > > _preverified_authorities;
+         uint64_t                                        _preverified_position = 0;
+
+         /// Whether speculate_block_transactions is used while applying blocks
+         bool                                            _parallel_tx_execution = false;
+
+         /**
+          * While applying a block, for each of its transactions the evaluator of its only operation if the operation
+          * was successfully evaluated in speculate_block_transactions. Applying it gives the same result as
+          * evaluating the operation again, because the transactions before it do not write anything it has read.
+          */
+         vector< unique_ptr<generic_evaluator> >         _speculative_evaluations;
+
          /**
           * Whether database is successfully opened or not.
           *
@@ -573,6 +701,12 @@ namespace graphene { namespace chain {
          const chain_property_object*           _p_chain_property_obj      = nullptr;
          const witness_schedule_object*         _p_witness_schedule_obj    = nullptr;
          ///@}
+
+         /// Secondary indexes of the order indexes, created with them
+         ///@{
+         const limit_order_book*                _p_limit_order_book        = nullptr;
+         const call_order_book*                 _p_call_order_book         = nullptr;
+         ///@}
    };
 
    namespace detail
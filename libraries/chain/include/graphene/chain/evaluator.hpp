@@ -41,6 +41,12 @@ namespace graphene { namespace chain {
       virtual int get_type()const = 0;
       virtual operation_result start_evaluate(transaction_evaluation_state& eval_state, const operation& op, bool apply);
 
+      /**
+       * Applies an operation which has been evaluated by start_evaluate() without applying it, in the context of
+       * eval_state. The caller has to make sure that nothing read by the evaluation has changed in between.
+       */
+      operation_result resume_apply(transaction_evaluation_state& eval_state, const operation& op);
+
       /**
        * @note derived classes should ASSUME that the default validation that is
        * indepenent of chain state should be performed by op.validate() and should
@@ -122,6 +128,8 @@ namespace graphene { namespace chain {
    public:
       virtual ~op_evaluator(){}
       virtual operation_result evaluate(transaction_evaluation_state& eval_state, const operation& op, bool apply) = 0;
+      /// Evaluates an operation without applying it, the returned evaluator can apply it later, see resume_apply()
+      virtual std::unique_ptr<generic_evaluator> speculate(transaction_evaluation_state& eval_state, const operation& op) = 0;
    };
 
    template<typename T>
@@ -133,6 +141,12 @@ namespace graphene { namespace chain {
          T eval;
          return eval.start_evaluate(eval_state, op, apply);
       }
+      virtual std::unique_ptr<generic_evaluator> speculate(transaction_evaluation_state& eval_state, const operation& op) override
+      {
+         std::unique_ptr<T> eval( new T );
+         eval->start_evaluate(eval_state, op, false);
+         return std::move(eval);
+      }
    };
 
    template<typename DerivedEvaluator>
@@ -23,6 +23,7 @@
  */
 #pragma once
 
+#include <graphene/chain/order_book.hpp>
 #include <graphene/chain/protocol/asset.hpp>
 #include <graphene/chain/protocol/types.hpp>
 #include <graphene/db/generic_index.hpp>
@@ -97,7 +98,8 @@ typedef multi_index_container<
          >,
          composite_key_compare<std::less<account_id_type>, std::greater<price>, std::less<object_id_type>>
       >
-   >
+   >,
+   pool_allocator< limit_order_object >
 > limit_order_multi_index_type;
 
 typedef generic_index<limit_order_object, limit_order_multi_index_type> limit_order_index;
@@ -208,7 +210,8 @@ typedef multi_index_container<
             member< object, object_id_type, &object::id >
          >
       >
-   >
+   >,
+   pool_allocator< call_order_object >
 > call_order_multi_index_type;
 
 struct by_expiration;
@@ -229,7 +232,8 @@ typedef multi_index_container<
             member< object, object_id_type, &object::id >
          >
       >
-   >
+   >,
+   pool_allocator< force_settlement_object >
 > force_settlement_object_multi_index_type;
 
 typedef multi_index_container<
@@ -258,6 +262,11 @@ typedef generic_index<call_order_object, call_order_multi_index_type>
 typedef generic_index<force_settlement_object, force_settlement_object_multi_index_type>   force_settlement_index;
 typedef generic_index<collateral_bid_object, collateral_bid_object_multi_index_type>       collateral_bid_index;
 
+/// The limit orders of each market in by_price order, best (highest sell_price) first
+typedef order_book_index<limit_order_object, &limit_order_object::sell_price, true>       limit_order_book;
+/// The call orders of each market in by_price order, least call_price first
+typedef order_book_index<call_order_object, &call_order_object::call_price, false>        call_order_book;
+
 } } // graphene::chain
 
 FC_REFLECT_DERIVED( graphene::chain::limit_order_object,
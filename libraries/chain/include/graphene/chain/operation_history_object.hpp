@@ -23,6 +23,7 @@
  */
 #pragma once
 #include <graphene/chain/protocol/operations.hpp>
+#include <graphene/db/generic_index.hpp>
 #include <graphene/db/object.hpp>
 #include <boost/multi_index/composite_key.hpp>
 
@@ -105,7 +106,8 @@ namespace graphene { namespace chain {
       operation_history_object,
       indexed_by<
          ordered_unique< tag<by_id>, member< object, object_id_type, &object::id > >
-      >
+      >,
+      pool_allocator< operation_history_object >
    > operation_history_multi_index_type;
 
    typedef generic_index<operation_history_object, operation_history_multi_index_type> operation_history_index;
@@ -133,7 +135,8 @@ namespace graphene { namespace chain {
          ordered_non_unique< tag<by_opid>,
             member< account_transaction_history_object, operation_history_id_type, &account_transaction_history_object::operation_id>
          >
-      >
+      >,
+      pool_allocator< account_transaction_history_object >
    > account_transaction_history_multi_index_type;
 
    typedef generic_index<account_transaction_history_object, account_transaction_history_multi_index_type> account_transaction_history_index;
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+
+#include <graphene/chain/protocol/asset.hpp>
+#include <graphene/db/index.hpp>
+
+#include <fc/container/flat.hpp>
+#include <fc/uint128.hpp>
+
+#include <algorithm>
+#include <deque>
+
+namespace graphene { namespace chain {
+
+   /**
+    * A price together with its ratio as a 64.64 fixed point number, base amount / quote amount rounded down.
+    * Different keys order like the prices they were made from, so comparisons only need the wide multiplications
+    * of price::operator< for prices of the same market which are closer than 2^-64.
+    */
+   struct order_book_price
+   {
+      order_book_price() {}
+      explicit order_book_price( const price& p )
+         : key( fc::uint128( uint64_t( p.base.amount.value ), 0 ) / fc::uint128( uint64_t( p.quote.amount.value ) ) ),
+           value( p ) {}
+
+      fc::uint128 key;
+      price       value;
+
+      friend bool operator < ( const order_book_price& a, const order_book_price& b )
+      {
+         if( a.key != b.key )
+            return a.key < b.key;
+         return a.value < b.value;
+      }
+      friend bool operator == ( const order_book_price& a, const order_book_price& b )
+      {
+         return a.key == b.key && a.value == b.value;
+      }
+   };
+
+   /**
+    * @brief A secondary index that keeps the orders of each market in contiguous price levels
+    *
+    * The orders of a market, i.e. with the same base and quote asset of Object::*Price, are kept in the same order
+    * as the by_price index of the primary index: from the best to the worst price, and by ID within a price level.
+    * Unlike iterating the by_price index, getting the best order of a market does not walk a tree and comparing
+    * levels mostly compares integers. Prices are equal if their ratios are equal, like in price::operator==.
+    *
+    * @tparam BestIsHighest whether the highest price of a market is the best, i.e. by_price uses std::greater
+    */
+   template<typename Object, price Object::*Price, bool BestIsHighest>
+   class order_book_index : public secondary_index
+   {
+      public:
+         struct price_level
+         {
+            order_book_price                price;
+            std::deque< const Object* >     orders; ///< sorted by ID
+         };
+         /// The price levels of a market sorted from the worst to the best, so that the best can be removed cheaply
+         typedef vector< price_level > book_type;
+
+         /// @return the best price level of the market, or nullptr if it has no orders
+         const price_level* best_level( asset_id_type base, asset_id_type quote )const
+         {
+            auto itr = _books.find( std::make_pair( base, quote ) );
+            if( itr == _books.end() )
+               return nullptr;
+            return &itr->second.back();
+         }
+
+         /// @return the first order of the market in by_price order, or nullptr if it has no orders
+         const Object* best( asset_id_type base, asset_id_type quote )const
+         {
+            const price_level* level = best_level( base, quote );
+            return level == nullptr ? nullptr : level->orders.front();
+         }
+
+         /// @return true if a is a better price than b in this book
+         static bool is_better( const order_book_price& a, const order_book_price& b )
+         {
+            return BestIsHighest ? b < a : a < b;
+         }
+
+         /// @return the price levels of the market, or nullptr if it has no orders
+         const book_type* get_book( asset_id_type base, asset_id_type quote )const
+         {
+            auto itr = _books.find( std::make_pair( base, quote ) );
+            return itr == _books.end() ? nullptr : &itr->second;
+         }
+
+         size_t market_count()const { return _books.size(); }
+
+         virtual void object_inserted( const object& obj ) override
+         {
+            const Object& o = static_cast<const Object&>( obj );
+            add( o, order_book_price( o.*Price ) );
+         }
+
+         virtual void object_removed( const object& obj ) override
+         {
+            const Object& o = static_cast<const Object&>( obj );
+            remove( o, order_book_price( o.*Price ) );
+         }
+
+         virtual void about_to_modify( const object& before ) override
+         {
+            _price_before_modify = static_cast<const Object&>( before ).*Price;
+         }
+
+         virtual void object_modified( const object& after ) override
+         {
+            const Object& o = static_cast<const Object&>( after );
+            const price& p = o.*Price;
+            if( p == _price_before_modify ) // also the same level if only the amounts have changed
+               return;
+            remove( o, order_book_price( _price_before_modify ) );
+            add( o, order_book_price( p ) );
+         }
+
+      private:
+         typedef std::pair< asset_id_type, asset_id_type > market_type;
+
+         /// @return the first level of book which is not worse than p
+         static typename book_type::iterator find_level( book_type& book, const order_book_price& p )
+         {
+            return std::lower_bound( book.begin(), book.end(), p,
+                                     []( const price_level& level, const order_book_price& p ) {
+                                        return is_better( p, level.price );
+                                     });
+         }
+
+         static bool by_id( const Object* a, const Object* b ) { return a->id < b->id; }
+
+         void add( const Object& o, const order_book_price& p )
+         {
+            book_type& book = _books[ std::make_pair( p.value.base.asset_id, p.value.quote.asset_id ) ];
+            auto level = find_level( book, p );
+            if( level == book.end() || is_better( level->price, p ) )
+            {
+               level = book.insert( level, price_level() );
+               level->price = p;
+            }
+            // new orders usually have the highest ID
+            if( level->orders.empty() || level->orders.back()->id < o.id )
+               level->orders.push_back( &o );
+            else
+               level->orders.insert( std::lower_bound( level->orders.begin(), level->orders.end(), &o, &by_id ), &o );
+         }
+
+         void remove( const Object& o, const order_book_price& p )
+         {
+            auto book = _books.find( std::make_pair( p.value.base.asset_id, p.value.quote.asset_id ) );
+            FC_ASSERT( book != _books.end(), "Order ${id} is not in the order book", ("id",o.id) );
+            auto level = find_level( book->second, p );
+            FC_ASSERT( level != book->second.end() && !is_better( level->price, p ),
+                       "Order ${id} is not in the order book", ("id",o.id) );
+            auto& orders = level->orders;
+            // matched orders are usually the oldest of the best level
+            auto itr = ( orders.front() == &o ) ? orders.begin()
+                                                : std::lower_bound( orders.begin(), orders.end(), &o, &by_id );
+            FC_ASSERT( itr != orders.end() && *itr == &o, "Order ${id} is not in the order book", ("id",o.id) );
+            orders.erase( itr );
+            if( orders.empty() )
+            {
+               book->second.erase( level );
+               if( book->second.empty() )
+                  _books.erase( book );
+            }
+         }
+
+         flat_map< market_type, book_type > _books;
+         price                              _price_before_modify;
+   };
+
+} } // graphene::chain
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+
+#include <fc/thread/parallel.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace graphene { namespace chain { namespace detail {
+
+   /// Starts task( begin, end ) for chunks of [0, count) on all IO threads, the caller has to wait for the result
+   template<typename Task>
+   std::vector<fc::future<void>> start_parallel_chunks( const size_t count, const Task& task )
+   {
+      const size_t chunks = fc::asio::default_io_service_scope::get_num_threads();
+      const size_t chunk_size = ( count + chunks - 1 ) / chunks;
+      std::vector<fc::future<void>> workers;
+      workers.reserve( chunks + 1 );
+      for( size_t base = 0; base < count; base += chunk_size )
+         workers.push_back( fc::do_parallel( [task,base,chunk_size,count] () {
+            task( base, std::min( base + chunk_size, count ) );
+         }) );
+      return workers;
+   }
+
+   /// Calls task( begin, end ) for chunks of [0, count) on all IO threads and waits for them
+   template<typename Task>
+   void run_in_parallel_chunks( const size_t count, const Task& task )
+   {
+      for( auto& worker : start_parallel_chunks( count, task ) )
+         worker.wait();
+   }
+
+} } } // graphene::chain::detail
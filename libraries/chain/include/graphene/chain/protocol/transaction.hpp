@@ -209,6 +209,9 @@ namespace graphene { namespace chain {
       virtual const transaction_id_type&       id()const override;
       virtual void                             validate()const override;
       virtual const flat_set<public_key_type>& get_signature_keys( const chain_id_type& chain_id )const override;
+
+      /** Provides keys recovered earlier from the same signatures, e. g. by another copy of this transaction */
+      void set_signature_keys( const flat_set<public_key_type>& keys )const { _signees = keys; }
    protected:
       mutable bool _validated = false;
    };
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+
+#include <graphene/chain/protocol/transaction.hpp>
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace graphene { namespace chain {
+
+   /**
+    * @brief Remembers the public keys recovered from the signatures of recent transactions
+    *
+    * A transaction usually arrives twice, first on its own via p2p or the API and later as part of a block.
+    * Both copies are separate objects, so without the cache the expensive key recovery would be done twice.
+    *
+    * Entries are keyed by the signature digest and the signatures, the least recently used entry is dropped
+    * when the cache is full. The cache is safe to use from several threads.
+    */
+   class signature_key_cache
+   {
+      public:
+         explicit signature_key_cache( size_t capacity = 10000 ) : _capacity( capacity ) {}
+
+         /** Changes the maximum number of entries, 0 disables the cache */
+         void set_capacity( size_t capacity );
+
+         /**
+          * Recovers the keys of trx unless they are in the cache, and makes them available through
+          * trx.get_signature_keys().
+          */
+         void apply( const precomputable_transaction& trx, const chain_id_type& chain_id );
+
+         uint64_t hits()const   { return _hits; }
+         uint64_t misses()const { return _misses; }
+
+      private:
+         typedef std::list< std::pair< digest_type, flat_set<public_key_type> > > entry_list;
+
+         void evict();
+
+         std::mutex                                               _mutex;
+         size_t                                                   _capacity;
+         entry_list                                               _entries; ///< most recently used first
+         std::unordered_map< digest_type, entry_list::iterator >  _index;
+         std::atomic<uint64_t>                                    _hits{0};
+         std::atomic<uint64_t>                                    _misses{0};
+   };
+
+} } // graphene::chain
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+
+#include <graphene/chain/account_object.hpp>
+#include <graphene/chain/vesting_balance_object.hpp>
+#include <graphene/chain/protocol/chain_parameters.hpp>
+
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace graphene { namespace chain {
+
+   class database;
+
+   /**
+    * @brief Keeps the vote tally of chain maintenance up to date between maintenance intervals
+    *
+    * The full tally walks every voting account and adds its voting stake to the votes and to the preferred numbers
+    * of witnesses and committee members of its opinion account, i.e. its voting account or itself. This class
+    * remembers the stake of each voting account and the total stake of each opinion account, which is added to the
+    * tally with the options the opinion account had then. Secondary indexes on accounts, account statistics and
+    * vesting balances mark the accounts whose stake or options may have changed, and update() only recomputes those.
+    *
+    * The full tally reads the cashback of an account when it reaches the account in name order, while it pays out
+    * the pending fees of the accounts before it, which deposits cashback. Between begin_fees() and end_fees() the
+    * accounts changed by paying fees are recomputed in the same order, see visit().
+    *
+    * Whether an account is a member depends on the time, so the tally is only valid if votes of non-members count.
+    */
+   class vote_tally
+   {
+      public:
+         /** Forgets everything, the next update() recomputes all voting accounts */
+         void reset();
+
+         bool is_complete()const { return _complete; }
+
+         /** Called by the secondary indexes when an object of the account has changed */
+         void mark( account_id_type account )
+         {
+            if( !_complete )
+               return;
+            _dirty.insert( account.instance.value );
+            if( _paying_fees )
+               _fee_marks.push_back( account );
+         }
+
+         /**
+          * Recomputes the marked accounts, or all voting accounts if the tally is not complete. The stakes are read
+          * in parallel and added to the tally in the order of the accounts.
+          */
+         void update( const database& db );
+
+         /** Starts paying the pending fees of accounts, which must happen in the order of their names */
+         void begin_fees();
+         /** Called before the pending fees of the account with the given name are paid */
+         void visit( const database& db, const string& name );
+         /** Recomputes the accounts changed by paying fees which come after the last paid account */
+         void end_fees( const database& db );
+
+         /**
+          * Writes the tally into buffers which have been sized and zeroed like the ones of the full tally, applying
+          * the maximum witness and committee counts of params.
+          */
+         void fill( vector<uint64_t>& votes, vector<uint64_t>& witness_counts, vector<uint64_t>& committee_counts,
+                    uint64_t& total_stake, const chain_parameters& params )const;
+
+         /** Called if the tally differs from the full tally, reset()s it */
+         void record_mismatch() { ++_mismatches; reset(); }
+         uint64_t mismatches()const { return _mismatches; }
+
+      private:
+         struct opinion
+         {
+            uint64_t                stake = 0;
+            flat_set<vote_id_type>  votes;
+            uint16_t                num_witness = 0;
+            uint16_t                num_committee = 0;
+            /** whether stake is in the tally, options of changed opinion accounts are applied again in update() */
+            bool                    applied = false;
+         };
+         struct contribution
+         {
+            account_id_type         opinion;
+            uint64_t                stake = 0;
+         };
+
+         /** @return the stake of a voting account, nothing if it does not vote, only reads db */
+         static optional<contribution> compute_contribution( const database& db, account_id_type account );
+         void set_contribution( const database& db, account_id_type account, const optional<contribution>& c );
+         void update_account( const database& db, account_id_type account )
+         {
+            set_contribution( db, account, compute_contribution( db, account ) );
+         }
+         /** recomputes the accounts, computing their stakes on all IO threads if there are many */
+         void update_accounts( const database& db, const vector<account_id_type>& accounts );
+         void adjust_opinion( const database& db, account_id_type account, int64_t delta );
+         void load_options( const database& db, account_id_type account, opinion& o );
+         void apply( const opinion& o, int64_t delta );
+         void resolve_fee_marks( const database& db );
+
+         bool                                           _complete = false;
+         std::unordered_set<uint64_t>                   _dirty;          ///< instances of marked accounts
+         std::unordered_map<uint64_t, contribution>     _contributions;  ///< by instance of the voting account
+         std::unordered_map<uint64_t, opinion>          _opinions;       ///< by instance, only with some stake
+
+         vector<uint64_t>                               _votes;          ///< by instance of the vote id
+         std::map<uint16_t, uint64_t>                   _witness_counts; ///< by preferred number of witnesses
+         std::map<uint16_t, uint64_t>                   _committee_counts;
+         uint64_t                                       _total_stake = 0;
+
+         bool                                           _paying_fees = false;
+         string                                         _fee_cursor;     ///< name of the last paid account
+         vector<account_id_type>                        _fee_marks;      ///< marked while paying fees
+         std::map<string, account_id_type>              _fee_unvisited;  ///< marked after the cursor, by name
+
+         uint64_t                                       _mismatches = 0;
+   };
+
+   /**
+    * @brief Marks the owners of changed objects in a vote_tally
+    */
+   template< typename Object >
+   class vote_tally_tracker : public secondary_index
+   {
+      public:
+         explicit vote_tally_tracker( vote_tally* tally ) : _tally( tally ) {}
+
+         virtual void object_inserted( const object& obj ) override
+         {
+            _tally->mark( owner_of( static_cast<const Object&>( obj ) ) );
+         }
+         virtual void object_removed( const object& obj ) override
+         {
+            _tally->mark( owner_of( static_cast<const Object&>( obj ) ) );
+         }
+         virtual void object_modified( const object& after ) override
+         {
+            _tally->mark( owner_of( static_cast<const Object&>( after ) ) );
+         }
+
+      private:
+         static account_id_type owner_of( const account_object& a ) { return a.get_id(); }
+         static account_id_type owner_of( const vesting_balance_object& b ) { return b.owner; }
+
+         vote_tally* _tally;
+   };
+
+   /**
+    * @brief Marks the owners of account statistics in a vote_tally when a field used by the tally changes
+    *
+    * The statistics of the fee payer change with nearly every operation, mostly only the fee fields.
+    */
+   class vote_tally_stats_tracker : public secondary_index
+   {
+      public:
+         explicit vote_tally_stats_tracker( vote_tally* tally ) : _tally( tally ) {}
+
+         virtual void object_inserted( const object& obj ) override
+         {
+            _tally->mark( static_cast<const account_statistics_object&>( obj ).owner );
+         }
+         virtual void object_removed( const object& obj ) override
+         {
+            _tally->mark( static_cast<const account_statistics_object&>( obj ).owner );
+         }
+         virtual void about_to_modify( const object& before ) override
+         {
+            _before = voting_fields( static_cast<const account_statistics_object&>( before ) );
+         }
+         virtual void object_modified( const object& after ) override
+         {
+            const auto& stats = static_cast<const account_statistics_object&>( after );
+            if( voting_fields( stats ) != _before )
+               _tally->mark( stats.owner );
+         }
+
+      private:
+         typedef std::tuple< bool, bool, share_type, share_type > fields_type;
+
+         static fields_type voting_fields( const account_statistics_object& s )
+         {
+            return std::make_tuple( s.is_voting, s.has_cashback_vb, s.total_core_in_orders, s.core_in_balance );
+         }
+
+         vote_tally*  _tally;
+         fields_type  _before;
+   };
+
+} } // graphene::chain
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <graphene/chain/signature_key_cache.hpp>
+
+#include <fc/io/raw.hpp>
+
+namespace graphene { namespace chain {
+
+void signature_key_cache::set_capacity( size_t capacity )
+{
+   std::lock_guard<std::mutex> guard( _mutex );
+   _capacity = capacity;
+   evict();
+}
+
+void signature_key_cache::evict()
+{
+   while( _entries.size() > _capacity )
+   {
+      _index.erase( _entries.back().first );
+      _entries.pop_back();
+   }
+}
+
+void signature_key_cache::apply( const precomputable_transaction& trx, const chain_id_type& chain_id )
+{
+   if( trx.signatures.empty() )
+      return;
+
+   // The signature digest alone is not enough, the same transaction may be signed by different keys
+   fc::sha256::encoder enc;
+   fc::raw::pack( enc, trx.sig_digest( chain_id ) );
+   fc::raw::pack( enc, trx.signatures );
+   const digest_type key = enc.result();
+
+   {
+      std::lock_guard<std::mutex> guard( _mutex );
+      auto itr = _index.find( key );
+      if( itr != _index.end() )
+      {
+         _entries.splice( _entries.begin(), _entries, itr->second );
+         trx.set_signature_keys( itr->second->second );
+         ++_hits;
+         return;
+      }
+      ++_misses;
+   }
+
+   // Recover outside of the lock, this is what takes the time
+   const flat_set<public_key_type>& keys = trx.get_signature_keys( chain_id );
+
+   std::lock_guard<std::mutex> guard( _mutex );
+   if( _capacity == 0 || _index.find( key ) != _index.end() )
+      return;
+   _entries.emplace_front( key, keys );
+   _index[key] = _entries.begin();
+   evict();
+}
+
+} } // graphene::chain
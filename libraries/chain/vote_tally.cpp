@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <graphene/chain/vote_tally.hpp>
+#include <graphene/chain/database.hpp>
+#include <graphene/chain/parallel_chunks.hpp>
+
+namespace graphene { namespace chain {
+
+void vote_tally::reset()
+{
+   _complete = false;
+   _dirty.clear();
+   _contributions.clear();
+   _opinions.clear();
+   _votes.clear();
+   _witness_counts.clear();
+   _committee_counts.clear();
+   _total_stake = 0;
+   _paying_fees = false;
+   _fee_marks.clear();
+   _fee_unvisited.clear();
+}
+
+void vote_tally::update( const database& db )
+{
+   // an exception while paying fees leaves the fee state behind, the marks are in _dirty anyway
+   _paying_fees = false;
+   _fee_marks.clear();
+   _fee_unvisited.clear();
+
+   if( !_complete )
+   {
+      reset();
+      const auto& stats_idx = db.get_index_type< account_stats_index >().indices().get< by_maintenance_seq >();
+      vector<account_id_type> accounts;
+      for( auto itr = stats_idx.lower_bound( true ); itr != stats_idx.end(); ++itr )
+         accounts.push_back( itr->owner );
+      update_accounts( db, accounts );
+      _complete = true;
+      return;
+   }
+
+   // take changed opinion accounts out of the tally, so that stakes can be moved without their old options
+   vector<uint64_t> reapply;
+   for( uint64_t instance : _dirty )
+   {
+      auto itr = _opinions.find( instance );
+      if( itr == _opinions.end() )
+         continue;
+      apply( itr->second, -int64_t( itr->second.stake ) );
+      itr->second.applied = false;
+      reapply.push_back( instance );
+   }
+
+   vector<account_id_type> accounts;
+   accounts.reserve( _dirty.size() );
+   for( uint64_t instance : _dirty )
+      accounts.push_back( account_id_type( instance ) );
+   _dirty.clear();
+   // the result does not depend on the order, sorting makes the work the same on all nodes
+   std::sort( accounts.begin(), accounts.end() );
+   update_accounts( db, accounts );
+
+   for( uint64_t instance : reapply )
+   {
+      auto itr = _opinions.find( instance );
+      // the opinion may have lost all its stake and been added again with the current options
+      if( itr == _opinions.end() || itr->second.applied )
+         continue;
+      load_options( db, account_id_type( instance ), itr->second );
+      apply( itr->second, int64_t( itr->second.stake ) );
+      itr->second.applied = true;
+   }
+}
+
+void vote_tally::begin_fees()
+{
+   _paying_fees = true;
+   _fee_cursor.clear();
+   _fee_marks.clear();
+   _fee_unvisited.clear();
+}
+
+void vote_tally::resolve_fee_marks( const database& db )
+{
+   for( account_id_type account : _fee_marks )
+   {
+      const account_object* a = db.find( account );
+      // the full tally has already passed accounts up to the cursor, changes of them count at the next maintenance
+      if( a != nullptr && a->name > _fee_cursor )
+         _fee_unvisited.emplace( a->name, account );
+   }
+   _fee_marks.clear();
+}
+
+void vote_tally::visit( const database& db, const string& name )
+{
+   FC_ASSERT( _paying_fees );
+   resolve_fee_marks( db );
+   // the full tally reaches these accounts before the fees of name are paid
+   auto end = _fee_unvisited.upper_bound( name );
+   for( auto itr = _fee_unvisited.begin(); itr != end; ++itr )
+   {
+      update_account( db, itr->second );
+      _dirty.erase( itr->second.instance.value );
+   }
+   _fee_unvisited.erase( _fee_unvisited.begin(), end );
+   _fee_cursor = name;
+}
+
+void vote_tally::end_fees( const database& db )
+{
+   FC_ASSERT( _paying_fees );
+   resolve_fee_marks( db );
+   for( const auto& item : _fee_unvisited )
+   {
+      update_account( db, item.second );
+      _dirty.erase( item.second.instance.value );
+   }
+   _fee_unvisited.clear();
+   _paying_fees = false;
+}
+
+void vote_tally::update_accounts( const database& db, const vector<account_id_type>& accounts )
+{
+   vector< optional<contribution> > results( accounts.size() );
+   auto compute = [&db,&accounts,&results]( size_t begin, size_t end ) {
+      for( size_t i = begin; i < end; ++i )
+         results[i] = compute_contribution( db, accounts[i] );
+   };
+   // not worth the thread switches for the few accounts which usually change between maintenance intervals
+   if( accounts.size() < 1000 )
+      compute( 0, accounts.size() );
+   else
+      detail::run_in_parallel_chunks( accounts.size(), compute );
+
+   for( size_t i = 0; i < accounts.size(); ++i )
+      set_contribution( db, accounts[i], results[i] );
+}
+
+optional<vote_tally::contribution> vote_tally::compute_contribution( const database& db, account_id_type account )
+{
+   const account_object* stake_account = db.find( account );
+   if( stake_account == nullptr )
+      return optional<contribution>();
+   const account_statistics_object& stats = stake_account->statistics( db );
+   if( !stats.has_some_core_voting() )
+      return optional<contribution>();
+
+   // same as vote_tally_helper in perform_chain_maintenance
+   uint64_t voting_stake = stats.total_core_in_orders.value
+         + (stake_account->cashback_vb.valid() ? (*stake_account->cashback_vb)(db).balance.amount.value: 0)
+         + stats.core_in_balance.value;
+   if( voting_stake == 0 )
+      return optional<contribution>();
+
+   contribution c;
+   c.opinion = stake_account->options.voting_account == GRAPHENE_PROXY_TO_SELF_ACCOUNT ? account
+                                                                                      : stake_account->options.voting_account;
+   c.stake = voting_stake;
+   return c;
+}
+
+void vote_tally::set_contribution( const database& db, account_id_type account, const optional<contribution>& c )
+{
+   auto itr = _contributions.find( account.instance.value );
+   if( itr != _contributions.end() )
+   {
+      const contribution old = itr->second;
+      _contributions.erase( itr );
+      adjust_opinion( db, old.opinion, -int64_t( old.stake ) );
+   }
+   if( !c.valid() )
+      return;
+   _contributions[account.instance.value] = *c;
+   adjust_opinion( db, c->opinion, int64_t( c->stake ) );
+}
+
+void vote_tally::adjust_opinion( const database& db, account_id_type account, int64_t delta )
+{
+   auto itr = _opinions.find( account.instance.value );
+   if( itr == _opinions.end() )
+   {
+      itr = _opinions.emplace( account.instance.value, opinion() ).first;
+      load_options( db, account, itr->second );
+      itr->second.applied = true;
+   }
+   opinion& o = itr->second;
+   o.stake += delta;
+   if( o.applied )
+      apply( o, delta );
+   if( o.stake == 0 )
+      _opinions.erase( itr );
+}
+
+void vote_tally::load_options( const database& db, account_id_type account, opinion& o )
+{
+   const account_options& options = account( db ).options;
+   o.votes = options.votes;
+   o.num_witness = options.num_witness;
+   o.num_committee = options.num_committee;
+}
+
+void vote_tally::apply( const opinion& o, int64_t delta )
+{
+   // stakes are unsigned, removing one wraps around to the right value
+   const uint64_t d = uint64_t( delta );
+   for( vote_id_type id : o.votes )
+   {
+      const uint32_t offset = id.instance();
+      if( offset >= _votes.size() )
+         _votes.resize( offset + 1 );
+      _votes[offset] += d;
+   }
+   _witness_counts[o.num_witness] += d;
+   _committee_counts[o.num_committee] += d;
+   _total_stake += d;
+}
+
+void vote_tally::fill( vector<uint64_t>& votes, vector<uint64_t>& witness_counts, vector<uint64_t>& committee_counts,
+                       uint64_t& total_stake, const chain_parameters& params )const
+{
+   std::copy( _votes.begin(), _votes.begin() + std::min( _votes.size(), votes.size() ), votes.begin() );
+
+   // votes for more than the maximum count as votes for the maximum, like in the full tally
+   for( const auto& item : _witness_counts )
+      if( item.first <= params.maximum_witness_count )
+         witness_counts[ std::min( size_t( item.first / 2 ), witness_counts.size() - 1 ) ] += item.second;
+   for( const auto& item : _committee_counts )
+      if( item.first <= params.maximum_committee_count )
+         committee_counts[ std::min( size_t( item.first / 2 ), committee_counts.size() - 1 ) ] += item.second;
+
+   total_stake = _total_stake;
+}
+
+} } // graphene::chain
@@ -23,6 +23,7 @@
  */
 #pragma once
 #include <graphene/db/index.hpp>
+#include <graphene/db/pool_allocator.hpp>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/member.hpp>
 #include <boost/multi_index/ordered_index.hpp>
@@ -29,8 +29,10 @@
 #include <fc/io/json.hpp>
 #include <fc/crypto/sha256.hpp>
 
+#include <algorithm>
 #include <fstream>
 #include <stack>
+#include <unordered_set>
 
 namespace graphene { namespace db {
    class object_database;
@@ -76,6 +78,9 @@ namespace graphene { namespace db {
          virtual uint8_t object_space_id()const = 0;
          virtual uint8_t object_type_id()const = 0;
 
+         /** Changes whenever the serialization of the objects in this index changes */
+         virtual fc::sha256     get_object_version()const = 0;
+
          virtual object_id_type get_next_id()const = 0;
          virtual void           use_next_id() = 0;
          virtual void           set_next_id( object_id_type id ) = 0;
@@ -99,6 +104,25 @@ namespace graphene { namespace db {
          virtual void open( const fc::path& db ) = 0;
          virtual void save( const fc::path& db ) = 0;
 
+         /** Writes the next id, the object version and all objects in the format used by save() */
+         virtual void save_objects( std::ostream& out )const = 0;
+         /** Loads data written by save_objects into an empty index */
+         virtual void load_objects( const char* data, size_t size ) = 0;
+
+         /** @return true if objects were created, modified or removed since the last save or save_changes */
+         virtual bool has_changes()const = 0;
+         /** @return true if so many objects were changed that rewriting the whole index is cheaper */
+         virtual bool needs_full_save()const = 0;
+         /**
+          *  Writes a checksummed segment file containing the objects changed since the last save or
+          *  save_changes, or all objects if full is set, and starts tracking changes from scratch.
+          */
+         virtual void save_changes( const fc::path& segment, bool full ) = 0;
+         /**
+          *  Applies a segment written by save_changes on top of the objects loaded so far
+          */
+         virtual void load_changes( const fc::path& segment ) = 0;
+
 
 
          /** @return the object with id or nullptr if not found */
@@ -167,6 +191,9 @@ namespace graphene { namespace db {
          /** called just after obj is modified */
          void on_modify( const object& obj );
 
+         /** @return true if the object_database can use the objects changed since the last flush in the next one */
+         bool track_changes()const;
+
          template<typename T, typename... Args>
          T* add_secondary_index(Args... args)
          {
@@ -299,6 +326,109 @@ namespace graphene { namespace db {
          };
    };
 
+   /** @class hashed_id_index
+    *  @brief A secondary index that maps object instances to objects in a flat, open-addressing hash table
+    *  with linear probing. Unlike direct_index it does not require the instances to be densely populated,
+    *  which makes it suitable for objects that are created and removed all the time, like orders.
+    */
+   template<typename Object>
+   class hashed_id_index : public secondary_index
+   {
+      // private
+         struct slot
+         {
+            uint64_t      instance = 0;
+            const Object* object = nullptr;
+         };
+         static const size_t npos = size_t(-1);
+
+         vector< slot > slots;
+         size_t         mask = 0;
+         uint8_t        shift = 64;
+         size_t         count = 0;
+
+         /** Fibonacci hashing, spreads consecutive instances over the table */
+         size_t home( uint64_t instance )const
+         {
+            return size_t( (instance * 11400714819323198485ULL) >> shift );
+         }
+
+         size_t locate( uint64_t instance )const
+         {
+            if( slots.empty() ) return npos;
+            for( size_t pos = home( instance ); slots[pos].object != nullptr; pos = (pos + 1) & mask )
+               if( slots[pos].instance == instance )
+                  return pos;
+            return npos;
+         }
+
+         void place( const slot& s )
+         {
+            size_t pos = home( s.instance );
+            while( slots[pos].object != nullptr )
+            {
+               FC_ASSERT( slots[pos].instance != s.instance, "Overwriting insert at ${i}!", ("i",s.instance) );
+               pos = (pos + 1) & mask;
+            }
+            slots[pos] = s;
+         }
+
+         void rehash( size_t capacity )
+         {
+            vector< slot > old;
+            old.swap( slots );
+            slots.resize( capacity );
+            mask = capacity - 1;
+            shift = 64;
+            while( capacity > 1 ) { --shift; capacity >>= 1; }
+            for( const slot& s : old )
+               if( s.object != nullptr )
+                  place( s );
+         }
+
+      public:
+         virtual ~hashed_id_index(){}
+
+         virtual void object_inserted( const object& obj )
+         {
+            FC_ASSERT( nullptr != dynamic_cast<const Object*>(&obj), "Wrong object type!" );
+            if( (count + 1) * 4 > slots.size() * 3 ) // keep the load factor below 3/4
+               rehash( std::max< size_t >( 16, slots.size() * 2 ) );
+            slot s;
+            s.instance = obj.id.instance();
+            s.object = static_cast<const Object*>( &obj );
+            place( s );
+            ++count;
+         }
+
+         virtual void object_removed( const object& obj )
+         {
+            size_t hole = locate( obj.id.instance() );
+            FC_ASSERT( hole != npos, "Removing non-existent object ${id}!", ("id",obj.id) );
+            // Move following entries of the cluster into the hole unless that would put them in front of their
+            // home slot, so that lookups never have to skip deleted entries
+            for( size_t pos = (hole + 1) & mask; slots[pos].object != nullptr; pos = (pos + 1) & mask )
+               if( ((pos - home( slots[pos].instance )) & mask) >= ((pos - hole) & mask) )
+               {
+                  slots[hole] = slots[pos];
+                  hole = pos;
+               }
+            slots[hole] = slot();
+            --count;
+         }
+
+         const Object* find( const object_id_type& id )const
+         {
+            FC_ASSERT( id.space() == Object::space_id, "Space ID mismatch!" );
+            FC_ASSERT( id.type() == Object::type_id, "Type_ID mismatch!" );
+            const size_t pos = locate( id.instance() );
+            return pos == npos ? nullptr : slots[pos].object;
+         }
+
+         size_t size()const { return count; }
+         size_t capacity()const { return slots.size(); }
+   };
+
    /**
     * @class primary_index
     * @brief  Wraps a derived index to intercept calls to create, modify, and remove so that
@@ -313,7 +443,7 @@ namespace graphene { namespace db {
          typedef typename DerivedIndex::object_type object_type;
 
          primary_index( object_database& db )
-         :base_primary_index(db),_next_id(object_type::space_id,object_type::type_id,0)
+         :base_primary_index(db),_next_id(object_type::space_id,object_type::type_id,0),_saved_next_id(_next_id)
          {
             if( DirectBits > 0 )
                _direct_by_id = add_secondary_index< direct_index< object_type, DirectBits > >();
@@ -337,7 +467,7 @@ namespace graphene { namespace db {
             return DerivedIndex::find( id );
          }
 
-         fc::sha256 get_object_version()const
+         virtual fc::sha256 get_object_version()const override
          {
             std::string desc = "1.0";//get_type_description<object_type>();
             return fc::sha256::hash(desc);
@@ -348,7 +478,34 @@ namespace graphene { namespace db {
             if( !fc::exists( db ) ) return;
             fc::file_mapping fm( db.generic_string().c_str(), fc::read_only );
             fc::mapped_region mr( fm, fc::read_only, 0, fc::file_size(db) );
-            fc::datastream<const char*> ds( (const char*)mr.get_address(), mr.get_size() );
+            load_objects( (const char*)mr.get_address(), mr.get_size() );
+         }
+
+         virtual void save( const path& db ) override 
+         {
+            std::ofstream out( db.generic_string(), 
+                               std::ofstream::binary | std::ofstream::out | std::ofstream::trunc );
+            FC_ASSERT( out );
+            save_objects( out );
+            forget_changes();
+         }
+
+         virtual void save_objects( std::ostream& out )const override
+         {
+            auto ver  = get_object_version();
+            fc::raw::pack( out, _next_id );
+            fc::raw::pack( out, ver );
+            this->inspect_all_objects( [&]( const object& o ) {
+                auto vec = fc::raw::pack( static_cast<const object_type&>(o) );
+                auto packed_vec = fc::raw::pack( vec );
+                out.write( packed_vec.data(), packed_vec.size() );
+            });
+         }
+
+         virtual void load_objects( const char* data, size_t size ) override
+         {
+            FC_ASSERT( _object_count == 0, "Loading objects into a non-empty index" );
+            fc::datastream<const char*> ds( data, size );
             fc::sha256 open_ver;
 
             fc::raw::unpack(ds, _next_id);
@@ -360,29 +517,122 @@ namespace graphene { namespace db {
                fc::raw::unpack( ds, tmp );
                load( tmp );
             }
+            forget_changes();
          }
 
-         virtual void save( const path& db ) override 
+         virtual bool has_changes()const override
          {
-            std::ofstream out( db.generic_string(), 
+            return _all_changed || !_changed_instances.empty() || _next_id != _saved_next_id;
+         }
+
+         virtual bool needs_full_save()const override
+         {
+            return _all_changed;
+         }
+
+         /**
+          *  Segment layout: next_id, object version, full flag, then for each object its instance, whether it
+          *  exists and if so its packed content, followed by the sha256 of everything before it.
+          */
+         virtual void save_changes( const path& segment, bool full ) override
+         {
+            std::ofstream out( segment.generic_string(),
                                std::ofstream::binary | std::ofstream::out | std::ofstream::trunc );
             FC_ASSERT( out );
-            auto ver  = get_object_version();
-            fc::raw::pack( out, _next_id );
-            fc::raw::pack( out, ver );
-            this->inspect_all_objects( [&]( const object& o ) {
-                auto vec = fc::raw::pack( static_cast<const object_type&>(o) );
-                auto packed_vec = fc::raw::pack( vec );
-                out.write( packed_vec.data(), packed_vec.size() );
-            });
+            fc::sha256::encoder check;
+            auto write = [&out,&check]( const vector<char>& data ) {
+               out.write( data.data(), data.size() );
+               check.write( data.data(), data.size() );
+            };
+            auto write_object = [&write]( uint64_t instance, const object* o ) {
+               write( fc::raw::pack( instance ) );
+               write( fc::raw::pack( o != nullptr ) );
+               if( o != nullptr )
+                  write( fc::raw::pack( fc::raw::pack( static_cast<const object_type&>(*o) ) ) );
+            };
+
+            write( fc::raw::pack( _next_id ) );
+            write( fc::raw::pack( get_object_version() ) );
+            write( fc::raw::pack( full ) );
+            if( full )
+               this->inspect_all_objects( [&write_object]( const object& o ) {
+                  write_object( o.id.instance(), &o );
+               });
+            else
+            {
+               // Ascending order keeps loading compatible with direct_index, which does not allow large holes
+               vector<uint64_t> instances( _changed_instances.begin(), _changed_instances.end() );
+               std::sort( instances.begin(), instances.end() );
+               for( uint64_t instance : instances )
+                  write_object( instance, find( object_id_type( object_type::space_id, object_type::type_id, instance ) ) );
+            }
+            fc::raw::pack( out, check.result() );
+            out.close();
+            FC_ASSERT( !out.fail(), "Failed to write ${s}", ("s",segment) );
+            forget_changes();
+         }
+
+         virtual void load_changes( const path& segment ) override
+         {
+            fc::file_mapping fm( segment.generic_string().c_str(), fc::read_only );
+            fc::mapped_region mr( fm, fc::read_only, 0, fc::file_size(segment) );
+            const char* data = (const char*)mr.get_address();
+            FC_ASSERT( mr.get_size() > sizeof(fc::sha256), "Truncated segment ${s}", ("s",segment) );
+            const size_t payload_size = mr.get_size() - sizeof(fc::sha256);
+
+            fc::sha256 stored_checksum;
+            fc::datastream<const char*> checksum_ds( data + payload_size, sizeof(fc::sha256) );
+            fc::raw::unpack( checksum_ds, stored_checksum );
+            fc::sha256::encoder check;
+            for( size_t done = 0; done < payload_size; done += std::min<size_t>( payload_size - done, 1 << 30 ) )
+               check.write( data + done, std::min<size_t>( payload_size - done, 1 << 30 ) );
+            FC_ASSERT( check.result() == stored_checksum, "Checksum mismatch, segment ${s} is corrupt", ("s",segment) );
+
+            fc::datastream<const char*> ds( data, payload_size );
+            fc::sha256 open_ver;
+            bool full;
+            fc::raw::unpack( ds, _next_id );
+            fc::raw::unpack( ds, open_ver );
+            fc::raw::unpack( ds, full );
+            FC_ASSERT( open_ver == get_object_version(), "Incompatible Version, the serialization of objects in this index has changed" );
+            FC_ASSERT( !full || _object_count == 0, "Full segment ${s} applied on top of existing objects", ("s",segment) );
+            vector<char> tmp;
+            while( ds.remaining() > 0 )
+            {
+               uint64_t instance;
+               bool exists;
+               fc::raw::unpack( ds, instance );
+               fc::raw::unpack( ds, exists );
+               const object* old = find( object_id_type( object_type::space_id, object_type::type_id, instance ) );
+               if( exists )
+               {
+                  fc::raw::unpack( ds, tmp );
+                  object_type obj = fc::raw::unpack<object_type>( tmp );
+                  if( old == nullptr )
+                     load_object( std::move(obj) );
+                  else
+                  {
+                     for( const auto& item : _sindex )
+                        item->about_to_modify( *old );
+                     DerivedIndex::modify( *old, [&obj]( object& o ) { o.move_from( obj ); } );
+                     for( const auto& item : _sindex )
+                        item->object_modified( *old );
+                  }
+               }
+               else if( old != nullptr )
+               {
+                  for( const auto& item : _sindex )
+                     item->object_removed( *old );
+                  DerivedIndex::remove( *old );
+                  --_object_count;
+               }
+            }
+            forget_changes();
          }
 
          virtual const object&  load( const std::vector<char>& data )override
          {
-            const auto& result = DerivedIndex::insert( fc::raw::unpack<object_type>( data ) );
-            for( const auto& item : _sindex )
-               item->object_inserted( result );
-            return result;
+            return load_object( fc::raw::unpack<object_type>( data ) );
          }
 
 
@@ -391,6 +641,8 @@ namespace graphene { namespace db {
             const auto& result = DerivedIndex::create( constructor );
             for( const auto& item : _sindex )
                item->object_inserted( result );
+            ++_object_count;
+            object_changed( result );
             on_add( result );
             return result;
          }
@@ -400,6 +652,8 @@ namespace graphene { namespace db {
             const auto& result = DerivedIndex::insert( std::move( obj ) );
             for( const auto& item : _sindex )
                item->object_inserted( result );
+            ++_object_count;
+            object_changed( result );
             on_add( result );
             return result;
          }
@@ -409,6 +663,8 @@ namespace graphene { namespace db {
             for( const auto& item : _sindex )
                item->object_removed( obj );
             on_remove(obj);
+            object_changed( obj );
+            --_object_count;
             DerivedIndex::remove(obj);
          }
 
@@ -420,6 +676,7 @@ namespace graphene { namespace db {
             DerivedIndex::modify( obj, m );
             for( const auto& item : _sindex )
                item->object_modified( obj );
+            object_changed( obj );
             on_modify( obj );
          }
 
@@ -447,8 +704,72 @@ namespace graphene { namespace db {
          }
 
       private:
+         const object& load_object( object_type&& obj )
+         {
+            const auto& result = DerivedIndex::insert( std::move( obj ) );
+            for( const auto& item : _sindex )
+               item->object_inserted( result );
+            ++_object_count;
+            return result;
+         }
+
+         void object_changed( const object& obj )
+         {
+            if( _all_changed || !track_changes() )
+               return;
+            _changed_instances.insert( obj.id.instance() );
+            // Past this point remembering individual objects costs more than it saves
+            if( _changed_instances.size() > 1024 && _changed_instances.size() > _object_count / 2 )
+            {
+               _all_changed = true;
+               _changed_instances.clear();
+            }
+         }
+
+         void forget_changes()
+         {
+            _changed_instances.clear();
+            _all_changed = false;
+            _saved_next_id = _next_id;
+         }
+
          object_id_type                                 _next_id;
          const direct_index< object_type, DirectBits >* _direct_by_id = nullptr;
+
+         /// Number of objects currently in the index
+         size_t                                         _object_count = 0;
+         /// Instances created, modified or removed since the last save or save_changes
+         std::unordered_set<uint64_t>                   _changed_instances;
+         /// Set instead of tracking individual instances when most of the index has changed
+         bool                                           _all_changed = false;
+         object_id_type                                 _saved_next_id;
+   };
+
+   /**
+    * @class hashed_primary_index
+    * @brief A primary_index that answers lookups by ID from a hashed_id_index instead of the ordered
+    *  by_id index of the derived index, i. e. in constant time.
+    *
+    * Meant for indexes that are too sparse for a direct_index, but whose objects are looked up by ID often.
+    */
+   template<typename DerivedIndex>
+   class hashed_primary_index : public primary_index< DerivedIndex >
+   {
+      public:
+         typedef typename DerivedIndex::object_type object_type;
+
+         hashed_primary_index( object_database& db ) : primary_index< DerivedIndex >( db )
+         {
+            _hashed_by_id = this->template add_secondary_index< hashed_id_index< object_type > >();
+         }
+
+         virtual const object* find( object_id_type id )const override
+         {
+            return _hashed_by_id->find( id );
+         }
+
+      private:
+         const hashed_id_index< object_type >* _hashed_by_id = nullptr;
    };
 
 } } // graphene::db
@@ -27,11 +27,37 @@
 #include <graphene/db/undo_database.hpp>
 
 #include <fc/log/logger.hpp>
+#include <fc/time.hpp>
 
+#include <functional>
 #include <map>
+#include <memory>
 
 namespace graphene { namespace db {
 
+   /**
+    * A point-in-time copy of all objects made by object_database::capture_snapshot
+    */
+   struct snapshot_capture
+   {
+      struct index_copy
+      {
+         uint8_t                      space_id = 0;
+         uint8_t                      type_id = 0;
+         object_id_type               next_id;
+         fc::sha256                   object_version;
+         vector< unique_ptr<object> > objects;
+      };
+
+      vector<char>         header;
+      vector<index_copy>   indexes;
+      /// How long capture_snapshot kept its caller, and thereby block application, waiting
+      fc::microseconds     capture_time;
+   };
+
+   /** Called after each index written to a snapshot with (indexes written, total indexes, bytes written) */
+   typedef std::function<void(uint32_t,uint32_t,uint64_t)> snapshot_progress;
+
    /**
     *   @class object_database
     *   @brief maintains a set of indexed objects that can be modified with multi-level rollback support
@@ -47,9 +73,55 @@ namespace graphene { namespace db {
          void open(const fc::path& data_dir );
 
          /**
-          * Saves the complete state of the object_database to disk, this could take a while
+          * Saves the complete state of the object_database to disk, this could take a while.
+          * In incremental mode only the objects changed since the previous flush are written.
           */
          void flush();
+
+         /**
+          * Enables incremental flushing: each flush() appends a checksummed segment file per changed index
+          * next to the full index files, and an index is rewritten completely once it has accumulated
+          * max_segments segments. 0 disables incremental flushing.
+          *
+          * Indexes only record changed objects while the files on disk are a valid base for the next flush,
+          * i.e. after open() found an object database, or after the first flush. Recording costs one hash set
+          * insert per created, modified or removed object, and the set of an index is dropped in favour of a
+          * single flag once more than half of its objects have changed, so memory stays below one entry per
+          * object.
+          */
+         void enable_incremental_flush( uint32_t max_segments );
+         bool incremental_flush_enabled()const { return _max_segments > 0; }
+
+         /**
+          * Writes all objects of all indexes into a single binary, versioned and checksummed file.
+          * Equivalent to write_snapshot( capture_snapshot( header ), file ).
+          * @param header opaque data stored in front of the objects, returned by load_snapshot
+          */
+         void save_snapshot( const fc::path& file, const vector<char>& header )const;
+         /**
+          * Copies all objects, which is much cheaper than serializing them. The result no longer refers to the
+          * database, so it can be passed to write_snapshot on another thread while the database keeps changing.
+          * The indexes are copied concurrently, one task per index; the caller must not modify the database
+          * until this returns.
+          */
+         std::shared_ptr<snapshot_capture> capture_snapshot( vector<char> header )const;
+         /**
+          * Serializes and compresses each index of a capture in its own task and writes the result to file.
+          * The objects of an index are released as soon as it has been written.
+          */
+         static void write_snapshot( const std::shared_ptr<snapshot_capture>& capture, const fc::path& file,
+                                     const snapshot_progress& progress = snapshot_progress() );
+         /**
+          * Loads a snapshot written by save_snapshot into empty indexes, one index per thread.
+          * Indexes not contained in the snapshot stay empty, sections without a matching index are skipped.
+          * @return the header passed to save_snapshot
+          */
+         vector<char> load_snapshot( const fc::path& file );
+         /**
+          * Hashes the contents and next ids of all indexes. Two databases which applied the same blocks have the
+          * same state hash, regardless of how they applied them.
+          */
+         fc::sha256 state_hash()const;
          void wipe(const fc::path& data_dir); // remove from disk
          void close();
 
@@ -170,8 +242,22 @@ namespace graphene { namespace db {
          void save_undo_add( const object& obj );
          void save_undo_remove( const object& obj );
 
+         /** @return true if the indexes should record which objects change, see enable_incremental_flush */
+         bool track_changes()const { return _max_segments > 0 && _segments_valid; }
+
+         void flush_full();
+         void flush_incremental();
+         void save_segment_manifest( const std::map< uint16_t, std::pair<uint32_t,uint32_t> >& segments )const;
+         void load_segment_manifest();
+
          fc::path                                                  _data_dir;
          vector< vector< unique_ptr<index> > >                     _index;
+
+         uint32_t                                                  _max_segments = 0;
+         /// Whether the files on disk plus the changes tracked by the indexes add up to the current state
+         bool                                                      _segments_valid = false;
+         /// (space << 8 | type) -> [first, last] segment applied on open, first == 0 means start from the full file
+         std::map< uint16_t, std::pair<uint32_t,uint32_t> >        _segments;
    };
 
 } } // graphene::db
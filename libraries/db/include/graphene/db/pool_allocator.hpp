@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+
+#include <fc/reflect/reflect.hpp>
+
+#include <boost/core/demangle.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+namespace graphene { namespace db {
+
+   struct pool_allocator_stats
+   {
+      /// the object type the pool allocates container nodes for
+      std::string name;
+      /// bytes per node, including the container's hooks
+      uint64_t    node_size = 0;
+      /// nodes currently in use
+      uint64_t    live_nodes = 0;
+      /// nodes that have been reserved but are not in use
+      uint64_t    free_nodes = 0;
+      /// total bytes reserved from the system
+      uint64_t    reserved_bytes = 0;
+      /// number of allocations served since startup
+      uint64_t    total_allocations = 0;
+      /// fraction of the reserved memory that is not in use
+      double      fragmentation = 0;
+   };
+
+   /**
+    * @brief A slab allocator for nodes of one size
+    *
+    * Memory is reserved in chunks of many nodes and released nodes are kept in a free list for reuse. Chunks
+    * are never returned to the system, so the pool stays as large as the highest number of nodes ever used
+    * at the same time.
+    *
+    * Each thread allocates from its own chunk and free list, so allocating and releasing nodes takes no lock.
+    * The pool mutex is only taken to reserve a new chunk, when a thread exits and hands its free nodes back,
+    * and for statistics. A node may be released by another thread than the one which allocated it, it is
+    * then reused by the releasing thread.
+    */
+   class node_pool
+   {
+      public:
+         node_pool( size_t node_size, size_t alignment, std::string name );
+         node_pool( const node_pool& ) = delete;
+         node_pool& operator=( const node_pool& ) = delete;
+
+         void*                allocate();
+         void                 deallocate( void* p );
+         pool_allocator_stats get_stats()const;
+
+      private:
+         struct free_node { free_node* next; };
+         struct thread_cache;
+         struct thread_caches;
+
+         /** @return the cache of the calling thread, created on first use */
+         thread_cache& local_cache();
+         /** Gives the cache a free list or a new chunk, called when it has run out of both */
+         void          refill( thread_cache& cache );
+         /** Takes back the free nodes of a thread which is about to exit */
+         void          release( thread_cache& cache );
+
+         mutable std::mutex                  _mutex;
+         /// position of this pool in the per-thread cache table
+         size_t                              _id = 0;
+         const size_t                        _node_size;
+         const size_t                        _nodes_per_chunk;
+         const std::string                   _name;
+         std::vector< std::unique_ptr<char[]> > _chunks;
+         /// caches of the threads using this pool
+         std::vector<thread_cache*>          _caches;
+         /// free nodes left behind by threads which have exited
+         free_node*                          _orphans = nullptr;
+         /// counters of threads which have exited
+         int64_t                             _retired_live = 0;
+         uint64_t                            _retired_allocations = 0;
+   };
+
+   /** @return the statistics of all node pools in use in this process */
+   std::vector<pool_allocator_stats> get_pool_allocator_stats();
+
+   /**
+    * @brief Allocator for the nodes of multi_index_containers holding objects of type Tag
+    *
+    * Single element allocations, i. e. container nodes, are served from a node_pool shared by all containers
+    * of the same node type, anything else is passed on to operator new.
+    *
+    * Usage: pass pool_allocator<ObjectType> as the allocator of the multi_index_container of a generic_index.
+    */
+   template<typename T, typename Tag = T>
+   class pool_allocator
+   {
+      public:
+         typedef T              value_type;
+         typedef T*             pointer;
+         typedef const T*       const_pointer;
+         typedef T&             reference;
+         typedef const T&       const_reference;
+         typedef std::size_t    size_type;
+         typedef std::ptrdiff_t difference_type;
+
+         template<typename U>
+         struct rebind { typedef pool_allocator<U, Tag> other; };
+
+         pool_allocator(){}
+         template<typename U>
+         pool_allocator( const pool_allocator<U, Tag>& ){}
+
+         pointer allocate( size_type n, const void* = nullptr )
+         {
+            if( n == 1 )
+               return static_cast<pointer>( pool().allocate() );
+            return static_cast<pointer>( ::operator new( n * sizeof(T) ) );
+         }
+
+         void deallocate( pointer p, size_type n )
+         {
+            if( n == 1 )
+               pool().deallocate( p );
+            else
+               ::operator delete( p );
+         }
+
+         template<typename U, typename... Args>
+         void construct( U* p, Args&&... args ) { ::new( (void*)p ) U( std::forward<Args>(args)... ); }
+
+         template<typename U>
+         void destroy( U* p ) { p->~U(); }
+
+         pointer       address( reference r )const       { return &r; }
+         const_pointer address( const_reference r )const { return &r; }
+         size_type     max_size()const                   { return size_type(-1) / sizeof(T); }
+
+         template<typename U>
+         bool operator==( const pool_allocator<U, Tag>& )const { return true; }
+         template<typename U>
+         bool operator!=( const pool_allocator<U, Tag>& )const { return false; }
+
+      private:
+         /** The pool lives until the end of the process, containers may be destroyed after static objects */
+         static node_pool& pool()
+         {
+            static node_pool* p = new node_pool( sizeof(T), alignof(T), boost::core::demangle( typeid(Tag).name() ) );
+            return *p;
+         }
+   };
+
+} } // graphene::db
+
+FC_REFLECT( graphene::db::pool_allocator_stats,
+            (name)(node_size)(live_nodes)(free_nodes)(reserved_bytes)(total_allocations)(fragmentation) )
@@ -32,14 +32,37 @@ namespace graphene { namespace db {
    using fc::flat_set;
    class object_database;
 
+   /**
+    * Summary of the changes recorded by one undo session, see undo_database::head(). The objects are owned by
+    * the undo_database and stay valid until the session is undone, merged or dropped.
+    */
    struct undo_state
    {
-      unordered_map<object_id_type, unique_ptr<object> > old_values;
+      unordered_map<object_id_type, const object*>       old_values;
       unordered_map<object_id_type, object_id_type>      old_index_next_ids;
       std::unordered_set<object_id_type>                 new_ids;
-      unordered_map<object_id_type, unique_ptr<object> > removed;
+      unordered_map<object_id_type, const object*>       removed;
    };
 
+   /**
+    * One change recorded in the undo journal. Within a session there is at most one entry per object.
+    */
+   struct undo_entry
+   {
+      enum kind_type : uint8_t
+      {
+         created,             ///< undo removes the object and resets the index's next id
+         modified,            ///< undo restores old_value
+         removed,             ///< undo inserts old_value again
+         created_and_removed  ///< undo only resets the index's next id
+      };
+
+      object_id_type        id;
+      kind_type             kind;
+      /// sequence number of the previous entry for the same object, if any
+      uint64_t              prev;
+      unique_ptr<object>    old_value;
+   };
 
    /**
     * @class undo_database
@@ -116,21 +139,61 @@ namespace graphene { namespace db {
           */
          void pop_commit();
 
-         std::size_t size()const { return _stack.size(); }
+         std::size_t size()const { return _sessions.size(); }
          void set_max_size(size_t new_max_size) { _max_size = new_max_size; }
          size_t max_size()const { return _max_size; }
          uint32_t active_sessions()const { return _active_sessions; }
 
-         const undo_state& head()const;
+         /** @return the changes recorded by the most recent session */
+         undo_state head()const;
+
+         /** @return a position in the journal, for use with changed_since */
+         uint64_t position()const { return _first_seq + _journal.size(); }
+         /**
+          * @return true if the object has been created, modified or removed since position, as long as the
+          * changes have neither been undone nor dropped
+          */
+         bool changed_since( const object_id_type& id, uint64_t position )const
+         {
+            auto itr = _latest.find( id );
+            return itr != _latest.end() && itr->second >= position;
+         }
 
       private:
+         static const uint64_t no_entry = uint64_t(-1);
+
          void undo();
          void merge();
          void commit();
 
+         void        ensure_session();
+         uint64_t    current_session_start()const { return _sessions.back(); }
+         undo_entry& entry( uint64_t seq ) { return _journal[seq - _first_seq]; }
+         void        record( const object_id_type& id, undo_entry::kind_type kind, uint64_t prev, unique_ptr<object> old_value );
+         /** @return a copy of obj, made in a spare object of the same type if there is one */
+         unique_ptr<object> copy_value( const object& obj );
+         /** Keeps an old value that is no longer needed for reuse by copy_value */
+         void        recycle_value( unique_ptr<object> value );
+         vector< unique_ptr<object> >& spare_values( const object_id_type& id );
+         /** Reverts the changes of the most recent session and removes it */
+         void        apply_head();
+         /** Removes the entries from seq to the end of the journal without applying them */
+         void        truncate( uint64_t seq );
+         /** Removes the oldest session */
+         void        drop_oldest();
+
          uint32_t                _active_sessions = 0;
          bool                    _disabled = true;
-         std::deque<undo_state>  _stack;
+         /// all recorded changes, oldest first; entries are addressed by a sequence number. The numbers of
+         /// entries removed from the end of the journal, by undo or when merging, are given to the next entries.
+         std::deque<undo_entry>  _journal;
+         uint64_t                _first_seq = 0;
+         /// sequence number of the first entry of each session, oldest session first
+         std::deque<uint64_t>    _sessions;
+         /// sequence number of the most recent entry for each object in the journal
+         unordered_map<object_id_type, uint64_t> _latest;
+         /// old values which are no longer referenced by the journal, by (space << 8 | type), see copy_value
+         vector< vector< unique_ptr<object> > > _spare_values;
          object_database&        _db;
          size_t                  _max_size = 256;
    };
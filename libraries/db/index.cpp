@@ -40,4 +40,7 @@ namespace graphene { namespace db {
 
    void base_primary_index::on_modify( const object& obj )
    {for( auto ob : _observers ) ob->on_modify(  obj ); }
+
+   bool base_primary_index::track_changes()const
+   { return _db.track_changes(); }
 } } // graphene::chain
@@ -23,11 +23,116 @@
  */
 #include <graphene/db/object_database.hpp>
 
+#include <fc/interprocess/file_mapping.hpp>
+#include <fc/io/fstream.hpp>
 #include <fc/io/raw.hpp>
 #include <fc/container/flat.hpp>
 #include <fc/thread/parallel.hpp>
 #include <fc/uint128.hpp>
 
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include <algorithm>
+#include <exception>
+#include <fstream>
+#include <mutex>
+
+namespace graphene { namespace db { namespace detail {
+
+   /**
+    * Snapshot file layout: magic, format version, opaque header, one section per index in the format of
+    * index::save_objects (possibly compressed), the packed snapshot_footer followed by its sha256, and finally
+    * the position of the footer. Sections are stored in index order.
+    */
+   const uint64_t snapshot_magic          = 0x50414e5344425247ULL; // "GRBDSNAP"
+   const uint32_t snapshot_format_version = 2;
+
+   enum snapshot_compression : uint8_t
+   {
+      snapshot_uncompressed = 0,
+      snapshot_zlib         = 1
+   };
+
+   struct snapshot_section
+   {
+      uint8_t    space_id = 0;
+      uint8_t    type_id = 0;
+      uint8_t    compression = snapshot_uncompressed;
+      uint64_t   offset = 0;
+      /// stored size, i. e. after compression
+      uint64_t   size = 0;
+      /// of the stored bytes
+      fc::sha256 checksum;
+   };
+
+   struct snapshot_footer
+   {
+      fc::sha256                header_checksum;
+      vector<snapshot_section>  sections;
+   };
+
+   /** fc::sha256::hash takes 32 bit sizes, index sections can be larger than that */
+   fc::sha256 checksum_of( const char* data, uint64_t size )
+   {
+      fc::sha256::encoder enc;
+      while( size > 0 )
+      {
+         const uint32_t chunk = uint32_t( std::min<uint64_t>( size, 1 << 30 ) );
+         enc.write( data, chunk );
+         data += chunk;
+         size -= chunk;
+      }
+      return enc.result();
+   }
+
+   /** Waits for all tasks, even if some of them fail, and then rethrows the first failure */
+   void wait_for_all( std::vector<fc::future<void>>& tasks )
+   {
+      std::exception_ptr failure;
+      for( auto& task : tasks )
+         try {
+            task.wait();
+         } catch( ... ) {
+            if( !failure )
+               failure = std::current_exception();
+         }
+      if( failure )
+         std::rethrow_exception( failure );
+   }
+
+   /** Serializes a captured index in the format of index::save_objects and compresses it */
+   std::string compress_index( const snapshot_capture::index_copy& copy )
+   {
+      std::string result;
+      boost::iostreams::filtering_ostream out;
+      out.push( boost::iostreams::zlib_compressor( boost::iostreams::zlib::best_speed ) );
+      out.push( boost::iostreams::back_inserter( result ) );
+      fc::raw::pack( out, copy.next_id );
+      fc::raw::pack( out, copy.object_version );
+      for( const auto& obj : copy.objects )
+         fc::raw::pack( out, obj->pack() );
+      out.reset(); // flushes the compressor
+      return result;
+   }
+
+   vector<char> decompress( const char* data, uint64_t size )
+   {
+      vector<char> result;
+      boost::iostreams::filtering_ostream out;
+      out.push( boost::iostreams::zlib_decompressor() );
+      out.push( boost::iostreams::back_inserter( result ) );
+      out.write( data, size );
+      out.reset();
+      return result;
+   }
+
+} } } // graphene::db::detail
+
+FC_REFLECT( graphene::db::detail::snapshot_section, (space_id)(type_id)(compression)(offset)(size)(checksum) )
+FC_REFLECT( graphene::db::detail::snapshot_footer, (header_checksum)(sections) )
+
 namespace graphene { namespace db {
 
 object_database::object_database()
@@ -70,8 +175,17 @@ index& object_database::get_mutable_index(uint8_t space_id, uint8_t type_id)
 }
 
 void object_database::flush()
+{
+   if( incremental_flush_enabled() && _segments_valid )
+      flush_incremental();
+   else
+      flush_full();
+}
+
+void object_database::flush_full()
 {
 //   ilog("Save object_database in ${d}", ("d", _data_dir));
+   _segments_valid = false;
    fc::create_directories( _data_dir / "object_database.tmp" / "lock" );
    std::vector<fc::future<void>> tasks;
    tasks.reserve(200);
@@ -92,6 +206,291 @@ void object_database::flush()
       fc::rename( _data_dir / "object_database", _data_dir / "object_database.old" );
    fc::rename( _data_dir / "object_database.tmp", _data_dir / "object_database" );
    fc::remove_all( _data_dir / "object_database.old" );
+   _segments.clear();
+   _segments_valid = true;
+}
+
+void object_database::flush_incremental()
+{
+   const fc::path db_dir = _data_dir / "object_database";
+   // If anything below fails the tracked changes are partially lost, so the next flush has to be a full one
+   _segments_valid = false;
+   auto segments = _segments;
+   std::vector<fc::future<void>> tasks;
+   tasks.reserve(200);
+   for( uint32_t space = 0; space < _index.size(); ++space )
+      for( uint32_t type = 0; type < _index[space].size(); ++type )
+      {
+         index* idx = _index[space][type].get();
+         if( !idx || !idx->has_changes() )
+            continue;
+         auto& range = segments[ uint16_t( (space << 8) | type ) ];
+         const uint32_t count = range.first == 0 ? range.second : range.second - range.first + 1;
+         const bool full = idx->needs_full_save() || count >= _max_segments;
+         ++range.second;
+         if( full )
+            range.first = range.second;
+         const fc::path segment = db_dir / fc::to_string(space) / ( fc::to_string(type) + "." + fc::to_string(range.second) );
+         tasks.push_back( fc::do_parallel( [idx,segment,full] () {
+            idx->save_changes( segment, full );
+         } ) );
+      }
+   for( auto& task : tasks )
+      task.wait();
+
+   // Committing the manifest makes the new segments part of the state
+   save_segment_manifest( segments );
+
+   // Remove segments made obsolete by full ones
+   for( const auto& item : segments )
+   {
+      auto old = _segments.find( item.first );
+      const uint32_t old_first = ( old == _segments.end() || old->second.first == 0 ) ? 1 : old->second.first;
+      const fc::path dir = db_dir / fc::to_string( item.first >> 8 );
+      for( uint32_t n = old_first; n < item.second.first; ++n )
+         fc::remove( dir / ( fc::to_string( item.first & 0xff ) + "." + fc::to_string(n) ) );
+   }
+   _segments = std::move( segments );
+   _segments_valid = true;
+}
+
+void object_database::save_segment_manifest( const std::map< uint16_t, std::pair<uint32_t,uint32_t> >& segments )const
+{
+   const fc::path manifest = _data_dir / "object_database" / "segments";
+   const fc::path tmp = _data_dir / "object_database" / "segments.tmp";
+   const auto data = fc::raw::pack( segments );
+   {
+      std::ofstream out( tmp.generic_string(), std::ofstream::binary | std::ofstream::out | std::ofstream::trunc );
+      FC_ASSERT( out );
+      fc::raw::pack( out, data );
+      fc::raw::pack( out, fc::sha256::hash( data.data(), data.size() ) );
+      out.close();
+      FC_ASSERT( !out.fail(), "Failed to write ${f}", ("f",tmp) );
+   }
+   fc::rename( tmp, manifest );
+}
+
+void object_database::load_segment_manifest()
+{
+   _segments.clear();
+   const fc::path manifest = _data_dir / "object_database" / "segments";
+   if( !fc::exists( manifest ) )
+      return;
+   std::string content;
+   fc::read_file_contents( manifest, content );
+   fc::datastream<const char*> ds( content.data(), content.size() );
+   vector<char> data;
+   fc::sha256 checksum;
+   fc::raw::unpack( ds, data );
+   fc::raw::unpack( ds, checksum );
+   FC_ASSERT( fc::sha256::hash( data.data(), data.size() ) == checksum, "Checksum mismatch in ${f}", ("f",manifest) );
+   _segments = fc::raw::unpack< std::map< uint16_t, std::pair<uint32_t,uint32_t> > >( data );
+}
+
+std::shared_ptr<snapshot_capture> object_database::capture_snapshot( vector<char> header )const
+{ try {
+   const fc::time_point start = fc::time_point::now();
+   auto capture = std::make_shared<snapshot_capture>();
+   capture->header = std::move( header );
+   std::vector<const index*> sources;
+   for( uint32_t space = 0; space < _index.size(); ++space )
+      for( uint32_t type = 0; type < _index[space].size(); ++type )
+      {
+         const index* idx = _index[space][type].get();
+         if( !idx )
+            continue;
+         capture->indexes.emplace_back();
+         auto& copy = capture->indexes.back();
+         copy.space_id = space;
+         copy.type_id = type;
+         copy.next_id = idx->get_next_id();
+         copy.object_version = idx->get_object_version();
+         sources.push_back( idx );
+      }
+
+   // The caller does not modify the database until we return, so the indexes can be read concurrently.
+   // Each task fills the slot of its own index, which keeps the copies in index order.
+   std::vector<fc::future<void>> tasks;
+   tasks.reserve( sources.size() );
+   for( size_t i = 0; i < sources.size(); ++i )
+   {
+      auto* copy = &capture->indexes[i];
+      const index* idx = sources[i];
+      tasks.push_back( fc::do_parallel( [copy,idx] () {
+         idx->inspect_all_objects( [copy]( const object& o ) {
+            copy->objects.emplace_back( o.clone() );
+         });
+      } ) );
+   }
+   detail::wait_for_all( tasks );
+   capture->capture_time = fc::time_point::now() - start;
+   return capture;
+} FC_CAPTURE_AND_RETHROW() }
+
+void object_database::write_snapshot( const std::shared_ptr<snapshot_capture>& capture, const fc::path& file,
+                                      const snapshot_progress& progress )
+{ try {
+   std::ofstream out( file.generic_string(), std::ofstream::binary | std::ofstream::out | std::ofstream::trunc );
+   FC_ASSERT( out, "Unable to open ${f}", ("f",file) );
+   fc::raw::pack( out, detail::snapshot_magic );
+   fc::raw::pack( out, detail::snapshot_format_version );
+   fc::raw::pack( out, capture->header );
+
+   detail::snapshot_footer footer;
+   footer.header_checksum = detail::checksum_of( capture->header.data(), capture->header.size() );
+
+   // One task per index serializes and compresses into its own slot. Sections are written in index order
+   // as soon as all sections before them are done, so the file does not depend on thread timing.
+   const uint32_t total = capture->indexes.size();
+   std::vector<std::string> compressed( total );
+   std::vector<fc::future<void>> tasks;
+   tasks.reserve( total );
+   for( uint32_t i = 0; i < total; ++i )
+   {
+      auto* copy = &capture->indexes[i];
+      auto* data = &compressed[i];
+      tasks.push_back( fc::do_parallel( [copy,data] () {
+         *data = detail::compress_index( *copy );
+         copy->objects.clear(); // no longer needed, give back the memory early
+      } ) );
+   }
+   try
+   {
+      for( uint32_t i = 0; i < total; ++i )
+      {
+         tasks[i].wait();
+         const auto& copy = capture->indexes[i];
+         std::string data = std::move( compressed[i] );
+
+         detail::snapshot_section section;
+         section.space_id = copy.space_id;
+         section.type_id = copy.type_id;
+         section.compression = detail::snapshot_zlib;
+         section.size = data.size();
+         section.checksum = detail::checksum_of( data.data(), data.size() );
+         section.offset = out.tellp();
+         out.write( data.data(), data.size() );
+         FC_ASSERT( out, "Failed to write snapshot" );
+         footer.sections.push_back( section );
+         if( progress )
+            progress( footer.sections.size(), total, section.offset + section.size );
+      }
+   }
+   catch( ... )
+   {
+      // The tasks refer to the slots, let them finish before these go away
+      for( auto& task : tasks )
+         try {
+            task.wait();
+         } catch( ... ) {
+         }
+      throw;
+   }
+
+   const uint64_t footer_pos = out.tellp();
+   const auto packed_footer = fc::raw::pack( footer );
+   fc::raw::pack( out, packed_footer );
+   fc::raw::pack( out, fc::sha256::hash( packed_footer.data(), packed_footer.size() ) );
+   fc::raw::pack( out, footer_pos );
+   out.close();
+   FC_ASSERT( !out.fail(), "Failed to write ${f}", ("f",file) );
+} FC_CAPTURE_AND_RETHROW( (file) ) }
+
+void object_database::save_snapshot( const fc::path& file, const vector<char>& header )const
+{
+   write_snapshot( capture_snapshot( header ), file );
+}
+
+fc::sha256 object_database::state_hash()const
+{
+   fc::sha256::encoder enc;
+   for( uint32_t space = 0; space < _index.size(); ++space )
+      for( uint32_t type = 0; type < _index[space].size(); ++type )
+      {
+         const index* idx = _index[space][type].get();
+         if( !idx )
+            continue;
+         fc::raw::pack( enc, idx->get_next_id() );
+         const fc::uint128 hash = idx->hash();
+         fc::raw::pack( enc, hash.high_bits() );
+         fc::raw::pack( enc, hash.low_bits() );
+      }
+   return enc.result();
+}
+
+vector<char> object_database::load_snapshot( const fc::path& file )
+{ try {
+   fc::file_mapping fm( file.generic_string().c_str(), fc::read_only );
+   fc::mapped_region mr( fm, fc::read_only, 0, fc::file_size(file) );
+   const char* data = (const char*)mr.get_address();
+   const uint64_t size = mr.get_size();
+
+   fc::datastream<const char*> ds( data, size );
+   uint64_t magic;
+   uint32_t format_version;
+   vector<char> header;
+   fc::raw::unpack( ds, magic );
+   FC_ASSERT( magic == detail::snapshot_magic, "${f} is not a binary snapshot", ("f",file) );
+   fc::raw::unpack( ds, format_version );
+   FC_ASSERT( format_version == detail::snapshot_format_version, "Unsupported snapshot format version ${v}",
+              ("v",format_version) );
+   fc::raw::unpack( ds, header );
+
+   uint64_t footer_pos;
+   FC_ASSERT( size >= sizeof(footer_pos), "Truncated snapshot" );
+   fc::datastream<const char*> pos_ds( data + size - sizeof(footer_pos), sizeof(footer_pos) );
+   fc::raw::unpack( pos_ds, footer_pos );
+   FC_ASSERT( footer_pos < size - sizeof(footer_pos), "Truncated snapshot" );
+   fc::datastream<const char*> footer_ds( data + footer_pos, size - sizeof(footer_pos) - footer_pos );
+   vector<char> packed_footer;
+   fc::sha256 footer_checksum;
+   fc::raw::unpack( footer_ds, packed_footer );
+   fc::raw::unpack( footer_ds, footer_checksum );
+   FC_ASSERT( fc::sha256::hash( packed_footer.data(), packed_footer.size() ) == footer_checksum,
+              "Snapshot index table is corrupt" );
+   const auto footer = fc::raw::unpack<detail::snapshot_footer>( packed_footer );
+   FC_ASSERT( detail::checksum_of( header.data(), header.size() ) == footer.header_checksum, "Snapshot header is corrupt" );
+
+   std::vector<fc::future<void>> tasks;
+   tasks.reserve( footer.sections.size() );
+   for( const auto& section : footer.sections )
+   {
+      FC_ASSERT( section.offset <= footer_pos && section.size <= footer_pos - section.offset,
+                 "Snapshot section ${s}.${t} out of range", ("s",section.space_id)("t",section.type_id) );
+      if( _index.size() <= section.space_id || _index[section.space_id].size() <= section.type_id
+            || !_index[section.space_id][section.type_id] )
+      {
+         wlog( "Skipping snapshot section ${s}.${t}, there is no such index", ("s",section.space_id)("t",section.type_id) );
+         continue;
+      }
+      index* idx = _index[section.space_id][section.type_id].get();
+      const char* section_data = data + section.offset;
+      tasks.push_back( fc::do_parallel( [idx,section,section_data] () {
+         FC_ASSERT( detail::checksum_of( section_data, section.size ) == section.checksum,
+                    "Snapshot section ${s}.${t} is corrupt", ("s",section.space_id)("t",section.type_id) );
+         if( section.compression == detail::snapshot_uncompressed )
+            idx->load_objects( section_data, section.size );
+         else
+         {
+            FC_ASSERT( section.compression == detail::snapshot_zlib, "Unknown compression ${c} in snapshot section ${s}.${t}",
+                       ("c",section.compression)("s",section.space_id)("t",section.type_id) );
+            const auto raw = detail::decompress( section_data, section.size );
+            idx->load_objects( raw.data(), raw.size() );
+         }
+      } ) );
+   }
+   // The tasks read from the mapping, so all of them have to finish before it goes away
+   detail::wait_for_all( tasks );
+   // The loaded state is not on disk yet
+   _segments_valid = false;
+   return header;
+} FC_CAPTURE_AND_RETHROW( (file) ) }
+
+void object_database::enable_incremental_flush( uint32_t max_segments )
+{
+   _max_segments = max_segments;
+   // Changes made so far were not tracked
+   _segments_valid = false;
 }
 
 void object_database::wipe(const fc::path& data_dir)
@@ -99,28 +498,44 @@ void object_database::wipe(const fc::path& data_dir)
    close();
    ilog("Wiping object database...");
    fc::remove_all(data_dir / "object_database");
+   _segments.clear();
+   _segments_valid = false;
    ilog("Done wiping object databse.");
 }
 
 void object_database::open(const fc::path& data_dir)
 { try {
    _data_dir = data_dir;
+   _segments.clear();
+   _segments_valid = false;
    if( fc::exists( _data_dir / "object_database" / "lock" ) )
    {
        wlog("Ignoring locked object_database");
        return;
    }
+   load_segment_manifest();
    std::vector<fc::future<void>> tasks;
    tasks.reserve(200);
    ilog("Opening object database from ${d} ...", ("d", data_dir));
    for( uint32_t space = 0; space < _index.size(); ++space )
       for( uint32_t type = 0; type  < _index[space].size(); ++type )
          if( _index[space][type] )
-            tasks.push_back( fc::do_parallel( [this,space,type] () {
-               _index[space][type]->open( _data_dir / "object_database" / fc::to_string(space)/fc::to_string(type) );
+         {
+            std::pair<uint32_t,uint32_t> range( 0, 0 );
+            auto itr = _segments.find( uint16_t( (space << 8) | type ) );
+            if( itr != _segments.end() )
+               range = itr->second;
+            tasks.push_back( fc::do_parallel( [this,space,type,range] () {
+               const fc::path base = _data_dir / "object_database" / fc::to_string(space)/fc::to_string(type);
+               if( range.first == 0 )
+                  _index[space][type]->open( base );
+               for( uint32_t n = std::max( range.first, 1u ); n <= range.second; ++n )
+                  _index[space][type]->load_changes( base.generic_string() + "." + fc::to_string(n) );
             } ) );
-   for( auto& task : tasks )
-      task.wait();
+         }
+   // Let every task finish before reporting a damaged file, they all refer to this object
+   detail::wait_for_all( tasks );
+   _segments_valid = fc::exists( _data_dir / "object_database" );
    ilog( "Done opening object database." );
 
 } FC_CAPTURE_AND_RETHROW( (data_dir) ) }
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <graphene/db/pool_allocator.hpp>
+
+#include <fc/exception/exception.hpp>
+
+#include <algorithm>
+
+namespace graphene { namespace db {
+
+   namespace {
+      struct pool_registry
+      {
+         std::mutex               mutex;
+         std::vector<node_pool*>  pools;
+      };
+
+      pool_registry& registry()
+      {
+         static pool_registry* r = new pool_registry();
+         return *r;
+      }
+   }
+
+   /** Free nodes and counters of one thread. Only the owning thread modifies it, others read the counters. */
+   struct node_pool::thread_cache
+   {
+      explicit thread_cache( node_pool& p ) : pool( p ) {}
+
+      node_pool&            pool;
+      free_node*            free_list = nullptr;
+      char*                 chunk_next = nullptr;
+      char*                 chunk_end = nullptr;
+      /// may become negative in a thread which releases nodes allocated by another one
+      std::atomic<int64_t>  live{0};
+      std::atomic<uint64_t> allocations{0};
+   };
+
+   /** The caches of one thread for all pools, indexed by node_pool::_id */
+   struct node_pool::thread_caches
+   {
+      ~thread_caches()
+      {
+         for( auto& cache : caches )
+            if( cache )
+               cache->pool.release( *cache );
+      }
+
+      std::vector< std::unique_ptr<thread_cache> > caches;
+   };
+
+   node_pool::node_pool( size_t node_size, size_t alignment, std::string name )
+   : _node_size( (std::max( node_size, sizeof(free_node) ) + alignment - 1) / alignment * alignment ),
+     _nodes_per_chunk( std::max<size_t>( 64, (64 << 10) / _node_size ) ),
+     _name( std::move(name) )
+   {
+      FC_ASSERT( alignment <= alignof(std::max_align_t), "Over-aligned nodes are not supported" );
+      pool_registry& r = registry();
+      std::lock_guard<std::mutex> guard( r.mutex );
+      _id = r.pools.size();
+      r.pools.push_back( this );
+   }
+
+   node_pool::thread_cache& node_pool::local_cache()
+   {
+      static thread_local thread_caches local;
+      if( local.caches.size() <= _id )
+         local.caches.resize( _id + 1 );
+      auto& cache = local.caches[_id];
+      if( !cache )
+      {
+         cache.reset( new thread_cache( *this ) );
+         std::lock_guard<std::mutex> guard( _mutex );
+         _caches.push_back( cache.get() );
+      }
+      return *cache;
+   }
+
+   void* node_pool::allocate()
+   {
+      thread_cache& cache = local_cache();
+      // Only this thread writes the counters, plain loads and stores avoid locked instructions
+      cache.live.store( cache.live.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+      cache.allocations.store( cache.allocations.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+      if( cache.free_list == nullptr && cache.chunk_next == cache.chunk_end )
+         refill( cache );
+      if( cache.free_list != nullptr )
+      {
+         free_node* result = cache.free_list;
+         cache.free_list = result->next;
+         return result;
+      }
+      void* result = cache.chunk_next;
+      cache.chunk_next += _node_size;
+      return result;
+   }
+
+   void node_pool::deallocate( void* p )
+   {
+      thread_cache& cache = local_cache();
+      free_node* node = static_cast<free_node*>( p );
+      node->next = cache.free_list;
+      cache.free_list = node;
+      cache.live.store( cache.live.load( std::memory_order_relaxed ) - 1, std::memory_order_relaxed );
+   }
+
+   void node_pool::refill( thread_cache& cache )
+   {
+      std::lock_guard<std::mutex> guard( _mutex );
+      if( _orphans != nullptr )
+      {
+         cache.free_list = _orphans;
+         _orphans = nullptr;
+         return;
+      }
+      _chunks.emplace_back( new char[ _node_size * _nodes_per_chunk ] );
+      cache.chunk_next = _chunks.back().get();
+      cache.chunk_end = cache.chunk_next + _node_size * _nodes_per_chunk;
+   }
+
+   void node_pool::release( thread_cache& cache )
+   {
+      // The rest of the current chunk becomes free nodes as well
+      for( ; cache.chunk_next != cache.chunk_end; cache.chunk_next += _node_size )
+      {
+         free_node* node = reinterpret_cast<free_node*>( cache.chunk_next );
+         node->next = cache.free_list;
+         cache.free_list = node;
+      }
+      std::lock_guard<std::mutex> guard( _mutex );
+      while( cache.free_list != nullptr )
+      {
+         free_node* node = cache.free_list;
+         cache.free_list = node->next;
+         node->next = _orphans;
+         _orphans = node;
+      }
+      _retired_live += cache.live.load( std::memory_order_relaxed );
+      _retired_allocations += cache.allocations.load( std::memory_order_relaxed );
+      _caches.erase( std::remove( _caches.begin(), _caches.end(), &cache ), _caches.end() );
+   }
+
+   pool_allocator_stats node_pool::get_stats()const
+   {
+      std::lock_guard<std::mutex> guard( _mutex );
+      int64_t live = _retired_live;
+      uint64_t allocations = _retired_allocations;
+      for( const thread_cache* cache : _caches )
+      {
+         live += cache->live.load( std::memory_order_relaxed );
+         allocations += cache->allocations.load( std::memory_order_relaxed );
+      }
+      pool_allocator_stats result;
+      result.name = _name;
+      result.node_size = _node_size;
+      result.live_nodes = uint64_t( std::max<int64_t>( live, 0 ) );
+      result.reserved_bytes = uint64_t(_chunks.size()) * _nodes_per_chunk * _node_size;
+      result.free_nodes = result.reserved_bytes / _node_size - result.live_nodes;
+      result.total_allocations = allocations;
+      if( result.reserved_bytes > 0 )
+         result.fragmentation = double( result.free_nodes * _node_size ) / result.reserved_bytes;
+      return result;
+   }
+
+   std::vector<pool_allocator_stats> get_pool_allocator_stats()
+   {
+      pool_registry& r = registry();
+      std::lock_guard<std::mutex> guard( r.mutex );
+      std::vector<pool_allocator_stats> result;
+      result.reserve( r.pools.size() );
+      for( const node_pool* pool : r.pools )
+         result.push_back( pool->get_stats() );
+      return result;
+   }
+
+} } // graphene::db
@@ -51,86 +51,178 @@ undo_database::session undo_database::start_undo_session( bool force_enable )
       _disabled = false;
 
    while( size() > max_size() )
-      _stack.pop_front();
+      drop_oldest();
 
-   _stack.emplace_back();
+   _sessions.push_back( _first_seq + _journal.size() );
    ++_active_sessions;
    return session(*this, disable_on_exit );
 }
+
+void undo_database::ensure_session()
+{
+   if( _sessions.empty() )
+      _sessions.push_back( _first_seq + _journal.size() );
+}
+
+void undo_database::record( const object_id_type& id, undo_entry::kind_type kind, uint64_t prev,
+                            unique_ptr<object> old_value )
+{
+   const uint64_t seq = _first_seq + _journal.size();
+   _journal.emplace_back();
+   undo_entry& e = _journal.back();
+   e.id = id;
+   e.kind = kind;
+   e.prev = prev;
+   e.old_value = std::move( old_value );
+   _latest[id] = seq;
+}
+
+vector< unique_ptr<object> >& undo_database::spare_values( const object_id_type& id )
+{
+   const size_t slot = ( size_t( id.space() ) << 8 ) | id.type();
+   if( _spare_values.size() <= slot )
+      _spare_values.resize( slot + 1 );
+   return _spare_values[slot];
+}
+
+unique_ptr<object> undo_database::copy_value( const object& obj )
+{
+   auto& spare = spare_values( obj.id );
+   if( spare.empty() )
+      return obj.clone();
+   unique_ptr<object> result = std::move( spare.back() );
+   spare.pop_back();
+   result->copy_from( obj );
+   return result;
+}
+
+void undo_database::recycle_value( unique_ptr<object> value )
+{
+   // Enough to cover the objects of one type touched by a typical block
+   static const size_t max_spare_values = 256;
+   if( !value )
+      return;
+   auto& spare = spare_values( value->id );
+   if( spare.size() < max_spare_values )
+      spare.push_back( std::move( value ) );
+}
+
 void undo_database::on_create( const object& obj )
 {
    if( _disabled ) return;
 
-   if( _stack.empty() )
-      _stack.emplace_back();
-   auto& state = _stack.back();
-   auto index_id = object_id_type( obj.id.space(), obj.id.type(), 0 );
-   auto itr = state.old_index_next_ids.find( index_id );
-   if( itr == state.old_index_next_ids.end() )
-      state.old_index_next_ids[index_id] = obj.id;
-   state.new_ids.insert(obj.id);
+   ensure_session();
+   auto itr = _latest.find( obj.id );
+   if( itr != _latest.end() && itr->second >= current_session_start() )
+   {
+      // del(was=X) + new -> upd(was=X), the object is back and only its value has to be restored
+      undo_entry& e = entry( itr->second );
+      assert( e.kind == undo_entry::removed );
+      if( e.kind == undo_entry::removed )
+         e.kind = undo_entry::modified;
+      return;
+   }
+   record( obj.id, undo_entry::created, itr == _latest.end() ? no_entry : itr->second, unique_ptr<object>() );
 }
 void undo_database::on_modify( const object& obj )
 {
    if( _disabled ) return;
 
-   if( _stack.empty() )
-      _stack.emplace_back();
-   auto& state = _stack.back();
-   if( state.new_ids.find(obj.id) != state.new_ids.end() )
+   ensure_session();
+   auto itr = _latest.find( obj.id );
+   // new or already modified in this session
+   if( itr != _latest.end() && itr->second >= current_session_start() )
       return;
-   auto itr =  state.old_values.find(obj.id);
-   if( itr != state.old_values.end() ) return;
-   state.old_values[obj.id] = obj.clone();
+   record( obj.id, undo_entry::modified, itr == _latest.end() ? no_entry : itr->second, copy_value( obj ) );
 }
 void undo_database::on_remove( const object& obj )
 {
    if( _disabled ) return;
 
-   if( _stack.empty() )
-      _stack.emplace_back();
-   undo_state& state = _stack.back();
-   if( state.new_ids.count(obj.id) )
+   ensure_session();
+   auto itr = _latest.find( obj.id );
+   if( itr != _latest.end() && itr->second >= current_session_start() )
    {
-      state.new_ids.erase(obj.id);
+      undo_entry& e = entry( itr->second );
+      if( e.kind == undo_entry::created )
+         e.kind = undo_entry::created_and_removed; // new + del -> nop, except for the next id
+      else if( e.kind == undo_entry::modified )
+         e.kind = undo_entry::removed; // upd(was=X) + del -> del(was=X)
       return;
    }
-   if( state.old_values.count(obj.id) )
+   record( obj.id, undo_entry::removed, itr == _latest.end() ? no_entry : itr->second, copy_value( obj ) );
+}
+
+void undo_database::apply_head()
+{
+   const uint64_t start = current_session_start();
+   const uint64_t end = _first_seq + _journal.size();
+
+   for( uint64_t seq = start; seq < end; ++seq )
    {
-      state.removed[obj.id] = std::move(state.old_values[obj.id]);
-      state.old_values.erase(obj.id);
-      return;
+      undo_entry& e = entry( seq );
+      if( e.kind == undo_entry::modified )
+         _db.modify( _db.get_object( e.id ), [&e]( object& obj ){ obj.move_from( *e.old_value ); } );
    }
-   if( state.removed.count(obj.id) ) return;
-   state.removed[obj.id] = obj.clone();
-}
 
-void undo_database::undo()
-{ try {
-   FC_ASSERT( !_disabled );
-   FC_ASSERT( _active_sessions > 0 );
-   disable();
+   // Going backwards the last next id set for each index is the one of the first object created in it
+   for( uint64_t seq = end; seq > start; --seq )
+   {
+      undo_entry& e = entry( seq - 1 );
+      if( e.kind == undo_entry::created )
+         _db.remove( _db.get_object( e.id ) );
+      if( e.kind == undo_entry::created || e.kind == undo_entry::created_and_removed )
+         _db.get_mutable_index( e.id.space(), e.id.type() ).set_next_id( e.id );
+   }
 
-   auto& state = _stack.back();
-   for( auto& item : state.old_values )
+   for( uint64_t seq = start; seq < end; ++seq )
    {
-      _db.modify( _db.get_object( item.second->id ), [&]( object& obj ){ obj.move_from( *item.second ); } );
+      undo_entry& e = entry( seq );
+      if( e.kind == undo_entry::removed )
+         _db.insert( std::move( *e.old_value ) );
    }
 
-   for( auto ritr = state.new_ids.begin(); ritr != state.new_ids.end(); ++ritr  )
+   truncate( start );
+   _sessions.pop_back();
+}
+
+void undo_database::truncate( uint64_t seq )
+{
+   while( _first_seq + _journal.size() > seq )
    {
-      _db.remove( _db.get_object(*ritr) );
+      const undo_entry& e = _journal.back();
+      if( e.prev != no_entry && e.prev >= _first_seq )
+         _latest[e.id] = e.prev;
+      else
+         _latest.erase( e.id );
+      recycle_value( std::move( _journal.back().old_value ) );
+      _journal.pop_back();
    }
+}
 
-   for( auto& item : state.old_index_next_ids )
+void undo_database::drop_oldest()
+{
+   const uint64_t end = _sessions.size() > 1 ? _sessions[1] : _first_seq + _journal.size();
+   while( _first_seq < end )
    {
-      _db.get_mutable_index( item.first.space(), item.first.type() ).set_next_id( item.second );
+      const undo_entry& e = _journal.front();
+      auto itr = _latest.find( e.id );
+      if( itr != _latest.end() && itr->second == _first_seq )
+         _latest.erase( itr );
+      recycle_value( std::move( _journal.front().old_value ) );
+      _journal.pop_front();
+      ++_first_seq;
    }
+   _sessions.pop_front();
+}
 
-   for( auto& item : state.removed )
-      _db.insert( std::move(*item.second) );
+void undo_database::undo()
+{ try {
+   FC_ASSERT( !_disabled );
+   FC_ASSERT( _active_sessions > 0 );
+   disable();
 
-   _stack.pop_back();
+   apply_head();
    enable();
    --_active_sessions;
 } FC_CAPTURE_AND_RETHROW() }
@@ -138,23 +230,25 @@ void undo_database::undo()
 void undo_database::merge()
 {
    FC_ASSERT( _active_sessions > 0 );
-   if( _active_sessions == 1 && _stack.size() == 1 )
+   if( _active_sessions == 1 && _sessions.size() == 1 )
    {
-      _stack.pop_back();
+      truncate( current_session_start() );
+      _sessions.pop_back();
       --_active_sessions;
       return;
    }
-   FC_ASSERT( _stack.size() >=2 );
-   auto& state = _stack.back();
-   auto& prev_state = _stack[_stack.size()-2];
-
-   // An object's relationship to a state can be:
-   // in new_ids            : new
-   // in old_values (was=X) : upd(was=X)
-   // in removed (was=X)    : del(was=X)
-   // not in any of above   : nop
+   FC_ASSERT( _sessions.size() >=2 );
+   const uint64_t prev_start = _sessions[_sessions.size()-2];
+   const uint64_t start = current_session_start();
+   const uint64_t end = _first_seq + _journal.size();
+
+   // An object's relationship to a session can be:
+   // created            : new
+   // modified (was=X)   : upd(was=X)
+   // removed (was=X)    : del(was=X)
+   // no entry           : nop
    //
-   // When merging A=prev_state and B=state we have a 4x4 matrix of all possibilities:
+   // When merging A=previous session and B=merged session we have a 4x4 matrix of all possibilities:
    //
    //                   |--------------------- B ----------------------|
    //
@@ -170,89 +264,55 @@ void undo_database::merge()
    // \ | nop        | new       B| upd(was=Y)B| del(was=Y)B| nop      AB|
    //   +------------+------------+------------+------------+------------+
    //
-   // Each entry was composed by labelling what should occur in the given case.
-   //
-   // Type A means the composition of states contains the same entry as the first of the two merged states for that object.
-   // Type B means the composition of states contains the same entry as the second of the two merged states for that object.
-   // Type C means the composition of states contains an entry different from either of the merged states for that object.
-   // Type N/A means the composition of states violates causal timing.
+   // Type A means the composition contains the same entry as the first of the two merged sessions for that object.
+   // Type B means the composition contains the same entry as the second of the two merged sessions for that object.
+   // Type C means the composition contains an entry different from either of the merged sessions for that object.
+   // Type N/A means the composition violates causal timing.
    // Type AB means both type A and type B simultaneously.
    //
-   // The merge() operation is defined as modifying prev_state in-place to be the state object which represents the composition of
-   // state A and B.
-   //
-   // Type A (and AB) can be implemented as a no-op; prev_state already contains the correct value for the merged state.
-   // Type B (and AB) can be implemented by copying from state to prev_state.
-   // Type C needs special case-by-case logic.
-   // Type N/A can be ignored or assert(false) as it can only occur if prev_state and state have illegal values
-   // (a serious logic error which should never happen).
-   //
-
-   // We can only be outside type A/AB (the nop path) if B is not nop, so it suffices to iterate through B's three containers.
-
-   // *+upd
-   for( auto& obj : state.old_values )
-   {
-      if( prev_state.new_ids.find(obj.second->id) != prev_state.new_ids.end() )
-      {
-         // new+upd -> new, type A
-         continue;
-      }
-      if( prev_state.old_values.find(obj.second->id) != prev_state.old_values.end() )
-      {
-         // upd(was=X) + upd(was=Y) -> upd(was=X), type A
-         continue;
-      }
-      // del+upd -> N/A
-      assert( prev_state.removed.find(obj.second->id) == prev_state.removed.end() );
-      // nop+upd(was=Y) -> upd(was=Y), type B
-      prev_state.old_values[obj.second->id] = std::move(obj.second);
-   }
-
-   // *+new, but we assume the N/A cases don't happen, leaving type B nop+new -> new
-   for( auto id : state.new_ids )
-      prev_state.new_ids.insert(id);
+   // Both sessions are adjacent ranges of the journal and each entry knows the previous entry for its object, so
+   // the merge only has to visit the entries of B. Entries of type B stay where they are and now simply belong
+   // to A, entries of type A and C are dropped after adjusting the entry in A. "nop" in A is represented by a
+   // created_and_removed entry, which still has to reset the next id.
 
-   // old_index_next_ids can only be updated, iterate over *+upd cases
-   for( auto& item : state.old_index_next_ids )
+   uint64_t out = start;
+   for( uint64_t seq = start; seq < end; ++seq )
    {
-      if( prev_state.old_index_next_ids.find( item.first ) == prev_state.old_index_next_ids.end() )
+      undo_entry& e = entry( seq );
+      if( e.prev != no_entry && e.prev >= prev_start )
       {
-         // nop+upd(was=Y) -> upd(was=Y), type B
-         prev_state.old_index_next_ids[item.first] = item.second;
+         undo_entry& a = entry( e.prev );
+         if( e.kind == undo_entry::removed )
+         {
+            if( a.kind == undo_entry::created )
+               a.kind = undo_entry::created_and_removed; // new + del -> nop, type C
+            else if( a.kind == undo_entry::modified )
+               a.kind = undo_entry::removed; // upd(was=X) + del(was=Y) -> del(was=X), type C
+            else
+               assert( !"del + del" );
+         }
+         else
+         {
+            // new+upd -> new, upd(was=X)+upd(was=Y) -> upd(was=X), type A
+            assert( e.kind == undo_entry::modified
+                    && ( a.kind == undo_entry::created || a.kind == undo_entry::modified ) );
+         }
+         _latest[e.id] = e.prev;
+         recycle_value( std::move( e.old_value ) );
          continue;
       }
-      else
+      // type B
+      if( out != seq )
       {
-         // upd(was=X)+upd(was=Y) -> upd(was=X), type A
-         // type A implementation is a no-op, as discussed above, so there is no code here
-         continue;
+         entry( out ) = std::move( e );
+         _latest[entry( out ).id] = out;
       }
+      ++out;
    }
+   while( _first_seq + _journal.size() > out )
+      _journal.pop_back();
 
-   // *+del
-   for( auto& obj : state.removed )
-   {
-      if( prev_state.new_ids.find(obj.second->id) != prev_state.new_ids.end() )
-      {
-         // new + del -> nop (type C)
-         prev_state.new_ids.erase(obj.second->id);
-         continue;
-      }
-      auto it = prev_state.old_values.find(obj.second->id);
-      if( it != prev_state.old_values.end() )
-      {
-         // upd(was=X) + del(was=Y) -> del(was=X)
-         prev_state.removed[obj.second->id] = std::move(it->second);
-         prev_state.old_values.erase(obj.second->id);
-         continue;
-      }
-      // del + del -> N/A
-      assert( prev_state.removed.find( obj.second->id ) == prev_state.removed.end() );
-      // nop + del(was=Y) -> del(was=Y)
-      prev_state.removed[obj.second->id] = std::move(obj.second);
-   }
-   _stack.pop_back();
+   _sessions.pop_back();
    --_active_sessions;
 }
 void undo_database::commit()
@@ -264,31 +324,11 @@ void undo_database::commit()
 void undo_database::pop_commit()
 {
    FC_ASSERT( _active_sessions == 0 );
-   FC_ASSERT( !_stack.empty() );
+   FC_ASSERT( !_sessions.empty() );
 
    disable();
    try {
-      auto& state = _stack.back();
-
-      for( auto& item : state.old_values )
-      {
-         _db.modify( _db.get_object( item.second->id ), [&]( object& obj ){ obj.move_from( *item.second ); } );
-      }
-
-      for( auto ritr = state.new_ids.begin(); ritr != state.new_ids.end(); ++ritr  )
-      {
-         _db.remove( _db.get_object(*ritr) );
-      }
-
-      for( auto& item : state.old_index_next_ids )
-      {
-         _db.get_mutable_index( item.first.space(), item.first.type() ).set_next_id( item.second );
-      }
-
-      for( auto& item : state.removed )
-         _db.insert( std::move(*item.second) );
-
-      _stack.pop_back();
+      apply_head();
    }
    catch ( const fc::exception& e )
    {
@@ -298,10 +338,26 @@ void undo_database::pop_commit()
    }
    enable();
 }
-const undo_state& undo_database::head()const
+
+undo_state undo_database::head()const
 {
-   FC_ASSERT( !_stack.empty() );
-   return _stack.back();
+   FC_ASSERT( !_sessions.empty() );
+   undo_state result;
+   for( uint64_t seq = _sessions.back(); seq < _first_seq + _journal.size(); ++seq )
+   {
+      const undo_entry& e = _journal[seq - _first_seq];
+      if( e.kind == undo_entry::created || e.kind == undo_entry::created_and_removed )
+      {
+         result.old_index_next_ids.emplace( object_id_type( e.id.space(), e.id.type(), 0 ), e.id );
+         if( e.kind == undo_entry::created )
+            result.new_ids.insert( e.id );
+      }
+      else if( e.kind == undo_entry::modified )
+         result.old_values[e.id] = e.old_value.get();
+      else
+         result.removed[e.id] = e.old_value.get();
+   }
+   return result;
 }
 
 } } // graphene::db
@@ -22,6 +22,7 @@
  * THE SOFTWARE.
  */
 #include <graphene/net/core_messages.hpp>
+#include <graphene/net/message.hpp>
 
 
 namespace graphene { namespace net {
@@ -45,6 +46,25 @@ namespace graphene { namespace net {
   const core_message_type_enum check_firewall_reply_message::type            = core_message_type_enum::check_firewall_reply_message_type;
   const core_message_type_enum get_current_connections_request_message::type = core_message_type_enum::get_current_connections_request_message_type;
   const core_message_type_enum get_current_connections_reply_message::type   = core_message_type_enum::get_current_connections_reply_message_type;
+  const core_message_type_enum compact_block_message::type                   = core_message_type_enum::compact_block_message_type;
+  const core_message_type_enum get_compact_block_transactions_message::type  = core_message_type_enum::get_compact_block_transactions_message_type;
+  const core_message_type_enum compact_block_transactions_message::type      = core_message_type_enum::compact_block_transactions_message_type;
+  const core_message_type_enum compressed_message::type                      = core_message_type_enum::compressed_message_type;
+
+  compact_block_message::compact_block_message(const item_hash_t& block_message_hash, const signed_block& block) :
+    block_message_hash(block_message_hash),
+    header(block)
+  {
+    transactions.reserve(block.transactions.size());
+    for (const graphene::chain::processed_transaction& transaction : block.transactions)
+    {
+      compact_block_transaction compact_transaction;
+      // the same message the peer has received, see application_impl::handle_block()
+      compact_transaction.message_hash = message(trx_message(transaction)).id();
+      compact_transaction.operation_results = transaction.operation_results;
+      transactions.push_back(std::move(compact_transaction));
+    }
+  }
 
 } } // graphene::net
 
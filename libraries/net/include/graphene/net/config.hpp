@@ -71,6 +71,19 @@
  */
 #define GRAPHENE_NET_MESSAGE_CACHE_DURATION_IN_BLOCKS        5
 
+/**
+ * Blocks we fetch from the blockchain to serve peers, e.g. syncing peers, are kept
+ * encoded until this many bytes of newer ones have been served, because several
+ * peers usually ask for the same blocks.
+ */
+#define GRAPHENE_NET_SERVED_ITEM_CACHE_SIZE_IN_BYTES         (32 * 1024 * 1024)
+
+/**
+ * Messages smaller than this are sent uncompressed even to peers which accept
+ * compressed messages, zlib would barely shrink them.
+ */
+#define GRAPHENE_NET_MIN_COMPRESSED_MESSAGE_SIZE             512
+
 /**
  * We prevent a peer from offering us a list of blocks which, if we fetched them
  * all, would result in a blockchain that extended into the future.
@@ -86,6 +86,10 @@ namespace graphene { namespace net {
     check_firewall_reply_message_type            = 5015,
     get_current_connections_request_message_type = 5016,
     get_current_connections_reply_message_type   = 5017,
+    compact_block_message_type                   = 5018,
+    get_compact_block_transactions_message_type  = 5019,
+    compact_block_transactions_message_type      = 5020,
+    compressed_message_type                      = 5021,
     core_message_type_last                       = 5099
   };
 
@@ -400,6 +404,56 @@ namespace graphene { namespace net {
     std::vector<current_connection_data> current_connections;
   };
 
+  /** A transaction of a compact block, which the peer is expected to have received as a trx_message */
+  struct compact_block_transaction
+  {
+    item_hash_t                                    message_hash; ///< of the trx_message of the transaction
+    std::vector<graphene::chain::operation_result> operation_results;
+  };
+
+  /**
+   * Sent instead of a block_message requested during normal operation if the peer has announced
+   * "compact_blocks" in its hello.  The peer rebuilds the block from the transactions it has relayed
+   * and requests the others with a get_compact_block_transactions_message.
+   */
+  struct compact_block_message
+  {
+    static const core_message_type_enum type;
+    item_hash_t                              block_message_hash; ///< the item requested, the hash of the block_message
+    graphene::chain::signed_block_header     header;
+    std::vector<compact_block_transaction>   transactions;
+
+    compact_block_message() {}
+    compact_block_message(const item_hash_t& block_message_hash, const signed_block& block);
+  };
+
+  struct get_compact_block_transactions_message
+  {
+    static const core_message_type_enum type;
+    item_hash_t            block_message_hash;
+    std::vector<uint32_t>  transaction_indexes;
+  };
+
+  struct compact_block_transactions_message
+  {
+    static const core_message_type_enum type;
+    item_hash_t                                         block_message_hash;
+    /// in the order of the transaction_indexes of the request
+    std::vector<graphene::chain::processed_transaction> transactions;
+  };
+
+  /**
+   * Carries another message compressed with zlib.  It is only sent to peers which announced "compression" in
+   * their hello, the connection unwraps it before the node sees it.  See message_compression.hpp
+   */
+  struct compressed_message
+  {
+    static const core_message_type_enum type;
+    uint32_t           original_type;
+    uint32_t           original_size;
+    std::vector<char>  compressed_data;
+  };
+
 
 } } // graphene::net
 
@@ -424,6 +478,10 @@ FC_REFLECT_ENUM( graphene::net::core_message_type_enum,
                  (check_firewall_reply_message_type)
                  (get_current_connections_request_message_type)
                  (get_current_connections_reply_message_type)
+                 (compact_block_message_type)
+                 (get_compact_block_transactions_message_type)
+                 (compact_block_transactions_message_type)
+                 (compressed_message_type)
                  (core_message_type_last) )
 
 FC_REFLECT( graphene::net::trx_message, (trx) )
@@ -508,6 +566,11 @@ FC_REFLECT(graphene::net::get_current_connections_reply_message, (upload_rate_on
                                                             (upload_rate_one_hour)
                                                             (download_rate_one_hour)
                                                             (current_connections))
+FC_REFLECT(graphene::net::compact_block_transaction, (message_hash)(operation_results))
+FC_REFLECT(graphene::net::compact_block_message, (block_message_hash)(header)(transactions))
+FC_REFLECT(graphene::net::get_compact_block_transactions_message, (block_message_hash)(transaction_indexes))
+FC_REFLECT(graphene::net::compact_block_transactions_message, (block_message_hash)(transactions))
+FC_REFLECT(graphene::net::compressed_message, (original_type)(original_size)(compressed_data))
 
 #include <unordered_map>
 #include <fc/crypto/city.hpp>
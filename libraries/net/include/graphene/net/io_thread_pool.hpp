@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+#include <fc/thread/thread.hpp>
+#include <fc/time.hpp>
+#include <fc/variant.hpp>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace graphene { namespace net {
+
+  /** Counters of the messages read and the bytes written on an I/O thread */
+  struct io_thread_counters
+  {
+    std::atomic<uint64_t> messages{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> bytes_written{0};
+  };
+
+  /**
+   *  @brief Threads reading and writing the messages of peer connections
+   *
+   *  Each connection is assigned one of the threads, round robin.  Its read loop decrypts, frames and unpacks
+   *  the messages on that thread and hands them to the thread of the node one at a time, so the node still
+   *  handles the messages of a connection in order.  Outgoing messages are encrypted and written on the same
+   *  thread, so all operations on the socket of a connection happen on one thread like before.
+   *
+   *  The sockets are not rate limited, because fc::rate_limiting_group can only be used from one thread.
+   */
+  class io_thread_pool
+  {
+  public:
+    struct assignment
+    {
+      fc::thread*         thread = nullptr;
+      io_thread_counters* counters = nullptr;
+    };
+
+    explicit io_thread_pool(uint16_t thread_count);
+    ~io_thread_pool();
+
+    /** @return the thread of the next connection */
+    assignment next_thread();
+    size_t size() const { return _threads.size(); }
+
+    /** @return name, CPU time, messages and bytes read and bytes written of each thread */
+    std::vector<fc::variant_object> get_stats() const;
+
+    uint64_t total_bytes_read() const;
+    uint64_t total_bytes_written() const;
+
+  private:
+    std::vector<std::unique_ptr<fc::thread>>         _threads;
+    std::vector<std::unique_ptr<io_thread_counters>> _counters;
+    uint32_t                                         _next = 0;
+  };
+
+  /** @return the CPU time used by the calling thread so far, 0 where the platform does not tell */
+  fc::microseconds current_thread_cpu_time();
+
+} } // graphene::net
@@ -29,6 +29,8 @@
 #include <fc/crypto/ripemd160.hpp>
 #include <fc/reflect/variant.hpp>
 
+#include <memory>
+
 namespace graphene { namespace net {
 
   /**
@@ -56,10 +58,13 @@ namespace graphene { namespace net {
      message(){}
 
      message( message&& m )
-     :message_header(m),data( std::move(m.data) ){}
+     :message_header(m),data( std::move(m.data) ),_id( std::move(m._id) ),_unpacked( std::move(m._unpacked) ){}
 
      message( const message& m )
-     :message_header(m),data( m.data ){}
+     :message_header(m),data( m.data ),_id( m._id ),_unpacked( m._unpacked ){}
+
+     message& operator=( const message& m ) = default;
+     message& operator=( message&& m ) = default;
 
      /**
       *  Assumes that T::type specifies the message type
@@ -74,9 +79,39 @@ namespace graphene { namespace net {
 
      fc::uint160_t id()const
      {
+        if( _id )
+           return *_id;
         return fc::ripemd160::hash( data.data(), (uint32_t)data.size() );
      }
 
+     /**
+      *  Computes the hash now, id() returns it later.  Used by the I/O threads so that the thread of the node
+      *  does not need to.
+      */
+     void hash_ahead()
+     {
+        _id = std::make_shared<const fc::uint160_t>( fc::ripemd160::hash( data.data(), (uint32_t)data.size() ) );
+     }
+
+     /**
+      *  Also unpacks the contents as T now, as<T>() returns a copy later.  Contents which cannot be unpacked
+      *  are left alone, as<T>() reports the error when the node asks for them.
+      */
+     template<typename T>
+     void unpack_ahead()
+     {
+        hash_ahead();
+        if( msg_type != T::type )
+           return;
+        try
+        {
+           _unpacked = std::make_shared<const T>( as<T>() );
+        }
+        catch( const fc::exception& )
+        {
+        }
+     }
+
      /**
       *  Automatically checks the type and deserializes T in the
       *  opposite process from the constructor.
@@ -86,6 +121,8 @@ namespace graphene { namespace net {
      {
          try {
           FC_ASSERT( msg_type == T::type );
+          if( _unpacked )
+             return *std::static_pointer_cast<const T>( _unpacked );
           T tmp;
           if( data.size() )
           {
@@ -106,6 +143,11 @@ namespace graphene { namespace net {
               ("msg_type", msg_type)
               );
      }
+
+  private:
+     /// the hash and the contents computed by unpack_ahead(), shared by the copies of the message
+     std::shared_ptr<const fc::uint160_t> _id;
+     std::shared_ptr<const void>          _unpacked;
   };
 
 
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+#include <graphene/net/message.hpp>
+
+#include <fc/optional.hpp>
+
+namespace graphene { namespace net {
+
+  /**
+   *  Messages of these types are compressed when sent to a peer which announced "compression" in its hello.
+   *  Only blocks are worth it, they make up the bulk of the traffic to a syncing peer.
+   */
+  bool is_compressible_message_type(uint32_t msg_type);
+
+  /**
+   *  Wraps a message into a compressed_message.
+   *  @return nothing if the message is too small to bother or compression does not make it smaller
+   */
+  fc::optional<message> compress_message(const message& message_to_compress);
+
+  /** @return the size of the message carried by a compressed_message, without inflating it */
+  uint32_t get_original_message_size(const message& compressed);
+
+  /**
+   *  @return the message carried by a compressed_message
+   *  @throws fc::exception if the data is corrupted or would inflate beyond MAX_MESSAGE_SIZE
+   */
+  message decompress_message(const message& compressed);
+
+} } // graphene::net
@@ -24,6 +24,7 @@
 #pragma once
 #include <fc/network/tcp_socket.hpp>
 #include <graphene/net/message.hpp>
+#include <graphene/net/io_thread_pool.hpp>
 
 namespace graphene { namespace net {
 
@@ -50,13 +51,25 @@ namespace graphene { namespace net {
        void accept();
        void bind(const fc::ip::endpoint& local_endpoint);
        void connect_to(const fc::ip::endpoint& remote_endpoint);
+       /** Reads and writes the socket on the given thread from now on, must be called before accept() or connect_to() */
+       void set_io_thread(const io_thread_pool::assignment& io_thread);
 
-       void send_message(const message& message_to_send);
+       /**
+        * Compresses the compressible messages sent from now on, once the peer has told it can read them.
+        * Compressed messages from the peer are always accepted.
+        */
+       void enable_compression();
+       bool is_compression_enabled() const;
+
+       /** The message is shared with the I/O thread writing it, which may outlive a canceled call */
+       void send_message(const std::shared_ptr<const message>& message_to_send);
        void close_connection();
        void destroy_connection();
 
        uint64_t       get_total_bytes_sent() const;
        uint64_t       get_total_bytes_received() const;
+       /** The bytes the compressed messages sent have been smaller than the messages themselves */
+       uint64_t       get_total_bytes_saved_by_compression() const;
        fc::time_point get_last_message_sent_time() const;
        fc::time_point get_last_message_received_time() const;
        fc::time_point get_connection_time() const;
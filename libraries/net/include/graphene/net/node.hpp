@@ -79,6 +79,14 @@ namespace graphene { namespace net {
           */
          virtual bool handle_block( const graphene::net::block_message& blk_msg, bool sync_mode, 
                                     std::vector<fc::uint160_t>& contained_transaction_message_ids ) = 0;
+
+         /**
+          *  @brief Called when a sync block arrives, long before it is passed to handle_block()
+          *
+          *  Lets the client start the work on the block which does not depend on the blocks before it, like
+          *  recovering signatures. It is called on the p2p thread and must not block.
+          */
+         virtual void precompute_sync_block( const graphene::net::block_message& blk_msg ) = 0;
          
          /**
           *  @brief Called when a new transaction comes in from the network
@@ -285,6 +293,14 @@ namespace graphene { namespace net {
 
         void set_total_bandwidth_limit(uint32_t upload_bytes_per_second, uint32_t download_bytes_per_second);
 
+        /**
+         * Decrypts, frames and unpacks the incoming messages and encrypts the outgoing ones on this many
+         * threads instead of the thread of the node.  0 keeps all of it on the thread of the node.
+         * Must be called before the node connects to peers.  The bandwidth limits of set_total_bandwidth_limit
+         * do not apply to the connections on I/O threads.
+         */
+        void set_io_threads(uint16_t thread_count);
+
         fc::variant_object network_get_info() const;
         fc::variant_object network_get_usage_stats() const;
 
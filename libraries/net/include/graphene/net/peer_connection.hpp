@@ -68,7 +68,13 @@ namespace graphene { namespace net
       virtual void on_message(peer_connection* originating_peer,
                               const message& received_message) = 0;
       virtual void on_connection_closed(peer_connection* originating_peer) = 0;
-      virtual message get_message_for_item(const item_id& item) = 0;
+      /** @return the encoded item, which may be shared with the send queues of other peers */
+      virtual std::shared_ptr<const message> get_message_for_item(const item_id& item) = 0;
+      /** @return the item compressed for peers which read compressed messages, or as it is if it is not worth it */
+      virtual std::shared_ptr<const message> get_compressed_message_for_item(const item_id& item)
+      {
+        return get_message_for_item(item);
+      }
     };
 
     class peer_connection;
@@ -123,7 +129,7 @@ namespace graphene { namespace net
           enqueue_time(enqueue_time)
         {}
 
-        virtual message get_message(peer_connection_delegate* node) = 0;
+        virtual std::shared_ptr<const message> get_message(peer_connection_delegate* node) = 0;
         /** returns roughly the number of bytes of memory the message is consuming while
          * it is sitting on the queue
          */
@@ -136,16 +142,31 @@ namespace graphene { namespace net
        */
       struct real_queued_message : queued_message
       {
-        message        message_to_send;
-        size_t         message_send_time_field_offset;
+        std::shared_ptr<message> message_to_send;
+        size_t                   message_send_time_field_offset;
 
         real_queued_message(message message_to_send,
                             size_t message_send_time_field_offset = (size_t)-1) :
-          message_to_send(std::move(message_to_send)),
+          message_to_send(std::make_shared<message>(std::move(message_to_send))),
           message_send_time_field_offset(message_send_time_field_offset)
         {}
 
-        message get_message(peer_connection_delegate* node) override;
+        std::shared_ptr<const message> get_message(peer_connection_delegate* node) override;
+        size_t get_size_in_queue() override;
+      };
+
+      /* when you queue up a 'shared_queued_message', the message is shared with the
+       * other peers it is queued for and with the message caches, nothing is copied
+       */
+      struct shared_queued_message : queued_message
+      {
+        std::shared_ptr<const message> message_to_send;
+
+        shared_queued_message(std::shared_ptr<const message> message_to_send) :
+          message_to_send(std::move(message_to_send))
+        {}
+
+        std::shared_ptr<const message> get_message(peer_connection_delegate* node) override;
         size_t get_size_in_queue() override;
       };
 
@@ -156,12 +177,15 @@ namespace graphene { namespace net
       struct virtual_queued_message : queued_message
       {
         item_id item_to_send;
+        /// the peer reads compressed messages, the node keeps the compressed form for all of them
+        bool    compressed;
 
-        virtual_queued_message(item_id item_to_send) :
-          item_to_send(std::move(item_to_send))
+        virtual_queued_message(item_id item_to_send, bool compressed = false) :
+          item_to_send(std::move(item_to_send)),
+          compressed(compressed)
         {}
 
-        message get_message(peer_connection_delegate* node) override;
+        std::shared_ptr<const message> get_message(peer_connection_delegate* node) override;
         size_t get_size_in_queue() override;
       };
 
@@ -254,6 +278,15 @@ namespace graphene { namespace net
       timestamped_items_set_type inventory_advertised_to_peer;
 
       item_to_time_map_type items_requested_from_peer;  /// items we've requested from this peer during normal operation.  fetch from another peer if this peer disconnects
+
+      bool supports_compact_blocks; /// the peer announced "compact_blocks" in its hello, we may answer its block requests with a compact_block_message
+      /** A block rebuilt from a compact_block_message, except for the transactions requested from the peer */
+      struct partial_compact_block
+      {
+        graphene::chain::signed_block block;
+        std::vector<uint32_t>         missing_transaction_indexes;
+      };
+      std::map<item_hash_t, partial_compact_block> compact_blocks_being_completed; /// by hash of the block message
       /// @}
 
       // if they're flooding us with transactions, we set this to avoid fetching for a few seconds to let the
@@ -279,6 +312,11 @@ namespace graphene { namespace net
       virtual ~peer_connection();
 
       fc::tcp_socket& get_socket();
+      /** Moves the socket work to an I/O thread, before accept_connection() or connect_to() */
+      void set_io_thread(const io_thread_pool::assignment& io_thread) { _message_connection.set_io_thread(io_thread); }
+      /** Compresses the large messages sent to the peer from now on, after it has announced "compression" in its hello */
+      void enable_compression() { _message_connection.enable_compression(); }
+      bool is_compression_enabled() const { return _message_connection.is_compression_enabled(); }
       void accept_connection();
       void connect_to(const fc::ip::endpoint& remote_endpoint, fc::optional<fc::ip::endpoint> local_endpoint = fc::optional<fc::ip::endpoint>());
 
@@ -287,12 +325,14 @@ namespace graphene { namespace net
 
       void send_queueable_message(std::unique_ptr<queued_message>&& message_to_send);
       void send_message(const message& message_to_send, size_t message_send_time_field_offset = (size_t)-1);
+      void send_message(const std::shared_ptr<const message>& message_to_send);
       void send_item(const item_id& item_to_send);
       void close_connection();
       void destroy_connection();
 
       uint64_t get_total_bytes_sent() const;
       uint64_t get_total_bytes_received() const;
+      uint64_t get_total_bytes_saved_by_compression() const { return _message_connection.get_total_bytes_saved_by_compression(); }
 
       fc::time_point get_last_message_sent_time() const;
       fc::time_point get_last_message_received_time() const;
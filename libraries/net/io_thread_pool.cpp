@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <graphene/net/io_thread_pool.hpp>
+
+#include <fc/exception/exception.hpp>
+#include <fc/log/logger.hpp>
+#include <fc/variant_object.hpp>
+
+#if defined(__linux__) || defined(__APPLE__)
+# include <time.h>
+#endif
+
+namespace graphene { namespace net {
+
+  io_thread_pool::io_thread_pool(uint16_t thread_count)
+  {
+    FC_ASSERT( thread_count > 0 );
+    _threads.reserve(thread_count);
+    _counters.reserve(thread_count);
+    for (uint16_t i = 0; i < thread_count; ++i)
+    {
+      _threads.emplace_back(new fc::thread("p2p io " + std::to_string(i)));
+      _counters.emplace_back(new io_thread_counters());
+    }
+  }
+
+  io_thread_pool::~io_thread_pool()
+  {
+    for (const auto& thread : _threads)
+      thread->quit();
+  }
+
+  io_thread_pool::assignment io_thread_pool::next_thread()
+  {
+    assignment result;
+    const uint32_t index = _next++ % _threads.size();
+    result.thread = _threads[index].get();
+    result.counters = _counters[index].get();
+    return result;
+  }
+
+  std::vector<fc::variant_object> io_thread_pool::get_stats() const
+  {
+    std::vector<fc::variant_object> result;
+    result.reserve(_threads.size());
+    for (size_t i = 0; i < _threads.size(); ++i)
+    {
+      fc::mutable_variant_object stats;
+      stats["name"] = _threads[i]->name();
+      stats["cpu_us"] = _threads[i]->async([](){ return current_thread_cpu_time().count(); },
+                                           "io thread cpu time").wait();
+      stats["messages"] = _counters[i]->messages.load();
+      stats["bytes"] = _counters[i]->bytes.load();
+      stats["bytes_written"] = _counters[i]->bytes_written.load();
+      result.emplace_back(std::move(stats));
+    }
+    return result;
+  }
+
+  uint64_t io_thread_pool::total_bytes_read() const
+  {
+    uint64_t result = 0;
+    for (const auto& counters : _counters)
+      result += counters->bytes;
+    return result;
+  }
+
+  uint64_t io_thread_pool::total_bytes_written() const
+  {
+    uint64_t result = 0;
+    for (const auto& counters : _counters)
+      result += counters->bytes_written;
+    return result;
+  }
+
+  fc::microseconds current_thread_cpu_time()
+  {
+#if defined(__linux__) || defined(__APPLE__)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+      return fc::microseconds(int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000);
+#endif
+    return fc::microseconds();
+  }
+
+} } // graphene::net
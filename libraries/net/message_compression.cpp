@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <graphene/net/message_compression.hpp>
+#include <graphene/net/config.hpp>
+#include <graphene/net/core_messages.hpp>
+
+#include <boost/iostreams/categories.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+namespace graphene { namespace net {
+
+  namespace detail
+  {
+    /** Collects the inflated data up to a limit, so that a small message cannot make us allocate a huge buffer */
+    class bounded_sink
+    {
+    public:
+      typedef char char_type;
+      typedef boost::iostreams::sink_tag category;
+
+      bounded_sink(std::vector<char>& output, size_t limit, bool& overflowed) :
+        _output(output),
+        _limit(limit),
+        _overflowed(overflowed)
+      {}
+
+      std::streamsize write(const char* s, std::streamsize n)
+      {
+        // what the stream flushes while it is torn down is dropped
+        if (_overflowed)
+          return n;
+        if (_output.size() + n > _limit)
+        {
+          // the stream swallows the exception and goes bad, so it stops inflating the rest of the data.
+          // The flag tells why
+          _overflowed = true;
+          FC_THROW("compressed message inflates beyond its original size");
+        }
+        _output.insert(_output.end(), s, s + n);
+        return n;
+      }
+
+    private:
+      std::vector<char>& _output;
+      size_t             _limit;
+      bool&              _overflowed;
+    };
+  }
+
+  bool is_compressible_message_type(uint32_t msg_type)
+  {
+    return msg_type == block_message_type;
+  }
+
+  fc::optional<message> compress_message(const message& message_to_compress)
+  {
+    if (message_to_compress.size < GRAPHENE_NET_MIN_COMPRESSED_MESSAGE_SIZE)
+      return fc::optional<message>();
+
+    compressed_message result;
+    result.original_type = message_to_compress.msg_type;
+    result.original_size = message_to_compress.size;
+    {
+      boost::iostreams::filtering_ostream out;
+      out.push(boost::iostreams::zlib_compressor(boost::iostreams::zlib::best_speed));
+      out.push(boost::iostreams::back_inserter(result.compressed_data));
+      out.write(message_to_compress.data.data(), message_to_compress.data.size());
+      out.reset(); // flushes the compressor
+    }
+    message compressed(result);
+    if (compressed.size >= message_to_compress.size)
+      return fc::optional<message>();
+    return compressed;
+  }
+
+  uint32_t get_original_message_size(const message& compressed)
+  {
+    FC_ASSERT(compressed.msg_type == compressed_message_type);
+    // the sizes are packed before the compressed data, they can be read without copying it
+    fc::datastream<const char*> ds(compressed.data.data(), compressed.data.size());
+    uint32_t original_type;
+    uint32_t original_size;
+    fc::raw::unpack(ds, original_type);
+    fc::raw::unpack(ds, original_size);
+    return original_size;
+  }
+
+  message decompress_message(const message& compressed)
+  { try {
+    FC_ASSERT(compressed.msg_type == compressed_message_type);
+    const compressed_message received = compressed.as<compressed_message>();
+    FC_ASSERT(received.original_size <= MAX_MESSAGE_SIZE, "compressed message would be too large",
+              ("original_size", received.original_size)("MAX_MESSAGE_SIZE", MAX_MESSAGE_SIZE));
+    FC_ASSERT(received.original_type != compressed_message_type);
+
+    message result;
+    result.msg_type = received.original_type;
+    result.data.reserve(received.original_size);
+    bool overflowed = false;
+    {
+      boost::iostreams::filtering_ostream out;
+      out.push(boost::iostreams::zlib_decompressor());
+      out.push(detail::bounded_sink(result.data, received.original_size, overflowed));
+      out.write(received.compressed_data.data(), received.compressed_data.size());
+      out.reset();
+    }
+    FC_ASSERT(!overflowed && result.data.size() == received.original_size,
+              "compressed message does not inflate to its original size",
+              ("original_size", received.original_size)("size", result.data.size()));
+    result.size = (uint32_t)result.data.size();
+    return result;
+  } FC_CAPTURE_AND_RETHROW( (compressed.size) ) }
+
+} } // graphene::net
@@ -31,6 +31,10 @@
 #include <graphene/net/message_oriented_connection.hpp>
 #include <graphene/net/stcp_socket.hpp>
 #include <graphene/net/config.hpp>
+#include <graphene/net/core_messages.hpp>
+#include <graphene/net/message_compression.hpp>
+
+#include <atomic>
 
 #ifdef DEFAULT_LOGGER
 # undef DEFAULT_LOGGER
@@ -65,25 +69,42 @@ namespace graphene { namespace net {
 #ifndef NDEBUG
       fc::thread* _thread;
 #endif
+      /// the thread of the delegate, which also calls all public methods
+      fc::thread* _delegate_thread;
+      /// the thread reading and writing the socket if the node has I/O threads, else the delegate thread does
+      io_thread_pool::assignment _io_thread;
+      /// the last message handed to the delegate by the read loop on the I/O thread
+      fc::future<void> _message_delivered;
+      /// the last write on the I/O thread, which goes on if the send_message() waiting for it is canceled
+      fc::future<size_t> _write_done;
+      /// set by the delegate thread, read where the messages are written
+      std::atomic<bool> _compression_enabled{false};
+      std::atomic<uint64_t> _bytes_saved_by_compression{0};
 
       void read_loop();
       void start_read_loop();
+      void deliver_message(const message& received_message, size_t bytes_received, fc::time_point received_time);
+      size_t write_message(const message& message_to_send);
     public:
       fc::tcp_socket& get_socket();
       void accept();
       void connect_to(const fc::ip::endpoint& remote_endpoint);
       void bind(const fc::ip::endpoint& local_endpoint);
+      void set_io_thread(const io_thread_pool::assignment& io_thread);
+      void enable_compression() { _compression_enabled = true; }
+      bool is_compression_enabled() const { return _compression_enabled; }
 
       message_oriented_connection_impl(message_oriented_connection* self,
                                        message_oriented_connection_delegate* delegate = nullptr);
       ~message_oriented_connection_impl();
 
-      void send_message(const message& message_to_send);
+      void send_message(const std::shared_ptr<const message>& message_to_send);
       void close_connection();
       void destroy_connection();
 
       uint64_t get_total_bytes_sent() const;
       uint64_t get_total_bytes_received() const;
+      uint64_t get_total_bytes_saved_by_compression() const { return _bytes_saved_by_compression; }
 
       fc::time_point get_last_message_sent_time() const;
       fc::time_point get_last_message_received_time() const;
@@ -101,6 +122,7 @@ namespace graphene { namespace net {
 #ifndef NDEBUG
       ,_thread(&fc::thread::current())
 #endif
+      ,_delegate_thread(&fc::thread::current())
     {
     }
     message_oriented_connection_impl::~message_oriented_connection_impl()
@@ -119,16 +141,14 @@ namespace graphene { namespace net {
     {
       VERIFY_CORRECT_THREAD();
       _sock.accept();
-      assert(!_read_loop_done.valid()); // check to be sure we never launch two read loops
-      _read_loop_done = fc::async([=](){ read_loop(); }, "message read_loop");
+      start_read_loop();
     }
 
     void message_oriented_connection_impl::connect_to(const fc::ip::endpoint& remote_endpoint)
     {
       VERIFY_CORRECT_THREAD();
       _sock.connect_to(remote_endpoint);
-      assert(!_read_loop_done.valid()); // check to be sure we never launch two read loops
-      _read_loop_done = fc::async([=](){ read_loop(); }, "message read_loop");
+      start_read_loop();
     }
 
     void message_oriented_connection_impl::bind(const fc::ip::endpoint& local_endpoint)
@@ -137,27 +157,68 @@ namespace graphene { namespace net {
       _sock.bind(local_endpoint);
     }
 
+    void message_oriented_connection_impl::set_io_thread(const io_thread_pool::assignment& io_thread)
+    {
+      VERIFY_CORRECT_THREAD();
+      assert(!_read_loop_done.valid()); // the socket must not be switched to another thread while it is read
+      _io_thread = io_thread;
+    }
 
-    void message_oriented_connection_impl::read_loop()
+    void message_oriented_connection_impl::start_read_loop()
+    {
+      VERIFY_CORRECT_THREAD();
+      assert(!_read_loop_done.valid()); // check to be sure we never launch two read loops
+      _connected_time = fc::time_point::now();
+      if (_io_thread.thread)
+        _read_loop_done = _io_thread.thread->async([=](){ read_loop(); }, "message read_loop");
+      else
+        _read_loop_done = fc::async([=](){ read_loop(); }, "message read_loop");
+    }
+
+    void message_oriented_connection_impl::deliver_message(const message& received_message, size_t bytes_received,
+                                                           fc::time_point received_time)
     {
       VERIFY_CORRECT_THREAD();
+      _bytes_received += bytes_received;
+      _last_message_received_time = received_time;
+      try
+      {
+        // message handling errors are warnings...
+        _delegate->on_message(_self, received_message);
+      }
+      /// Dedicated catches needed to distinguish from general fc::exception
+      catch ( const fc::canceled_exception& e ) { throw; }
+      catch ( const fc::eof_exception& e ) { throw; }
+      catch ( const fc::exception& e)
+      {
+        /// Here loop should be continued so exception should be just caught locally.
+        wlog( "message transmission failed ${er}", ("er", e.to_detail_string() ) );
+        throw;
+      }
+    }
+
+    /**
+     * Runs on the I/O thread of the connection if there is one.  Then the message is unpacked there, and the
+     * delegate is called on its own thread while the next message is read.  The previous message must have
+     * been handled before the next one is handed over, this keeps the order and limits the messages in flight.
+     */
+    void message_oriented_connection_impl::read_loop()
+    {
       const int BUFFER_SIZE = 16;
       const int LEFTOVER = BUFFER_SIZE - sizeof(message_header);
       static_assert(BUFFER_SIZE >= sizeof(message_header), "insufficient buffer");
 
-      _connected_time = fc::time_point::now();
-
       fc::oexception exception_to_rethrow;
       bool call_on_connection_closed = false;
 
       try
       {
-        message m;
         while( true )
         {
+          message m;
           char buffer[BUFFER_SIZE];
           _sock.read(buffer, BUFFER_SIZE);
-          _bytes_received += BUFFER_SIZE;
+          size_t bytes_received = BUFFER_SIZE;
           memcpy((char*)&m, buffer, sizeof(message_header));
 
           FC_ASSERT( m.size <= MAX_MESSAGE_SIZE, "", ("m.size",m.size)("MAX_MESSAGE_SIZE",MAX_MESSAGE_SIZE) );
@@ -168,26 +229,35 @@ namespace graphene { namespace net {
           if (remaining_bytes_with_padding)
           {
             _sock.read(&m.data[LEFTOVER], remaining_bytes_with_padding);
-            _bytes_received += remaining_bytes_with_padding;
+            bytes_received += remaining_bytes_with_padding;
           }
           m.data.resize(m.size); // truncate off the padding bytes
+          if (m.msg_type == compressed_message_type)
+            m = decompress_message(m);
 
-          _last_message_received_time = fc::time_point::now();
+          const fc::time_point received_time = fc::time_point::now();
 
-          try
-          {
-            // message handling errors are warnings...
-            _delegate->on_message(_self, m);
-          }
-          /// Dedicated catches needed to distinguish from general fc::exception
-          catch ( const fc::canceled_exception& e ) { throw; }
-          catch ( const fc::eof_exception& e ) { throw; }
-          catch ( const fc::exception& e)
+          if (!_io_thread.thread)
           {
-            /// Here loop should be continued so exception should be just caught locally.
-            wlog( "message transmission failed ${er}", ("er", e.to_detail_string() ) );
-            throw;
+            deliver_message(m, bytes_received, received_time);
+            continue;
           }
+
+          if (m.msg_type == block_message_type)
+            m.unpack_ahead<block_message>();
+          else if (m.msg_type == trx_message_type)
+            m.unpack_ahead<trx_message>();
+          else
+            m.hash_ahead();
+          ++_io_thread.counters->messages;
+          _io_thread.counters->bytes += bytes_received;
+
+          if (_message_delivered.valid())
+            _message_delivered.wait(); // rethrows what the delegate threw
+          auto received_message = std::make_shared<const message>(std::move(m));
+          _message_delivered = _delegate_thread->async([this,received_message,bytes_received,received_time](){
+                                   deliver_message(*received_message, bytes_received, received_time);
+                                 }, "deliver message");
         }
       }
       catch ( const fc::canceled_exception& e )
@@ -220,13 +290,28 @@ namespace graphene { namespace net {
       }
 
       if (call_on_connection_closed)
-        _delegate->on_connection_closed(_self);
+      {
+        if (_io_thread.thread)
+        {
+          try
+          {
+            if (_message_delivered.valid())
+              _message_delivered.wait();
+          }
+          catch (...)
+          {
+          }
+          _delegate_thread->async([this](){ _delegate->on_connection_closed(_self); }, "on_connection_closed").wait();
+        }
+        else
+          _delegate->on_connection_closed(_self);
+      }
 
       if (exception_to_rethrow)
         throw *exception_to_rethrow;
     }
 
-    void message_oriented_connection_impl::send_message(const message& message_to_send)
+    void message_oriented_connection_impl::send_message(const std::shared_ptr<const message>& message_to_send)
     {
       VERIFY_CORRECT_THREAD();
 #if 0 // this gets too verbose
@@ -255,25 +340,64 @@ namespace graphene { namespace net {
 
       try
       {
-        size_t size_of_message_and_header = sizeof(message_header) + message_to_send.size;
-        if( message_to_send.size > MAX_MESSAGE_SIZE )
-           elog("Trying to send a message larger than MAX_MESSAGE_SIZE. This probably won't work...");
-        //pad the message we send to a multiple of 16 bytes
-        size_t size_with_padding = 16 * ((size_of_message_and_header + 15) / 16);
-        std::unique_ptr<char[]> padded_message(new char[size_with_padding]);
-        memcpy(padded_message.get(), (char*)&message_to_send, sizeof(message_header));
-        memcpy(padded_message.get() + sizeof(message_header), message_to_send.data.data(), message_to_send.size );
-        _sock.write(padded_message.get(), size_with_padding);
-        _sock.flush();
+        size_t size_with_padding;
+        if (_io_thread.thread)
+        {
+          // the write of a canceled send_message() may still be running, it owns its message
+          if (_write_done.valid() && !_write_done.ready())
+            _write_done.wait();
+          _write_done = _io_thread.thread->async([this,message_to_send](){
+                            return write_message(*message_to_send);
+                          }, "send message");
+          size_with_padding = _write_done.wait();
+        }
+        else
+          size_with_padding = write_message(*message_to_send);
         _bytes_sent += size_with_padding;
         _last_message_sent_time = fc::time_point::now();
       } FC_RETHROW_EXCEPTIONS( warn, "unable to send message" );
     }
 
+    /**
+     * Compresses if enabled, encrypts and writes the message on the thread of the socket, @return the bytes written.
+     * Blocks served from the node's cache come compressed already
+     */
+    size_t message_oriented_connection_impl::write_message(const message& message_to_send_uncompressed)
+    {
+      fc::optional<message> compressed;
+      if (message_to_send_uncompressed.msg_type == compressed_message_type)
+        _bytes_saved_by_compression += get_original_message_size(message_to_send_uncompressed)
+                                       - message_to_send_uncompressed.size;
+      else if (_compression_enabled && is_compressible_message_type(message_to_send_uncompressed.msg_type))
+      {
+        compressed = compress_message(message_to_send_uncompressed);
+        if (compressed)
+          _bytes_saved_by_compression += message_to_send_uncompressed.size - compressed->size;
+      }
+      const message& message_to_send = compressed ? *compressed : message_to_send_uncompressed;
+
+      size_t size_of_message_and_header = sizeof(message_header) + message_to_send.size;
+      if( message_to_send.size > MAX_MESSAGE_SIZE )
+         elog("Trying to send a message larger than MAX_MESSAGE_SIZE. This probably won't work...");
+      //pad the message we send to a multiple of 16 bytes
+      size_t size_with_padding = 16 * ((size_of_message_and_header + 15) / 16);
+      std::unique_ptr<char[]> padded_message(new char[size_with_padding]);
+      memcpy(padded_message.get(), (char*)&message_to_send, sizeof(message_header));
+      memcpy(padded_message.get() + sizeof(message_header), message_to_send.data.data(), message_to_send.size );
+      _sock.write(padded_message.get(), size_with_padding);
+      _sock.flush();
+      if (_io_thread.counters)
+        _io_thread.counters->bytes_written += size_with_padding;
+      return size_with_padding;
+    }
+
     void message_oriented_connection_impl::close_connection()
     {
       VERIFY_CORRECT_THREAD();
-      _sock.close();
+      if (_io_thread.thread)
+        _io_thread.thread->async([this](){ _sock.close(); }, "close socket").wait();
+      else
+        _sock.close();
     }
 
     void message_oriented_connection_impl::destroy_connection()
@@ -302,6 +426,26 @@ namespace graphene { namespace net {
       {
         wlog( "Exception thrown while canceling message_oriented_connection's read_loop, ignoring" );
       }
+
+      // a message handed over by the read loop must not reach the delegate after this
+      try
+      {
+        if (_message_delivered.valid() && !_message_delivered.ready())
+          _message_delivered.cancel_and_wait(__FUNCTION__);
+      }
+      catch (...)
+      {
+      }
+
+      // the write of a canceled send_message() uses the socket and this object until it is done
+      try
+      {
+        if (_write_done.valid() && !_write_done.ready())
+          _write_done.cancel_and_wait(__FUNCTION__);
+      }
+      catch (...)
+      {
+      }
     }
 
     uint64_t message_oriented_connection_impl::get_total_bytes_sent() const
@@ -366,7 +510,12 @@ namespace graphene { namespace net {
     my->bind(local_endpoint);
   }
 
-  void message_oriented_connection::send_message(const message& message_to_send)
+  void message_oriented_connection::set_io_thread(const io_thread_pool::assignment& io_thread)
+  {
+    my->set_io_thread(io_thread);
+  }
+
+  void message_oriented_connection::send_message(const std::shared_ptr<const message>& message_to_send)
   {
     my->send_message(message_to_send);
   }
@@ -381,6 +530,21 @@ namespace graphene { namespace net {
     my->destroy_connection();
   }
 
+  void message_oriented_connection::enable_compression()
+  {
+    my->enable_compression();
+  }
+
+  bool message_oriented_connection::is_compression_enabled() const
+  {
+    return my->is_compression_enabled();
+  }
+
+  uint64_t message_oriented_connection::get_total_bytes_saved_by_compression() const
+  {
+    return my->get_total_bytes_saved_by_compression();
+  }
+
   uint64_t message_oriented_connection::get_total_bytes_sent() const
   {
     return my->get_total_bytes_sent();
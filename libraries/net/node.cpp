@@ -76,6 +76,7 @@
 #include <graphene/net/stcp_socket.hpp>
 #include <graphene/net/config.hpp>
 #include <graphene/net/exceptions.hpp>
+#include <graphene/net/message_compression.hpp>
 
 #include <graphene/chain/config.hpp>
 #include <graphene/chain/protocol/fee_schedule.hpp>
@@ -134,7 +135,8 @@ namespace graphene { namespace net {
       struct message_info
       {
         message_hash_type message_hash;
-        message           message_body;
+        /// shared with the send queues of the peers it is sent to
+        std::shared_ptr<const message> message_body;
         uint32_t          block_clock_when_received;
 
         // for network performance stats
@@ -147,7 +149,7 @@ namespace graphene { namespace net {
                       const message_propagation_data& propagation_data,
                       fc::uint160_t            message_contents_hash ) :
           message_hash( message_hash ),
-          message_body( message_body ),
+          message_body( std::make_shared<const message>( message_body ) ),
           block_clock_when_received( block_clock_when_received ),
           propagation_data( propagation_data ),
           message_contents_hash( message_contents_hash )
@@ -167,6 +169,25 @@ namespace graphene { namespace net {
 
       uint32_t block_clock;
 
+      struct served_item_info
+      {
+        item_id                        item;
+        std::shared_ptr<const message> message_body;
+      };
+      struct item_id_index{};
+      struct served_order_index{};
+      typedef boost::multi_index_container
+        < served_item_info,
+            bmi::indexed_by< bmi::hashed_unique< bmi::tag<item_id_index>,
+                                                 bmi::member<served_item_info, item_id, &served_item_info::item>,
+                                                 std::hash<item_id> >,
+                             bmi::sequenced< bmi::tag<served_order_index> > >
+        > served_item_container;
+
+      /// items fetched from the delegate, the most recently served first
+      served_item_container _served_items;
+      size_t                _served_items_size = 0;
+
     public:
       blockchain_tied_message_cache() :
         block_clock( 0 )
@@ -174,9 +195,17 @@ namespace graphene { namespace net {
       void block_accepted();
       void cache_message( const message& message_to_cache, const message_hash_type& hash_of_message_to_cache,
                         const message_propagation_data& propagation_data, const fc::uint160_t& message_content_hash );
-      message get_message( const message_hash_type& hash_of_message_to_lookup );
+      /** @return the message with the given hash, or null */
+      std::shared_ptr<const message> find_message( const message_hash_type& hash_of_message_to_lookup ) const;
+      /** @return the cached block message of the given block, or null */
+      std::shared_ptr<const message> find_block_message( const item_hash_t& block_id ) const;
       message_propagation_data get_message_propagation_data( const fc::uint160_t& hash_of_message_contents_to_lookup ) const;
       size_t size() const { return _message_cache.size(); }
+
+      /** Keeps an item fetched from the delegate for serving it to more peers */
+      void cache_served_item( const item_id& item, const std::shared_ptr<const message>& message_body );
+      /** @return the served item, or null */
+      std::shared_ptr<const message> find_served_item( const item_id& item );
     };
 
     void blockchain_tied_message_cache::block_accepted()
@@ -199,13 +228,47 @@ namespace graphene { namespace net {
                                          message_content_hash ) );
     }
 
-    message blockchain_tied_message_cache::get_message( const message_hash_type& hash_of_message_to_lookup )
+    std::shared_ptr<const message> blockchain_tied_message_cache::find_message( const message_hash_type& hash_of_message_to_lookup ) const
     {
       message_cache_container::index<message_hash_index>::type::const_iterator iter =
          _message_cache.get<message_hash_index>().find(hash_of_message_to_lookup );
       if( iter != _message_cache.get<message_hash_index>().end() )
         return iter->message_body;
-      FC_THROW_EXCEPTION(  fc::key_not_found_exception, "Requested message not in cache" );
+      return std::shared_ptr<const message>();
+    }
+
+    std::shared_ptr<const message> blockchain_tied_message_cache::find_block_message( const item_hash_t& block_id ) const
+    {
+      const auto& contents_index = _message_cache.get<message_contents_hash_index>();
+      for( auto iter = contents_index.lower_bound( block_id );
+           iter != contents_index.end() && iter->message_contents_hash == block_id; ++iter )
+        if( iter->message_body->msg_type == block_message_type )
+          return iter->message_body;
+      return std::shared_ptr<const message>();
+    }
+
+    void blockchain_tied_message_cache::cache_served_item( const item_id& item, const std::shared_ptr<const message>& message_body )
+    {
+      auto& order_index = _served_items.get<served_order_index>();
+      auto result = order_index.push_front( served_item_info{ item, message_body } );
+      if( !result.second )
+        return;
+      _served_items_size += message_body->data.size();
+      while( _served_items_size > GRAPHENE_NET_SERVED_ITEM_CACHE_SIZE_IN_BYTES && order_index.size() > 1 )
+      {
+        _served_items_size -= order_index.back().message_body->data.size();
+        order_index.pop_back();
+      }
+    }
+
+    std::shared_ptr<const message> blockchain_tied_message_cache::find_served_item( const item_id& item )
+    {
+      auto iter = _served_items.get<item_id_index>().find( item );
+      if( iter == _served_items.get<item_id_index>().end() )
+        return std::shared_ptr<const message>();
+      auto& order_index = _served_items.get<served_order_index>();
+      order_index.relocate( order_index.begin(), _served_items.project<served_order_index>( iter ) );
+      return iter->message_body;
     }
 
     message_propagation_data blockchain_tied_message_cache::get_message_propagation_data( const fc::uint160_t& hash_of_message_contents_to_lookup ) const
@@ -313,7 +376,12 @@ namespace graphene { namespace net { namespace detail {
       _node_is_shutting_down(false),
       _maximum_number_of_blocks_to_handle_at_one_time(MAXIMUM_NUMBER_OF_BLOCKS_TO_HANDLE_AT_ONE_TIME),
       _maximum_number_of_sync_blocks_to_prefetch(MAXIMUM_NUMBER_OF_BLOCKS_TO_PREFETCH),
-      _maximum_blocks_per_peer_during_syncing(GRAPHENE_NET_MAX_BLOCKS_PER_PEER_DURING_SYNCING)
+      _maximum_blocks_per_peer_during_syncing(GRAPHENE_NET_MAX_BLOCKS_PER_PEER_DURING_SYNCING),
+      _compact_blocks_enabled(true),
+      _compact_blocks_sent(0),
+      _compact_blocks_received(0),
+      _compact_block_transactions_requested(0),
+      _compression_enabled(true)
     {
       _rate_limiter.set_actual_rate_time_constant(fc::seconds(2));
       fc::rand_bytes(&_node_id.data[0], (int)_node_id.size());
@@ -1068,11 +1136,26 @@ namespace graphene { namespace net { namespace detail {
 
       uint32_t seconds_since_last_update = current_time.sec_since_epoch() - _bandwidth_monitor_last_update_time.sec_since_epoch();
       seconds_since_last_update = std::max(UINT32_C(1), seconds_since_last_update);
-      uint32_t bytes_read_this_second = _rate_limiter.get_actual_download_rate();
-      uint32_t bytes_written_this_second = _rate_limiter.get_actual_upload_rate();
-      for (uint32_t i = 0; i < seconds_since_last_update - 1; ++i)
-        update_bandwidth_data(0, 0);
-      update_bandwidth_data(bytes_read_this_second, bytes_written_this_second);
+      if (_io_threads)
+      {
+        // the sockets on the I/O threads are not in _rate_limiter, which is only used on this thread
+        const uint64_t bytes_read = _io_threads->total_bytes_read();
+        const uint64_t bytes_written = _io_threads->total_bytes_written();
+        const uint32_t read_per_second = uint32_t((bytes_read - _io_bytes_read) / seconds_since_last_update);
+        const uint32_t written_per_second = uint32_t((bytes_written - _io_bytes_written) / seconds_since_last_update);
+        _io_bytes_read = bytes_read;
+        _io_bytes_written = bytes_written;
+        for (uint32_t i = 0; i < seconds_since_last_update; ++i)
+          update_bandwidth_data(read_per_second, written_per_second);
+      }
+      else
+      {
+        uint32_t bytes_read_this_second = _rate_limiter.get_actual_download_rate();
+        uint32_t bytes_written_this_second = _rate_limiter.get_actual_upload_rate();
+        for (uint32_t i = 0; i < seconds_since_last_update - 1; ++i)
+          update_bandwidth_data(0, 0);
+        update_bandwidth_data(bytes_read_this_second, bytes_written_this_second);
+      }
       _bandwidth_monitor_last_update_time = current_time;
 
       if (!_node_is_shutting_down && !_bandwidth_monitor_loop_done.canceled())
@@ -1313,6 +1396,15 @@ namespace graphene { namespace net { namespace detail {
       case core_message_type_enum::get_current_connections_reply_message_type:
         on_get_current_connections_reply_message(originating_peer, received_message.as<get_current_connections_reply_message>());
         break;
+      case core_message_type_enum::compact_block_message_type:
+        on_compact_block_message(originating_peer, received_message.as<compact_block_message>());
+        break;
+      case core_message_type_enum::get_compact_block_transactions_message_type:
+        on_get_compact_block_transactions_message(originating_peer, received_message.as<get_compact_block_transactions_message>());
+        break;
+      case core_message_type_enum::compact_block_transactions_message_type:
+        on_compact_block_transactions_message(originating_peer, received_message.as<compact_block_transactions_message>());
+        break;
 
       default:
         // ignore any message in between core_message_type_first and _last that we don't handle above
@@ -1356,6 +1448,12 @@ namespace graphene { namespace net { namespace detail {
       if (!_hard_fork_block_numbers.empty())
         user_data["last_known_fork_block_number"] = _hard_fork_block_numbers.back();
 
+      if (_compact_blocks_enabled)
+        user_data["compact_blocks"] = true;
+      // we always read compressed messages, this only asks the peer to send them
+      if (_compression_enabled)
+        user_data["compression"] = "zlib";
+
       return user_data;
     }
     void node_impl::parse_hello_user_data_for_peer(peer_connection* originating_peer, const fc::variant_object& user_data)
@@ -1378,6 +1476,10 @@ namespace graphene { namespace net { namespace detail {
         originating_peer->node_id = user_data["node_id"].as<node_id_t>(1);
       if (user_data.contains("last_known_fork_block_number"))
         originating_peer->last_known_fork_block_number = user_data["last_known_fork_block_number"].as<uint32_t>(1);
+      if (user_data.contains("compact_blocks"))
+        originating_peer->supports_compact_blocks = user_data["compact_blocks"].as_bool();
+      if (_compression_enabled && user_data.contains("compression") && user_data["compression"].as_string() == "zlib")
+        originating_peer->enable_compression();
     }
 
     void node_impl::on_hello_message( peer_connection* originating_peer, const hello_message& hello_message_received )
@@ -2226,21 +2328,60 @@ namespace graphene { namespace net { namespace detail {
       }
     }
 
-    message node_impl::get_message_for_item(const item_id& item)
+    /**
+     * Blocks and transactions are encoded once and the same message is queued for all peers.  Items which are not
+     * in the message cache any more, e.g. blocks requested by syncing peers, are kept after fetching them from
+     * the delegate, so that serving them to the next peers does not read and pack them again.
+     */
+    std::shared_ptr<const message> node_impl::get_message_for_item(const item_id& item)
     {
+      std::shared_ptr<const message> cached = _message_cache.find_message(item.item_hash);
+      if (!cached && item.item_type == block_message_type)
+        cached = _message_cache.find_block_message(item.item_hash);
+      if (!cached)
+        cached = _message_cache.find_served_item(item);
+      if (cached)
+        return cached;
       try
       {
-        return _message_cache.get_message(item.item_hash);
-      }
-      catch (fc::key_not_found_exception&)
-      {}
-      try
-      {
-        return _delegate->get_item(item);
+        std::shared_ptr<const message> fetched = std::make_shared<const message>(_delegate->get_item(item));
+        _message_cache.cache_served_item(item, fetched);
+        return fetched;
       }
       catch (fc::key_not_found_exception&)
       {}
-      return item_not_available_message(item);
+      return std::make_shared<const message>(item_not_available_message(item));
+    }
+
+    /**
+     * Blocks are compressed once for all the peers which read compressed messages, the compressed form is kept in
+     * the served item cache next to the block.  Blocks not worth compressing are kept there as they are.
+     */
+    std::shared_ptr<const message> node_impl::get_compressed_message_for_item(const item_id& item)
+    {
+      const item_id compressed_item(compressed_message_type, item.item_hash);
+      std::shared_ptr<const message> compressed = _message_cache.find_served_item(compressed_item);
+      if (compressed)
+        return compressed;
+      std::shared_ptr<const message> uncompressed = get_message_for_item(item);
+      if (!is_compressible_message_type(uncompressed->msg_type))
+        return uncompressed;
+      fc::optional<message> compressed_message = compress_message(*uncompressed);
+      compressed = compressed_message ? std::make_shared<const message>(std::move(*compressed_message)) : uncompressed;
+      _message_cache.cache_served_item(compressed_item, compressed);
+      return compressed;
+    }
+
+    /** The block ID is packed last in a block message, it can be read without unpacking the block */
+    static block_id_type get_block_id_of_message(const message& block_message_to_read)
+    {
+      FC_ASSERT( block_message_to_read.msg_type == block_message_type
+                 && block_message_to_read.data.size() >= sizeof(block_id_type) );
+      block_id_type block_id;
+      fc::datastream<const char*> ds(block_message_to_read.data.data() + block_message_to_read.data.size() - sizeof(block_id_type),
+                                     sizeof(block_id_type));
+      fc::raw::unpack(ds, block_id);
+      return block_id;
     }
 
     void node_impl::on_fetch_items_message(peer_connection* originating_peer, const fetch_items_message& fetch_items_message_received)
@@ -2251,69 +2392,215 @@ namespace graphene { namespace net { namespace detail {
            ("type", fetch_items_message_received.item_type)
            ("endpoint", originating_peer->get_remote_endpoint()));
 
-      fc::optional<message> last_block_message_sent;
+      fc::optional<block_id_type> last_block_sent;
 
-      std::list<message> reply_messages;
+      std::list<std::shared_ptr<const message>> reply_messages;
       for (const item_hash_t& item_hash : fetch_items_message_received.items_to_fetch)
       {
-        try
+        item_id item_to_fetch(fetch_items_message_received.item_type, item_hash);
+        std::shared_ptr<const message> requested_message = get_message_for_item(item_to_fetch);
+        reply_messages.push_back(requested_message);
+        if (requested_message->msg_type == item_not_available_message_type)
         {
-          message requested_message = _message_cache.get_message(item_hash);
-          dlog("received item request for item ${id} from peer ${endpoint}, returning the item from my message cache",
-               ("endpoint", originating_peer->get_remote_endpoint())
-               ("id", requested_message.id()));
-          reply_messages.push_back(requested_message);
-          if (fetch_items_message_received.item_type == block_message_type)
-            last_block_message_sent = requested_message;
+          dlog("received item request from peer ${endpoint} but we don't have it",
+               ("endpoint", originating_peer->get_remote_endpoint()));
           continue;
         }
-        catch (fc::key_not_found_exception&)
+        dlog("received item request from peer ${endpoint}, returning the item with id ${id} size ${size}",
+             ("id", requested_message->id())
+             ("size", requested_message->size)
+             ("endpoint", originating_peer->get_remote_endpoint()));
+        if (requested_message->msg_type == block_message_type)
+          last_block_sent = get_block_id_of_message(*requested_message);
+      }
+
+      // if we sent them a block, update our record of the last block they've seen accordingly
+      if (last_block_sent)
+      {
+        originating_peer->last_block_delegate_has_seen = *last_block_sent;
+        originating_peer->last_block_time_delegate_has_seen = _delegate->get_block_time(*last_block_sent);
+      }
+
+      auto item_hash_iter = fetch_items_message_received.items_to_fetch.begin();
+      for (const std::shared_ptr<const message>& reply : reply_messages)
+      {
+        const item_hash_t& item_hash = *item_hash_iter++;
+        if (reply->msg_type == block_message_type)
         {
-           // it wasn't in our local cache, that's ok ask the client
+          const block_id_type block_id = get_block_id_of_message(*reply);
+          // during normal operation blocks are requested by the hash of the message, during sync by their ID.
+          // A syncing peer is unlikely to have seen the transactions of the block, so it gets the full block
+          if (_compact_blocks_enabled && originating_peer->supports_compact_blocks && item_hash != block_id)
+          {
+            std::shared_ptr<const message> compact_block = get_compact_block_message(*reply, item_hash);
+            if (compact_block)
+            {
+              originating_peer->send_message(compact_block);
+              ++_compact_blocks_sent;
+              continue;
+            }
+          }
+          // blocks are queued by their ID only, the encoded block is shared with the other peers
+          originating_peer->send_item(item_id(block_message_type, block_id));
         }
+        else
+          originating_peer->send_message(reply);
+      }
+    }
 
-        item_id item_to_fetch(fetch_items_message_received.item_type, item_hash);
-        try
+    std::shared_ptr<const message> node_impl::get_compact_block_message(const message& block_message_to_compact,
+                                                                        const item_hash_t& block_message_hash)
+    {
+      const item_id compact_item(compact_block_message_type, block_message_hash);
+      std::shared_ptr<const message> compact_block = _message_cache.find_served_item(compact_item);
+      if (compact_block)
+        return compact_block;
+      const graphene::net::block_message block_message_to_send = block_message_to_compact.as<graphene::net::block_message>();
+      // nothing to save on an empty block
+      if (block_message_to_send.block.transactions.empty())
+        return nullptr;
+      compact_block = std::make_shared<const message>(compact_block_message(block_message_hash, block_message_to_send.block));
+      _message_cache.cache_served_item(compact_item, compact_block);
+      return compact_block;
+    }
+
+    void node_impl::on_compact_block_message(peer_connection* originating_peer,
+                                             const compact_block_message& compact_block_message_received)
+    {
+      VERIFY_CORRECT_THREAD();
+      const item_hash_t& block_message_hash = compact_block_message_received.block_message_hash;
+      if (originating_peer->items_requested_from_peer.find(item_id(block_message_type, block_message_hash)) ==
+          originating_peer->items_requested_from_peer.end())
+      {
+        wlog("received a compact block ${hash} I didn't ask for from peer ${endpoint}, disconnecting from peer",
+             ("hash", block_message_hash)("endpoint", originating_peer->get_remote_endpoint()));
+        fc::exception detailed_error(FC_LOG_MESSAGE(error, "You sent me a compact block that I didn't ask for, hash: ${hash}",
+                                                    ("hash", block_message_hash)));
+        disconnect_from_peer(originating_peer, "You sent me a compact block that I didn't ask for", true, detailed_error);
+        return;
+      }
+      ++_compact_blocks_received;
+
+      peer_connection::partial_compact_block partial_block;
+      static_cast<graphene::chain::signed_block_header&>(partial_block.block) = compact_block_message_received.header;
+      partial_block.block.transactions.reserve(compact_block_message_received.transactions.size());
+      for (const compact_block_transaction& compact_transaction : compact_block_message_received.transactions)
+      {
+        // the transactions we have relayed stay in the message cache for a few blocks
+        std::shared_ptr<const message> transaction_message = _message_cache.find_message(compact_transaction.message_hash);
+        if (transaction_message && transaction_message->msg_type == trx_message_type)
+          partial_block.block.transactions.emplace_back(transaction_message->as<trx_message>().trx);
+        else
         {
-          message requested_message = _delegate->get_item(item_to_fetch);
-          dlog("received item request from peer ${endpoint}, returning the item from delegate with id ${id} size ${size}",
-               ("id", requested_message.id())
-               ("size", requested_message.size)
-               ("endpoint", originating_peer->get_remote_endpoint()));
-          reply_messages.push_back(requested_message);
-          if (fetch_items_message_received.item_type == block_message_type)
-            last_block_message_sent = requested_message;
-          continue;
+          partial_block.missing_transaction_indexes.push_back((uint32_t)partial_block.block.transactions.size());
+          partial_block.block.transactions.emplace_back();
         }
-        catch (fc::key_not_found_exception&)
+        partial_block.block.transactions.back().operation_results = compact_transaction.operation_results;
+      }
+
+      if (partial_block.missing_transaction_indexes.empty())
+      {
+        process_rebuilt_compact_block(originating_peer, block_message_hash, partial_block.block);
+        return;
+      }
+
+      dlog("requesting ${count} of the ${total} transactions of compact block ${hash} from peer ${endpoint}",
+           ("count", partial_block.missing_transaction_indexes.size())
+           ("total", partial_block.block.transactions.size())
+           ("hash", block_message_hash)("endpoint", originating_peer->get_remote_endpoint()));
+      _compact_block_transactions_requested += partial_block.missing_transaction_indexes.size();
+      get_compact_block_transactions_message request;
+      request.block_message_hash = block_message_hash;
+      request.transaction_indexes = partial_block.missing_transaction_indexes;
+      originating_peer->compact_blocks_being_completed[block_message_hash] = std::move(partial_block);
+      originating_peer->send_message(message(request));
+    }
+
+    void node_impl::on_get_compact_block_transactions_message(peer_connection* originating_peer,
+                                                              const get_compact_block_transactions_message& get_compact_block_transactions_message_received)
+    {
+      VERIFY_CORRECT_THREAD();
+      const item_id requested_block(block_message_type, get_compact_block_transactions_message_received.block_message_hash);
+      std::shared_ptr<const message> block_message_to_read = get_message_for_item(requested_block);
+      if (block_message_to_read->msg_type != block_message_type)
+      {
+        originating_peer->send_message(block_message_to_read);
+        return;
+      }
+
+      const graphene::net::block_message requested_block_message = block_message_to_read->as<graphene::net::block_message>();
+      const auto& transactions = requested_block_message.block.transactions;
+      compact_block_transactions_message reply;
+      reply.block_message_hash = get_compact_block_transactions_message_received.block_message_hash;
+      reply.transactions.reserve(get_compact_block_transactions_message_received.transaction_indexes.size());
+      for (uint32_t index : get_compact_block_transactions_message_received.transaction_indexes)
+      {
+        if (index >= transactions.size())
         {
-          reply_messages.push_back(item_not_available_message(item_to_fetch));
-          dlog("received item request from peer ${endpoint} but we don't have it",
-               ("endpoint", originating_peer->get_remote_endpoint()));
+          fc::exception detailed_error(FC_LOG_MESSAGE(error, "You requested transaction ${index} of a block with ${count} transactions",
+                                                      ("index", index)("count", transactions.size())));
+          disconnect_from_peer(originating_peer, "You requested a transaction that is not in the block", true, detailed_error);
+          return;
         }
+        reply.transactions.push_back(transactions[index]);
       }
+      originating_peer->send_message(message(reply));
+    }
 
-      // if we sent them a block, update our record of the last block they've seen accordingly
-      if (last_block_message_sent)
+    void node_impl::on_compact_block_transactions_message(peer_connection* originating_peer,
+                                                          const compact_block_transactions_message& compact_block_transactions_message_received)
+    {
+      VERIFY_CORRECT_THREAD();
+      const item_hash_t& block_message_hash = compact_block_transactions_message_received.block_message_hash;
+      auto partial_block_iter = originating_peer->compact_blocks_being_completed.find(block_message_hash);
+      if (partial_block_iter == originating_peer->compact_blocks_being_completed.end())
       {
-        graphene::net::block_message block = last_block_message_sent->as<graphene::net::block_message>();
-        originating_peer->last_block_delegate_has_seen = block.block_id;
-        originating_peer->last_block_time_delegate_has_seen = _delegate->get_block_time(block.block_id);
+        dlog("received transactions of compact block ${hash} which we are not rebuilding, ignoring them",
+             ("hash", block_message_hash));
+        return;
       }
+      peer_connection::partial_compact_block partial_block = std::move(partial_block_iter->second);
+      originating_peer->compact_blocks_being_completed.erase(partial_block_iter);
 
-      for (const message& reply : reply_messages)
+      const auto& transactions = compact_block_transactions_message_received.transactions;
+      if (transactions.size() != partial_block.missing_transaction_indexes.size())
       {
-        if (reply.msg_type == block_message_type)
-          originating_peer->send_item(item_id(block_message_type, reply.as<graphene::net::block_message>().block_id));
-        else
-          originating_peer->send_message(reply);
+        fc::exception detailed_error(FC_LOG_MESSAGE(error, "You sent me ${count} transactions of compact block ${hash}, I requested ${requested}",
+                                                    ("count", transactions.size())("hash", block_message_hash)
+                                                    ("requested", partial_block.missing_transaction_indexes.size())));
+        disconnect_from_peer(originating_peer, "You sent me the wrong transactions of a compact block", true, detailed_error);
+        return;
       }
+      for (size_t i = 0; i < transactions.size(); ++i)
+        partial_block.block.transactions[partial_block.missing_transaction_indexes[i]] = transactions[i];
+
+      process_rebuilt_compact_block(originating_peer, block_message_hash, partial_block.block);
+    }
+
+    void node_impl::process_rebuilt_compact_block(peer_connection* originating_peer, const item_hash_t& block_message_hash,
+                                                  const signed_block& block)
+    {
+      VERIFY_CORRECT_THREAD();
+      // the same block packs to the same message, so this also checks the transactions and results the peer sent
+      message rebuilt_message((graphene::net::block_message(block)));
+      if (rebuilt_message.id() != block_message_hash)
+      {
+        wlog("compact block ${hash} from peer ${endpoint} does not rebuild the block it announced, disconnecting from peer",
+             ("hash", block_message_hash)("endpoint", originating_peer->get_remote_endpoint()));
+        fc::exception detailed_error(FC_LOG_MESSAGE(error, "Your compact block ${hash} does not match the block",
+                                                    ("hash", block_message_hash)));
+        disconnect_from_peer(originating_peer, "You sent me a compact block which does not match the block", true, detailed_error);
+        return;
+      }
+      process_block_message(originating_peer, rebuilt_message, block_message_hash);
     }
 
     void node_impl::on_item_not_available_message( peer_connection* originating_peer, const item_not_available_message& item_not_available_message_received )
     {
       VERIFY_CORRECT_THREAD();
       const item_id& requested_item = item_not_available_message_received.requested_item;
+      // the peer may have dropped a block while we requested the transactions of its compact block
+      originating_peer->compact_blocks_being_completed.erase(requested_item.item_hash);
       auto regular_item_iter = originating_peer->items_requested_from_peer.find(requested_item);
       if (regular_item_iter != originating_peer->items_requested_from_peer.end())
       {
@@ -2448,7 +2735,8 @@ namespace graphene { namespace net { namespace detail {
     {
       VERIFY_CORRECT_THREAD();
       peer_connection_ptr originating_peer_ptr = originating_peer->shared_from_this();
-      _rate_limiter.remove_tcp_socket( &originating_peer->get_socket() );
+      if( !_io_threads )
+        _rate_limiter.remove_tcp_socket( &originating_peer->get_socket() );
 
       // if we closed the connection (due to timeout or handshake failure), we should have recorded an
       // error message to store in the peer database when we closed the connection
@@ -2857,6 +3145,9 @@ namespace graphene { namespace net { namespace detail {
       VERIFY_CORRECT_THREAD();
       dlog( "received a sync block from peer ${endpoint}", ("endpoint", originating_peer->get_remote_endpoint() ) );
 
+      // the client prepares the block while it waits in _received_sync_items for the blocks before it
+      _delegate->precompute_sync_block( block_message_to_process );
+
       // add it to the front of _received_sync_items, then process _received_sync_items to try to
       // pass as many messages as possible to the client.
       _new_received_sync_items.push_front( block_message_to_process );
@@ -3188,7 +3479,7 @@ namespace graphene { namespace net { namespace detail {
         {
           // we're not connected to them, so we need to set up a connection to them
           // to test.
-          peer_connection_ptr peer_for_testing(peer_connection::make_shared(this));
+          peer_connection_ptr peer_for_testing(new_peer_connection());
           peer_for_testing->firewall_check_state = new firewall_check_state_data;
           peer_for_testing->firewall_check_state->endpoint_to_test = check_firewall_message_received.endpoint_to_check;
           peer_for_testing->firewall_check_state->expected_node_id = check_firewall_message_received.node_id;
@@ -3744,7 +4035,7 @@ namespace graphene { namespace net { namespace detail {
       VERIFY_CORRECT_THREAD();
       while ( !_accept_loop_complete.canceled() )
       {
-        peer_connection_ptr new_peer(peer_connection::make_shared(this));
+        peer_connection_ptr new_peer(new_peer_connection());
 
         try
         {
@@ -3754,7 +4045,8 @@ namespace graphene { namespace net { namespace detail {
             return;
           new_peer->connection_initiation_time = fc::time_point::now();
           _handshaking_connections.insert( new_peer );
-          _rate_limiter.add_tcp_socket( &new_peer->get_socket() );
+          if( !_io_threads )
+            _rate_limiter.add_tcp_socket( &new_peer->get_socket() );
           std::weak_ptr<peer_connection> new_weak_peer(new_peer);
           new_peer->accept_or_connect_task_done = fc::async( [this, new_weak_peer]() {
             peer_connection_ptr new_peer(new_weak_peer.lock());
@@ -4147,7 +4439,8 @@ namespace graphene { namespace net { namespace detail {
       new_peer->get_socket().set_reuse_address();
       new_peer->connection_initiation_time = fc::time_point::now();
       _handshaking_connections.insert(new_peer);
-      _rate_limiter.add_tcp_socket(&new_peer->get_socket());
+      if (!_io_threads)
+        _rate_limiter.add_tcp_socket(&new_peer->get_socket());
 
       if (_node_is_shutting_down)
         return;
@@ -4170,7 +4463,7 @@ namespace graphene { namespace net { namespace detail {
                            ("endpoint", remote_endpoint));
 
       dlog("node_impl::connect_to_endpoint(${endpoint})", ("endpoint", remote_endpoint));
-      peer_connection_ptr new_peer(peer_connection::make_shared(this));
+      peer_connection_ptr new_peer(new_peer_connection());
       new_peer->set_remote_endpoint(remote_endpoint);
       initiate_connect_to(new_peer);
     }
@@ -4371,6 +4664,8 @@ namespace graphene { namespace net { namespace detail {
         peer_details["lastrecv"] = peer->get_last_message_received_time().sec_since_epoch();
         peer_details["bytessent"] = peer->get_total_bytes_sent();
         peer_details["bytesrecv"] = peer->get_total_bytes_received();
+        peer_details["compression"] = peer->is_compression_enabled();
+        peer_details["bytessavedbycompression"] = peer->get_total_bytes_saved_by_compression();
         peer_details["conntime"] = peer->get_connection_time();
         peer_details["pingtime"] = "";
         peer_details["pingwait"] = "";
@@ -4498,6 +4793,10 @@ namespace graphene { namespace net { namespace detail {
         _maximum_number_of_sync_blocks_to_prefetch = params["maximum_number_of_sync_blocks_to_prefetch"].as<uint32_t>(1);
       if (params.contains("maximum_blocks_per_peer_during_syncing"))
         _maximum_blocks_per_peer_during_syncing = params["maximum_blocks_per_peer_during_syncing"].as<uint32_t>(1);
+      if (params.contains("compact_blocks"))
+        _compact_blocks_enabled = params["compact_blocks"].as_bool();
+      if (params.contains("compression"))
+        _compression_enabled = params["compression"].as_bool();
 
       _desired_number_of_connections = std::min(_desired_number_of_connections, _maximum_number_of_connections);
 
@@ -4517,6 +4816,8 @@ namespace graphene { namespace net { namespace detail {
       result["maximum_number_of_blocks_to_handle_at_one_time"] = _maximum_number_of_blocks_to_handle_at_one_time;
       result["maximum_number_of_sync_blocks_to_prefetch"] = _maximum_number_of_sync_blocks_to_prefetch;
       result["maximum_blocks_per_peer_during_syncing"] = _maximum_blocks_per_peer_during_syncing;
+      result["compact_blocks"] = _compact_blocks_enabled;
+      result["compression"] = _compression_enabled;
       return result;
     }
 
@@ -4565,6 +4866,28 @@ namespace graphene { namespace net { namespace detail {
       _rate_limiter.set_download_limit( download_bytes_per_second );
     }
 
+    void node_impl::set_io_threads( uint16_t thread_count )
+    {
+      VERIFY_CORRECT_THREAD();
+      FC_ASSERT( _handshaking_connections.empty() && _active_connections.empty() && _closing_connections.empty()
+                 && _terminating_connections.empty(), "The I/O threads must be set up before connecting to peers" );
+      if( thread_count == 0 )
+        _io_threads.reset();
+      else
+        _io_threads.reset( new io_thread_pool( thread_count ) );
+      _io_bytes_read = 0;
+      _io_bytes_written = 0;
+    }
+
+    peer_connection_ptr node_impl::new_peer_connection()
+    {
+      VERIFY_CORRECT_THREAD();
+      peer_connection_ptr peer = peer_connection::make_shared(this);
+      if( _io_threads )
+        peer->set_io_thread( _io_threads->next_thread() );
+      return peer;
+    }
+
     void node_impl::disable_peer_advertising()
     {
       VERIFY_CORRECT_THREAD();
@@ -4615,6 +4938,19 @@ namespace graphene { namespace net { namespace detail {
       result["usage_by_second"] = fc::variant( network_usage_by_second, 2 );
       result["usage_by_minute"] = fc::variant( network_usage_by_minute, 2 );
       result["usage_by_hour"]   = fc::variant( network_usage_by_hour, 2 );
+
+      // the CPU time of the node thread and of the threads reading and writing the sockets, if any
+      fc::mutable_variant_object node_thread;
+      node_thread["name"] = fc::thread::current().name();
+      node_thread["cpu_us"] = current_thread_cpu_time().count();
+      result["node_thread"] = node_thread;
+      result["io_threads"] = fc::variant( _io_threads ? _io_threads->get_stats() : std::vector<fc::variant_object>(), 2 );
+
+      fc::mutable_variant_object compact_blocks;
+      compact_blocks["sent"] = _compact_blocks_sent;
+      compact_blocks["received"] = _compact_blocks_received;
+      compact_blocks["transactions_requested"] = _compact_block_transactions_requested;
+      result["compact_blocks"] = compact_blocks;
       return result;
     }
 
@@ -4775,6 +5111,11 @@ namespace graphene { namespace net { namespace detail {
     INVOKE_IN_IMPL(set_total_bandwidth_limit, upload_bytes_per_second, download_bytes_per_second);
   }
 
+  void node::set_io_threads(uint16_t thread_count)
+  {
+    INVOKE_IN_IMPL(set_io_threads, thread_count);
+  }
+
   void node::disable_peer_advertising()
   {
     INVOKE_IN_IMPL(disable_peer_advertising);
@@ -4972,6 +5313,13 @@ namespace graphene { namespace net { namespace detail {
       INVOKE_AND_COLLECT_STATISTICS(handle_block, block_message, sync_mode, contained_transaction_message_ids);
     }
 
+    void statistics_gathering_node_delegate_wrapper::precompute_sync_block( const graphene::net::block_message& block_message )
+    {
+      // only starts the work, called directly so that the p2p thread does not wait for the delegate thread
+      ASSERT_TASK_NOT_PREEMPTED();
+      _node_delegate->precompute_sync_block(block_message);
+    }
+
     void statistics_gathering_node_delegate_wrapper::handle_transaction( const graphene::net::trx_message& transaction_message )
     {
       INVOKE_AND_COLLECT_STATISTICS(handle_transaction, transaction_message);
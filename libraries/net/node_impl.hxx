@@ -145,6 +145,7 @@ private:
       bool has_item( const graphene::net::item_id& id ) override;
       void handle_message( const message& ) override;
       bool handle_block( const graphene::net::block_message& block_message, bool sync_mode, std::vector<fc::uint160_t>& contained_transaction_message_ids ) override;
+      void precompute_sync_block( const graphene::net::block_message& block_message ) override;
       void handle_transaction( const graphene::net::trx_message& transaction_message ) override;
       std::vector<item_hash_t> get_block_ids(const std::vector<item_hash_t>& blockchain_synopsis,
                                              uint32_t& remaining_item_count,
@@ -170,6 +171,11 @@ class node_impl : public peer_connection_delegate
       std::shared_ptr<fc::thread> _thread;
 #endif // P2P_IN_DEDICATED_THREAD
       std::unique_ptr<statistics_gathering_node_delegate_wrapper> _delegate;
+      /// reads and writes the sockets of the connections if set, else this thread does
+      std::unique_ptr<io_thread_pool> _io_threads;
+      /// the bytes read and written on the I/O threads up to the last update of the bandwidth monitor
+      uint64_t _io_bytes_read = 0;
+      uint64_t _io_bytes_written = 0;
       fc::sha256           _chain_id;
 
 #define NODE_CONFIGURATION_FILENAME      "node_config.json"
@@ -288,6 +294,7 @@ class node_impl : public peer_connection_delegate
 
       blockchain_tied_message_cache _message_cache; /// cache message we have received and might be required to provide to other peers via inventory requests
 
+      /// not thread safe, so it only holds the sockets of the connections without an I/O thread
       fc::rate_limiting_group _rate_limiter;
 
       uint32_t _last_reported_number_of_connections; // number of connections last reported to the client (to avoid sending duplicate messages)
@@ -335,6 +342,15 @@ class node_impl : public peer_connection_delegate
       unsigned _maximum_number_of_sync_blocks_to_prefetch;
       unsigned _maximum_blocks_per_peer_during_syncing;
 
+      /// whether we announce compact block support in our hello and answer block requests of peers with compact blocks
+      bool _compact_blocks_enabled;
+      uint64_t _compact_blocks_sent;
+      uint64_t _compact_blocks_received;
+      /// the transactions of received compact blocks which we had not relayed and requested from the peer
+      uint64_t _compact_block_transactions_requested;
+      /// whether we compress the blocks sent to peers which can read compressed messages
+      bool _compression_enabled;
+
       std::list<fc::future<void> > _handle_message_calls_in_progress;
 
       node_impl(const std::string& user_agent);
@@ -436,6 +452,23 @@ class node_impl : public peer_connection_delegate
       void on_get_current_connections_reply_message(peer_connection* originating_peer,
                                                     const get_current_connections_reply_message& get_current_connections_reply_message_received);
 
+      void on_compact_block_message(peer_connection* originating_peer,
+                                    const compact_block_message& compact_block_message_received);
+
+      void on_get_compact_block_transactions_message(peer_connection* originating_peer,
+                                                     const get_compact_block_transactions_message& get_compact_block_transactions_message_received);
+
+      void on_compact_block_transactions_message(peer_connection* originating_peer,
+                                                 const compact_block_transactions_message& compact_block_transactions_message_received);
+
+      /** Passes a block rebuilt from a compact block on like a received block_message, if it is the block requested */
+      void process_rebuilt_compact_block(peer_connection* originating_peer, const item_hash_t& block_message_hash,
+                                         const signed_block& block);
+
+      /** @return the compact block message of a block message, built once for all peers */
+      std::shared_ptr<const message> get_compact_block_message(const message& block_message_to_compact,
+                                                               const item_hash_t& block_message_hash);
+
       void on_connection_closed(peer_connection* originating_peer) override;
 
       void send_sync_block_to_node_delegate(const graphene::net::block_message& block_message_to_send);
@@ -498,6 +531,8 @@ class node_impl : public peer_connection_delegate
       bool is_connected() const;
       std::vector<potential_peer_record> get_potential_peers() const;
       void set_advanced_node_parameters( const fc::variant_object& params );
+      void set_io_threads( uint16_t thread_count );
+      peer_connection_ptr new_peer_connection();
 
       fc::variant_object         get_advanced_node_parameters();
       message_propagation_data   get_transaction_propagation_data( const graphene::net::transaction_id_type& transaction_id );
@@ -509,7 +544,8 @@ class node_impl : public peer_connection_delegate
       void                       set_total_bandwidth_limit( uint32_t upload_bytes_per_second, uint32_t download_bytes_per_second );
       void                       disable_peer_advertising();
       fc::variant_object         get_call_statistics() const;
-      message                    get_message_for_item(const item_id& item) override;
+      std::shared_ptr<const message> get_message_for_item(const item_id& item) override;
+      std::shared_ptr<const message> get_compressed_message_for_item(const item_id& item) override;
 
       fc::variant_object         network_get_info() const;
       fc::variant_object         network_get_usage_stats() const;
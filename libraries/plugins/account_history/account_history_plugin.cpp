@@ -23,6 +23,7 @@
  */
 
 #include <graphene/account_history/account_history_plugin.hpp>
+#include <graphene/account_history/operation_history_store.hpp>
 
 #include <graphene/chain/impacted.hpp>
 
@@ -41,6 +42,144 @@ namespace graphene { namespace account_history {
 namespace detail
 {
 
+/**
+ *  @brief This secondary index keeps the account history entries of each account by operation type.
+ *
+ *  The operation IDs of each account and operation type are kept sorted, which orders the entries of an account
+ *  like their sequence numbers. The type of an operation is only known from its operation history object, which
+ *  may not exist yet when an entry is inserted while loading the database or undoing a block, so new entries are
+ *  only indexed by resolve(). Operations of irreversible blocks may have been moved to the operation history
+ *  store, their type is read from there.
+ */
+class operation_type_history_index : public secondary_index
+{
+   public:
+      operation_type_history_index( const database* db ) : _db( *db ) {}
+
+      /** look up the operations which are not in the object database any more in the store */
+      void set_history_store( const operation_history_store* store )
+      { _history_store = store; }
+
+      virtual void object_inserted( const object& obj ) override;
+      virtual void object_removed( const object& obj ) override;
+
+      /** index the entries inserted since the last call */
+      void resolve();
+
+      /** @return false if some entries are not indexed yet */
+      bool is_complete()const
+      { return _unresolved.empty() && _missing.empty(); }
+
+      /** @return the IDs of the operations of the account with the type in ascending order, or nullptr if none */
+      const vector< operation_history_id_type >* get_operations( account_id_type account, int operation_type )const;
+
+   private:
+      typedef std::pair< account_id_type, int > key_type;
+
+      void add( const account_transaction_history_object& ath, int operation_type );
+      bool remove( const account_transaction_history_object& ath, int operation_type );
+      /** @return the type of the operation of the entry, or -1 if the operation cannot be found */
+      int find_operation_type( const account_transaction_history_object& ath )const;
+
+      const database& _db;
+      const operation_history_store* _history_store = nullptr;
+
+      /** maps account and operation type to the sorted operation IDs */
+      map< key_type, vector< operation_history_id_type > > _operations;
+
+      /** entries which are not indexed yet */
+      flat_set< account_transaction_history_id_type > _unresolved;
+      /** entries whose operation was found neither in the object database nor in the store, not retried */
+      flat_set< account_transaction_history_id_type > _missing;
+};
+
+void operation_type_history_index::object_inserted( const object& obj )
+{
+   _unresolved.insert( _unresolved.end(), account_transaction_history_id_type( obj.id ) );
+}
+
+void operation_type_history_index::object_removed( const object& obj )
+{ try {
+   const auto& ath = static_cast<const account_transaction_history_object&>( obj );
+   if( _unresolved.erase( account_transaction_history_id_type( ath.id ) ) > 0
+         || _missing.erase( account_transaction_history_id_type( ath.id ) ) > 0 )
+      return;
+   const int operation_type = find_operation_type( ath );
+   if( operation_type >= 0 && remove( ath, operation_type ) )
+      return;
+   // the operation has been removed before, look for the entry in all types
+   for( int type = 0; type < operation::count(); ++type )
+      if( remove( ath, type ) )
+         return;
+} FC_CAPTURE_AND_RETHROW( (obj) ) }
+
+int operation_type_history_index::find_operation_type( const account_transaction_history_object& ath )const
+{
+   const operation_history_object* oho = _db.find( ath.operation_id );
+   if( oho != nullptr )
+      return oho->op.which();
+   if( _history_store != nullptr )
+   {
+      const optional< operation_history_object > stored = _history_store->fetch( ath.operation_id );
+      if( stored.valid() )
+         return stored->op.which();
+   }
+   return -1;
+}
+
+void operation_type_history_index::resolve()
+{
+   // Only the entries inserted since the last call are looked at. When a block has been applied, the operations
+   // of its entries exist, so an entry whose operation is missing now will not be resolved by a later call
+   for( const auto& id : _unresolved )
+   {
+      const account_transaction_history_object& ath = id(_db);
+      const int operation_type = find_operation_type( ath );
+      if( operation_type >= 0 )
+         add( ath, operation_type );
+      else
+      {
+         wlog( "Operation ${op} of account history entry ${id} not found, indexing by operation type disabled",
+               ("op", ath.operation_id)("id", id) );
+         _missing.insert( id );
+      }
+   }
+   _unresolved.clear();
+}
+
+const vector< operation_history_id_type >* operation_type_history_index::get_operations( account_id_type account,
+                                                                                          int operation_type )const
+{
+   auto itr = _operations.find( std::make_pair( account, operation_type ) );
+   return itr == _operations.end() ? nullptr : &itr->second;
+}
+
+void operation_type_history_index::add( const account_transaction_history_object& ath, int operation_type )
+{
+   auto& ops = _operations[ std::make_pair( ath.account, operation_type ) ];
+   // new entries usually have the highest operation ID
+   if( ops.empty() || ops.back() < ath.operation_id )
+      ops.push_back( ath.operation_id );
+   else
+      ops.insert( std::lower_bound( ops.begin(), ops.end(), ath.operation_id ), ath.operation_id );
+}
+
+bool operation_type_history_index::remove( const account_transaction_history_object& ath, int operation_type )
+{
+   auto itr = _operations.find( std::make_pair( ath.account, operation_type ) );
+   if( itr == _operations.end() )
+      return false;
+   auto& ops = itr->second;
+   // removed entries are usually the earliest of the account
+   auto op_itr = std::lower_bound( ops.begin(), ops.end(), ath.operation_id );
+   if( op_itr == ops.end() || *op_itr != ath.operation_id )
+      return false;
+   ops.erase( op_itr );
+   if( ops.empty() )
+      _operations.erase( itr );
+   return true;
+}
+
 
 class account_history_plugin_impl
 {
@@ -66,10 +205,18 @@ class account_history_plugin_impl
       bool _partial_operations = false;
       primary_index< operation_history_index >* _oho_index;
       uint64_t _max_ops_per_account = -1;
+      operation_type_history_index* _op_type_index = nullptr;
+      std::unique_ptr< operation_history_store > _history_store;
    private:
       /** add one history record, then check and remove the earliest history record */
       void add_account_history( const account_id_type account_id, const operation_history_id_type op_id );
 
+      /** move the operations of blocks which can no longer be undone from the object database to _history_store */
+      void move_irreversible_operations();
+
+      /** last irreversible block when the previous block was applied, the undo history has no older blocks */
+      uint32_t _undoable_block_num = 0;
+
 };
 
 account_history_plugin_impl::~account_history_plugin_impl()
@@ -191,6 +338,41 @@ void account_history_plugin_impl::update_account_histories( const signed_block&
       if (_partial_operations && ! oho.valid())
          skip_oho_id();
    }
+   if( _op_type_index != nullptr )
+      _op_type_index->resolve();
+   if( _history_store )
+      move_irreversible_operations();
+}
+
+void account_history_plugin_impl::move_irreversible_operations()
+{
+   graphene::chain::database& db = database();
+   const auto& by_id_idx = _oho_index->indices().get<by_id>();
+   const uint32_t undoable_block_num = _undoable_block_num;
+   _undoable_block_num = db.get_dynamic_global_properties().last_irreversible_block_num;
+   if( by_id_idx.empty() || by_id_idx.begin()->block_num >= undoable_block_num )
+      return;
+
+   // The undo history only has blocks since undoable_block_num, so the removal is not recorded. It would
+   // keep a copy of every moved object in memory until its block is dropped from the undo history.
+   const bool undo_enabled = db._undo_db.enabled();
+   if( undo_enabled )
+      db._undo_db.disable();
+   try {
+      for( auto itr = by_id_idx.begin(); itr != by_id_idx.end() && itr->block_num < undoable_block_num;
+           itr = by_id_idx.begin() )
+      {
+         _history_store->store( *itr );
+         db.remove( *itr );
+      }
+      _history_store->flush();
+   } catch( ... ) {
+      if( undo_enabled )
+         db._undo_db.enable();
+      throw;
+   }
+   if( undo_enabled )
+      db._undo_db.enable();
 }
 
 void account_history_plugin_impl::add_account_history( const account_id_type account_id, const operation_history_id_type op_id )
@@ -244,8 +426,10 @@ void account_history_plugin_impl::add_account_history( const account_id_type acc
             const auto& by_opid_idx = his_idx.indices().get<by_opid>();
             if( by_opid_idx.find( remove_op_id ) == by_opid_idx.end() )
             {
-               // if no reference, remove
-               db.remove( remove_op_id(db) );
+               // if no reference, remove, unless it has been moved to the operation history store
+               const operation_history_object* remove_op = db.find( remove_op_id );
+               if( remove_op != nullptr )
+                  db.remove( *remove_op );
             }
          }
       }
@@ -282,13 +466,17 @@ void account_history_plugin::plugin_set_program_options(
          ("track-account", boost::program_options::value<std::vector<std::string>>()->composing()->multitoken(), "Account ID to track history for (may specify multiple times)")
          ("partial-operations", boost::program_options::value<bool>(), "Keep only those operations in memory that are related to account history tracking")
          ("max-ops-per-account", boost::program_options::value<uint64_t>(), "Maximum number of operations per account will be kept in memory")
+         ("index-operation-types", boost::program_options::value<bool>(), "Index account history by operation type to speed up get_account_history_operations (false by default)")
+         ("operation-history-store", boost::program_options::value<boost::filesystem::path>(), "Directory to move operations of irreversible blocks to, instead of keeping them in memory. "
+          "Snapshots of the object database do not contain the moved operations")
          ;
    cfg.add(cli);
 }
 
 void account_history_plugin::plugin_initialize(const boost::program_options::variables_map& options)
 {
-   database().applied_block.connect( [&]( const signed_block& b){ my->update_account_histories(b); } );
+   database().applied_block.connect( database().get_profiler().profile_applied_block( plugin_name(),
+                                     [this]( const signed_block& b){ my->update_account_histories(b); } ) );
    my->_oho_index = database().add_index< primary_index< operation_history_index > >();
    database().add_index< primary_index< account_transaction_history_index > >();
 
@@ -299,10 +487,22 @@ void account_history_plugin::plugin_initialize(const boost::program_options::var
    if (options.count("max-ops-per-account")) {
        my->_max_ops_per_account = options["max-ops-per-account"].as<uint64_t>();
    }
+   if( options.count("index-operation-types") && options["index-operation-types"].as<bool>() ) {
+       my->_op_type_index = database().add_secondary_index< primary_index< account_transaction_history_index >,
+                                                            detail::operation_type_history_index >( &database() );
+   }
+   if( options.count("operation-history-store") ) {
+       my->_history_store.reset( new operation_history_store );
+       my->_history_store->open( options["operation-history-store"].as<boost::filesystem::path>() );
+       if( my->_op_type_index != nullptr )
+          my->_op_type_index->set_history_store( my->_history_store.get() );
+   }
 }
 
 void account_history_plugin::plugin_startup()
 {
+   if( my->_op_type_index != nullptr )
+      my->_op_type_index->resolve();
 }
 
 flat_set<account_id_type> account_history_plugin::tracked_accounts() const
@@ -310,4 +510,32 @@ flat_set<account_id_type> account_history_plugin::tracked_accounts() const
    return my->_tracked_accounts;
 }
 
+optional< vector< operation_history_id_type > > account_history_plugin::get_account_operations_by_type(
+      account_id_type account, int operation_type, operation_history_id_type start,
+      operation_history_id_type stop, unsigned limit )const
+{
+   if( my->_op_type_index == nullptr || !my->_op_type_index->is_complete() )
+      return optional< vector< operation_history_id_type > >();
+   vector< operation_history_id_type > result;
+   const auto* ops = my->_op_type_index->get_operations( account, operation_type );
+   if( ops == nullptr )
+      return result;
+   auto itr = std::upper_bound( ops->begin(), ops->end(), start );
+   while( itr != ops->begin() && result.size() < limit )
+   {
+      --itr;
+      if( stop != operation_history_id_type() && itr->instance.value <= stop.instance.value )
+         break;
+      result.push_back( *itr );
+   }
+   return result;
+}
+
+optional< operation_history_object > account_history_plugin::find_stored_operation( operation_history_id_type id )const
+{
+   if( !my->_history_store )
+      return optional< operation_history_object >();
+   return my->_history_store->fetch( id );
+}
+
 } }
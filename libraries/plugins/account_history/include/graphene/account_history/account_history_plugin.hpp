@@ -76,6 +76,23 @@ class account_history_plugin : public graphene::app::plugin
 
       flat_set<account_id_type> tracked_accounts()const;
 
+      /**
+       * Gets the operations of one type from the history of an account, using the index of operation types.
+       * @return the IDs of the operations with stop < ID <= start, or all with ID <= start if stop is 0,
+       *         ordered from most recent to oldest; nothing if the index is disabled or not up to date
+       */
+      optional< vector< operation_history_id_type > > get_account_operations_by_type( account_id_type account,
+                                                                                      int operation_type,
+                                                                                      operation_history_id_type start,
+                                                                                      operation_history_id_type stop,
+                                                                                      unsigned limit )const;
+
+      /**
+       * @return the operation history object if it has been moved from the object database to the operation
+       *         history store, see the operation-history-store option
+       */
+      optional< operation_history_object > find_stored_operation( operation_history_id_type id )const;
+
       friend class detail::account_history_plugin_impl;
       std::unique_ptr<detail::account_history_plugin_impl> my;
 };
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+
+#include <graphene/chain/operation_history_object.hpp>
+
+#include <fstream>
+#include <memory>
+
+namespace graphene { namespace account_history {
+   using namespace chain;
+
+   /**
+    * Stores operation history objects on disk, in an append-only log ("operations") plus a fixed-size index
+    * ("operations.index") of their positions addressed by object instance, like the block database.
+    *
+    * Reads are served from read-only memory mappings of both files, which are remapped when a read needs data
+    * written after the current mapping was made. Storing an object which is already stored with the same
+    * content, as happens when blocks are replayed, leaves the files unchanged; a different object with the same
+    * id replaces the previous copy. All methods must be called from the thread applying blocks.
+    *
+    * The stored objects are not part of the object database, so snapshots of the object database do not contain
+    * them; the snapshot plugin refuses to run together with a store.
+    */
+   class operation_history_store
+   {
+      public:
+         operation_history_store();
+         ~operation_history_store();
+
+         void open( const fc::path& dir );
+         bool is_open()const;
+         /** Makes the stored objects visible to readers and writes them to disk */
+         void flush();
+         void close();
+
+         void store( const operation_history_object& obj );
+
+         optional<operation_history_object> fetch( operation_history_id_type id )const;
+
+         /** @return the number of bytes in the operation log */
+         uint64_t total_size()const { return _log_size; }
+
+      private:
+         class mapped_file;
+
+         /** @return the stored copy of the object with the given instance */
+         const char* find_stored( uint64_t instance, uint32_t& size )const;
+         /** @return a mapping of at least the first required_size bytes of the file, or nullptr if it is shorter */
+         const mapped_file* map_for_read( std::unique_ptr<const mapped_file>& mapping, const fc::path& filename,
+                                          uint64_t file_size, uint64_t required_size )const;
+
+         fc::path      _log_filename;
+         fc::path      _index_filename;
+         std::fstream  _log;
+         std::fstream  _index;
+         uint64_t      _log_size = 0;
+         uint64_t      _index_size = 0;
+
+         mutable std::unique_ptr<const mapped_file> _log_mapping;
+         mutable std::unique_ptr<const mapped_file> _index_mapping;
+   };
+
+} } // graphene::account_history
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <graphene/account_history/operation_history_store.hpp>
+
+#include <fc/io/raw.hpp>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace graphene { namespace account_history {
+
+namespace detail {
+
+struct operation_index_entry
+{
+   uint64_t position = 0;
+   uint32_t size = 0; ///< 0 if the object is not stored
+};
+
+/** Forces the content of a file written through a stream, and already flushed by it, to disk */
+void sync_file( const fc::path& filename )
+{
+#ifdef _WIN32
+   const int fd = ::_open( filename.generic_string().c_str(), _O_RDWR | _O_BINARY );
+   FC_ASSERT( fd >= 0, "Unable to open ${f}", ("f",filename) );
+   const int result = ::_commit( fd );
+   ::_close( fd );
+#else
+   const int fd = ::open( filename.generic_string().c_str(), O_RDONLY );
+   FC_ASSERT( fd >= 0, "Unable to open ${f}", ("f",filename) );
+   const int result = ::fsync( fd );
+   ::close( fd );
+#endif
+   FC_ASSERT( result == 0, "Unable to write ${f} to disk", ("f",filename) );
+}
+
+} // detail
+
+/** A read-only mapping of a whole file as it was at the time the mapping was made */
+class operation_history_store::mapped_file
+{
+   public:
+      explicit mapped_file( const fc::path& filename )
+         : _mapping( filename.generic_string().c_str(), boost::interprocess::read_only ),
+           _region( _mapping, boost::interprocess::read_only )
+      {}
+
+      const char* data()const { return static_cast<const char*>( _region.get_address() ); }
+      uint64_t    size()const { return _region.get_size(); }
+
+   private:
+      boost::interprocess::file_mapping  _mapping;
+      boost::interprocess::mapped_region _region;
+};
+
+operation_history_store::operation_history_store() {}
+
+operation_history_store::~operation_history_store()
+{
+   close();
+}
+
+void operation_history_store::open( const fc::path& dir )
+{ try {
+   fc::create_directories( dir );
+   _log_filename = dir / "operations";
+   _index_filename = dir / "operations.index";
+   _log.exceptions( std::ios_base::failbit | std::ios_base::badbit );
+   _index.exceptions( std::ios_base::failbit | std::ios_base::badbit );
+
+   auto mode = std::fstream::binary | std::fstream::in | std::fstream::out;
+   if( !fc::exists( _index_filename ) || !fc::exists( _log_filename ) )
+      mode |= std::fstream::trunc;
+   _log.open( _log_filename.generic_string().c_str(), mode );
+   _index.open( _index_filename.generic_string().c_str(), mode );
+
+   _log_size = fc::file_size( _log_filename );
+   _index_size = fc::file_size( _index_filename );
+   _index_size -= _index_size % sizeof( detail::operation_index_entry );
+} FC_CAPTURE_AND_RETHROW( (dir) ) }
+
+bool operation_history_store::is_open()const
+{
+   return _log.is_open();
+}
+
+void operation_history_store::flush()
+{
+   _log.flush();
+   _index.flush();
+   // The objects are removed from the object database once they are here, the log goes first so that the
+   // index never points past its end
+   detail::sync_file( _log_filename );
+   detail::sync_file( _index_filename );
+}
+
+void operation_history_store::close()
+{
+   _log_mapping.reset();
+   _index_mapping.reset();
+   if( _log.is_open() )
+      _log.close();
+   if( _index.is_open() )
+      _index.close();
+   _log_size = 0;
+   _index_size = 0;
+}
+
+void operation_history_store::store( const operation_history_object& obj )
+{
+   const auto data = fc::raw::pack( obj );
+   uint32_t stored_size = 0;
+   const char* stored = find_stored( obj.id.instance(), stored_size );
+   if( stored != nullptr && stored_size == data.size() && std::memcmp( stored, data.data(), data.size() ) == 0 )
+      return;
+
+   detail::operation_index_entry e;
+   e.position = _log_size;
+   e.size = data.size();
+   _log.seekp( e.position );
+   _log.write( data.data(), data.size() );
+   _log_size += e.size;
+
+   // skipped instances between the end of the index and this one read as empty entries
+   const uint64_t index_pos = sizeof( e ) * obj.id.instance();
+   _index.seekp( index_pos );
+   _index.write( (const char*)&e, sizeof( e ) );
+   _index_size = std::max( _index_size, index_pos + sizeof( e ) );
+}
+
+const operation_history_store::mapped_file* operation_history_store::map_for_read(
+      std::unique_ptr<const mapped_file>& mapping, const fc::path& filename,
+      uint64_t file_size, uint64_t required_size )const
+{
+   if( file_size < required_size )
+      return nullptr;
+   if( !mapping || mapping->size() < required_size )
+   {
+      mapping.reset();
+      mapping.reset( new mapped_file( filename ) );
+      if( mapping->size() < required_size )
+         return nullptr;
+   }
+   return mapping.get();
+}
+
+const char* operation_history_store::find_stored( uint64_t instance, uint32_t& size )const
+{
+   detail::operation_index_entry e;
+   const uint64_t index_pos = sizeof( e ) * instance;
+   const mapped_file* index = map_for_read( _index_mapping, _index_filename, _index_size, index_pos + sizeof( e ) );
+   if( index == nullptr )
+      return nullptr;
+   std::memcpy( (char*)&e, index->data() + index_pos, sizeof( e ) );
+   if( e.size == 0 )
+      return nullptr;
+
+   const mapped_file* log = map_for_read( _log_mapping, _log_filename, _log_size, e.position + e.size );
+   if( log == nullptr )
+      return nullptr;
+   size = e.size;
+   return log->data() + e.position;
+}
+
+optional<operation_history_object> operation_history_store::fetch( operation_history_id_type id )const
+{ try {
+   uint32_t size = 0;
+   const char* data = find_stored( id.instance.value, size );
+   if( data == nullptr )
+      return optional<operation_history_object>();
+   // deserialize straight out of the mapping
+   fc::datastream<const char*> ds( data, size );
+   operation_history_object result;
+   fc::raw::unpack( ds, result );
+   FC_ASSERT( result.id == id, "Operation history store is corrupt" );
+   return result;
+} FC_CAPTURE_AND_RETHROW( (id) ) }
+
+} } // graphene::account_history
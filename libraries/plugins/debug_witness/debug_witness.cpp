@@ -96,7 +96,8 @@ void debug_witness_plugin::plugin_startup()
 
    // connect needed signals
 
-   _applied_block_conn  = db.applied_block.connect([this](const graphene::chain::signed_block& b){ on_applied_block(b); });
+   _applied_block_conn  = db.applied_block.connect( db.get_profiler().profile_applied_block( plugin_name(),
+                                                    [this](const graphene::chain::signed_block& b){ on_applied_block(b); } ) );
    _changed_objects_conn = db.changed_objects.connect([this](const std::vector<graphene::db::object_id_type>& ids, const fc::flat_set<graphene::chain::account_id_type>& impacted_accounts){ on_changed_objects(ids, impacted_accounts); });
    _removed_objects_conn = db.removed_objects.connect([this](const std::vector<graphene::db::object_id_type>& ids, const std::vector<const graphene::db::object*>& objs, const fc::flat_set<graphene::chain::account_id_type>& impacted_accounts){ on_removed_objects(ids, objs, impacted_accounts); });
 
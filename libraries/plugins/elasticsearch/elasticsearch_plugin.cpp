@@ -33,6 +33,16 @@ namespace graphene { namespace elasticsearch {
 namespace detail
 {
 
+/** The data of an account history document, which is serialized on a sender thread */
+struct pending_document
+{
+   account_transaction_history_object                 ath;
+   std::shared_ptr<const operation_history_object>    oho;
+   block_struct                                       block;
+   optional<visitor_struct>                           visitor;
+   std::string                                        index_name;
+};
+
 class elasticsearch_plugin_impl
 {
    public:
@@ -59,36 +69,34 @@ class elasticsearch_plugin_impl
       std::string _elasticsearch_index_prefix = "bitshares-";
       bool _elasticsearch_operation_object = false;
       uint32_t _elasticsearch_start_es_after_block = 0;
+      uint16_t _elasticsearch_sender_threads = 2;
+      uint32_t _elasticsearch_max_queued_bulks = 8;
+      uint32_t _elasticsearch_max_retries = 3;
       CURL *curl; // curl handler
-      vector <string> bulk_lines; //  vector of op lines
-      vector<std::string> prepare;
+      std::unique_ptr<graphene::utilities::es_bulk_exporter> exporter;
+      vector<pending_document> documents; // documents of the next bulk
 
-      graphene::utilities::ES es;
       uint32_t limit_documents;
-      int16_t op_type;
-      operation_history_struct os;
       block_struct bs;
       visitor_struct vs;
-      bulk_struct bulk_line_struct;
-      std::string bulk_line;
       std::string index_name;
       bool is_sync = false;
+      uint32_t last_block_num = 0;
+
+      /** queue the collected documents for sending */
+      bool sendBulk();
    private:
-      bool add_elasticsearch( const account_id_type account_id, const optional<operation_history_object>& oho, const uint32_t block_number );
+      bool add_elasticsearch( const account_id_type account_id, const std::shared_ptr<const operation_history_object>& oho, const uint32_t block_number );
       const account_transaction_history_object& addNewEntry(const account_statistics_object& stats_obj,
                                                             const account_id_type& account_id,
-                                                            const optional <operation_history_object>& oho);
+                                                            const operation_history_id_type& oho_id);
       const account_statistics_object& getStatsObject(const account_id_type& account_id);
       void growStats(const account_statistics_object& stats_obj, const account_transaction_history_object& ath);
-      void getOperationType(const optional <operation_history_object>& oho);
-      void doOperationHistory(const optional <operation_history_object>& oho);
       void doBlock(uint32_t trx_in_block, const signed_block& b);
       void doVisitor(const optional <operation_history_object>& oho);
       void checkState(const fc::time_point_sec& block_time);
       void cleanObjects(const account_transaction_history_id_type& ath, const account_id_type& account_id);
-      void createBulkLine(const account_transaction_history_object& ath);
-      void prepareBulk(const account_transaction_history_id_type& ath_id);
-      void populateESstruct();
+      void addDocument(const account_transaction_history_object& ath, const std::shared_ptr<const operation_history_object>& oho);
 };
 
 elasticsearch_plugin_impl::~elasticsearch_plugin_impl()
@@ -96,9 +104,57 @@ elasticsearch_plugin_impl::~elasticsearch_plugin_impl()
    return;
 }
 
+static operation_history_struct doOperationHistory( const operation_history_object& oho, bool operation_object )
+{
+   operation_history_struct os;
+   os.trx_in_block = oho.trx_in_block;
+   os.op_in_trx = oho.op_in_trx;
+   os.operation_result = fc::json::to_string(oho.result);
+   os.virtual_op = oho.virtual_op;
+
+   if(operation_object) {
+      oho.op.visit(fc::from_static_variant(os.op_object, FC_PACK_MAX_DEPTH));
+      adaptor_struct adaptor;
+      os.op_object = adaptor.adapt(os.op_object.get_object());
+   }
+   else
+      os.op = fc::json::to_string(oho.op);
+
+   return os;
+}
+
+/** builds the bulk lines of the documents, runs on a sender thread */
+static std::vector<std::string> serializeDocuments( const vector<pending_document>& documents, bool operation_object )
+{
+   std::vector<std::string> bulk_lines;
+   bulk_lines.reserve(documents.size() * 2);
+   for( const pending_document& doc : documents )
+   {
+      bulk_struct bulk_line_struct;
+      bulk_line_struct.account_history = doc.ath;
+      bulk_line_struct.operation_history = doOperationHistory(*doc.oho, operation_object);
+      bulk_line_struct.operation_type = doc.oho->op.which();
+      bulk_line_struct.operation_id_num = doc.ath.operation_id.instance.value;
+      bulk_line_struct.block_data = doc.block;
+      bulk_line_struct.additional_data = doc.visitor;
+
+      const account_transaction_history_id_type ath_id = doc.ath.id;
+      fc::mutable_variant_object bulk_header;
+      bulk_header["_index"] = doc.index_name;
+      bulk_header["_type"] = "data";
+      bulk_header["_id"] = fc::to_string(ath_id.space_id) + "." + fc::to_string(ath_id.type_id) + "."
+                         + fc::to_string(ath_id.instance.value);
+      const auto bulk = graphene::utilities::createBulk(bulk_header,
+                                                        fc::json::to_string(bulk_line_struct, fc::json::legacy_generator));
+      bulk_lines.insert(bulk_lines.end(), bulk.begin(), bulk.end());
+   }
+   return bulk_lines;
+}
+
 bool elasticsearch_plugin_impl::update_account_histories( const signed_block& b )
 {
    checkState(b.timestamp);
+   last_block_num = b.block_num();
    index_name = graphene::utilities::generateIndexName(b.timestamp, _elasticsearch_index_prefix);
 
    graphene::chain::database& db = database();
@@ -137,10 +193,10 @@ bool elasticsearch_plugin_impl::update_account_histories( const signed_block& b
          continue;
       }
       oho = create_oho();
+      // shared by the documents of all impacted accounts, serialized later
+      const auto shared_oho = std::make_shared<const operation_history_object>(*oho);
 
       // populate what we can before impacted loop
-      getOperationType(oho);
-      doOperationHistory(oho);
       doBlock(oho->trx_in_block, b);
       if(_elasticsearch_visitor)
          doVisitor(oho);
@@ -163,27 +219,21 @@ bool elasticsearch_plugin_impl::update_account_histories( const signed_block& b
 
       for( auto& account_id : impacted )
       {
-         if(!add_elasticsearch( account_id, oho, b.block_num() ))
+         if(!add_elasticsearch( account_id, shared_oho, b.block_num() ))
             return false;
       }
    }
    // we send bulk at end of block when we are in sync for better real time client experience
-   if(is_sync)
+   if(is_sync && !documents.empty())
+      return sendBulk();
+
+   if(!is_sync && b.block_num() % 10000 == 0)
    {
-      populateESstruct();
-      if(es.bulk_lines.size() > 0)
-      {
-         prepare.clear();
-         if(!graphene::utilities::SendBulk(std::move(es)))
-            return false;
-         else
-            bulk_lines.clear();
-      }
+      const auto stats = exporter->get_stats();
+      ilog( "elasticsearch: ${q} bulks with ${d} documents queued, sent up to block ${s}, lag ${l} ms",
+            ("q",stats.queued_bulks)("d",stats.queued_documents)("s",stats.last_sent_block)
+            ("l",stats.lag.count() / 1000) );
    }
-
-   if(bulk_lines.size() != limit_documents)
-      bulk_lines.reserve(limit_documents);
-
    return true;
 }
 
@@ -201,29 +251,6 @@ void elasticsearch_plugin_impl::checkState(const fc::time_point_sec& block_time)
    }
 }
 
-void elasticsearch_plugin_impl::getOperationType(const optional <operation_history_object>& oho)
-{
-   if (!oho->id.is_null())
-      op_type = oho->op.which();
-}
-
-void elasticsearch_plugin_impl::doOperationHistory(const optional <operation_history_object>& oho)
-{
-   os.trx_in_block = oho->trx_in_block;
-   os.op_in_trx = oho->op_in_trx;
-   os.operation_result = fc::json::to_string(oho->result);
-   os.virtual_op = oho->virtual_op;
-
-   if(_elasticsearch_operation_object) {
-      oho->op.visit(fc::from_static_variant(os.op_object, FC_PACK_MAX_DEPTH));
-      adaptor_struct adaptor;
-      os.op_object = adaptor.adapt(os.op_object.get_object());
-   }
-   else
-      os.op = fc::json::to_string(oho->op);
-
-}
-
 void elasticsearch_plugin_impl::doBlock(uint32_t trx_in_block, const signed_block& b)
 {
    std::string trx_id = "";
@@ -276,30 +303,41 @@ void elasticsearch_plugin_impl::doVisitor(const optional <operation_history_obje
 }
 
 bool elasticsearch_plugin_impl::add_elasticsearch( const account_id_type account_id,
-                                                   const optional <operation_history_object>& oho,
+                                                   const std::shared_ptr<const operation_history_object>& oho,
                                                    const uint32_t block_number)
 {
    const auto &stats_obj = getStatsObject(account_id);
-   const auto &ath = addNewEntry(stats_obj, account_id, oho);
+   const auto &ath = addNewEntry(stats_obj, account_id, oho->id);
    growStats(stats_obj, ath);
-   if(block_number > _elasticsearch_start_es_after_block)  {
-      createBulkLine(ath);
-      prepareBulk(ath.id);
-   }
+   if(block_number > _elasticsearch_start_es_after_block)
+      addDocument(ath, oho);
    cleanObjects(ath.id, account_id);
 
-   if (curl && bulk_lines.size() >= limit_documents) { // we are in bulk time, ready to add data to elasticsearech
-      prepare.clear();
-      populateESstruct();
-      if(!graphene::utilities::SendBulk(std::move(es)))
-         return false;
-      else
-         bulk_lines.clear();
-   }
+   if (documents.size() >= limit_documents) // we are in bulk time, ready to add data to elasticsearech
+      return sendBulk();
 
    return true;
 }
 
+bool elasticsearch_plugin_impl::sendBulk()
+{
+   const auto bulk = std::make_shared<const vector<pending_document>>(std::move(documents));
+   documents.clear();
+   const bool operation_object = _elasticsearch_operation_object;
+   try
+   {
+      exporter->push(last_block_num, bulk->size(), [bulk,operation_object]() {
+         return serializeDocuments(*bulk, operation_object);
+      });
+   }
+   catch (const fc::exception& e)
+   {
+      elog( "Error sending data to elasticsearch: ${e}", ("e",e.to_detail_string()) );
+      return false;
+   }
+   return true;
+}
+
 const account_statistics_object& elasticsearch_plugin_impl::getStatsObject(const account_id_type& account_id)
 {
    graphene::chain::database& db = database();
@@ -310,11 +348,11 @@ const account_statistics_object& elasticsearch_plugin_impl::getStatsObject(const
 
 const account_transaction_history_object& elasticsearch_plugin_impl::addNewEntry(const account_statistics_object& stats_obj,
                                                                                  const account_id_type& account_id,
-                                                                                 const optional <operation_history_object>& oho)
+                                                                                 const operation_history_id_type& oho_id)
 {
    graphene::chain::database& db = database();
    const auto &ath = db.create<account_transaction_history_object>([&](account_transaction_history_object &obj) {
-      obj.operation_id = oho->id;
+      obj.operation_id = oho_id;
       obj.account = account_id;
       obj.sequence = stats_obj.total_ops + 1;
       obj.next = stats_obj.most_recent_op;
@@ -333,29 +371,17 @@ void elasticsearch_plugin_impl::growStats(const account_statistics_object& stats
    });
 }
 
-void elasticsearch_plugin_impl::createBulkLine(const account_transaction_history_object& ath)
+void elasticsearch_plugin_impl::addDocument(const account_transaction_history_object& ath,
+                                            const std::shared_ptr<const operation_history_object>& oho)
 {
-   bulk_line_struct.account_history = ath;
-   bulk_line_struct.operation_history = os;
-   bulk_line_struct.operation_type = op_type;
-   bulk_line_struct.operation_id_num = ath.operation_id.instance.value;
-   bulk_line_struct.block_data = bs;
+   pending_document doc;
+   doc.ath = ath;
+   doc.oho = oho;
+   doc.block = bs;
    if(_elasticsearch_visitor)
-      bulk_line_struct.additional_data = vs;
-   bulk_line = fc::json::to_string(bulk_line_struct, fc::json::legacy_generator);
-}
-
-void elasticsearch_plugin_impl::prepareBulk(const account_transaction_history_id_type& ath_id)
-{
-   const std::string _id = fc::json::to_string(ath_id);
-   fc::mutable_variant_object bulk_header;
-   bulk_header["_index"] = index_name;
-   bulk_header["_type"] = "data";
-   bulk_header["_id"] = fc::to_string(ath_id.space_id) + "." + fc::to_string(ath_id.type_id) + "."
-                      + fc::to_string(ath_id.instance.value);
-   prepare = graphene::utilities::createBulk(bulk_header, std::move(bulk_line));
-   std::move(prepare.begin(), prepare.end(), std::back_inserter(bulk_lines));
-   prepare.clear();
+      doc.visitor = vs;
+   doc.index_name = index_name;
+   documents.push_back(std::move(doc));
 }
 
 void elasticsearch_plugin_impl::cleanObjects(const account_transaction_history_id_type& ath_id, const account_id_type& account_id)
@@ -387,17 +413,6 @@ void elasticsearch_plugin_impl::cleanObjects(const account_transaction_history_i
    }
 }
 
-void elasticsearch_plugin_impl::populateESstruct()
-{
-   es.curl = curl;
-   es.bulk_lines = std::move(bulk_lines);
-   es.elasticsearch_url = _elasticsearch_node_url;
-   es.auth = _elasticsearch_basic_auth;
-   es.index_prefix = _elasticsearch_index_prefix;
-   es.endpoint = "";
-   es.query = "";
-}
-
 } // end namespace detail
 
 elasticsearch_plugin::elasticsearch_plugin() :
@@ -432,16 +447,20 @@ void elasticsearch_plugin::plugin_set_program_options(
          ("elasticsearch-index-prefix", boost::program_options::value<std::string>(), "Add a prefix to the index(bitshares-)")
          ("elasticsearch-operation-object", boost::program_options::value<bool>(), "Save operation as object(false)")
          ("elasticsearch-start-es-after-block", boost::program_options::value<uint32_t>(), "Start doing ES job after block(0)")
+         ("elasticsearch-sender-threads", boost::program_options::value<uint16_t>(), "Number of threads serializing and sending bulks(2)")
+         ("elasticsearch-max-queued-bulks", boost::program_options::value<uint32_t>(), "Number of bulks which may wait to be sent before block processing waits for them(8)")
+         ("elasticsearch-max-retries", boost::program_options::value<uint32_t>(), "Number of times a failed bulk is sent again(3)")
          ;
    cfg.add(cli);
 }
 
 void elasticsearch_plugin::plugin_initialize(const boost::program_options::variables_map& options)
 {
-   database().applied_block.connect( [&]( const signed_block& b) {
+   database().applied_block.connect( database().get_profiler().profile_applied_block( plugin_name(),
+                                     [this]( const signed_block& b) {
       if (!my->update_account_histories(b))
          FC_THROW_EXCEPTION(graphene::chain::plugin_exception, "Error populating ES database, we are going to keep trying.");
-   } );
+   } ) );
 
    my->_oho_index = database().add_index< primary_index< operation_history_index > >();
    database().add_index< primary_index< account_transaction_history_index > >();
@@ -469,7 +488,24 @@ void elasticsearch_plugin::plugin_initialize(const boost::program_options::varia
    }
    if (options.count("elasticsearch-start-es-after-block")) {
       my->_elasticsearch_start_es_after_block = options["elasticsearch-start-es-after-block"].as<uint32_t>();
-   }   
+   }
+   if (options.count("elasticsearch-sender-threads")) {
+      my->_elasticsearch_sender_threads = options["elasticsearch-sender-threads"].as<uint16_t>();
+   }
+   if (options.count("elasticsearch-max-queued-bulks")) {
+      my->_elasticsearch_max_queued_bulks = options["elasticsearch-max-queued-bulks"].as<uint32_t>();
+   }
+   if (options.count("elasticsearch-max-retries")) {
+      my->_elasticsearch_max_retries = options["elasticsearch-max-retries"].as<uint32_t>();
+   }
+
+   graphene::utilities::es_exporter_options exporter_options;
+   exporter_options.elasticsearch_url = my->_elasticsearch_node_url;
+   exporter_options.auth = my->_elasticsearch_basic_auth;
+   exporter_options.sender_threads = my->_elasticsearch_sender_threads;
+   exporter_options.max_queued_bulks = my->_elasticsearch_max_queued_bulks;
+   exporter_options.max_retries = my->_elasticsearch_max_retries;
+   my->exporter.reset(new graphene::utilities::es_bulk_exporter(exporter_options));
 }
 
 void elasticsearch_plugin::plugin_startup()
@@ -484,4 +520,26 @@ void elasticsearch_plugin::plugin_startup()
    ilog("elasticsearch ACCOUNT HISTORY: plugin_startup() begin");
 }
 
+void elasticsearch_plugin::plugin_shutdown()
+{
+   if(!my->exporter)
+      return;
+   try
+   {
+      if(!my->documents.empty())
+         my->sendBulk();
+      my->exporter->flush();
+   }
+   catch (const fc::exception& e)
+   {
+      elog( "Error sending data to elasticsearch: ${e}", ("e",e.to_detail_string()) );
+   }
+}
+
+graphene::utilities::es_exporter_stats elasticsearch_plugin::exporter_stats()const
+{
+   FC_ASSERT( my->exporter );
+   return my->exporter->get_stats();
+}
+
 } }
@@ -32,12 +32,40 @@
 #include <graphene/chain/account_object.hpp>
 
 #include <graphene/utilities/elasticsearch.hpp>
+#include <graphene/utilities/elasticsearch_exporter.hpp>
+
+#include <algorithm>
+#include <unordered_map>
 
 namespace graphene { namespace es_objects {
 
 namespace detail
 {
 
+/** a state of an object which has not been queued for sending yet */
+struct pending_object
+{
+   object_id_type                  id;
+   /** the state to index, cloned when the document is queued if only the current state is kept */
+   std::shared_ptr<const object>   state;
+   bool                            removed = false;
+   uint32_t                        block_number = 0;
+   fc::time_point_sec              block_time;
+};
+
+/**
+ * The documents of an object type. Each type has its own exporter with a single sender thread, so the documents of
+ * an object reach elasticsearch in order while the documents of different types are sent on parallel connections.
+ */
+struct object_stream
+{
+   std::string                                              index_name;
+   std::unique_ptr<graphene::utilities::es_bulk_exporter>   exporter;
+   vector<pending_object>                                   documents;
+   /** position of the document of each object instance in documents, used if only the current state is kept */
+   std::unordered_map<uint64_t, size_t>                     positions;
+};
+
 class es_objects_plugin_impl
 {
    public:
@@ -47,7 +75,11 @@ class es_objects_plugin_impl
       virtual ~es_objects_plugin_impl();
 
       bool index_database( const vector<object_id_type>& ids, std::string action);
-      void remove_from_database( object_id_type id, std::string index);
+
+      /** queue the collected documents of all streams for sending */
+      bool sendBulk();
+      /** create the streams of the enabled object types */
+      void init_streams();
 
       es_objects_plugin& _self;
       std::string _es_objects_elasticsearch_url = "http://localhost:9200/";
@@ -62,20 +94,53 @@ class es_objects_plugin_impl
       bool _es_objects_asset_bitasset = true;
       std::string _es_objects_index_prefix = "objects-";
       uint32_t _es_objects_start_es_after_block = 0;
+      uint32_t _es_objects_max_queued_bulks = 4;
+      uint32_t _es_objects_max_retries = 3;
       CURL *curl; // curl handler
-      vector <std::string> bulk;
-      vector<std::string> prepare;
 
       bool _es_objects_keep_only_current = true;
 
       uint32_t block_number;
       fc::time_point_sec block_time;
 
+      /** streams by space and type of their objects */
+      std::map<uint16_t, object_stream> streams;
+      /** number of documents in all streams */
+      uint32_t pending_documents = 0;
+
    private:
       template<typename T>
-      void prepareTemplate(T blockchain_object, string index_name);
+      void add_stream(bool enabled, const string& index_name);
+      void add_document(object_stream& stream, const object_id_type& id, bool removed);
 };
 
+template<typename T>
+void es_objects_plugin_impl::add_stream(bool enabled, const string& index_name)
+{
+   if(!enabled)
+      return;
+   graphene::utilities::es_exporter_options options;
+   options.elasticsearch_url = _es_objects_elasticsearch_url;
+   options.auth = _es_objects_auth;
+   options.sender_threads = 1;
+   options.max_queued_bulks = _es_objects_max_queued_bulks;
+   options.max_retries = _es_objects_max_retries;
+
+   object_stream& stream = streams[object_id_type(T::space_id, T::type_id, 0).space_type()];
+   stream.index_name = _es_objects_index_prefix + index_name;
+   stream.exporter.reset(new graphene::utilities::es_bulk_exporter(options));
+}
+
+void es_objects_plugin_impl::init_streams()
+{
+   add_stream<proposal_object>(_es_objects_proposals, "proposal");
+   add_stream<account_object>(_es_objects_accounts, "account");
+   add_stream<asset_object>(_es_objects_assets, "asset");
+   add_stream<account_balance_object>(_es_objects_balances, "balance");
+   add_stream<limit_order_object>(_es_objects_limit_orders, "limitorder");
+   add_stream<asset_bitasset_data_object>(_es_objects_asset_bitasset, "bitasset");
+}
+
 bool es_objects_plugin_impl::index_database( const vector<object_id_type>& ids, std::string action)
 {
    graphene::chain::database &db = _self.database();
@@ -92,124 +157,153 @@ bool es_objects_plugin_impl::index_database( const vector<object_id_type>& ids,
       else
          limit_documents = _es_objects_bulk_replay;
 
-
+      const bool removed = (action == "delete");
       for (auto const &value: ids) {
-         if (value.is<proposal_object>() && _es_objects_proposals) {
-            auto obj = db.find_object(value);
-            auto p = static_cast<const proposal_object *>(obj);
-            if (p != nullptr) {
-               if (action == "delete")
-                  remove_from_database(p->id, "proposal");
-               else
-                  prepareTemplate<proposal_object>(*p, "proposal");
-            }
-         } else if (value.is<account_object>() && _es_objects_accounts) {
-            auto obj = db.find_object(value);
-            auto a = static_cast<const account_object *>(obj);
-            if (a != nullptr) {
-               if (action == "delete")
-                  remove_from_database(a->id, "account");
-               else
-                  prepareTemplate<account_object>(*a, "account");
-            }
-         } else if (value.is<asset_object>() && _es_objects_assets) {
-            auto obj = db.find_object(value);
-            auto a = static_cast<const asset_object *>(obj);
-            if (a != nullptr) {
-               if (action == "delete")
-                  remove_from_database(a->id, "asset");
-               else
-                  prepareTemplate<asset_object>(*a, "asset");
-            }
-         } else if (value.is<account_balance_object>() && _es_objects_balances) {
-            auto obj = db.find_object(value);
-            auto b = static_cast<const account_balance_object *>(obj);
-            if (b != nullptr) {
-               if (action == "delete")
-                  remove_from_database(b->id, "balance");
-               else
-                  prepareTemplate<account_balance_object>(*b, "balance");
-            }
-         } else if (value.is<limit_order_object>() && _es_objects_limit_orders) {
-            auto obj = db.find_object(value);
-            auto l = static_cast<const limit_order_object *>(obj);
-            if (l != nullptr) {
-               if (action == "delete")
-                  remove_from_database(l->id, "limitorder");
-               else
-                  prepareTemplate<limit_order_object>(*l, "limitorder");
-            }
-         } else if (value.is<asset_bitasset_data_object>() && _es_objects_asset_bitasset) {
-            auto obj = db.find_object(value);
-            auto ba = static_cast<const asset_bitasset_data_object *>(obj);
-            if (ba != nullptr) {
-               if (action == "delete")
-                  remove_from_database(ba->id, "bitasset");
-               else
-                  prepareTemplate<asset_bitasset_data_object>(*ba, "bitasset");
-            }
-         }
+         auto stream = streams.find(value.space_type());
+         if (stream != streams.end())
+            add_document(stream->second, value, removed);
       }
 
-      if (curl && bulk.size() >= limit_documents) { // we are in bulk time, ready to add data to elasticsearech
-
-         graphene::utilities::ES es;
-         es.curl = curl;
-         es.bulk_lines = bulk;
-         es.elasticsearch_url = _es_objects_elasticsearch_url;
-         es.auth = _es_objects_auth;
-
-         if (!graphene::utilities::SendBulk(std::move(es)))
-            return false;
-         else
-            bulk.clear();
-      }
+      if (pending_documents >= limit_documents) // we are in bulk time, ready to add data to elasticsearech
+         return sendBulk();
    }
 
    return true;
 }
 
-void es_objects_plugin_impl::remove_from_database( object_id_type id, std::string index)
+void es_objects_plugin_impl::add_document(object_stream& stream, const object_id_type& id, bool removed)
 {
-   if(_es_objects_keep_only_current)
+   if(!_es_objects_keep_only_current)
    {
-      fc::mutable_variant_object delete_line;
-      delete_line["_id"] = string(id);
-      delete_line["_index"] = _es_objects_index_prefix + index;
-      delete_line["_type"] = "data";
-      fc::mutable_variant_object final_delete_line;
-      final_delete_line["delete"] = delete_line;
-      prepare.push_back(fc::json::to_string(final_delete_line));
-      std::move(prepare.begin(), prepare.end(), std::back_inserter(bulk));
-      prepare.clear();
+      // every state is indexed, removals are not
+      if(removed)
+         return;
+      const object* obj = _self.database().find_object(id);
+      if(obj == nullptr)
+         return;
+      pending_object doc;
+      doc.id = id;
+      doc.state = std::shared_ptr<const object>(obj->clone());
+      doc.block_number = block_number;
+      doc.block_time = block_time;
+      stream.documents.push_back(std::move(doc));
+      ++pending_documents;
+      return;
    }
-}
 
-template<typename T>
-void es_objects_plugin_impl::prepareTemplate(T blockchain_object, string index_name)
-{
-   fc::mutable_variant_object bulk_header;
-   bulk_header["_index"] = _es_objects_index_prefix + index_name;
-   bulk_header["_type"] = "data";
-   if(_es_objects_keep_only_current)
+   // only the last state of an object within a bulk is indexed, it is read when the bulk is queued
+   auto itr = stream.positions.find(id.instance());
+   if(itr == stream.positions.end())
    {
-      bulk_header["_id"] = string(blockchain_object.id);
+      itr = stream.positions.emplace(id.instance(), stream.documents.size()).first;
+      stream.documents.emplace_back();
+      ++pending_documents;
    }
+   pending_object& doc = stream.documents[itr->second];
+   doc.id = id;
+   doc.removed = removed;
+   doc.block_number = block_number;
+   doc.block_time = block_time;
+}
 
+static vector<std::string> serializeObjects( const vector<pending_object>& documents, const std::string& index_name,
+                                             bool keep_only_current )
+{
+   vector<std::string> bulk;
+   bulk.reserve(documents.size() * 2);
    adaptor_struct adaptor;
-   fc::variant blockchain_object_variant;
-   fc::to_variant( blockchain_object, blockchain_object_variant, GRAPHENE_NET_MAX_NESTED_OBJECTS );
-   fc::mutable_variant_object o = adaptor.adapt(blockchain_object_variant.get_object());
+   for(const auto& doc : documents)
+   {
+      if(doc.removed)
+      {
+         fc::mutable_variant_object delete_line;
+         delete_line["_id"] = string(doc.id);
+         delete_line["_index"] = index_name;
+         delete_line["_type"] = "data";
+         fc::mutable_variant_object final_delete_line;
+         final_delete_line["delete"] = delete_line;
+         bulk.push_back(fc::json::to_string(final_delete_line));
+         continue;
+      }
 
-   o["object_id"] = string(blockchain_object.id);
-   o["block_time"] = block_time;
-   o["block_number"] = block_number;
+      fc::mutable_variant_object bulk_header;
+      bulk_header["_index"] = index_name;
+      bulk_header["_type"] = "data";
+      if(keep_only_current)
+         bulk_header["_id"] = string(doc.id);
 
-   string data = fc::json::to_string(o, fc::json::legacy_generator);
+      fc::mutable_variant_object o = adaptor.adapt(doc.state->to_variant().get_object());
+      o["object_id"] = string(doc.id);
+      o["block_time"] = doc.block_time;
+      o["block_number"] = doc.block_number;
 
-   prepare = graphene::utilities::createBulk(bulk_header, std::move(data));
-   std::move(prepare.begin(), prepare.end(), std::back_inserter(bulk));
-   prepare.clear();
+      auto lines = graphene::utilities::createBulk(bulk_header, fc::json::to_string(o, fc::json::legacy_generator));
+      std::move(lines.begin(), lines.end(), std::back_inserter(bulk));
+   }
+   return bulk;
+}
+
+bool es_objects_plugin_impl::sendBulk()
+{
+   const graphene::chain::database& db = _self.database();
+   const bool keep_only_current = _es_objects_keep_only_current;
+   try
+   {
+      for(auto& item : streams)
+      {
+         object_stream& stream = item.second;
+         if(stream.documents.empty())
+            continue;
+
+         if(keep_only_current)
+         {
+            // clone the current states, objects which are gone without a removal are skipped
+            auto end = std::remove_if(stream.documents.begin(), stream.documents.end(),
+                                      [&db]( pending_object& doc ) -> bool {
+               if(doc.removed)
+                  return false;
+               const object* obj = db.find_object(doc.id);
+               if(obj == nullptr)
+                  return true;
+               doc.state = std::shared_ptr<const object>(obj->clone());
+               return false;
+            });
+            stream.documents.erase(end, stream.documents.end());
+            stream.positions.clear();
+         }
+
+         const auto bulk = std::make_shared<vector<pending_object>>(std::move(stream.documents));
+         stream.documents.clear();
+         if(bulk->empty())
+            continue;
+         const std::string index_name = stream.index_name;
+         try
+         {
+            stream.exporter->push(block_number, bulk->size(), [bulk,index_name,keep_only_current]() {
+               return serializeObjects(*bulk, index_name, keep_only_current);
+            });
+         }
+         catch (const fc::exception&)
+         {
+            // the bulk has not been queued, keep its documents for the next attempt
+            stream.documents = std::move(*bulk);
+            if(keep_only_current)
+               for(size_t i = 0; i < stream.documents.size(); ++i)
+                  stream.positions[stream.documents[i].id.instance()] = i;
+            throw;
+         }
+      }
+   }
+   catch (const fc::exception& e)
+   {
+      elog( "Error sending objects to elasticsearch: ${e}", ("e",e.to_detail_string()) );
+      pending_documents = 0;
+      for(const auto& item : streams)
+         pending_documents += item.second.documents.size();
+      return false;
+   }
+   pending_documents = 0;
+   return true;
 }
 
 es_objects_plugin_impl::~es_objects_plugin_impl()
@@ -245,7 +339,7 @@ void es_objects_plugin::plugin_set_program_options(
    cli.add_options()
          ("es-objects-elasticsearch-url", boost::program_options::value<std::string>(), "Elasticsearch node url(http://localhost:9200/)")
          ("es-objects-auth", boost::program_options::value<std::string>(), "Basic auth username:password('')")
-         ("es-objects-bulk-replay", boost::program_options::value<uint32_t>(), "Number of bulk documents to index on replay(10000)")
+         ("es-objects-bulk-replay", boost::program_options::value<uint32_t>(), "Number of bulk documents to index on replay, updates of an object within a bulk count once if only the current state is kept(10000)")
          ("es-objects-bulk-sync", boost::program_options::value<uint32_t>(), "Number of bulk documents to index on a synchronized chain(100)")
          ("es-objects-proposals", boost::program_options::value<bool>(), "Store proposal objects(true)")
          ("es-objects-accounts", boost::program_options::value<bool>(), "Store account objects(true)")
@@ -256,6 +350,8 @@ void es_objects_plugin::plugin_set_program_options(
          ("es-objects-index-prefix", boost::program_options::value<std::string>(), "Add a prefix to the index(objects-)")
          ("es-objects-keep-only-current", boost::program_options::value<bool>(), "Keep only current state of the objects(true)")
          ("es-objects-start-es-after-block", boost::program_options::value<uint32_t>(), "Start doing ES job after block(0)")
+         ("es-objects-max-queued-bulks", boost::program_options::value<uint32_t>(), "Number of bulks of each object type which may wait to be sent before block processing waits for them(4)")
+         ("es-objects-max-retries", boost::program_options::value<uint32_t>(), "Number of times a failed bulk is sent again(3)")
          ;
    cfg.add(cli);
 }
@@ -321,6 +417,13 @@ void es_objects_plugin::plugin_initialize(const boost::program_options::variable
    if (options.count("es-objects-start-es-after-block")) {
       my->_es_objects_start_es_after_block = options["es-objects-start-es-after-block"].as<uint32_t>();
    }
+   if (options.count("es-objects-max-queued-bulks")) {
+      my->_es_objects_max_queued_bulks = options["es-objects-max-queued-bulks"].as<uint32_t>();
+   }
+   if (options.count("es-objects-max-retries")) {
+      my->_es_objects_max_retries = options["es-objects-max-retries"].as<uint32_t>();
+   }
+   my->init_streams();
 }
 
 void es_objects_plugin::plugin_startup()
@@ -336,4 +439,32 @@ void es_objects_plugin::plugin_startup()
    ilog("elasticsearch OBJECTS: plugin_startup() begin");
 }
 
-} }
\ No newline at end of file
+void es_objects_plugin::plugin_shutdown()
+{
+   try
+   {
+      flush();
+   }
+   catch (const fc::exception& e)
+   {
+      elog( "Error sending objects to elasticsearch: ${e}", ("e",e.to_detail_string()) );
+   }
+}
+
+void es_objects_plugin::flush()
+{
+   if(my->pending_documents > 0)
+      FC_ASSERT(my->sendBulk(), "Failed to queue objects for elasticsearch");
+   for(auto& item : my->streams)
+      item.second.exporter->flush();
+}
+
+std::map<std::string, graphene::utilities::es_exporter_stats> es_objects_plugin::get_stats()const
+{
+   std::map<std::string, graphene::utilities::es_exporter_stats> result;
+   for(const auto& item : my->streams)
+      result[item.second.index_name] = item.second.exporter->get_stats();
+   return result;
+}
+
+} }
@@ -25,6 +25,7 @@
 
 #include <graphene/app/plugin.hpp>
 #include <graphene/chain/database.hpp>
+#include <graphene/utilities/elasticsearch_exporter.hpp>
 
 namespace graphene { namespace es_objects {
 
@@ -48,6 +49,12 @@ class es_objects_plugin : public graphene::app::plugin
          boost::program_options::options_description& cfg) override;
       virtual void plugin_initialize(const boost::program_options::variables_map& options) override;
       virtual void plugin_startup() override;
+      virtual void plugin_shutdown() override;
+
+      /** queue the collected documents and wait until all queued documents have been sent */
+      void flush();
+      /** statistics of the exporter of each index, by index name */
+      std::map<std::string, graphene::utilities::es_exporter_stats> get_stats()const;
 
       friend class detail::es_objects_plugin_impl;
       std::unique_ptr<detail::es_objects_plugin_impl> my;
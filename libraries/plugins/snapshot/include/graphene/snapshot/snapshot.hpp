@@ -26,6 +26,7 @@
 #include <graphene/app/plugin.hpp>
 #include <graphene/chain/database.hpp>
 
+#include <fc/thread/thread.hpp>
 #include <fc/time.hpp>
 
 namespace graphene { namespace snapshot_plugin {
@@ -48,10 +49,15 @@ class snapshot_plugin : public graphene::app::plugin {
 
    private:
        void check_snapshot( const graphene::chain::signed_block& b);
+       void create_binary_snapshot();
 
        uint32_t           snapshot_block = -1, last_block = 0;
        fc::time_point_sec snapshot_time = fc::time_point_sec::maximum(), last_time = fc::time_point_sec(1);
        fc::path           dest;
+       bool               binary_format = false;
+       /// binary snapshots are written here so that block processing can continue meanwhile
+       std::shared_ptr<fc::thread> writer_thread;
+       fc::future<void>            pending_write;
 };
 
 } } //graphene::snapshot_plugin
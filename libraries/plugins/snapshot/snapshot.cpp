@@ -36,6 +36,7 @@ namespace bpo = boost::program_options;
 static const char* OPT_BLOCK_NUM  = "snapshot-at-block";
 static const char* OPT_BLOCK_TIME = "snapshot-at-time";
 static const char* OPT_DEST       = "snapshot-to";
+static const char* OPT_FORMAT     = "snapshot-format";
 
 void snapshot_plugin::plugin_set_program_options(
    boost::program_options::options_description& command_line_options,
@@ -44,7 +45,10 @@ void snapshot_plugin::plugin_set_program_options(
    command_line_options.add_options()
          (OPT_BLOCK_NUM, bpo::value<uint32_t>(), "Block number after which to do a snapshot")
          (OPT_BLOCK_TIME, bpo::value<string>(), "Block time (ISO format) after which to do a snapshot")
-         (OPT_DEST, bpo::value<string>(), "Pathname of JSON file where to store the snapshot")
+         (OPT_DEST, bpo::value<string>(), "Pathname of file where to store the snapshot")
+         (OPT_FORMAT, bpo::value<string>()->default_value("json"),
+          "Snapshot format: \"json\" for one JSON object per line, "
+          "\"binary\" for a checksummed image that can be loaded with --load-snapshot")
          ;
    config_file_options.add(command_line_options);
 }
@@ -66,14 +70,21 @@ void snapshot_plugin::plugin_initialize(const boost::program_options::variables_
    if( options.count(OPT_BLOCK_NUM) || options.count(OPT_BLOCK_TIME) )
    {
       FC_ASSERT( options.count(OPT_DEST), "Must specify snapshot-to in addition to snapshot-at-block or snapshot-at-time!" );
+      // Operations moved there are no longer in the object database, a snapshot would silently lack them
+      FC_ASSERT( !options.count("operation-history-store"),
+                 "Snapshots do not contain the operations in operation-history-store, remove one of the options" );
       dest = options[OPT_DEST].as<std::string>();
       if( options.count(OPT_BLOCK_NUM) )
          snapshot_block = options[OPT_BLOCK_NUM].as<uint32_t>();
       if( options.count(OPT_BLOCK_TIME) )
          snapshot_time = fc::time_point_sec::from_iso_string( options[OPT_BLOCK_TIME].as<std::string>() );
-      database().applied_block.connect( [&]( const graphene::chain::signed_block& b ) {
+      const std::string format = options[OPT_FORMAT].as<std::string>();
+      FC_ASSERT( format == "binary" || format == "json", "Unknown snapshot format ${f}", ("f",format) );
+      binary_format = ( format == "binary" );
+      database().applied_block.connect( database().get_profiler().profile_applied_block( plugin_name(),
+                                        [this]( const graphene::chain::signed_block& b ) {
          check_snapshot( b );
-      });
+      }));
    }
    else
       FC_ASSERT( !options.count("snapshot-to"), "Must specify snapshot-at-block or snapshot-at-time in addition to snapshot-to!" );
@@ -82,7 +93,65 @@ void snapshot_plugin::plugin_initialize(const boost::program_options::variables_
 
 void snapshot_plugin::plugin_startup() {}
 
-void snapshot_plugin::plugin_shutdown() {}
+void snapshot_plugin::plugin_shutdown()
+{
+   if( pending_write.valid() && !pending_write.ready() )
+   {
+      ilog( "snapshot plugin: waiting for snapshot to be written" );
+      pending_write.wait();
+   }
+   if( writer_thread )
+   {
+      writer_thread->quit();
+      writer_thread.reset();
+   }
+}
+
+/**
+ * Only the copy of the objects is made in the applied_block handler, one index per worker thread, while
+ * block application waits. Serialization, compression and writing happen on the writer thread.
+ */
+void snapshot_plugin::create_binary_snapshot()
+{
+   if( pending_write.valid() && !pending_write.ready() )
+   {
+      wlog( "snapshot plugin: previous snapshot is still being written, skipping" );
+      return;
+   }
+   ilog("snapshot plugin: creating binary snapshot");
+   std::shared_ptr<graphene::db::snapshot_capture> capture;
+   try
+   {
+      capture = database().capture_snapshot();
+      ilog( "snapshot plugin: captured state in ${t} ms, block application was blocked meanwhile",
+            ("t",capture->capture_time.count() / 1000) );
+   }
+   catch ( fc::exception& e )
+   {
+      wlog( "Failed to create snapshot: ${ex}", ("ex",e) );
+      return;
+   }
+
+   if( !writer_thread )
+      writer_thread = std::make_shared<fc::thread>( "snapshot" );
+   const fc::path file = dest;
+   pending_write = writer_thread->async( [capture,file] () {
+      try
+      {
+         const fc::time_point start = fc::time_point::now();
+         graphene::db::object_database::write_snapshot( capture, file,
+            [] ( uint32_t done, uint32_t total, uint64_t bytes ) {
+               ilog( "snapshot plugin: wrote ${d} of ${n} indexes, ${b} bytes", ("d",done)("n",total)("b",bytes) );
+            });
+         ilog( "snapshot plugin: created snapshot in ${t} ms",
+               ("t",(fc::time_point::now() - start).count() / 1000) );
+      }
+      catch ( fc::exception& e )
+      {
+         wlog( "Failed to create snapshot: ${ex}", ("ex",e) );
+      }
+   }, "write_snapshot" );
+}
 
 static void create_snapshot( const graphene::chain::database& db, const fc::path& dest )
 {
@@ -122,7 +191,12 @@ void snapshot_plugin::check_snapshot( const graphene::chain::signed_block& b )
     uint32_t current_block = b.block_num();
     if( (last_block < snapshot_block && snapshot_block <= current_block)
            || (last_time < snapshot_time && snapshot_time <= b.timestamp) )
-       create_snapshot( database(), dest );
+    {
+       if( binary_format )
+          create_binary_snapshot();
+       else
+          create_snapshot( database(), dest );
+    }
     last_block = current_block;
     last_time = b.timestamp;
 } FC_LOG_AND_RETHROW() }
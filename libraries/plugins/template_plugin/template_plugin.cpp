@@ -95,9 +95,10 @@ void template_plugin::plugin_set_program_options(
 
 void template_plugin::plugin_initialize(const boost::program_options::variables_map& options)
 {
-   database().applied_block.connect( [&]( const signed_block& b) {
+   database().applied_block.connect( database().get_profiler().profile_applied_block( plugin_name(),
+                                     [this]( const signed_block& b) {
       my->onBlock(b);
-   } );
+   } ) );
 
    if (options.count("template_plugin")) {
       my->_plugin_option = options["template_plugin"].as<std::string>();
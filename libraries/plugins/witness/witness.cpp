@@ -127,10 +127,11 @@ void witness_plugin::plugin_startup()
          _production_skip_flags |= graphene::chain::database::skip_undo_history_check;
       }
       refresh_witness_key_cache();
-      d.applied_block.connect( [this]( const chain::signed_block& b )
+      d.applied_block.connect( d.get_profiler().profile_applied_block( plugin_name(),
+                               [this]( const chain::signed_block& b )
       {
          refresh_witness_key_cache();
-      });
+      }));
       schedule_production_loop();
    }
    else
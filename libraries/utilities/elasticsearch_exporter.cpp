@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <graphene/utilities/elasticsearch_exporter.hpp>
+#include <graphene/utilities/elasticsearch.hpp>
+
+#include <fc/exception/exception.hpp>
+#include <fc/log/logger.hpp>
+#include <fc/thread/thread.hpp>
+
+namespace graphene { namespace utilities {
+
+es_bulk_exporter::es_bulk_exporter( const es_exporter_options& options )
+   : _options( options )
+{
+   FC_ASSERT( _options.sender_threads > 0 && _options.max_queued_bulks > 0 );
+   for( uint16_t i = 0; i < _options.sender_threads; ++i )
+   {
+      _threads.push_back( std::make_shared<fc::thread>( "elasticsearch_" + std::to_string(i) ) );
+      _curl.push_back( curl_easy_init() );
+   }
+}
+
+es_bulk_exporter::~es_bulk_exporter()
+{
+   while( !_pending.empty() )
+   {
+      pending_bulk bulk = std::move( _pending.front() );
+      _pending.pop_front();
+      try
+      {
+         bulk.result.wait( _options.wait_timeout );
+      }
+      catch( const fc::timeout_exception& )
+      {
+         wlog( "Giving up on a bulk of block ${b} to elasticsearch", ("b",bulk.block_num) );
+      }
+      catch( const fc::exception& e )
+      {
+         wlog( "Failed to send bulks to elasticsearch: ${e}", ("e",e.to_detail_string()) );
+      }
+      // wait for the sender threads before their curl handles go away
+      if( !bulk.result.ready() )
+         bulk.result.cancel_and_wait();
+   }
+   for( auto& thread : _threads )
+      thread->quit();
+   _threads.clear();
+   for( CURL* curl : _curl )
+      curl_easy_cleanup( curl );
+}
+
+void es_bulk_exporter::push( uint32_t block_num, uint32_t document_count, serializer_type serializer )
+{
+   collect( false );
+   while( _pending.size() >= _options.max_queued_bulks )
+      collect( true );
+
+   pending_bulk bulk;
+   bulk.block_num = block_num;
+   bulk.document_count = document_count;
+   bulk.queued = fc::time_point::now();
+   const size_t index = _next_thread++ % _threads.size();
+   bulk.result = _threads[index]->async( [this,index,serializer]() {
+      send( index, serializer );
+   }, "elasticsearch_bulk" );
+   _pending.push_back( std::move( bulk ) );
+   _stats.queued_documents += document_count;
+   _stats.last_queued_block = block_num;
+}
+
+void es_bulk_exporter::flush()
+{
+   while( !_pending.empty() )
+      collect( true );
+}
+
+void es_bulk_exporter::collect( bool wait )
+{
+   while( !_pending.empty() )
+   {
+      if( !_pending.front().result.ready() )
+      {
+         if( !wait )
+            return;
+         try
+         {
+            _pending.front().result.wait( _options.wait_timeout );
+         }
+         catch( const fc::timeout_exception& )
+         {
+            // a slow server only slows the producer down
+            wlog( "Still waiting for elasticsearch to accept the bulk of block ${b}, queued ${t} s ago",
+                  ("b",_pending.front().block_num)
+                  ("t",( fc::time_point::now() - _pending.front().queued ).count() / 1000000) );
+            continue;
+         }
+         catch( const fc::exception& )
+         {
+            // reported below, after the bulk has been removed, so that it is reported only once
+         }
+         wait = false;
+      }
+      pending_bulk bulk = std::move( _pending.front() );
+      _pending.pop_front();
+      _stats.queued_documents -= bulk.document_count;
+      // rethrows if the bulk could not be sent
+      bulk.result.wait();
+      ++_stats.sent_bulks;
+      _stats.sent_documents += bulk.document_count;
+      _stats.last_sent_block = bulk.block_num;
+   }
+}
+
+void es_bulk_exporter::send( size_t thread_index, const serializer_type& serializer )
+{
+   CurlRequest request;
+   request.handler = _curl[thread_index];
+   request.url = _options.elasticsearch_url + "_bulk";
+   request.auth = _options.auth;
+   request.type = "POST";
+   request.query = joinBulkLines( serializer() );
+
+   fc::microseconds delay = _options.retry_delay;
+   for( uint32_t attempt = 0; ; ++attempt )
+   {
+      bool sent = false;
+      try
+      {
+         const std::string response = doCurl( request );
+         sent = handleBulkResponse( getResponseCode( request.handler ), response );
+      }
+      catch( const fc::exception& e )
+      {
+         wlog( "Bad response from elasticsearch: ${e}", ("e",e.to_detail_string()) );
+      }
+      if( sent )
+         return;
+      ++_failed_attempts;
+      FC_ASSERT( attempt < _options.max_retries,
+                 "Unable to send a bulk to elasticsearch after ${n} attempts", ("n",attempt + 1) );
+      fc::usleep( delay );
+      delay = fc::microseconds( delay.count() * 2 );
+   }
+}
+
+es_exporter_stats es_bulk_exporter::get_stats()const
+{
+   es_exporter_stats stats = _stats;
+   stats.queued_bulks = _pending.size();
+   stats.failed_attempts = _failed_attempts.load();
+   if( !_pending.empty() )
+      stats.lag = fc::time_point::now() - _pending.front().queued;
+   return stats;
+}
+
+} } // end namespace graphene::utilities
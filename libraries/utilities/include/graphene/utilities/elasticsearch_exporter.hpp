@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+
+#include <curl/curl.h>
+#include <fc/thread/future.hpp>
+#include <fc/time.hpp>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fc { class thread; }
+
+namespace graphene { namespace utilities {
+
+   struct es_exporter_options
+   {
+      std::string       elasticsearch_url;
+      std::string       auth;
+      uint16_t          sender_threads = 2;
+      /** push() waits while this many bulks are queued or being sent */
+      uint32_t          max_queued_bulks = 8;
+      /** number of times a failed bulk is sent again */
+      uint32_t          max_retries = 3;
+      /** delay before the first retry, doubled for each further retry */
+      fc::microseconds  retry_delay = fc::seconds(1);
+      /** push() and flush() log a warning each time they have waited this long for the oldest bulk,
+       *  the destructor gives up on a bulk after this time */
+      fc::microseconds  wait_timeout = fc::seconds(120);
+   };
+
+   struct es_exporter_stats
+   {
+      uint32_t          queued_bulks = 0;      ///< bulks which are queued or being sent
+      uint64_t          queued_documents = 0;
+      uint64_t          sent_bulks = 0;
+      uint64_t          sent_documents = 0;
+      uint64_t          failed_attempts = 0;   ///< requests which failed, including retried ones
+      uint32_t          last_queued_block = 0;
+      uint32_t          last_sent_block = 0;   ///< the bulks of all blocks up to this one have been sent
+      fc::microseconds  lag;                   ///< time since the oldest bulk which has not been sent was queued
+   };
+
+   /**
+    * Sends bulks of documents to elasticsearch from a pool of sender threads.
+    *
+    * The documents of a bulk are serialized on the sender thread, the thread calling push() only collects the data
+    * they are made of. Failed requests are sent again after a delay. At most max_queued_bulks bulks are queued or being
+    * sent, push() waits for the oldest one when there are more, so a slow server slows down the producer instead of
+    * filling the memory. A bulk which still fails after all retries is reported once, by the next push() or flush()
+    * which gets to it, and then dropped.
+    *
+    * All methods must be called from the same thread.
+    */
+   class es_bulk_exporter
+   {
+      public:
+         /** builds the lines of a bulk request, called on a sender thread */
+         typedef std::function< std::vector<std::string>() > serializer_type;
+
+         explicit es_bulk_exporter( const es_exporter_options& options );
+         ~es_bulk_exporter();
+
+         /** queues a bulk of document_count documents of blocks up to block_num */
+         void push( uint32_t block_num, uint32_t document_count, serializer_type serializer );
+
+         /** waits until all queued bulks have been sent */
+         void flush();
+
+         es_exporter_stats get_stats()const;
+
+      private:
+         struct pending_bulk
+         {
+            uint32_t          block_num = 0;
+            uint32_t          document_count = 0;
+            fc::time_point    queued;
+            fc::future<void>  result;
+         };
+
+         /** runs on the sender thread with the given index */
+         void send( size_t thread_index, const serializer_type& serializer );
+
+         /** removes the bulks which have been sent from the front of the queue, waiting for the oldest if wait is set */
+         void collect( bool wait );
+
+         es_exporter_options                          _options;
+         std::vector< std::shared_ptr<fc::thread> >   _threads;
+         /** curl handles are not thread safe, each sender thread has its own */
+         std::vector< CURL* >                         _curl;
+         size_t                                       _next_thread = 0;
+         std::deque< pending_bulk >                   _pending;
+         es_exporter_stats                            _stats;
+         std::atomic<uint64_t>                        _failed_attempts{0};
+   };
+
+} } // end namespace graphene::utilities
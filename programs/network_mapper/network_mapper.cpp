@@ -153,9 +153,9 @@ public:
     _probe_complete_promise->set_value();
   }
 
-  graphene::net::message get_message_for_item(const graphene::net::item_id& item) override
+  std::shared_ptr<const graphene::net::message> get_message_for_item(const graphene::net::item_id& item) override
   {
-    return graphene::net::item_not_available_message(item);
+    return std::make_shared<const graphene::net::message>(graphene::net::item_not_available_message(item));
   }
 
   void wait( const fc::microseconds& timeout_us )
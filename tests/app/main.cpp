@@ -27,6 +27,10 @@
 
 #include <graphene/chain/balance_object.hpp>
 
+#include <graphene/net/config.hpp>
+#include <graphene/net/core_messages.hpp>
+#include <graphene/net/message_compression.hpp>
+
 #include <graphene/utilities/tempdir.hpp>
 
 #include <graphene/account_history/account_history_plugin.hpp>
@@ -323,6 +327,12 @@ BOOST_AUTO_TEST_CASE( two_node_network )
       BOOST_CHECK_EQUAL(app1.p2p_node()->get_connection_count(), 1u);
       BOOST_CHECK_EQUAL(app1.chain_database()->head_block_num(), 1u);
 
+      BOOST_TEST_MESSAGE( "Checking the block has been relayed as a compact block" );
+      const fc::variant_object compact_blocks = app1.p2p_node()->network_get_usage_stats()["compact_blocks"].get_object();
+      BOOST_CHECK_EQUAL( compact_blocks["received"].as_uint64(), 1u );
+      // app1 has broadcast the only transaction of the block itself
+      BOOST_CHECK_EQUAL( compact_blocks["transactions_requested"].as_uint64(), 0u );
+
       BOOST_TEST_MESSAGE( "Checking GRAPHENE_NULL_ACCOUNT has balance" );
    } catch( fc::exception& e ) {
       edump((e.to_detail_string()));
@@ -330,6 +340,433 @@ BOOST_AUTO_TEST_CASE( two_node_network )
    }
 }
 
+/////////////
+/// @brief create a 2 node network whose messages are read on I/O threads
+/////////////
+BOOST_AUTO_TEST_CASE( two_node_network_with_io_threads )
+{
+   using namespace graphene::chain;
+   using namespace graphene::app;
+   try {
+      fc::temp_directory app_dir( graphene::utilities::temp_directory_path() );
+
+      graphene::app::application app1;
+      app1.register_plugin< graphene::witness_plugin::witness_plugin >();
+      app1.startup_plugins();
+      boost::program_options::variables_map cfg;
+      cfg.emplace("p2p-endpoint", boost::program_options::variable_value(string("127.0.0.1:3940"), false));
+      cfg.emplace("genesis-json", boost::program_options::variable_value(create_genesis_file(app_dir), false));
+      cfg.emplace("seed-nodes", boost::program_options::variable_value(string("[]"), false));
+      cfg.emplace("p2p-io-threads", boost::program_options::variable_value(uint16_t(2), false));
+      app1.initialize(app_dir.path(), cfg);
+      app1.startup();
+      fc::usleep(fc::milliseconds(500));
+
+      fc::temp_directory app2_dir( graphene::utilities::temp_directory_path() );
+      graphene::app::application app2;
+      app2.register_plugin< graphene::witness_plugin::witness_plugin >();
+      app2.startup_plugins();
+      auto cfg2 = cfg;
+      cfg2.erase("p2p-endpoint");
+      cfg2.emplace("p2p-endpoint", boost::program_options::variable_value(string("127.0.0.1:4041"), false));
+      cfg2.emplace("seed-node", boost::program_options::variable_value(vector<string>{"127.0.0.1:3940"}, false));
+      app2.initialize(app2_dir.path(), cfg2);
+      app2.startup();
+      fc::usleep(fc::milliseconds(500));
+
+      BOOST_REQUIRE_EQUAL(app1.p2p_node()->get_connection_count(), 1u);
+
+      std::shared_ptr<chain::database> db2 = app2.chain_database();
+      fc::ecc::private_key committee_key = fc::ecc::private_key::regenerate(fc::sha256::hash(string("nathan")));
+      auto block_1 = db2->generate_block(
+         db2->get_slot_time(1),
+         db2->get_scheduled_witness(1),
+         committee_key,
+         database::skip_nothing);
+      app2.p2p_node()->broadcast(graphene::net::block_message( block_1 ));
+
+      fc::usleep(fc::milliseconds(500));
+      BOOST_CHECK_EQUAL(app1.p2p_node()->get_connection_count(), 1u);
+      BOOST_CHECK_EQUAL(app1.chain_database()->head_block_num(), 1u);
+
+      // the messages of the peer have been read on the I/O threads
+      const fc::variant_object stats = app1.p2p_node()->network_get_usage_stats();
+      const auto io_threads = stats["io_threads"].get_array();
+      BOOST_REQUIRE_EQUAL( io_threads.size(), 2u );
+      uint64_t messages = 0;
+      for( const auto& thread : io_threads )
+         messages += thread.get_object()["messages"].as_uint64();
+      BOOST_CHECK( messages > 0 );
+      BOOST_CHECK( stats.contains( "node_thread" ) );
+   } catch( fc::exception& e ) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+/// @brief a transaction claiming the balance of nathan and transferring some of it to GRAPHENE_NULL_ACCOUNT
+static graphene::chain::precomputable_transaction create_null_account_transfer( const graphene::chain::database& db )
+{
+   using namespace graphene::chain;
+   precomputable_transaction trx;
+   account_id_type nathan_id = db.get_index_type<account_index>().indices().get<by_name>().find( "nathan" )->id;
+   fc::ecc::private_key nathan_key = fc::ecc::private_key::regenerate(fc::sha256::hash(string("nathan")));
+
+   balance_claim_operation claim_op;
+   balance_id_type bid = balance_id_type();
+   claim_op.deposit_to_account = nathan_id;
+   claim_op.balance_to_claim = bid;
+   claim_op.balance_owner_key = nathan_key.get_public_key();
+   claim_op.total_claimed = bid(db).balance;
+   trx.operations.push_back( claim_op );
+   db.current_fee_schedule().set_fee( trx.operations.back() );
+
+   transfer_operation xfer_op;
+   xfer_op.from = nathan_id;
+   xfer_op.to = GRAPHENE_NULL_ACCOUNT;
+   xfer_op.amount = asset( 1000000 );
+   trx.operations.push_back( xfer_op );
+   db.current_fee_schedule().set_fee( trx.operations.back() );
+
+   trx.set_expiration( db.get_slot_time( 10 ) );
+   trx.sign( nathan_key, db.get_chain_id() );
+   trx.validate();
+   return trx;
+}
+
+/////////////
+/// @brief relay a compact block with a transaction the receiving node has never seen
+/////////////
+BOOST_AUTO_TEST_CASE( compact_block_missing_transactions )
+{
+   using namespace graphene::chain;
+   using namespace graphene::app;
+   try {
+      fc::temp_directory app_dir( graphene::utilities::temp_directory_path() );
+
+      graphene::app::application app1;
+      app1.register_plugin< graphene::witness_plugin::witness_plugin >();
+      app1.startup_plugins();
+      boost::program_options::variables_map cfg;
+      cfg.emplace("p2p-endpoint", boost::program_options::variable_value(string("127.0.0.1:3944"), false));
+      cfg.emplace("genesis-json", boost::program_options::variable_value(create_genesis_file(app_dir), false));
+      cfg.emplace("seed-nodes", boost::program_options::variable_value(string("[]"), false));
+      app1.initialize(app_dir.path(), cfg);
+      app1.startup();
+      fc::usleep(fc::milliseconds(500));
+
+      fc::temp_directory app2_dir( graphene::utilities::temp_directory_path() );
+      graphene::app::application app2;
+      app2.register_plugin< graphene::witness_plugin::witness_plugin >();
+      app2.startup_plugins();
+      auto cfg2 = cfg;
+      cfg2.erase("p2p-endpoint");
+      cfg2.emplace("p2p-endpoint", boost::program_options::variable_value(string("127.0.0.1:4046"), false));
+      cfg2.emplace("seed-node", boost::program_options::variable_value(vector<string>{"127.0.0.1:3944"}, false));
+      app2.initialize(app2_dir.path(), cfg2);
+      app2.startup();
+      fc::usleep(fc::milliseconds(500));
+
+      BOOST_REQUIRE_EQUAL(app1.p2p_node()->get_connection_count(), 1u);
+
+      std::shared_ptr<chain::database> db1 = app1.chain_database();
+      std::shared_ptr<chain::database> db2 = app2.chain_database();
+
+      BOOST_TEST_MESSAGE( "Pushing tx on db2 only, without broadcasting it" );
+      db2->push_transaction( create_null_account_transfer( *db2 ) );
+      BOOST_CHECK_EQUAL( db1->get_balance( GRAPHENE_NULL_ACCOUNT, asset_id_type() ).amount.value, 0 );
+
+      fc::ecc::private_key committee_key = fc::ecc::private_key::regenerate(fc::sha256::hash(string("nathan")));
+      auto block_1 = db2->generate_block(
+         db2->get_slot_time(1),
+         db2->get_scheduled_witness(1),
+         committee_key,
+         database::skip_nothing);
+      BOOST_REQUIRE_EQUAL( block_1.transactions.size(), 1u );
+      app2.p2p_node()->broadcast(graphene::net::block_message( block_1 ));
+
+      fc::usleep(fc::milliseconds(500));
+      BOOST_CHECK_EQUAL(app1.p2p_node()->get_connection_count(), 1u);
+      BOOST_CHECK_EQUAL(db1->head_block_num(), 1u);
+      BOOST_CHECK( db1->head_block_id() == block_1.id() );
+      BOOST_CHECK_EQUAL( db1->get_balance( GRAPHENE_NULL_ACCOUNT, asset_id_type() ).amount.value, 1000000 );
+
+      BOOST_TEST_MESSAGE( "Checking app1 has fetched the transaction of the compact block from app2" );
+      const fc::variant_object compact_blocks = app1.p2p_node()->network_get_usage_stats()["compact_blocks"].get_object();
+      BOOST_CHECK_EQUAL( compact_blocks["received"].as_uint64(), 1u );
+      BOOST_CHECK_EQUAL( compact_blocks["transactions_requested"].as_uint64(), 1u );
+      const fc::variant_object sent_compact_blocks = app2.p2p_node()->network_get_usage_stats()["compact_blocks"].get_object();
+      BOOST_CHECK_EQUAL( sent_compact_blocks["sent"].as_uint64(), 1u );
+   } catch( fc::exception& e ) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+/////////////
+/// @brief a compact block which does not rebuild the block it announces gets the peer disconnected
+/////////////
+BOOST_AUTO_TEST_CASE( forged_compact_block )
+{
+   using namespace graphene::chain;
+   using namespace graphene::app;
+   try {
+      fc::temp_directory app_dir( graphene::utilities::temp_directory_path() );
+
+      graphene::app::application app1;
+      app1.register_plugin< graphene::witness_plugin::witness_plugin >();
+      app1.startup_plugins();
+      boost::program_options::variables_map cfg;
+      cfg.emplace("p2p-endpoint", boost::program_options::variable_value(string("127.0.0.1:3945"), false));
+      cfg.emplace("genesis-json", boost::program_options::variable_value(create_genesis_file(app_dir), false));
+      cfg.emplace("seed-nodes", boost::program_options::variable_value(string("[]"), false));
+      app1.initialize(app_dir.path(), cfg);
+      app1.startup();
+      fc::usleep(fc::milliseconds(500));
+
+      fc::temp_directory app2_dir( graphene::utilities::temp_directory_path() );
+      graphene::app::application app2;
+      app2.register_plugin< graphene::witness_plugin::witness_plugin >();
+      app2.startup_plugins();
+      auto cfg2 = cfg;
+      cfg2.erase("p2p-endpoint");
+      cfg2.emplace("p2p-endpoint", boost::program_options::variable_value(string("127.0.0.1:4047"), false));
+      cfg2.emplace("seed-node", boost::program_options::variable_value(vector<string>{"127.0.0.1:3945"}, false));
+      app2.initialize(app2_dir.path(), cfg2);
+      app2.startup();
+      fc::usleep(fc::milliseconds(500));
+
+      BOOST_REQUIRE_EQUAL(app1.p2p_node()->get_connection_count(), 1u);
+
+      std::shared_ptr<chain::database> db2 = app2.chain_database();
+      db2->push_transaction( create_null_account_transfer( *db2 ) );
+      fc::ecc::private_key committee_key = fc::ecc::private_key::regenerate(fc::sha256::hash(string("nathan")));
+      auto block_1 = db2->generate_block(
+         db2->get_slot_time(1),
+         db2->get_scheduled_witness(1),
+         committee_key,
+         database::skip_nothing);
+
+      BOOST_TEST_MESSAGE( "Broadcasting a block message with a wrong block id" );
+      // the compact block only carries the block, app1 rebuilds a message with the right id and a different hash
+      graphene::net::block_message forged_message( block_1 );
+      forged_message.block_id = block_id_type( fc::ripemd160::hash( string("forged") ) );
+      app2.p2p_node()->broadcast( forged_message );
+
+      fc::usleep(fc::milliseconds(500));
+      const fc::variant_object compact_blocks = app1.p2p_node()->network_get_usage_stats()["compact_blocks"].get_object();
+      BOOST_CHECK_EQUAL( compact_blocks["received"].as_uint64(), 1u );
+      BOOST_CHECK_EQUAL( compact_blocks["transactions_requested"].as_uint64(), 1u );
+
+      BOOST_TEST_MESSAGE( "Checking app1 has disconnected from app2 without applying the block" );
+      BOOST_CHECK_EQUAL(app1.p2p_node()->get_connection_count(), 0u);
+      BOOST_CHECK_EQUAL(app1.chain_database()->head_block_num(), 0u);
+   } catch( fc::exception& e ) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+/// @brief the example genesis an hour ago, to sync blocks from the past
+static graphene::chain::genesis_state_type create_past_genesis()
+{
+   graphene::chain::genesis_state_type genesis_state = graphene::app::detail::create_example_genesis();
+   genesis_state.initial_timestamp = fc::time_point_sec( genesis_state.initial_timestamp.sec_since_epoch() - 3600 );
+   return genesis_state;
+}
+
+static boost::filesystem::path create_past_genesis_file( fc::temp_directory& directory )
+{
+   boost::filesystem::path genesis_path = boost::filesystem::path{directory.path().generic_string()} / "genesis.json";
+   fc::json::save_to_file( create_past_genesis(), fc::path( genesis_path ) );
+   return genesis_path;
+}
+
+/////////////
+/// @brief two peers syncing the same historical blocks from a node
+/////////////
+BOOST_AUTO_TEST_CASE( historical_blocks_served_once )
+{
+   using namespace graphene::chain;
+   using namespace graphene::app;
+   try {
+      fc::temp_directory app_dir( graphene::utilities::temp_directory_path() );
+
+      // the chain starts in the past, so that the blocks of app1 are not rejected as coming from the future
+      boost::filesystem::path genesis_path = create_past_genesis_file( app_dir );
+
+      graphene::app::application app1;
+      app1.register_plugin< graphene::witness_plugin::witness_plugin >();
+      app1.startup_plugins();
+      boost::program_options::variables_map cfg;
+      cfg.emplace("p2p-endpoint", boost::program_options::variable_value(string("127.0.0.1:3942"), false));
+      cfg.emplace("genesis-json", boost::program_options::variable_value(genesis_path, false));
+      cfg.emplace("seed-nodes", boost::program_options::variable_value(string("[]"), false));
+      app1.initialize(app_dir.path(), cfg);
+      app1.startup();
+
+      std::shared_ptr<chain::database> db1 = app1.chain_database();
+      fc::ecc::private_key committee_key = fc::ecc::private_key::regenerate(fc::sha256::hash(string("nathan")));
+      const uint32_t block_count = 10;
+      for( uint32_t i = 0; i < block_count; ++i )
+         db1->generate_block( db1->get_slot_time(1), db1->get_scheduled_witness(1), committee_key, database::skip_nothing );
+      BOOST_REQUIRE_EQUAL( db1->head_block_num(), block_count );
+
+      fc::temp_directory app2_dir( graphene::utilities::temp_directory_path() );
+      graphene::app::application app2;
+      app2.register_plugin< graphene::witness_plugin::witness_plugin >();
+      app2.startup_plugins();
+      auto cfg2 = cfg;
+      cfg2.erase("p2p-endpoint");
+      cfg2.emplace("p2p-endpoint", boost::program_options::variable_value(string("127.0.0.1:4043"), false));
+      cfg2.emplace("seed-node", boost::program_options::variable_value(vector<string>{"127.0.0.1:3942"}, false));
+      app2.initialize(app2_dir.path(), cfg2);
+      app2.startup();
+      fc::usleep(fc::milliseconds(1000));
+      BOOST_REQUIRE_EQUAL( app2.chain_database()->head_block_num(), block_count );
+
+      fc::temp_directory app3_dir( graphene::utilities::temp_directory_path() );
+      graphene::app::application app3;
+      app3.register_plugin< graphene::witness_plugin::witness_plugin >();
+      app3.startup_plugins();
+      auto cfg3 = cfg2;
+      cfg3.erase("p2p-endpoint");
+      cfg3.emplace("p2p-endpoint", boost::program_options::variable_value(string("127.0.0.1:4044"), false));
+      app3.initialize(app3_dir.path(), cfg3);
+      app3.startup();
+      fc::usleep(fc::milliseconds(1000));
+      BOOST_REQUIRE_EQUAL( app3.chain_database()->head_block_num(), block_count );
+      BOOST_CHECK_EQUAL( app1.p2p_node()->get_connection_count(), 2u );
+
+      // the blocks served to the second peer come from the served item cache, not from the database
+      const fc::variant_object call_statistics = app1.p2p_node()->get_call_statistics();
+      BOOST_CHECK_EQUAL( call_statistics["get_item"].get_object()["count"].as_uint64(), uint64_t( block_count ) );
+   } catch( fc::exception& e ) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+/////////////
+/// @brief a syncing peer receiving compressed blocks
+/////////////
+BOOST_AUTO_TEST_CASE( compressed_sync_blocks )
+{
+   using namespace graphene::chain;
+   using namespace graphene::app;
+   try {
+      fc::temp_directory app_dir( graphene::utilities::temp_directory_path() );
+
+      graphene::app::application app1;
+      app1.register_plugin< graphene::witness_plugin::witness_plugin >();
+      app1.startup_plugins();
+      boost::program_options::variables_map cfg;
+      cfg.emplace("p2p-endpoint", boost::program_options::variable_value(string("127.0.0.1:3943"), false));
+      cfg.emplace("genesis-json", boost::program_options::variable_value(create_past_genesis_file(app_dir), false));
+      cfg.emplace("seed-nodes", boost::program_options::variable_value(string("[]"), false));
+      app1.initialize(app_dir.path(), cfg);
+      app1.startup();
+
+      BOOST_TEST_MESSAGE( "Generating a block with many transfers on db1" );
+      std::shared_ptr<chain::database> db1 = app1.chain_database();
+      fc::ecc::private_key nathan_key = fc::ecc::private_key::regenerate(fc::sha256::hash(string("nathan")));
+      {
+         account_id_type nathan_id = db1->get_index_type<account_index>().indices().get<by_name>().find( "nathan" )->id;
+         precomputable_transaction trx;
+         balance_claim_operation claim_op;
+         balance_id_type bid = balance_id_type();
+         claim_op.deposit_to_account = nathan_id;
+         claim_op.balance_to_claim = bid;
+         claim_op.balance_owner_key = nathan_key.get_public_key();
+         claim_op.total_claimed = bid(*db1).balance;
+         trx.operations.push_back( claim_op );
+         db1->current_fee_schedule().set_fee( trx.operations.back() );
+         for( int i = 0; i < 30; ++i )
+         {
+            transfer_operation xfer_op;
+            xfer_op.from = nathan_id;
+            xfer_op.to = GRAPHENE_NULL_ACCOUNT;
+            xfer_op.amount = asset( 1000 + i );
+            trx.operations.push_back( xfer_op );
+            db1->current_fee_schedule().set_fee( trx.operations.back() );
+         }
+         trx.set_expiration( db1->get_slot_time( 10 ) );
+         trx.sign( nathan_key, db1->get_chain_id() );
+         db1->push_transaction( trx );
+      }
+      const signed_block block_1 = db1->generate_block( db1->get_slot_time(1), db1->get_scheduled_witness(1),
+                                                        nathan_key, database::skip_nothing );
+      BOOST_REQUIRE_GT( fc::raw::pack_size( block_1 ), size_t( GRAPHENE_NET_MIN_COMPRESSED_MESSAGE_SIZE ) );
+
+      fc::temp_directory app2_dir( graphene::utilities::temp_directory_path() );
+      graphene::app::application app2;
+      app2.register_plugin< graphene::witness_plugin::witness_plugin >();
+      app2.startup_plugins();
+      auto cfg2 = cfg;
+      cfg2.erase("p2p-endpoint");
+      cfg2.emplace("p2p-endpoint", boost::program_options::variable_value(string("127.0.0.1:4045"), false));
+      cfg2.emplace("seed-node", boost::program_options::variable_value(vector<string>{"127.0.0.1:3943"}, false));
+      app2.initialize(app2_dir.path(), cfg2);
+      app2.startup();
+      fc::usleep(fc::milliseconds(1000));
+
+      BOOST_REQUIRE_EQUAL( app2.chain_database()->head_block_num(), 1u );
+      BOOST_CHECK_EQUAL( app2.chain_database()->get_balance( GRAPHENE_NULL_ACCOUNT, asset_id_type() ).amount.value,
+                         db1->get_balance( GRAPHENE_NULL_ACCOUNT, asset_id_type() ).amount.value );
+
+      BOOST_TEST_MESSAGE( "Checking the block has been sent compressed" );
+      const std::vector<graphene::net::peer_status> peers = app1.p2p_node()->get_connected_peers();
+      BOOST_REQUIRE_EQUAL( peers.size(), 1u );
+      BOOST_CHECK( peers.front().info["compression"].as_bool() );
+      BOOST_CHECK_GT( peers.front().info["bytessavedbycompression"].as_uint64(), 0u );
+   } catch( fc::exception& e ) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+/////////////
+/// @brief blocks sent to peers which read compressed messages
+/////////////
+BOOST_AUTO_TEST_CASE( compressed_message_roundtrip )
+{
+   using namespace graphene::chain;
+   signed_block block;
+   block.timestamp = fc::time_point_sec( 1500000000 );
+   for( int i = 0; i < 20; ++i )
+   {
+      transfer_operation xfer_op;
+      xfer_op.from = account_id_type( 17 );
+      xfer_op.to = account_id_type( 18 );
+      xfer_op.amount = asset( 1000 + i );
+      signed_transaction trx;
+      trx.operations.push_back( xfer_op );
+      block.transactions.push_back( processed_transaction( trx ) );
+   }
+
+   const graphene::net::message original( (graphene::net::block_message( block )) );
+   const fc::optional<graphene::net::message> compressed = graphene::net::compress_message( original );
+   BOOST_REQUIRE( compressed.valid() );
+   BOOST_CHECK_EQUAL( compressed->msg_type, uint32_t( graphene::net::compressed_message_type ) );
+   BOOST_CHECK_LT( compressed->size, original.size );
+   BOOST_CHECK_EQUAL( graphene::net::get_original_message_size( *compressed ), original.size );
+
+   const graphene::net::message restored = graphene::net::decompress_message( *compressed );
+   BOOST_CHECK_EQUAL( restored.msg_type, original.msg_type );
+   BOOST_CHECK_EQUAL( restored.size, original.size );
+   BOOST_CHECK( restored.data == original.data );
+   BOOST_CHECK( restored.id() == original.id() );
+
+   // the data cannot inflate beyond the size announced by the peer
+   graphene::net::compressed_message lying = compressed->as<graphene::net::compressed_message>();
+   lying.original_size -= 1;
+   BOOST_CHECK_THROW( graphene::net::decompress_message( graphene::net::message( lying ) ), fc::exception );
+
+   // not worth it for small messages
+   const graphene::net::message empty_block( (graphene::net::block_message( signed_block() )) );
+   BOOST_CHECK( !graphene::net::compress_message( empty_block ).valid() );
+}
+
 // a contrived example to test the breaking out of application_impl to a header file
 
 #include "../../libraries/app/application_impl.hxx"
@@ -348,3 +785,95 @@ BOOST_AUTO_TEST_CASE(application_impl_breakout) {
    graphene::net::item_id id;
    BOOST_CHECK(impl.has_item(id));
 }
+
+BOOST_AUTO_TEST_CASE( precomputed_sync_blocks )
+{
+   using namespace graphene::chain;
+   class test_impl : public graphene::app::detail::application_impl {
+   public:
+      test_impl() : application_impl(nullptr) {}
+      size_t precomputed_count()
+      {
+         std::lock_guard<std::mutex> guard( _precomputed_sync_blocks_mutex );
+         return _precomputed_sync_blocks.size();
+      }
+      uint64_t precomputed_size()
+      {
+         std::lock_guard<std::mutex> guard( _precomputed_sync_blocks_mutex );
+         return _precomputed_sync_blocks_size;
+      }
+      uint64_t taken()
+      {
+         std::lock_guard<std::mutex> guard( _precomputed_sync_blocks_mutex );
+         return _precomputed_sync_blocks_taken;
+      }
+      void set_lifetime( fc::microseconds lifetime )
+      {
+         std::lock_guard<std::mutex> guard( _precomputed_sync_blocks_mutex );
+         _precomputed_sync_block_lifetime = lifetime;
+      }
+   };
+
+   try {
+      // blocks from the past, as they are during sync
+      genesis_state_type genesis_state = create_past_genesis();
+      auto load_genesis = [&genesis_state] () { return genesis_state; };
+
+      fc::temp_directory source_dir( graphene::utilities::temp_directory_path() );
+      database source_db;
+      source_db.open( source_dir.path(), load_genesis, "TEST" );
+      fc::ecc::private_key committee_key = fc::ecc::private_key::regenerate(fc::sha256::hash(string("nathan")));
+      std::vector<graphene::net::block_message> blocks;
+      for( int i = 0; i < 4; ++i )
+         blocks.emplace_back( source_db.generate_block( source_db.get_slot_time(1), source_db.get_scheduled_witness(1),
+                                                        committee_key, database::skip_nothing ) );
+
+      fc::temp_directory app_dir( graphene::utilities::temp_directory_path() );
+      test_impl impl;
+      impl._chain_db->open( app_dir.path(), load_genesis, "TEST" );
+      std::vector<fc::uint160_t> contained_transaction_message_ids;
+
+      BOOST_TEST_MESSAGE( "The precomputed block is taken by handle_block" );
+      impl._sync_precompute_memory_limit = 1024 * 1024;
+      impl.precompute_sync_block( blocks[0] );
+      BOOST_CHECK_EQUAL( impl.precomputed_count(), 1u );
+      impl.handle_block( blocks[0], true, contained_transaction_message_ids );
+      BOOST_CHECK_EQUAL( impl._chain_db->head_block_num(), 1u );
+      BOOST_CHECK_EQUAL( impl.taken(), 1u );
+      BOOST_CHECK_EQUAL( impl.precomputed_count(), 0u );
+      BOOST_CHECK_EQUAL( impl.precomputed_size(), 0u );
+
+      BOOST_TEST_MESSAGE( "The memory limit is respected" );
+      impl._sync_precompute_memory_limit = fc::raw::pack_size( blocks[1].block );
+      impl.precompute_sync_block( blocks[1] );
+      impl.precompute_sync_block( blocks[2] );
+      BOOST_CHECK_EQUAL( impl.precomputed_count(), 1u );
+      BOOST_CHECK_EQUAL( impl.precomputed_size(), impl._sync_precompute_memory_limit );
+
+      BOOST_TEST_MESSAGE( "Stale blocks are forgotten" );
+      impl.set_lifetime( fc::milliseconds(500) );
+      fc::usleep( fc::milliseconds(1000) );
+      impl._sync_precompute_memory_limit = 1024 * 1024;
+      impl.precompute_sync_block( blocks[2] );
+      BOOST_CHECK_EQUAL( impl.precomputed_count(), 1u );
+      BOOST_CHECK_EQUAL( impl.precomputed_size(), fc::raw::pack_size( blocks[2].block ) );
+      // block 2 has been forgotten, handle_block precomputes it itself
+      impl.handle_block( blocks[1], true, contained_transaction_message_ids );
+      BOOST_CHECK_EQUAL( impl.taken(), 1u );
+      impl.handle_block( blocks[2], true, contained_transaction_message_ids );
+      BOOST_CHECK_EQUAL( impl.taken(), 2u );
+      BOOST_CHECK_EQUAL( impl._chain_db->head_block_num(), 3u );
+
+      BOOST_TEST_MESSAGE( "Blocks left over are forgotten before closing the database" );
+      impl.precompute_sync_block( blocks[3] );
+      impl.wait_for_precomputed_sync_blocks();
+      BOOST_CHECK_EQUAL( impl.precomputed_count(), 0u );
+      BOOST_CHECK_EQUAL( impl.precomputed_size(), 0u );
+
+      impl._chain_db->close();
+      source_db.close();
+   } catch( fc::exception& e ) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
@@ -119,6 +119,17 @@ database_fixture::database_fixture()
    {
       options.insert(std::make_pair("max-ops-per-account", boost::program_options::variable_value((uint64_t)75, false)));
    }
+   if (current_test_name == "operation_history_store" || current_test_name == "operation_type_index_with_history_store")
+   {
+      options.insert(std::make_pair("operation-history-store", boost::program_options::variable_value(
+            boost::filesystem::path( ( data_dir->path() / "operation_history" ).generic_string() ), false)));
+   }
+   if (current_test_name == "get_account_history_operations_by_type_index"
+         || current_test_name == "operation_type_index_with_history_store")
+   {
+      options.insert(std::make_pair("max-ops-per-account", boost::program_options::variable_value((uint64_t)75, false)));
+      options.insert(std::make_pair("index-operation-types", boost::program_options::variable_value(true, false)));
+   }
    // add account tracking for ahplugin for special test case with track-account enabled
    if( !options.count("track-account") && current_test_name == "track_account") {
       std::vector<std::string> track_account;
@@ -136,6 +147,13 @@ database_fixture::database_fixture()
       track_account.push_back(track);
       options.insert(std::make_pair("track-account", boost::program_options::variable_value(track_account, false)));
    }
+   // the tests elect with the incremental vote tally, the vote tests check it against the full one in every
+   // maintenance interval
+   app.chain_database()->enable_incremental_vote_tally( true );
+   if( current_test_name == "incremental_vote_tally" || current_test_name == "put_my_witnesses"
+         || current_test_name == "put_my_committee_members" || current_test_name == "last_voting_date_proxy" ) {
+      app.chain_database()->enable_vote_tally_verification( true );
+   }
    // standby votes tracking
    if( boost::unit_test::framework::current_test_case().p_name.value == "track_votes_witnesses_disabled" ||
        boost::unit_test::framework::current_test_case().p_name.value == "track_votes_committee_disabled") {
@@ -160,15 +178,21 @@ database_fixture::database_fixture()
       ahplugin->plugin_set_app(&app);
       ahplugin->plugin_initialize(options);
       ahplugin->plugin_startup();
+      if( current_test_name == "get_account_history_operations_by_type_index"
+            || current_test_name == "operation_history_store" )
+         app.enable_plugin( ahplugin->plugin_name() );
    }
 
-   if(current_test_name == "elasticsearch_objects" || current_test_name == "elasticsearch_suite") {
+   if(current_test_name == "elasticsearch_objects" || current_test_name == "elasticsearch_objects_current_state"
+         || current_test_name == "elasticsearch_suite") {
       auto esobjects_plugin = app.register_plugin<graphene::es_objects::es_objects_plugin>();
       esobjects_plugin->plugin_set_app(&app);
 
       options.insert(std::make_pair("es-objects-elasticsearch-url", boost::program_options::variable_value(string("http://localhost:9200/"), false)));
-      options.insert(std::make_pair("es-objects-bulk-replay", boost::program_options::variable_value(uint32_t(2), false)));
-      options.insert(std::make_pair("es-objects-bulk-sync", boost::program_options::variable_value(uint32_t(2), false)));
+      // the current state test collects the updates of several blocks into one bulk
+      const uint32_t bulk_documents = ( current_test_name == "elasticsearch_objects_current_state" ? 100 : 2 );
+      options.insert(std::make_pair("es-objects-bulk-replay", boost::program_options::variable_value(bulk_documents, false)));
+      options.insert(std::make_pair("es-objects-bulk-sync", boost::program_options::variable_value(bulk_documents, false)));
       options.insert(std::make_pair("es-objects-proposals", boost::program_options::variable_value(true, false)));
       options.insert(std::make_pair("es-objects-accounts", boost::program_options::variable_value(true, false)));
       options.insert(std::make_pair("es-objects-assets", boost::program_options::variable_value(true, false)));
@@ -178,6 +202,8 @@ database_fixture::database_fixture()
 
       esobjects_plugin->plugin_initialize(options);
       esobjects_plugin->plugin_startup();
+      if(current_test_name == "elasticsearch_objects_current_state")
+         app.enable_plugin( esobjects_plugin->plugin_name() );
    }
 
    options.insert(std::make_pair("bucket-size", boost::program_options::variable_value(string("[15]"),false)));
@@ -215,6 +241,7 @@ database_fixture::~database_fixture()
       {
          verify_asset_supplies(db);
          BOOST_CHECK( db.get_node_properties().skip_flags == database::skip_nothing );
+         BOOST_CHECK_EQUAL( db.get_vote_tally().mismatches(), 0u );
       }
       return;
    } catch (fc::exception& ex) {
@@ -27,6 +27,14 @@
 #include <fc/crypto/digest.hpp>
 
 #include <graphene/utilities/elasticsearch.hpp>
+#include <graphene/utilities/elasticsearch_exporter.hpp>
+#include <graphene/es_objects/es_objects.hpp>
+
+#include <fc/network/http/server.hpp>
+#include <fc/thread/thread.hpp>
+
+#include <algorithm>
+#include <atomic>
 
 #include "../common/database_fixture.hpp"
 
@@ -183,6 +191,58 @@ BOOST_AUTO_TEST_CASE(elasticsearch_objects) {
    }
 }
 
+BOOST_AUTO_TEST_CASE(elasticsearch_objects_current_state) {
+   try {
+
+      CURL *curl; // curl handler
+      curl = curl_easy_init();
+
+      graphene::utilities::ES es;
+      es.curl = curl;
+      es.elasticsearch_url = "http://localhost:9200/";
+      es.index_prefix = "objects-";
+
+      auto delete_objects = graphene::utilities::deleteAll(es);
+
+      generate_block();
+      fc::usleep(fc::milliseconds(1000));
+
+      if(delete_objects) { // all records deleted
+
+         auto esobjects = app.get_plugin<graphene::es_objects::es_objects_plugin>("es_objects");
+         const account_id_type alice_id = create_account("alice").id;
+         generate_block();
+         esobjects->flush();
+         const uint64_t balances_before = esobjects->get_stats()["objects-balance"].sent_documents;
+
+         // updates of the same balance objects in several blocks of a bulk are indexed as one document each,
+         // with the last state
+         for(int i = 0; i < 3; ++i)
+         {
+            transfer(committee_account, alice_id, asset(100));
+            generate_block();
+         }
+         esobjects->flush();
+         fc::usleep(fc::milliseconds(1000));
+
+         // the balances of the committee account and of alice
+         BOOST_CHECK_EQUAL(esobjects->get_stats()["objects-balance"].sent_documents - balances_before, 2u);
+
+         es.endpoint = es.index_prefix + "balance/data/_search";
+         es.query = "{ \"query\" : { \"bool\": { \"must\" : [{ \"term\": { \"owner_\": \""
+                    + std::string(object_id_type(alice_id)) + "\"}}] } } }";
+         auto res = graphene::utilities::simpleQuery(es);
+         variant j = fc::json::from_string(res);
+         BOOST_CHECK_EQUAL(j["hits"]["total"].as_string(), "1");
+         BOOST_CHECK_EQUAL(j["hits"]["hits"][size_t(0)]["_source"]["balance"].as_string(), "300");
+      }
+   }
+   catch (fc::exception &e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
 BOOST_AUTO_TEST_CASE(elasticsearch_suite) {
    try {
 
@@ -210,4 +270,118 @@ BOOST_AUTO_TEST_CASE(elasticsearch_suite) {
    }
 }
 
+BOOST_AUTO_TEST_CASE(elasticsearch_exporter) {
+   try {
+      // a stub of the bulk API which counts the documents and fails the first requests
+      std::atomic<uint32_t> requests{0};
+      std::atomic<uint32_t> documents{0};
+      std::atomic<uint32_t> failures_left{2};
+      std::atomic<uint32_t> delay_ms{0};
+      fc::thread server_thread( "elasticsearch_stub" );
+      std::shared_ptr<fc::http::server> server;
+      const uint16_t port = server_thread.async( [&]() -> uint16_t {
+         server = std::make_shared<fc::http::server>();
+         server->listen( fc::ip::endpoint( fc::ip::address( "127.0.0.1" ), 0 ) );
+         server->on_request( [&]( const fc::http::request& req, const fc::http::server::response& resp ) {
+            ++requests;
+            if( delay_ms > 0 )
+               fc::usleep( fc::milliseconds( delay_ms ) );
+            std::string body = "{\"errors\":false}";
+            if( failures_left > 0 )
+            {
+               --failures_left;
+               resp.set_status( fc::http::reply::InternalServerError );
+               body = "{}";
+            }
+            else
+            {
+               documents += std::count( req.body.begin(), req.body.end(), '\n' ) / 2;
+               resp.set_status( fc::http::reply::OK );
+            }
+            resp.set_length( body.size() );
+            resp.write( body.c_str(), body.size() );
+         });
+         return server->get_local_endpoint().port();
+      }).wait();
+
+      graphene::utilities::es_exporter_options options;
+      options.elasticsearch_url = "http://127.0.0.1:" + std::to_string( port ) + "/";
+      options.sender_threads = 2;
+      options.max_queued_bulks = 2;
+      options.max_retries = 3;
+      options.retry_delay = fc::milliseconds( 10 );
+
+      auto make_bulk = []( uint32_t block, uint32_t count ) {
+         return [block,count]() -> std::vector<std::string> {
+            std::vector<std::string> lines;
+            for( uint32_t i = 0; i < count; ++i )
+            {
+               lines.push_back( "{\"index\":{}}" );
+               lines.push_back( "{\"block\":" + std::to_string( block ) + "}" );
+            }
+            return lines;
+         };
+      };
+
+      {
+         graphene::utilities::es_bulk_exporter exporter( options );
+         for( uint32_t block = 1; block <= 10; ++block )
+         {
+            exporter.push( block, 3, make_bulk( block, 3 ) );
+            BOOST_CHECK_LE( exporter.get_stats().queued_bulks, 2u );
+            BOOST_CHECK_EQUAL( exporter.get_stats().last_queued_block, block );
+         }
+         exporter.flush();
+
+         auto stats = exporter.get_stats();
+         BOOST_CHECK_EQUAL( stats.queued_bulks, 0u );
+         BOOST_CHECK_EQUAL( stats.queued_documents, 0u );
+         BOOST_CHECK_EQUAL( stats.sent_bulks, 10u );
+         BOOST_CHECK_EQUAL( stats.sent_documents, 30u );
+         BOOST_CHECK_EQUAL( stats.failed_attempts, 2u );
+         BOOST_CHECK_EQUAL( stats.last_sent_block, 10u );
+         BOOST_CHECK_EQUAL( documents.load(), 30u );
+         BOOST_CHECK_EQUAL( requests.load(), 12u );
+
+         // a bulk which fails more often than it is retried is reported
+         failures_left = 10;
+         exporter.push( 11, 1, make_bulk( 11, 1 ) );
+         BOOST_CHECK_THROW( exporter.flush(), fc::exception );
+         stats = exporter.get_stats();
+         BOOST_CHECK_EQUAL( stats.failed_attempts, 6u );
+         BOOST_CHECK_EQUAL( stats.last_sent_block, 10u );
+         BOOST_CHECK_EQUAL( documents.load(), 30u );
+
+         // ... exactly once, the exporter keeps working afterwards
+         failures_left = 0;
+         BOOST_CHECK_NO_THROW( exporter.flush() );
+         exporter.push( 12, 1, make_bulk( 12, 1 ) );
+         BOOST_CHECK_NO_THROW( exporter.flush() );
+         stats = exporter.get_stats();
+         BOOST_CHECK_EQUAL( stats.queued_bulks, 0u );
+         BOOST_CHECK_EQUAL( stats.last_sent_block, 12u );
+         BOOST_CHECK_EQUAL( documents.load(), 31u );
+      }
+
+      {
+         // waiting longer than wait_timeout for a slow server is not an error
+         delay_ms = 200;
+         graphene::utilities::es_exporter_options slow_options = options;
+         slow_options.wait_timeout = fc::milliseconds( 20 );
+         graphene::utilities::es_bulk_exporter exporter( slow_options );
+         exporter.push( 13, 1, make_bulk( 13, 1 ) );
+         BOOST_CHECK_NO_THROW( exporter.flush() );
+         BOOST_CHECK_EQUAL( exporter.get_stats().last_sent_block, 13u );
+         BOOST_CHECK_EQUAL( documents.load(), 32u );
+         delay_ms = 0;
+      }
+
+      server_thread.async( [&]() { server.reset(); } ).wait();
+   }
+   catch (fc::exception &e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -27,6 +27,8 @@
 
 #include <graphene/chain/account_object.hpp>
 #include <graphene/chain/asset_object.hpp>
+#include <graphene/chain/hardfork.hpp>
+#include <graphene/chain/market_object.hpp>
 #include <graphene/chain/proposal_object.hpp>
 
 #include <graphene/db/simple_index.hpp>
@@ -55,6 +57,158 @@ BOOST_AUTO_TEST_CASE( sigcheck_benchmark )
    wlog( "Benchmark: verify ${sps} signatures/s", ("sps",(cycles*1000000)/elapsed.count()) );
 }
 
+/** Compares lookups by ID in the ordered by_id index with the hashed_id_index */
+BOOST_AUTO_TEST_CASE( id_lookup_benchmark )
+{ try {
+   graphene::db::primary_index< limit_order_index > tree_orders( db );
+   graphene::db::hashed_primary_index< limit_order_index > hashed_orders( db );
+
+   const uint64_t objects = 1000000;
+   const uint64_t lookups = 10000000;
+   for( uint64_t i = 0; i < objects; ++i )
+   {
+      limit_order_object order;
+      order.id = limit_order_id_type( i * 3 ); // not dense, like orders after a while
+      const auto packed = fc::raw::pack( order );
+      tree_orders.load( packed );
+      hashed_orders.load( packed );
+   }
+
+   std::vector<object_id_type> ids;
+   ids.reserve( lookups );
+   for( uint64_t i = 0; i < lookups; ++i )
+      ids.push_back( limit_order_id_type( (uint64_t(std::rand()) % objects) * 3 + (i % 8 == 0 ? 1 : 0) ) );
+
+   auto measure = [&ids] ( const char* name, const graphene::db::index& idx ) {
+      uint64_t found = 0;
+      auto start = fc::time_point::now();
+      for( const auto& id : ids )
+         if( idx.find( id ) != nullptr )
+            ++found;
+      auto elapsed = fc::time_point::now() - start;
+      wlog( "${name}: ${lps} lookups/s, ${f} found", ("name",name)("lps",(ids.size()*1000000)/elapsed.count())("f",found) );
+   };
+   measure( "ordered by_id", tree_orders );
+   measure( "hashed_id_index", hashed_orders );
+} FC_LOG_AND_RETHROW() }
+
+/** Places a deep order book, finds its best order many times and sweeps it with crossing orders */
+BOOST_AUTO_TEST_CASE( order_book_benchmark )
+{ try {
+   generate_blocks( HARDFORK_CORE_625_TIME );
+   generate_blocks( db.get_dynamic_global_properties().next_maintenance_time );
+
+   ACTORS( (maker)(taker) );
+   const asset_id_type uia_id = create_user_issued_asset( "BOOK" ).id;
+   issue_uia( maker_id, asset( 1000000000, uia_id ) );
+   fund( taker, asset( 1000000000 ) );
+
+   auto push = [this] ( const operation& op ) {
+      trx.clear();
+      trx.operations.push_back( op );
+      test::set_expiration( db, trx );
+      db.push_transaction( trx, ~0 );
+   };
+
+   const uint32_t depth = 50000;
+   limit_order_create_operation op;
+   op.seller = maker_id;
+   op.expiration = time_point_sec::maximum();
+   auto start = fc::time_point::now();
+   for( uint32_t i = 0; i < depth; ++i )
+   {
+      op.amount_to_sell = asset( 1000, uia_id );
+      op.min_to_receive = asset( 1000 + i / 8 ); // eight orders per price level
+      push( op );
+   }
+   auto elapsed = fc::time_point::now() - start;
+   wlog( "Placed ${ops} resting orders/s", ("ops",(depth*1000000ull)/elapsed.count()) );
+
+   const uint32_t lookups = 1000000;
+   const auto& by_price_idx = db.get_index_type<limit_order_index>().indices().get<by_price>();
+   const price best_possible = price::max( uia_id, asset_id_type() );
+   uint64_t found = 0;
+   start = fc::time_point::now();
+   for( uint32_t i = 0; i < lookups; ++i )
+      found += by_price_idx.lower_bound( best_possible )->for_sale.value;
+   elapsed = fc::time_point::now() - start;
+   wlog( "by_price: ${lps} best order lookups/s", ("lps",(lookups*1000000ull)/elapsed.count()) );
+   const limit_order_book& book = db.get_limit_order_book();
+   start = fc::time_point::now();
+   for( uint32_t i = 0; i < lookups; ++i )
+      found += book.best( uia_id, asset_id_type() )->for_sale.value;
+   elapsed = fc::time_point::now() - start;
+   wlog( "limit_order_book: ${lps} best order lookups/s", ("lps",(lookups*1000000ull)/elapsed.count()) );
+   BOOST_CHECK_EQUAL( found, 2ull * lookups * 1000 );
+
+   auto resting_orders = [&book,uia_id] () -> size_t {
+      size_t count = 0;
+      if( const auto* levels = book.get_book( uia_id, asset_id_type() ) )
+         for( const auto& level : *levels )
+            count += level.orders.size();
+      return count;
+   };
+   BOOST_CHECK_EQUAL( resting_orders(), depth );
+
+   // every crossing order fills up to twenty resting orders, the rest of it stays on the other side of the book
+   op.seller = taker_id;
+   op.min_to_receive = asset( 1, uia_id );
+   start = fc::time_point::now();
+   for( uint32_t i = 0; i < depth / 10; ++i )
+   {
+      op.amount_to_sell = asset( 20 * 1000 + i );
+      push( op );
+   }
+   elapsed = fc::time_point::now() - start;
+   const size_t filled = depth - resting_orders();
+   wlog( "Filled ${fps} resting orders/s, ${f} in ${ms}ms",
+         ("fps",(filled*1000000ull)/elapsed.count())("f",filled)("ms",elapsed.count()/1000) );
+   BOOST_CHECK_GT( filled, depth / 2 );
+} FC_LOG_AND_RETHROW() }
+
+/** Pushing pending transactions and applying blocks are dominated by undo bookkeeping for cheap operations */
+BOOST_AUTO_TEST_CASE( undo_journal_benchmark )
+{ try {
+   ACTORS( (alice)(bob) );
+   fund( alice, asset(1000000000) );
+
+   const uint32_t cycles = 20000;
+   std::vector<signed_transaction> transactions;
+   transactions.reserve( cycles );
+   transfer_operation op;
+   op.from = alice_id;
+   op.to = bob_id;
+   for( uint32_t i = 0; i < cycles; ++i )
+   {
+      op.amount = asset( i + 1 ); // unique transaction IDs
+      trx.clear();
+      trx.operations.push_back( op );
+      test::set_expiration( db, trx );
+      transactions.push_back( trx );
+   }
+   trx.clear();
+
+   auto start = fc::time_point::now();
+   for( const auto& tx : transactions )
+      db.push_transaction( tx, ~0 );
+   auto elapsed = fc::time_point::now() - start;
+   wlog( "Pushed ${tps} pending transactions/s over ${total}ms",
+         ("tps",(cycles*1000000)/elapsed.count())("total",elapsed.count()/1000) );
+
+   start = fc::time_point::now();
+   const auto block = generate_block();
+   elapsed = fc::time_point::now() - start;
+   wlog( "Generated block with ${n} transactions at ${tps} transactions/s",
+         ("n",block.transactions.size())("tps",(block.transactions.size()*1000000)/elapsed.count()) );
+
+   db.pop_block();
+   start = fc::time_point::now();
+   db.push_block( block, ~0 );
+   elapsed = fc::time_point::now() - start;
+   wlog( "Applied block with ${n} transactions at ${tps} transactions/s",
+         ("n",block.transactions.size())("tps",(block.transactions.size()*1000000)/elapsed.count()) );
+} FC_LOG_AND_RETHROW() }
+
 // See https://bitshares.org/blog/2015/06/08/measuring-performance/
 // (note this is not the original test mentioned in the above post, but was
 //  recreated later according to the description)
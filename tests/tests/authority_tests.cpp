@@ -32,6 +32,7 @@
 #include <graphene/chain/committee_member_object.hpp>
 #include <graphene/chain/proposal_object.hpp>
 #include <graphene/chain/hardfork.hpp>
+#include <graphene/chain/signature_key_cache.hpp>
 
 #include <graphene/db/simple_index.hpp>
 
@@ -1751,6 +1752,102 @@ BOOST_AUTO_TEST_CASE( irrelevant_signatures )
    PUSH_TX( db, trx );
 } FC_LOG_AND_RETHROW() }
 
+BOOST_AUTO_TEST_CASE( signature_key_cache_test )
+{ try {
+   const chain_id_type& chain_id = db.get_chain_id();
+   const fc::ecc::private_key key1 = fc::ecc::private_key::regenerate( fc::digest( "key1" ) );
+   const fc::ecc::private_key key2 = fc::ecc::private_key::regenerate( fc::digest( "key2" ) );
+
+   transfer_operation to;
+   to.amount = asset( 1 );
+   to.from = account_id_type( 1 );
+   signed_transaction tx;
+   tx.operations.push_back( to );
+   set_expiration( db, tx );
+   tx.sign( key1, chain_id );
+
+   signature_key_cache cache( 2 );
+   const precomputable_transaction first( tx );
+   const precomputable_transaction second( tx );
+   cache.apply( first, chain_id );
+   cache.apply( second, chain_id );
+   BOOST_CHECK_EQUAL( 1u, cache.misses() );
+   BOOST_CHECK_EQUAL( 1u, cache.hits() );
+   BOOST_CHECK( second.get_signature_keys( chain_id ) == flat_set<public_key_type>{ public_key_type( key1.get_public_key() ) } );
+
+   // same transaction, different signature
+   signed_transaction other = tx;
+   other.clear_signatures();
+   other.sign( key2, chain_id );
+   const precomputable_transaction third( other );
+   cache.apply( third, chain_id );
+   BOOST_CHECK_EQUAL( 2u, cache.misses() );
+   BOOST_CHECK( third.get_signature_keys( chain_id ) == flat_set<public_key_type>{ public_key_type( key2.get_public_key() ) } );
+
+   // a third entry drops the least recently used one
+   other.sign( key1, chain_id );
+   cache.apply( precomputable_transaction( other ), chain_id );
+   BOOST_CHECK_EQUAL( 3u, cache.misses() );
+   cache.apply( precomputable_transaction( tx ), chain_id );
+   BOOST_CHECK_EQUAL( 4u, cache.misses() );
+   BOOST_CHECK_EQUAL( 1u, cache.hits() );
+} FC_LOG_AND_RETHROW() }
+
+/**
+ * Authorities of a block's transactions are verified in parallel against the state before the block, transactions
+ * depending on accounts changed earlier in the same block must be verified again
+ */
+BOOST_AUTO_TEST_CASE( parallel_block_authority_verification )
+{ try {
+   ACTORS( (alice)(bob) );
+   fund( alice );
+   generate_block();
+
+   // changes alice's keys and transfers in the same block, returns the block after popping it
+   auto update_and_transfer = [this,alice_id,bob_id] ( const fc::ecc::private_key& old_key,
+                                                       const fc::ecc::private_key& new_key,
+                                                       const fc::ecc::private_key& transfer_signer ) {
+      account_update_operation auo;
+      auo.account = alice_id;
+      auo.owner = authority( 1, public_key_type( new_key.get_public_key() ), 1 );
+      auo.active = auo.owner;
+      trx.clear();
+      set_expiration( db, trx );
+      trx.operations.push_back( auo );
+      sign( trx, old_key );
+      PUSH_TX( db, trx );
+
+      transfer_operation to;
+      to.amount = asset( 1 );
+      to.from = alice_id;
+      to.to = bob_id;
+      trx.clear();
+      set_expiration( db, trx );
+      trx.operations.push_back( to );
+      sign( trx, transfer_signer );
+      PUSH_TX( db, trx, database::skip_transaction_signatures );
+      trx.clear();
+
+      signed_block block = generate_block();
+      BOOST_REQUIRE_EQUAL( 2u, block.transactions.size() );
+      db.pop_block();
+      return block;
+   };
+
+   const fc::ecc::private_key key1 = fc::ecc::private_key::regenerate( fc::digest( "key1" ) );
+   const fc::ecc::private_key key2 = fc::ecc::private_key::regenerate( fc::digest( "key2" ) );
+
+   // the transfer fails against the state before the block, but is valid after the update
+   const signed_block good = update_and_transfer( alice_private_key, key1, key1 );
+   db.push_block( good, database::skip_witness_signature );
+   BOOST_CHECK( db.head_block_id() == good.id() );
+
+   // the transfer is valid against the state before the block, but not after the update
+   const signed_block bad = update_and_transfer( key1, key2, key1 );
+   GRAPHENE_REQUIRE_THROW( db.push_block( bad, database::skip_witness_signature ), fc::exception );
+   BOOST_CHECK( db.head_block_id() == good.id() );
+} FC_LOG_AND_RETHROW() }
+
 BOOST_AUTO_TEST_CASE( self_approving_proposal )
 { try {
    ACTORS( (alice) );
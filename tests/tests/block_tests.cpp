@@ -39,6 +39,12 @@
 #include <graphene/utilities/tempdir.hpp>
 
 #include <fc/crypto/digest.hpp>
+#include <fc/io/fstream.hpp>
+#include <fc/io/json.hpp>
+#include <fc/thread/thread.hpp>
+
+#include <atomic>
+#include <thread>
 
 #include "../common/database_fixture.hpp"
 
@@ -129,6 +135,109 @@ BOOST_AUTO_TEST_CASE( block_database_test )
    }
 }
 
+BOOST_AUTO_TEST_CASE( block_database_concurrent_read_test )
+{
+   try {
+      fc::temp_directory data_dir( graphene::utilities::temp_directory_path() );
+
+      block_database bdb;
+      bdb.open( data_dir.path() );
+
+      // two competing chains, so the writer can switch forks and rewrite index entries in place
+      const uint32_t num_blocks = 100;
+      std::vector<signed_block> main_chain;
+      std::vector<signed_block> fork_chain;
+      // ids are computed up front, signed_block caches its id lazily and is not safe to share between threads
+      std::vector<block_id_type> main_ids;
+      std::vector<block_id_type> fork_ids;
+      clearable_block b;
+      clearable_block f;
+      for( uint32_t i = 0; i < num_blocks; ++i )
+      {
+         if( i > 0 )
+         {
+            b.previous = b.id();
+            f.previous = f.id();
+         }
+         b.witness = witness_id_type(i+1);
+         f.witness = witness_id_type(i+1001);
+         b.clear();
+         f.clear();
+         main_chain.push_back( b );
+         fork_chain.push_back( f );
+         main_ids.push_back( b.id() );
+         fork_ids.push_back( f.id() );
+      }
+
+      // readers share no cursor, so they must not disturb each other or the writer
+      const uint32_t num_readers = 4;
+      std::atomic<uint32_t> failures(0);
+      std::atomic<uint32_t> caught_up(0);
+      std::atomic<bool> writer_done(false);
+      std::vector<std::thread> readers;
+      for( uint32_t t = 0; t < num_readers; ++t )
+         readers.emplace_back( [&]() {
+            // follow the writer as it appends, each block must show up complete
+            for( uint32_t i = 0; i < num_blocks; ++i )
+            {
+               optional<signed_block> blk;
+               while( !(blk = bdb.fetch_by_number( i+1 )).valid() )
+                  std::this_thread::yield();
+               if( blk->id() != main_ids[i] || !bdb.contains( main_ids[i] ) )
+                  ++failures;
+            }
+            ++caught_up;
+            // then keep reading while the writer switches forks, every entry must point to one of the two blocks
+            while( !writer_done.load() )
+               for( uint32_t i = 0; i < num_blocks; ++i )
+               {
+                  auto blk = bdb.fetch_by_number( i+1 );
+                  if( !blk.valid() || ( blk->id() != main_ids[i] && blk->id() != fork_ids[i] ) )
+                     ++failures;
+               }
+         });
+
+      // appending makes the mapping grow under the readers
+      for( const auto& blk : main_chain )
+         bdb.store( blk.id(), blk );
+      while( caught_up.load() < num_readers )
+         std::this_thread::yield();
+      for( uint32_t round = 0; round < 10; ++round )
+      {
+         for( const auto& blk : fork_chain )
+            bdb.store( blk.id(), blk );
+         for( const auto& blk : main_chain )
+            bdb.store( blk.id(), blk );
+      }
+      writer_done.store( true );
+      for( auto& reader : readers )
+         reader.join();
+      BOOST_CHECK_EQUAL( failures.load(), 0u );
+
+      for( uint32_t i = 1; i <= num_blocks; ++i )
+      {
+         auto blk = bdb.fetch_by_number( i );
+         BOOST_REQUIRE( blk.valid() );
+         BOOST_CHECK( blk->witness == witness_id_type(i) );
+         BOOST_CHECK( !bdb.contains( fork_chain[i-1].id() ) );
+      }
+      BOOST_CHECK( bdb.last_id().valid() && *bdb.last_id() == main_chain.back().id() );
+      // the main chain was stored last, so its last block ends the log
+      size_t end_position = 0;
+      BOOST_CHECK( bdb.fetch_by_number( num_blocks, end_position ).valid() );
+      BOOST_CHECK_EQUAL( end_position, bdb.total_block_size() );
+
+      bdb.remove( main_chain.back().id() );
+      BOOST_CHECK( !bdb.contains( main_chain.back().id() ) );
+      BOOST_CHECK( !bdb.fetch_optional( main_chain.back().id() ).valid() );
+      BOOST_CHECK( !bdb.fetch_by_number( num_blocks ).valid() );
+
+   } catch (fc::exception& e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
 BOOST_AUTO_TEST_CASE( generate_empty_blocks )
 {
    try {
@@ -188,6 +297,105 @@ BOOST_AUTO_TEST_CASE( generate_empty_blocks )
    }
 }
 
+BOOST_AUTO_TEST_CASE( replay_pipeline )
+{
+   try {
+      fc::temp_directory data_dir( graphene::utilities::temp_directory_path() );
+      auto init_account_priv_key = fc::ecc::private_key::regenerate(fc::sha256::hash(string("null_key")) );
+
+      block_id_type head_id;
+      std::string dynamic_properties;
+      std::string witness_schedule;
+      std::string witnesses;
+      {
+         database db;
+         db.open( data_dir.path(), make_genesis, "TEST" );
+         // more blocks than the undo history kept by the replay, so that both apply_block and push_block are used
+         for( uint32_t i = 0; i < 80; ++i )
+            db.generate_block( db.get_slot_time(1), db.get_scheduled_witness(1), init_account_priv_key, database::skip_nothing );
+         head_id = db.head_block_id();
+         dynamic_properties = fc::json::to_string( db.get_dynamic_global_properties() );
+         witness_schedule = fc::json::to_string( db.get( witness_schedule_id_type() ) );
+         vector<witness_object> all_witnesses( db.get_index_type<witness_index>().indices().begin(),
+                                               db.get_index_type<witness_index>().indices().end() );
+         witnesses = fc::json::to_string( all_witnesses );
+         db.close();
+      }
+      {
+         database db;
+         db.set_replay_pipeline_depth( 2 );
+         // another version wipes the object database, so all blocks are replayed from genesis
+         db.open( data_dir.path(), make_genesis, "TEST2" );
+         BOOST_CHECK( db.head_block_id() == head_id );
+         BOOST_CHECK_EQUAL( fc::json::to_string( db.get_dynamic_global_properties() ), dynamic_properties );
+         BOOST_CHECK_EQUAL( fc::json::to_string( db.get( witness_schedule_id_type() ) ), witness_schedule );
+         vector<witness_object> all_witnesses( db.get_index_type<witness_index>().indices().begin(),
+                                               db.get_index_type<witness_index>().indices().end() );
+         BOOST_CHECK_EQUAL( fc::json::to_string( all_witnesses ), witnesses );
+         db.close();
+      }
+   } catch (fc::exception& e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_AUTO_TEST_CASE( binary_snapshot_test )
+{
+   try {
+      fc::temp_directory data_dir1( graphene::utilities::temp_directory_path() );
+      fc::temp_directory data_dir2( graphene::utilities::temp_directory_path() );
+      const fc::path snapshot_file = data_dir1.path() / "snapshot.bin";
+      auto init_account_priv_key = fc::ecc::private_key::regenerate(fc::sha256::hash(string("null_key")) );
+
+      database db1;
+      db1.open( data_dir1.path(), make_genesis, "TEST" );
+      for( uint32_t i = 0; i < 20; ++i )
+         db1.generate_block( db1.get_slot_time(1), db1.get_scheduled_witness(1), init_account_priv_key, database::skip_nothing );
+      const block_id_type snapshot_head = db1.head_block_id();
+      // the snapshot is written while db1 keeps applying blocks and must still reflect the captured state
+      fc::thread writer( "snapshot" );
+      const auto capture = db1.capture_snapshot();
+      // a second capture of the same state, sections are written in index order so the files must be identical
+      const fc::path second_file = data_dir1.path() / "snapshot2.bin";
+      object_database::write_snapshot( db1.capture_snapshot(), second_file );
+      auto written = writer.async( [capture,snapshot_file] () {
+         object_database::write_snapshot( capture, snapshot_file );
+      });
+      signed_block next = db1.generate_block( db1.get_slot_time(1), db1.get_scheduled_witness(1),
+                                              init_account_priv_key, database::skip_nothing );
+      written.wait();
+      {
+         std::string first_content, second_content;
+         fc::read_file_contents( snapshot_file, first_content );
+         fc::read_file_contents( second_file, second_content );
+         BOOST_CHECK( first_content == second_content );
+      }
+
+      {
+         database wrong_chain;
+         BOOST_CHECK_THROW( wrong_chain.load_snapshot( snapshot_file, chain_id_type() ), fc::exception );
+      }
+
+      database db2;
+      db2.load_snapshot( snapshot_file, db1.get_chain_id() );
+      db2.open( data_dir2.path(), []{ return genesis_state_type(); }, "TEST" );
+      BOOST_CHECK( db2.head_block_id() == snapshot_head );
+      BOOST_CHECK( db2.get_chain_id() == db1.get_chain_id() );
+      BOOST_CHECK( db2.fetch_block_by_id( snapshot_head ).valid() );
+      BOOST_CHECK_EQUAL( db2.get_index<account_object>().get_next_id().instance(),
+                         db1.get_index<account_object>().get_next_id().instance() );
+
+      // the restored node continues from the head block of the snapshot
+      db2.push_block( next, database::skip_nothing );
+      BOOST_CHECK( db2.head_block_id() == db1.head_block_id() );
+      BOOST_CHECK( db2.get_dynamic_global_properties().current_aslot == db1.get_dynamic_global_properties().current_aslot );
+   } catch (fc::exception& e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
 BOOST_AUTO_TEST_CASE( undo_block )
 {
    try {
@@ -1923,4 +2131,205 @@ BOOST_FIXTURE_TEST_CASE( block_size_test, database_fixture )
    }
 }
 
+/**
+ * Applies the same blocks serially and with parallel transaction execution and compares the resulting states.
+ * The blocks contain independent transfers, transfers depending on earlier ones, and transactions which end the
+ * speculation.
+ */
+BOOST_FIXTURE_TEST_CASE( parallel_tx_execution_equivalence, database_fixture )
+{ try {
+   ACTORS( (alice)(bob)(carol)(dan)(erin) );
+   fund( alice );
+   fund( bob );
+   fund( carol );
+   fund( erin );
+   const asset_id_type uia_id = create_user_issued_asset( "UIA" ).id;
+   issue_uia( dan_id, asset( 1000000, uia_id ) );
+   generate_block();
+
+   share_type counter = 0; // keeps the transactions unique
+   auto make_transfer = [&counter] ( account_id_type from, account_id_type to, asset amount ) -> transfer_operation {
+      counter += 1;
+      transfer_operation op;
+      op.from = from;
+      op.to = to;
+      op.amount = amount;
+      op.amount.amount += counter;
+      return op;
+   };
+   auto push_ops = [this] ( const vector<operation>& ops, const fc::ecc::private_key& key ) {
+      trx.clear();
+      set_expiration( db, trx );
+      trx.operations = ops;
+      sign( trx, key );
+      PUSH_TX( db, trx );
+      trx.clear();
+   };
+
+   vector<signed_block> blocks;
+
+   push_ops( { make_transfer( alice_id, bob_id, asset(100) ) }, alice_private_key );
+   push_ops( { make_transfer( carol_id, dan_id, asset(100) ) }, carol_private_key );
+   push_ops( { make_transfer( dan_id, alice_id, asset(1000, uia_id) ) }, dan_private_key );
+   push_ops( { make_transfer( bob_id, carol_id, asset(150) ) }, bob_private_key ); // depends on the first two
+   push_ops( { make_transfer( dan_id, bob_id, asset(1000, uia_id) ) }, dan_private_key );
+   blocks.push_back( generate_block() );
+
+   limit_order_create_operation loc;
+   loc.seller = alice_id;
+   loc.amount_to_sell = asset( 1000 );
+   loc.min_to_receive = asset( 100, uia_id );
+   loc.expiration = db.head_block_time() + fc::days(1);
+   push_ops( { make_transfer( bob_id, carol_id, asset(100) ) }, bob_private_key );
+   push_ops( { loc }, alice_private_key );
+   push_ops( { make_transfer( dan_id, alice_id, asset(100) ) }, dan_private_key );
+   push_ops( { make_transfer( carol_id, dan_id, asset(100) ) }, carol_private_key );
+   blocks.push_back( generate_block() );
+
+   push_ops( { make_transfer( alice_id, bob_id, asset(100) ), make_transfer( alice_id, dan_id, asset(100) ) },
+             alice_private_key );
+   push_ops( { make_transfer( carol_id, bob_id, asset(100) ) }, carol_private_key );
+   push_ops( { make_transfer( dan_id, carol_id, asset(100, uia_id) ) }, dan_private_key );
+   blocks.push_back( generate_block() );
+
+   // erin has no UIA before the block, the transfer from erin only works with the balance the first transaction gives.
+   // Evaluated against the state before the block it would fail, so it must not be taken from the speculation.
+   BOOST_REQUIRE_EQUAL( get_balance( erin_id, uia_id ), 0 );
+   push_ops( { make_transfer( dan_id, erin_id, asset(500, uia_id) ) }, dan_private_key );
+   push_ops( { make_transfer( carol_id, alice_id, asset(100) ) }, carol_private_key );
+   push_ops( { make_transfer( erin_id, bob_id, asset(200, uia_id) ) }, erin_private_key );
+   blocks.push_back( generate_block() );
+   const share_type erin_uia = get_balance( erin_id, uia_id );
+   const share_type bob_uia = get_balance( bob_id, uia_id );
+   BOOST_REQUIRE_GT( erin_uia.value, 0 );
+
+   const block_id_type serial_head = db.head_block_id();
+   const fc::sha256 serial_hash = db.state_hash();
+
+   auto replay = [this,&blocks] ( bool parallel ) {
+      for( size_t i = 0; i < blocks.size(); ++i )
+         db.pop_block();
+      db.clear_pending();
+      db.enable_parallel_tx_execution( parallel );
+      for( const auto& block : blocks )
+         PUSH_BLOCK( db, block, database::skip_witness_signature );
+      db.clear_pending();
+   };
+
+   replay( true );
+   BOOST_CHECK( db.head_block_id() == serial_head );
+   BOOST_CHECK( db.state_hash() == serial_hash );
+   BOOST_CHECK_EQUAL( get_balance( erin_id, uia_id ), erin_uia.value );
+   BOOST_CHECK_EQUAL( get_balance( bob_id, uia_id ), bob_uia.value );
+
+   replay( false );
+   BOOST_CHECK( db.head_block_id() == serial_head );
+   BOOST_CHECK( db.state_hash() == serial_hash );
+
+   // Valid against the state before the block, but not after the first transfer
+   db.enable_parallel_tx_execution( true );
+   const share_type balance = get_balance( alice_id, asset_id_type() );
+   push_ops( { make_transfer( alice_id, bob_id, asset(balance / 2) ) }, alice_private_key );
+   push_ops( { make_transfer( alice_id, carol_id, asset(balance / 4) ) }, alice_private_key );
+   signed_block bad = generate_block();
+   db.pop_block();
+   db.clear_pending();
+   bad.transactions[1].operations[0].get<transfer_operation>().amount.amount = balance * 3 / 4;
+   GRAPHENE_REQUIRE_THROW( PUSH_BLOCK( db, bad, database::skip_witness_signature | database::skip_merkle_check
+                                                | database::skip_transaction_signatures ), fc::exception );
+   BOOST_CHECK( db.head_block_id() == serial_head );
+   BOOST_CHECK( db.state_hash() == serial_hash );
+
+   // Two independent transfers are speculated, the evaluation of the second one fails. It is evaluated again
+   // when applied, which has to reject the block just like the serial path does.
+   const share_type carol_balance = get_balance( carol_id, asset_id_type() );
+   push_ops( { make_transfer( alice_id, bob_id, asset(100) ) }, alice_private_key );
+   push_ops( { make_transfer( carol_id, dan_id, asset(100) ) }, carol_private_key );
+   signed_block overdrawn = generate_block();
+   db.pop_block();
+   db.clear_pending();
+   overdrawn.transactions[1].operations[0].get<transfer_operation>().amount.amount = carol_balance + 1;
+   for( bool parallel : { true, false } )
+   {
+      db.enable_parallel_tx_execution( parallel );
+      GRAPHENE_REQUIRE_THROW( PUSH_BLOCK( db, overdrawn, database::skip_witness_signature | database::skip_merkle_check
+                                                         | database::skip_transaction_signatures ), fc::exception );
+      BOOST_CHECK( db.head_block_id() == serial_head );
+      BOOST_CHECK( db.state_hash() == serial_hash );
+   }
+} FC_LOG_AND_RETHROW() }
+
+BOOST_FIXTURE_TEST_CASE( block_profiler_records_phases, database_fixture )
+{ try {
+   ACTORS( (alice)(bob) );
+   transfer( committee_account, alice_id, asset(10000) );
+   generate_block();
+
+   block_profiler& profiler = db.get_profiler();
+   BOOST_CHECK( !profiler.enabled() );
+   BOOST_CHECK_EQUAL( profiler.get_profile().blocks, 0u );
+
+   unsigned slot_calls = 0;
+   boost::signals2::scoped_connection slot = db.applied_block.connect( profiler.profile_applied_block( "test",
+                                             [&slot_calls]( const signed_block& ) { ++slot_calls; } ) );
+   profiler.enable( true );
+   transfer( alice_id, bob_id, asset(100) );
+   // evaluations outside of applying a block are not recorded
+   BOOST_CHECK( profiler.get_profile().operations.empty() );
+   generate_block();
+   generate_block();
+
+   block_profile profile = profiler.get_profile();
+   BOOST_CHECK( profile.enabled );
+   BOOST_CHECK_EQUAL( profile.blocks, 2u );
+   BOOST_CHECK_EQUAL( profile.last_block, db.head_block_num() );
+   BOOST_CHECK_EQUAL( profile.block_phases.at( "transactions" ).count, 2u );
+   BOOST_CHECK_EQUAL( profile.block_phases.at( "notify_changed_objects" ).count, 2u );
+   BOOST_CHECK_EQUAL( profile.applied_block_slots.at( "test" ).count, 2u );
+   BOOST_CHECK_EQUAL( slot_calls, 2u );
+
+   const int transfer_tag = operation::tag<transfer_operation>::value;
+   BOOST_REQUIRE( profile.operations.count( transfer_tag ) );
+   const operation_profile& transfers = profile.operations.at( transfer_tag );
+   BOOST_CHECK_EQUAL( transfers.name, "transfer_operation" );
+   // only the evaluation while applying the block, not those when it was pushed and when the block was generated
+   BOOST_CHECK_EQUAL( transfers.evaluate.count, 1u );
+   BOOST_CHECK_EQUAL( transfers.apply.count, 1u );
+   BOOST_CHECK( transfers.apply.max_us <= transfers.apply.total_us );
+
+   fc::temp_directory dir( graphene::utilities::temp_directory_path() );
+   const fc::path file = dir.path() / "profile.json";
+   profiler.dump( file );
+   const block_profile dumped = fc::json::from_file( file ).as<block_profile>( GRAPHENE_MAX_NESTED_OBJECTS );
+   BOOST_CHECK_EQUAL( dumped.blocks, 2u );
+   BOOST_CHECK_EQUAL( dumped.operations.at( transfer_tag ).name, "transfer_operation" );
+
+   // the phases of chain maintenance are recorded with the same times as get_maintenance_timings
+   BOOST_CHECK( profile.maintenance_phases.empty() );
+   generate_blocks( db.get_dynamic_global_properties().next_maintenance_time );
+   profile = profiler.get_profile();
+   const auto& timings = db.get_maintenance_timings();
+   BOOST_CHECK_EQUAL( profile.maintenance_phases.size(), timings.size() );
+   for( const auto& phase : timings )
+   {
+      BOOST_REQUIRE( profile.maintenance_phases.count( phase.first ) );
+      BOOST_CHECK_EQUAL( profile.maintenance_phases.at( phase.first ).count, 1u );
+      BOOST_CHECK_EQUAL( profile.maintenance_phases.at( phase.first ).total_us, uint64_t( phase.second.count() ) );
+   }
+
+   // switched off, nothing is recorded but the handlers are still called
+   const uint64_t blocks = profile.blocks;
+   const uint32_t calls = slot_calls;
+   profiler.enable( false );
+   generate_block();
+   profile = profiler.get_profile();
+   BOOST_CHECK_EQUAL( profile.blocks, blocks );
+   BOOST_CHECK_EQUAL( profile.applied_block_slots.at( "test" ).count, blocks );
+   BOOST_CHECK_EQUAL( slot_calls, calls + 1 );
+
+   profiler.reset();
+   BOOST_CHECK_EQUAL( profiler.get_profile().blocks, 0u );
+   BOOST_CHECK( profiler.get_profile().operations.empty() );
+} FC_LOG_AND_RETHROW() }
+
 BOOST_AUTO_TEST_SUITE_END()
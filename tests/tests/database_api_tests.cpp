@@ -24,7 +24,9 @@
 
 #include <boost/test/unit_test.hpp>
 
+#include <graphene/app/application.hpp>
 #include <graphene/app/database_api.hpp>
+#include <graphene/app/change_notifier.hpp>
 
 #include <fc/crypto/digest.hpp>
 
@@ -665,6 +667,112 @@ BOOST_AUTO_TEST_CASE( set_subscribe_callback_disable_notify_all_test ) {
    } FC_LOG_AND_RETHROW()
 }
 
+BOOST_AUTO_TEST_CASE( subscribers_share_serialized_objects ) {
+   try {
+      ACTORS( (alice) );
+      auto notifier = std::make_shared<graphene::app::change_notifier>( db );
+
+      size_t updates1 = 0;
+      size_t updates2 = 0;
+      size_t updates3 = 0;
+      graphene::app::database_api db_api1( db, nullptr, notifier );
+      graphene::app::database_api db_api2( db, nullptr, notifier );
+      graphene::app::database_api db_api3( db, nullptr, notifier );
+      db_api1.set_subscribe_callback( [&]( const variant& v ) { updates1 += v.get_array().size(); }, false );
+      db_api2.set_subscribe_callback( [&]( const variant& v ) { updates2 += v.get_array().size(); }, false );
+      db_api3.set_subscribe_callback( [&]( const variant& v ) { updates3 += v.get_array().size(); }, false );
+
+      // the first two connections subscribe to Alice, the third to nothing
+      db_api1.get_full_accounts( { "alice" }, true );
+      db_api2.get_full_accounts( { "alice" }, true );
+      generate_block();
+      fc::usleep(fc::milliseconds(200));
+
+      updates1 = updates2 = updates3 = 0;
+      const uint64_t serialized_before = notifier->serialized_objects();
+      transfer( account_id_type(), alice_id, asset(1) );
+      generate_block();
+      fc::usleep(fc::milliseconds(200)); // sleep a while to execute callback in another thread
+
+      BOOST_CHECK( updates1 > 0 );
+      BOOST_CHECK_EQUAL( updates1, updates2 );
+      BOOST_CHECK_EQUAL( updates3, 0u );
+      // each object was serialized once for both connections
+      BOOST_CHECK_EQUAL( notifier->serialized_objects() - serialized_before, updates1 );
+
+      // unsubscribed connections get nothing
+      db_api2.cancel_all_subscriptions();
+      updates1 = updates2 = 0;
+      transfer( account_id_type(), alice_id, asset(1) );
+      generate_block();
+      fc::usleep(fc::milliseconds(200));
+      BOOST_CHECK( updates1 > 0 );
+      BOOST_CHECK_EQUAL( updates2, 0u );
+
+   } FC_LOG_AND_RETHROW()
+}
+
+BOOST_AUTO_TEST_CASE( subscription_limits ) {
+   try {
+      ACTORS( (alice)(bob)(carol)(dan) );
+      auto notifier = std::make_shared<graphene::app::change_notifier>( db );
+
+      graphene::app::application_options opt;
+      opt.subscription_limits.max_accounts = 3;
+      opt.subscription_limits.max_objects = 5;
+
+      size_t updates = 0;
+      auto callback = [&]( const variant& v ) { updates += v.get_array().size(); };
+      graphene::app::database_api db_api( db, &opt, notifier );
+      db_api.set_subscribe_callback( callback, false );
+
+      // the fourth account is beyond the limit
+      db_api.get_full_accounts( { "alice", "bob", "carol", "dan" }, true );
+      auto stats = notifier->get_stats();
+      BOOST_CHECK_EQUAL( stats.accounts, 3u );
+      BOOST_CHECK_EQUAL( stats.rejected, 1u );
+      BOOST_CHECK_EQUAL( stats.objects, 3u );
+      BOOST_CHECK( stats.memory_used > 0 );
+
+      // looking up keys subscribes to nothing, no change could be matched against them
+      db_api.get_key_references( { alice_public_key } );
+      stats = db_api.get_subscription_stats();
+      BOOST_CHECK_EQUAL( stats.objects, 3u );
+      BOOST_CHECK_EQUAL( stats.rejected, 1u );
+
+      // the fourth and fifth objects fit, the sixth is beyond the limit
+      db_api.get_objects( { dan_id, asset_id_type(), account_id_type() } );
+      stats = db_api.get_subscription_stats();
+      BOOST_CHECK_EQUAL( stats.objects, 5u );
+      BOOST_CHECK_EQUAL( stats.rejected, 2u );
+
+      // the registry is exact, changes of other objects are not delivered
+      db_api.set_subscribe_callback( callback, false );
+      db_api.get_objects( { alice_id } );
+      BOOST_CHECK_EQUAL( notifier->get_stats().objects, 1u );
+      generate_block();
+      fc::usleep(fc::milliseconds(200));
+      updates = 0;
+      transfer( account_id_type(), bob_id, asset(1) );
+      generate_block();
+      fc::usleep(fc::milliseconds(200)); // sleep a while to execute callback in another thread
+      BOOST_CHECK_EQUAL( updates, 0u );
+
+      // the memory limit of the node rejects new entries of all connections
+      notifier->set_memory_limit( notifier->get_stats().memory_used );
+      db_api.get_objects( { bob_id } );
+      stats = notifier->get_stats();
+      BOOST_CHECK_EQUAL( stats.objects, 1u );
+      BOOST_CHECK_EQUAL( stats.rejected, 3u );
+
+      // forgetting the subscriptions frees their memory
+      db_api.set_subscribe_callback( callback, false );
+      BOOST_CHECK_EQUAL( notifier->get_stats().memory_used, 0u );
+      notifier->set_memory_limit( 0 );
+
+   } FC_LOG_AND_RETHROW()
+}
+
 BOOST_AUTO_TEST_CASE( lookup_vote_ids )
 { try {
    ACTORS( (connie)(whitney)(wolverine) );
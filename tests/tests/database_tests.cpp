@@ -27,8 +27,14 @@
 #include <graphene/chain/database.hpp>
 
 #include <graphene/chain/account_object.hpp>
+#include <graphene/chain/market_object.hpp>
+
+#include <graphene/utilities/tempdir.hpp>
 
 #include <fc/crypto/digest.hpp>
+#include <fc/io/fstream.hpp>
+
+#include <thread>
 
 #include "../common/database_fixture.hpp"
 
@@ -88,6 +94,78 @@ BOOST_AUTO_TEST_CASE(failed_modify_test)
    BOOST_CHECK_NE((long)db.find_object(obj_id), (long)nullptr);
 } FC_LOG_AND_RETHROW() }
 
+BOOST_AUTO_TEST_CASE( undo_journal_merge_test )
+{ try {
+   auto create_balance = [this] ( int64_t amount ) -> const account_balance_object& {
+      return db.create<account_balance_object>( [amount] ( account_balance_object& o ) { o.balance = amount; } );
+   };
+   const account_balance_id_type existing_id = create_balance( 1 ).id;
+   const account_balance_id_type doomed_id = create_balance( 2 ).id;
+   const object_id_type next_id = db.get_index<account_balance_object>().get_next_id();
+
+   auto outer = db._undo_db.start_undo_session();
+   db.modify( existing_id(db), [] ( account_balance_object& o ) { o.balance = 10; } );
+   const account_balance_id_type temp_id = create_balance( 3 ).id;
+   const account_balance_id_type created_id = create_balance( 4 ).id;
+   {
+      auto inner = db._undo_db.start_undo_session();
+      db.modify( existing_id(db), [] ( account_balance_object& o ) { o.balance = 20; } ); // upd + upd -> upd(was=1)
+      db.modify( created_id(db), [] ( account_balance_object& o ) { o.balance = 40; } );  // new + upd -> new
+      db.remove( temp_id(db) );                                                            // new + del -> nop
+      db.remove( doomed_id(db) );                                                          // nop + del -> del(was=2)
+      inner.merge();
+   }
+   {
+      const auto changes = db._undo_db.head();
+      BOOST_REQUIRE_EQUAL( 1u, changes.old_values.size() );
+      BOOST_CHECK_EQUAL( 1, static_cast<const account_balance_object*>( changes.old_values.at( existing_id ) )->balance.value );
+      BOOST_CHECK_EQUAL( 1u, changes.new_ids.size() );
+      BOOST_CHECK_EQUAL( 1u, changes.new_ids.count( created_id ) );
+      BOOST_REQUIRE_EQUAL( 1u, changes.removed.size() );
+      BOOST_CHECK_EQUAL( 2, static_cast<const account_balance_object*>( changes.removed.at( doomed_id ) )->balance.value );
+      BOOST_CHECK( changes.old_index_next_ids.at( object_id_type( next_id.space(), next_id.type(), 0 ) ) == next_id );
+   }
+   {
+      auto inner = db._undo_db.start_undo_session();
+      db.remove( existing_id(db) ); // upd(was=1) + del -> del(was=1)
+      inner.merge();
+   }
+   BOOST_CHECK( db._undo_db.head().old_values.empty() );
+   BOOST_CHECK_EQUAL( 2u, db._undo_db.head().removed.size() );
+
+   outer.undo();
+   BOOST_CHECK_EQUAL( 1, existing_id(db).balance.value );
+   BOOST_CHECK_EQUAL( 2, doomed_id(db).balance.value );
+   BOOST_CHECK( db.find( temp_id ) == nullptr );
+   BOOST_CHECK( db.find( created_id ) == nullptr );
+   BOOST_CHECK( db.get_index<account_balance_object>().get_next_id() == next_id );
+} FC_LOG_AND_RETHROW() }
+
+BOOST_AUTO_TEST_CASE( undo_journal_reuses_old_values )
+{ try {
+   const account_balance_id_type balance_id = db.create<account_balance_object>( [] ( account_balance_object& o ) {
+      o.balance = 1;
+   }).id;
+
+   const object* first_copy = nullptr;
+   {
+      auto session = db._undo_db.start_undo_session();
+      db.modify( balance_id(db), [] ( account_balance_object& o ) { o.balance = 2; } );
+      first_copy = db._undo_db.head().old_values.at( balance_id );
+      session.undo();
+   }
+   BOOST_CHECK_EQUAL( 1, balance_id(db).balance.value );
+
+   // the old value released by the undo is the storage for the next one
+   auto session = db._undo_db.start_undo_session();
+   db.modify( balance_id(db), [] ( account_balance_object& o ) { o.balance = 3; } );
+   const object* second_copy = db._undo_db.head().old_values.at( balance_id );
+   BOOST_CHECK( second_copy == first_copy );
+   BOOST_CHECK_EQUAL( 1, static_cast<const account_balance_object*>( second_copy )->balance.value );
+   session.undo();
+   BOOST_CHECK_EQUAL( 1, balance_id(db).balance.value );
+} FC_LOG_AND_RETHROW() }
+
 BOOST_AUTO_TEST_CASE( flat_index_test )
 { try {
    ACTORS((sam));
@@ -222,4 +300,182 @@ BOOST_AUTO_TEST_CASE( direct_index_test )
    // but the secondary has not updated its representation
 } FC_LOG_AND_RETHROW() }
 
+BOOST_AUTO_TEST_CASE( hashed_index_test )
+{ try {
+   graphene::db::hashed_primary_index< limit_order_index > my_orders( db );
+   const auto& hashed = my_orders.get_secondary_index<graphene::db::hashed_id_index< limit_order_object >>();
+   BOOST_CHECK( nullptr == my_orders.find( limit_order_id_type( 1 ) ) );
+   BOOST_CHECK_THROW( hashed.find( object_id_type( asset_id_type( 1 ) ) ), fc::assert_exception );
+
+   // sparse instances, removals in between and enough objects to force a few rehashes
+   const uint32_t total = 5000;
+   for( uint32_t i = 0; i < total; ++i )
+   {
+      limit_order_object order;
+      order.id = limit_order_id_type( uint64_t(i) * 37 );
+      order.for_sale = i;
+      my_orders.load( fc::raw::pack( order ) );
+   }
+   for( uint32_t i = 0; i < total; i += 3 )
+      my_orders.remove( *my_orders.find( limit_order_id_type( uint64_t(i) * 37 ) ) );
+   const auto& created = my_orders.create( [] ( object& o ) {
+      static_cast< limit_order_object& >( o ).for_sale = 42;
+   });
+   BOOST_CHECK_EQUAL( 0u, created.id.instance() );
+   BOOST_CHECK( &created == my_orders.find( created.id ) );
+
+   uint32_t count = 0;
+   for( uint64_t instance = 1; instance < uint64_t(total) * 37; ++instance )
+   {
+      const object_id_type id = limit_order_id_type( instance );
+      const auto* order = static_cast< const limit_order_object* >( my_orders.find( id ) );
+      const auto expected = my_orders.indices().find( id );
+      if( expected == my_orders.indices().end() )
+      {
+         BOOST_CHECK( order == nullptr );
+         continue;
+      }
+      BOOST_REQUIRE( order == &*expected );
+      BOOST_CHECK_EQUAL( instance, uint64_t( order->for_sale.value ) * 37 );
+      ++count;
+   }
+   BOOST_CHECK_EQUAL( count + 1, my_orders.indices().size() );
+   BOOST_CHECK_EQUAL( hashed.size(), my_orders.indices().size() );
+} FC_LOG_AND_RETHROW() }
+
+BOOST_AUTO_TEST_CASE( pool_allocator_test )
+{ try {
+   auto order_pool_stats = [] () {
+      for( const auto& stats : graphene::db::get_pool_allocator_stats() )
+         if( stats.name == "graphene::chain::limit_order_object" )
+            return stats;
+      return graphene::db::pool_allocator_stats();
+   };
+
+   const auto& first = db.create<limit_order_object>( [] ( limit_order_object& o ) { o.for_sale = 1; } );
+   const auto before = order_pool_stats();
+   BOOST_REQUIRE_GT( before.live_nodes, 0u );
+   BOOST_CHECK_GE( before.reserved_bytes, before.live_nodes * before.node_size );
+   BOOST_CHECK_GE( before.node_size, sizeof(limit_order_object) );
+
+   const auto& second = db.create<limit_order_object>( [] ( limit_order_object& o ) { o.for_sale = 2; } );
+   BOOST_CHECK_EQUAL( before.live_nodes + 1, order_pool_stats().live_nodes );
+   BOOST_CHECK_EQUAL( before.total_allocations + 1, order_pool_stats().total_allocations );
+
+   // a released node is reused for the next object
+   const limit_order_object* released = &second;
+   db.remove( second );
+   BOOST_CHECK_EQUAL( before.live_nodes, order_pool_stats().live_nodes );
+   const auto& third = db.create<limit_order_object>( [] ( limit_order_object& o ) { o.for_sale = 3; } );
+   BOOST_CHECK( &third == released );
+   BOOST_CHECK_EQUAL( before.reserved_bytes, order_pool_stats().reserved_bytes );
+
+   db.remove( third );
+   db.remove( first );
+   BOOST_CHECK_EQUAL( before.live_nodes - 1, order_pool_stats().live_nodes );
+   BOOST_CHECK_GT( order_pool_stats().fragmentation, 0 );
+} FC_LOG_AND_RETHROW() }
+
+BOOST_AUTO_TEST_CASE( pool_allocator_threads_test )
+{ try {
+   // pools live until the end of the process
+   auto* pool = new graphene::db::node_pool( 32, 8, "pool_allocator_threads_test" );
+   void* first = pool->allocate();
+
+   // nodes can be released by another thread than the one which allocated them
+   std::vector<void*> nodes;
+   std::thread worker( [pool,first,&nodes] () {
+      for( int i = 0; i < 10; ++i )
+         nodes.push_back( pool->allocate() );
+      pool->deallocate( first );
+   });
+   worker.join();
+   auto stats = pool->get_stats();
+   BOOST_CHECK_EQUAL( stats.live_nodes, 10u );
+   BOOST_CHECK_EQUAL( stats.total_allocations, 11u );
+   const uint64_t reserved = stats.reserved_bytes;
+
+   for( void* node : nodes )
+      pool->deallocate( node );
+   BOOST_CHECK_EQUAL( pool->get_stats().live_nodes, 0u );
+
+   // the free nodes of the exited worker are handed to the next thread instead of reserving a new chunk
+   std::thread second_worker( [pool] () {
+      pool->deallocate( pool->allocate() );
+   });
+   second_worker.join();
+   stats = pool->get_stats();
+   BOOST_CHECK_EQUAL( stats.reserved_bytes, reserved );
+   BOOST_CHECK_EQUAL( stats.live_nodes, 0u );
+   BOOST_CHECK_EQUAL( stats.total_allocations, 12u );
+} FC_LOG_AND_RETHROW() }
+
+BOOST_AUTO_TEST_CASE( incremental_flush_test )
+{ try {
+   fc::temp_directory data_dir( graphene::utilities::temp_directory_path() );
+   const fc::path type_dir = data_dir.path() / "object_database" / fc::to_string( account_balance_object::space_id );
+   const std::string type_name = fc::to_string( account_balance_object::type_id );
+   account_balance_id_type kept_id, modified_id, removed_id, added_id;
+   {
+      database db1;
+      db1.enable_incremental_flush( 2 );
+      db1.object_database::open( data_dir.path() );
+      auto make_balance = [&db1]( int64_t amount ) {
+         return db1.create<account_balance_object>( [amount]( account_balance_object& obj ){
+            obj.balance = amount;
+         }).id;
+      };
+      kept_id = make_balance( 1 );
+      modified_id = make_balance( 2 );
+      removed_id = make_balance( 3 );
+      // nothing on disk yet, so this writes everything
+      db1.flush();
+      BOOST_CHECK( fc::exists( type_dir / type_name ) );
+      BOOST_CHECK( !fc::exists( type_dir / ( type_name + ".1" ) ) );
+
+      db1.modify( modified_id(db1), []( account_balance_object& obj ){ obj.balance = 20; } );
+      db1.remove( removed_id(db1) );
+      added_id = make_balance( 4 );
+      db1.flush();
+      BOOST_CHECK( fc::exists( type_dir / ( type_name + ".1" ) ) );
+      BOOST_CHECK( fc::exists( data_dir.path() / "object_database" / "segments" ) );
+
+      db1.modify( modified_id(db1), []( account_balance_object& obj ){ obj.balance = 21; } );
+      db1.flush();
+      BOOST_CHECK( fc::exists( type_dir / ( type_name + ".2" ) ) );
+
+      // third segment would exceed the limit, so the index is rewritten in one piece
+      db1.modify( kept_id(db1), []( account_balance_object& obj ){ obj.balance = 10; } );
+      db1.flush();
+      BOOST_CHECK( fc::exists( type_dir / ( type_name + ".3" ) ) );
+      BOOST_CHECK( !fc::exists( type_dir / ( type_name + ".1" ) ) );
+      BOOST_CHECK( !fc::exists( type_dir / ( type_name + ".2" ) ) );
+
+      db1.modify( kept_id(db1), []( account_balance_object& obj ){ obj.balance = 11; } );
+      db1.flush();
+   }
+   {
+      database db2;
+      db2.object_database::open( data_dir.path() );
+      BOOST_CHECK_EQUAL( kept_id(db2).balance.value, 11 );
+      BOOST_CHECK_EQUAL( modified_id(db2).balance.value, 21 );
+      BOOST_CHECK_EQUAL( added_id(db2).balance.value, 4 );
+      BOOST_CHECK( db2.find( removed_id ) == nullptr );
+      BOOST_CHECK( db2.get_index<account_balance_object>().get_next_id() == object_id_type( added_id ) + 1 );
+   }
+   {
+      // a damaged segment must be detected
+      const fc::path segment = type_dir / ( type_name + ".4" );
+      std::string content;
+      fc::read_file_contents( segment, content );
+      content[ content.size() / 2 ] ^= 0x55;
+      std::ofstream out( segment.generic_string(), std::ofstream::binary | std::ofstream::trunc );
+      out.write( content.data(), content.size() );
+      out.close();
+
+      database db3;
+      BOOST_CHECK_THROW( db3.object_database::open( data_dir.path() ), fc::exception );
+   }
+} FC_LOG_AND_RETHROW() }
+
 BOOST_AUTO_TEST_SUITE_END()
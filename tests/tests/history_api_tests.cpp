@@ -25,6 +25,8 @@
 #include <boost/test/unit_test.hpp>
 
 #include <graphene/app/api.hpp>
+#include <graphene/account_history/account_history_plugin.hpp>
+#include <graphene/account_history/operation_history_store.hpp>
 
 #include <graphene/utilities/tempdir.hpp>
 
@@ -604,4 +606,265 @@ BOOST_AUTO_TEST_CASE(get_account_history_operations) {
    }
 }
 
+BOOST_AUTO_TEST_CASE(get_account_history_operations_by_type_index) {
+   try {
+      graphene::app::history_api hist_api(app);
+      auto ahplugin = app.get_plugin<graphene::account_history::account_history_plugin>( "account_history" );
+
+      int transfer_op_id = operation::tag<transfer_operation>::value;
+      int account_create_op_id = operation::tag<account_create_operation>::value;
+
+      ACTORS( (alice)(bob) );
+      fund( alice );
+      for( int i = 0; i < 5; ++i )
+      {
+         transfer( alice_id, bob_id, asset(1) );
+         create_account( "mytempacct" + std::to_string(i) );
+      }
+      generate_block();
+
+      // compare with walking the linked list of the account history
+      auto check = [&]( const account_id_type account, int type, operation_history_id_type start,
+                        operation_history_id_type stop, unsigned limit ) -> size_t {
+         vector<operation_history_id_type> expected;
+         const auto& stats = account(db).statistics(db);
+         for( auto node = stats.most_recent_op; expected.size() < limit; node = node(db).next )
+         {
+            const auto& ath = node(db);
+            if( stop != operation_history_id_type() && ath.operation_id.instance.value <= stop.instance.value )
+               break;
+            if( ath.operation_id.instance.value <= start.instance.value && ath.operation_id(db).op.which() == type )
+               expected.push_back( ath.operation_id );
+            if( ath.next == account_transaction_history_id_type() )
+               break;
+         }
+         vector<operation_history_object> histories = hist_api.get_account_history_operations(
+               std::string( object_id_type( account ) ), type, start, stop, limit );
+         BOOST_REQUIRE_EQUAL( histories.size(), expected.size() );
+         for( size_t i = 0; i < expected.size(); ++i )
+            BOOST_CHECK( histories[i].id == expected[i] );
+         return expected.size();
+      };
+
+      const auto last = alice_id(db).statistics(db).most_recent_op(db).operation_id;
+      auto ops = ahplugin->get_account_operations_by_type( alice_id, transfer_op_id, last,
+                                                          operation_history_id_type(), 100 );
+      BOOST_REQUIRE( ops.valid() );
+      BOOST_CHECK_EQUAL( ops->size(), 6u );
+      BOOST_CHECK( ops->front() == last );
+
+      BOOST_CHECK_EQUAL( check( alice_id, transfer_op_id, last, operation_history_id_type(), 100 ), 6u );
+      BOOST_CHECK_EQUAL( check( alice_id, account_create_op_id, last, operation_history_id_type(), 100 ), 1u );
+      BOOST_CHECK_EQUAL( check( alice_id, transfer_op_id, last, operation_history_id_type(), 2 ), 2u );
+      BOOST_CHECK_EQUAL( check( bob_id, transfer_op_id, last, operation_history_id_type(), 100 ), 5u );
+      BOOST_CHECK_EQUAL( check( bob_id, account_create_op_id, last, operation_history_id_type(), 100 ), 1u );
+      check( alice_id, transfer_op_id, last + (-3), operation_history_id_type(), 100 );
+      check( alice_id, transfer_op_id, last, last + (-4), 100 );
+
+      // stop == 0 includes 1.11.0 in the index and in the walk of the list alike. It is the creation of alice, so
+      // alice and the committee account which registered alice both hold it, one of them through 2.9.0.
+      const operation_history_id_type first_op;
+      const auto alice_by_index = hist_api.get_account_history_operations( "alice", account_create_op_id,
+                                                                           last, first_op, 100 );
+      const auto committee_by_index = hist_api.get_account_history_operations( "committee-account",
+                                                                               account_create_op_id, last, first_op, 100 );
+      transfer( alice_id, bob_id, asset(1) );
+      generate_block();
+      db.pop_block();
+      BOOST_REQUIRE( !ahplugin->get_account_operations_by_type( alice_id, account_create_op_id, last,
+                                                                first_op, 100 ).valid() );
+      const auto alice_by_walk = hist_api.get_account_history_operations( "alice", account_create_op_id,
+                                                                          last, first_op, 100 );
+      const auto committee_by_walk = hist_api.get_account_history_operations( "committee-account",
+                                                                              account_create_op_id, last, first_op, 100 );
+      BOOST_REQUIRE_EQUAL( alice_by_index.size(), alice_by_walk.size() );
+      for( size_t i = 0; i < alice_by_index.size(); ++i )
+         BOOST_CHECK( alice_by_index[i].id == alice_by_walk[i].id );
+      BOOST_REQUIRE_EQUAL( committee_by_index.size(), committee_by_walk.size() );
+      for( size_t i = 0; i < committee_by_index.size(); ++i )
+         BOOST_CHECK( committee_by_index[i].id == committee_by_walk[i].id );
+      BOOST_REQUIRE( !alice_by_walk.empty() && !committee_by_walk.empty() );
+      BOOST_CHECK( alice_by_walk.back().id == first_op );
+      BOOST_CHECK( committee_by_walk.back().id == first_op );
+      generate_block();
+
+      // old entries are removed from the index too
+      for( int i = 0; i < 80; ++i )
+         transfer( alice_id, bob_id, asset(1) );
+      generate_block();
+      auto new_last = alice_id(db).statistics(db).most_recent_op(db).operation_id;
+      BOOST_CHECK_EQUAL( check( alice_id, transfer_op_id, new_last, operation_history_id_type(), 100 ), 75u );
+      BOOST_CHECK_EQUAL( check( alice_id, account_create_op_id, new_last, operation_history_id_type(), 100 ), 0u );
+
+      // entries restored by popping the block are indexed when the next block is applied,
+      // until then the API walks the history
+      db.pop_block();
+      BOOST_CHECK( !ahplugin->get_account_operations_by_type( alice_id, transfer_op_id, last,
+                                                              operation_history_id_type(), 100 ).valid() );
+      BOOST_CHECK_EQUAL( check( alice_id, account_create_op_id, last, operation_history_id_type(), 100 ), 1u );
+      generate_block();
+      BOOST_CHECK( ahplugin->get_account_operations_by_type( alice_id, transfer_op_id, last,
+                                                             operation_history_id_type(), 100 ).valid() );
+      new_last = alice_id(db).statistics(db).most_recent_op(db).operation_id;
+      check( alice_id, transfer_op_id, new_last, operation_history_id_type(), 100 );
+      check( alice_id, account_create_op_id, new_last, operation_history_id_type(), 100 );
+      check( bob_id, transfer_op_id, new_last, operation_history_id_type(), 100 );
+
+   } catch (fc::exception &e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_AUTO_TEST_CASE(operation_history_store) {
+   try {
+      graphene::app::history_api hist_api(app);
+      auto ahplugin = app.get_plugin<graphene::account_history::account_history_plugin>( "account_history" );
+
+      ACTORS( (alice)(bob) );
+      fund( alice );
+      for( int i = 0; i < 5; ++i )
+      {
+         transfer( alice_id, bob_id, asset(1) );
+         generate_block();
+      }
+
+      int transfer_op_id = operation::tag<transfer_operation>::value;
+      const auto history = hist_api.get_account_history( "alice", operation_history_id_type(), 100,
+                                                         operation_history_id_type() );
+      const auto transfers = hist_api.get_account_history_operations( "alice", transfer_op_id,
+                                                                      operation_history_id_type(),
+                                                                      operation_history_id_type(), 100 );
+      const auto relative = hist_api.get_relative_account_history( "alice", 0, 100, 0 );
+      BOOST_REQUIRE_EQUAL( history.size(), 7u );
+      BOOST_REQUIRE_EQUAL( transfers.size(), 6u );
+      BOOST_REQUIRE_EQUAL( relative.size(), 7u );
+      const operation_history_id_type oldest = history.back().id;
+      const operation_history_id_type newest = history.front().id;
+      BOOST_CHECK( !ahplugin->find_stored_operation( oldest ).valid() );
+
+      // operations are moved once their blocks have left the undo history
+      for( int i = 0; i < 50 && db.find( newest ) != nullptr; ++i )
+         generate_block();
+      BOOST_REQUIRE( db.find( oldest ) == nullptr );
+      BOOST_REQUIRE( db.find( newest ) == nullptr );
+      BOOST_REQUIRE( ahplugin->find_stored_operation( oldest ).valid() );
+      BOOST_CHECK( ahplugin->find_stored_operation( oldest )->op.which() == history.back().op.which() );
+
+      // the API returns the same objects
+      auto check_same = []( const vector<operation_history_object>& a, const vector<operation_history_object>& b ) {
+         BOOST_REQUIRE_EQUAL( a.size(), b.size() );
+         for( size_t i = 0; i < a.size(); ++i )
+            BOOST_CHECK( fc::raw::pack( a[i] ) == fc::raw::pack( b[i] ) );
+      };
+      check_same( history, hist_api.get_account_history( "alice", operation_history_id_type(), 100,
+                                                         operation_history_id_type() ) );
+      check_same( transfers, hist_api.get_account_history_operations( "alice", transfer_op_id,
+                                                                      operation_history_id_type(),
+                                                                      operation_history_id_type(), 100 ) );
+      check_same( relative, hist_api.get_relative_account_history( "alice", 0, 100, 0 ) );
+
+      // new operations are served from memory until they are moved too
+      transfer( alice_id, bob_id, asset(1) );
+      generate_block();
+      BOOST_CHECK_EQUAL( hist_api.get_account_history( "alice", operation_history_id_type(), 100,
+                                                       operation_history_id_type() ).size(), 8u );
+
+   } catch (fc::exception &e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_AUTO_TEST_CASE(operation_type_index_with_history_store) {
+   try {
+      auto ahplugin = app.get_plugin<graphene::account_history::account_history_plugin>( "account_history" );
+      int transfer_op_id = operation::tag<transfer_operation>::value;
+      int account_create_op_id = operation::tag<account_create_operation>::value;
+
+      ACTORS( (alice)(bob) );
+      fund( alice );
+      for( int i = 0; i < 5; ++i )
+      {
+         transfer( alice_id, bob_id, asset(1) );
+         generate_block();
+      }
+      const auto last = alice_id(db).statistics(db).most_recent_op(db).operation_id;
+      for( int i = 0; i < 50 && db.find( last ) != nullptr; ++i )
+         generate_block();
+      BOOST_REQUIRE( db.find( last ) == nullptr );
+
+      const auto transfers = ahplugin->get_account_operations_by_type( alice_id, transfer_op_id, last,
+                                                                       operation_history_id_type(), 100 );
+      const auto creations = ahplugin->get_account_operations_by_type( alice_id, account_create_op_id, last,
+                                                                       operation_history_id_type(), 100 );
+      BOOST_REQUIRE( transfers.valid() );
+      BOOST_REQUIRE( creations.valid() );
+      BOOST_CHECK_EQUAL( transfers->size(), 6u );
+      BOOST_CHECK_EQUAL( creations->size(), 1u );
+
+      // after a restart the entries are loaded while their operations are in the store only
+      db.close();
+      graphene::app::application app2;
+      auto ahplugin2 = app2.register_plugin<graphene::account_history::account_history_plugin>();
+      ahplugin2->plugin_set_app( &app2 );
+      boost::program_options::variables_map options;
+      options.insert(std::make_pair("operation-history-store", boost::program_options::variable_value(
+            boost::filesystem::path( ( data_dir->path() / "operation_history" ).generic_string() ), false)));
+      options.insert(std::make_pair("index-operation-types", boost::program_options::variable_value(true, false)));
+      ahplugin2->plugin_initialize( options );
+      app2.chain_database()->open( data_dir->path(), [this]{return genesis_state;}, "test" );
+      ahplugin2->plugin_startup();
+
+      const auto restored_transfers = ahplugin2->get_account_operations_by_type( alice_id, transfer_op_id, last,
+                                                                                 operation_history_id_type(), 100 );
+      const auto restored_creations = ahplugin2->get_account_operations_by_type( alice_id, account_create_op_id,
+                                                                                 last, operation_history_id_type(), 100 );
+      BOOST_REQUIRE( restored_transfers.valid() );
+      BOOST_REQUIRE( restored_creations.valid() );
+      BOOST_CHECK( *restored_transfers == *transfers );
+      BOOST_CHECK( *restored_creations == *creations );
+      app2.chain_database()->close();
+
+   } catch (fc::exception &e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_AUTO_TEST_CASE(operation_history_store_restore) {
+   try {
+      fc::temp_directory dir( graphene::utilities::temp_directory_path() );
+      graphene::account_history::operation_history_store store;
+      store.open( dir.path() );
+
+      operation_history_object obj;
+      obj.id = operation_history_id_type( 3 );
+      obj.block_num = 10;
+      store.store( obj );
+      store.flush();
+      const uint64_t size = store.total_size();
+      BOOST_CHECK_GT( size, 0u );
+
+      // a replay stores the same objects again, which must not grow the log
+      store.store( obj );
+      store.flush();
+      BOOST_CHECK_EQUAL( store.total_size(), size );
+      BOOST_REQUIRE( store.fetch( obj.id ).valid() );
+      BOOST_CHECK_EQUAL( store.fetch( obj.id )->block_num, 10u );
+
+      // a different object with the same id replaces the stored one
+      obj.block_num = 11;
+      store.store( obj );
+      store.flush();
+      BOOST_CHECK_GT( store.total_size(), size );
+      BOOST_REQUIRE( store.fetch( obj.id ).valid() );
+      BOOST_CHECK_EQUAL( store.fetch( obj.id )->block_num, 11u );
+      BOOST_CHECK( !store.fetch( operation_history_id_type( 2 ) ).valid() );
+   } catch (fc::exception &e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -33,6 +33,30 @@
 using namespace graphene::chain;
 using namespace graphene::chain::test;
 
+/// Checks that an order book holds the same orders in the same order as a by_price index
+template<typename Book, typename PriceIndex, typename GetPrice>
+static void check_order_book( const Book& book, const PriceIndex& by_price, GetPrice get_price )
+{
+   size_t markets = 0;
+   auto itr = by_price.begin();
+   while( itr != by_price.end() )
+   {
+      const price& p = get_price( *itr );
+      const auto* levels = book.get_book( p.base.asset_id, p.quote.asset_id );
+      BOOST_REQUIRE( levels != nullptr );
+      ++markets;
+      for( auto level = levels->rbegin(); level != levels->rend(); ++level )
+         for( const auto* order : level->orders )
+         {
+            BOOST_REQUIRE( itr != by_price.end() );
+            BOOST_CHECK( &*itr == order );
+            BOOST_CHECK( get_price( *itr ) == level->price.value );
+            ++itr;
+         }
+   }
+   BOOST_CHECK_EQUAL( markets, book.market_count() );
+}
+
 BOOST_FIXTURE_TEST_SUITE(market_tests, database_fixture)
 
 /***
@@ -1507,4 +1531,76 @@ BOOST_AUTO_TEST_CASE(target_cr_test_call_limit)
 
 } FC_LOG_AND_RETHROW() }
 
+/***
+ * The order books must follow the by_price indexes through matching, cancellation and undo
+ */
+BOOST_AUTO_TEST_CASE(order_book_consistency_test)
+{ try {
+   generate_blocks( HARDFORK_CORE_625_TIME );
+   generate_blocks( db.get_dynamic_global_properties().next_maintenance_time );
+   set_expiration( db, trx );
+
+   ACTORS((alice)(bob)(borrower)(borrower2)(feedproducer));
+   const asset_id_type uia_id = create_user_issued_asset( "BOOK" ).id;
+   issue_uia( alice_id, asset( 1000000, uia_id ) );
+   fund( bob, asset( 1000000 ) );
+   fund( borrower, asset( 1000000 ) );
+   fund( borrower2, asset( 1000000 ) );
+
+   const auto& limit_by_price = db.get_index_type<limit_order_index>().indices().get<by_price>();
+   const auto& call_by_price = db.get_index_type<call_order_index>().indices().get<by_price>();
+   auto check = [&]() {
+      check_order_book( db.get_limit_order_book(), limit_by_price,
+                        []( const limit_order_object& o ) -> const price& { return o.sell_price; } );
+      check_order_book( db.get_call_order_book(), call_by_price,
+                        []( const call_order_object& o ) -> const price& { return o.call_price; } );
+   };
+
+   // prices closer than the resolution of the keys are still ordered exactly
+   const price close_high = asset( 999999999999ll, uia_id ) / asset( 1000000000000ll );
+   const price close_low  = asset( 999999999998ll, uia_id ) / asset( 999999999999ll );
+   BOOST_CHECK( close_low < close_high );
+   BOOST_CHECK( order_book_price( close_low ) < order_book_price( close_high ) );
+   BOOST_CHECK( !( order_book_price( close_high ) < order_book_price( close_low ) ) );
+
+   const auto& bitusd = create_bitasset( "USDBIT", feedproducer_id );
+   update_feed_producers( bitusd, { feedproducer_id } );
+   price_feed current_feed;
+   current_feed.maintenance_collateral_ratio = 1750;
+   current_feed.maximum_short_squeeze_ratio = 1100;
+   current_feed.settlement_price = bitusd.amount( 1 ) / asset( 5 );
+   publish_feed( bitusd, feedproducer, current_feed );
+   borrow( borrower, bitusd.amount( 1000 ), asset( 15000 ) );
+   borrow( borrower2, bitusd.amount( 1000 ), asset( 15500 ) );
+   check();
+
+   // equal ratios with different amounts share a price level, ordered by ID
+   create_sell_order( alice_id, asset( 100, uia_id ), asset( 200 ) );
+   create_sell_order( alice_id, asset( 300, uia_id ), asset( 600 ) );
+   create_sell_order( alice_id, asset( 100, uia_id ), asset( 201 ) );
+   create_sell_order( alice_id, asset( 100, uia_id ), asset( 199 ) );
+   const limit_order_id_type last_id = create_sell_order( alice_id, asset( 50, uia_id ), asset( 100 ) )->id;
+   create_sell_order( borrower_id, bitusd.amount( 100 ), asset( 1000 ) );
+   check();
+   BOOST_CHECK_EQUAL( 3u, db.get_limit_order_book().get_book( uia_id, asset_id_type() )->size() );
+   generate_block();
+   set_expiration( db, trx );
+   check();
+
+   // fills the best two levels and a part of the next one
+   create_sell_order( bob_id, asset( 700 ), asset( 300, uia_id ) );
+   check();
+   cancel_limit_order( last_id(db) );
+   // moves a call order to another price
+   borrow( borrower, bitusd.amount( 100 ), asset( 0 ) );
+   check();
+
+   // undo the changes above
+   db.clear_pending();
+   check();
+   db.pop_block();
+   check();
+   BOOST_CHECK_EQUAL( 0u, db.get_limit_order_book().market_count() );
+} FC_LOG_AND_RETHROW() }
+
 BOOST_AUTO_TEST_SUITE_END()
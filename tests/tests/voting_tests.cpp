@@ -539,4 +539,133 @@ BOOST_AUTO_TEST_CASE(last_voting_date_proxy)
    } FC_LOG_AND_RETHROW()
 }
 
+BOOST_AUTO_TEST_CASE(incremental_vote_tally)
+{
+   try
+   {
+      ACTORS((alice)(proxy));
+      upgrade_to_lifetime_member(proxy_id);
+      // cashback of fees paid by carol and zed goes to proxy, whose name is between theirs
+      const account_id_type carol_id = create_account("carol", proxy_id(db), proxy_id(db)).id;
+      const account_id_type zed_id = create_account("zed", proxy_id(db), proxy_id(db)).id;
+      transfer(committee_account, alice_id, asset(1000000));
+      transfer(committee_account, proxy_id, asset(1000000));
+      transfer(committee_account, carol_id, asset(1000000));
+      transfer(committee_account, zed_id, asset(1000000));
+
+      const vote_id_type witness1_vote = witness_id_type(1)(db).vote_id;
+      auto vote = [&]( account_id_type account, account_id_type voting_account, bool for_witness1 ) {
+         account_update_operation op;
+         op.account = account;
+         op.new_options = account(db).options;
+         op.new_options->voting_account = voting_account;
+         if( for_witness1 )
+            op.new_options->votes.insert(witness1_vote);
+         else
+            op.new_options->votes.erase(witness1_vote);
+         trx.operations.push_back(op);
+         for( auto& o : trx.operations ) db.current_fee_schedule().set_fee(o);
+         set_expiration( db, trx );
+         PUSH_TX( db, trx, ~0 );
+         trx.clear();
+      };
+      auto check_tally = [&]() {
+         BOOST_CHECK( db.get_vote_tally().is_complete() );
+         BOOST_CHECK_EQUAL( db.get_vote_tally().mismatches(), 0u );
+      };
+
+      vote( proxy_id, GRAPHENE_PROXY_TO_SELF_ACCOUNT, true );
+      vote( alice_id, proxy_id, false );
+      vote( carol_id, GRAPHENE_PROXY_TO_SELF_ACCOUNT, true );
+      vote( zed_id, proxy_id, false );
+      generate_blocks( db.get_dynamic_global_properties().next_maintenance_time );
+      check_tally();
+
+      enable_fees();
+      transfer( carol_id, alice_id, asset(1000) );
+      transfer( zed_id, alice_id, asset(1000) );
+      create_sell_order( alice_id, asset(5000), asset(5000, asset_id_type(1)) );
+      generate_blocks( db.get_dynamic_global_properties().next_maintenance_time );
+      check_tally();
+      BOOST_CHECK( proxy_id(db).cashback_vb.valid() );
+
+      // options of an opinion account and stakes change in the same interval
+      vote( proxy_id, GRAPHENE_PROXY_TO_SELF_ACCOUNT, false );
+      vote( alice_id, GRAPHENE_PROXY_TO_SELF_ACCOUNT, true );
+      transfer( zed_id, carol_id, asset(50000) );
+      generate_blocks( db.get_dynamic_global_properties().next_maintenance_time );
+      check_tally();
+
+      // undoing a maintenance block leaves the changed accounts to be recomputed
+      vote( zed_id, GRAPHENE_PROXY_TO_SELF_ACCOUNT, true );
+      transfer( carol_id, zed_id, asset(20000) );
+      generate_blocks( db.get_dynamic_global_properties().next_maintenance_time );
+      db.pop_block();
+      generate_block();
+      check_tally();
+      generate_blocks( db.get_dynamic_global_properties().next_maintenance_time );
+      check_tally();
+
+      // without verification the incremental tally alone decides
+      db.enable_vote_tally_verification( false );
+      const uint64_t votes_before = witness_id_type(1)(db).total_votes;
+      generate_blocks( db.get_dynamic_global_properties().next_maintenance_time );
+      BOOST_CHECK_EQUAL( witness_id_type(1)(db).total_votes, votes_before );
+      db.enable_vote_tally_verification( true );
+      generate_blocks( db.get_dynamic_global_properties().next_maintenance_time );
+      check_tally();
+
+   } FC_LOG_AND_RETHROW()
+}
+
+BOOST_AUTO_TEST_CASE(maintenance_timings)
+{
+   try {
+      ACTORS((alice)(bob));
+      transfer(committee_account, alice_id, asset(1000000));
+      transfer(committee_account, bob_id, asset(2000000));
+
+      auto vote = [&]( account_id_type account, witness_id_type witness, committee_member_id_type member ) {
+         account_update_operation op;
+         op.account = account;
+         op.new_options = account(db).options;
+         op.new_options->votes.insert( witness(db).vote_id );
+         op.new_options->votes.insert( member(db).vote_id );
+         trx.operations.push_back(op);
+         set_expiration( db, trx );
+         PUSH_TX( db, trx, ~0 );
+         trx.clear();
+      };
+      vote( alice_id, witness_id_type(1), committee_member_id_type(1) );
+      vote( bob_id, witness_id_type(2), committee_member_id_type(2) );
+
+      // the elections run in parallel by default
+      generate_blocks( db.get_dynamic_global_properties().next_maintenance_time );
+      BOOST_CHECK_GT( witness_id_type(2)(db).total_votes, witness_id_type(1)(db).total_votes );
+      const auto parallel_witnesses = db.get_global_properties().active_witnesses;
+      const auto parallel_committee = db.get_global_properties().active_committee_members;
+
+      const auto timings = db.get_maintenance_timings();
+      vector<string> phases;
+      for( const auto& phase : timings )
+      {
+         BOOST_CHECK_GT( phase.second.count(), 0 );
+         phases.push_back( phase.first );
+      }
+      const vector<string> expected = { "fba", "buyback", "vote tally", "elections", "apply elections",
+                                        "parameters", "bitassets", "budget" };
+      BOOST_CHECK( phases == expected );
+
+      // the same maintenance with the elections run one after the other selects the same members
+      db.pop_block();
+      db.enable_parallel_elections( false );
+      generate_block();
+      BOOST_CHECK_EQUAL( db.get_maintenance_timings().size(), expected.size() );
+      BOOST_CHECK( db.get_global_properties().active_witnesses == parallel_witnesses );
+      BOOST_CHECK( db.get_global_properties().active_committee_members == parallel_committee );
+      db.enable_parallel_elections( true );
+
+   } FC_LOG_AND_RETHROW()
+}
+
 BOOST_AUTO_TEST_SUITE_END()